@@ -4,19 +4,76 @@
 
 void command_load( int nlhs, mxArray *plhs[],
                    int nrhs, const mxArray *prhs[] );
+void command_load_simple( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] );
+void command_load_columns( int nlhs, mxArray *plhs[],
+                           int nrhs, const mxArray *prhs[] );
+void command_load_file( int nlhs, mxArray *plhs[],
+                        int nrhs, const mxArray *prhs[] );
+void command_load_file_cached( int nlhs, mxArray *plhs[],
+                               int nrhs, const mxArray *prhs[] );
+void command_extract( int nlhs, mxArray *plhs[],
+                      int nrhs, const mxArray *prhs[] );
+void command_events( int nlhs, mxArray *plhs[],
+                     int nrhs, const mxArray *prhs[] );
 void command_dump( int nlhs, mxArray *plhs[],
                    int nrhs, const mxArray *prhs[] );
+void command_dump_simple( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] );
+void command_writer_open( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] );
+void command_writer_write( int nlhs, mxArray *plhs[],
+                           int nrhs, const mxArray *prhs[] );
+void command_writer_close( int nlhs, mxArray *plhs[],
+                           int nrhs, const mxArray *prhs[] );
+void command_reloader_open( int nlhs, mxArray *plhs[],
+                            int nrhs, const mxArray *prhs[] );
+void command_reloader_read( int nlhs, mxArray *plhs[],
+                            int nrhs, const mxArray *prhs[] );
+void command_reloader_close( int nlhs, mxArray *plhs[],
+                             int nrhs, const mxArray *prhs[] );
+void command_load_async( int nlhs, mxArray *plhs[],
+                         int nrhs, const mxArray *prhs[] );
+void command_ready( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] );
+void command_fetch( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] );
+void command_cancel( int nlhs, mxArray *plhs[],
+                     int nrhs, const mxArray *prhs[] );
+void command_index( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] );
+void command_load_doc( int nlhs, mxArray *plhs[],
+                       int nrhs, const mxArray *prhs[] );
+void command_cache( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] );
+void command_limits( int nlhs, mxArray *plhs[],
+                     int nrhs, const mxArray *prhs[] );
+void command_scanner( int nlhs, mxArray *plhs[],
+                      int nrhs, const mxArray *prhs[] );
+void command_emitter( int nlhs, mxArray *plhs[],
+                      int nrhs, const mxArray *prhs[] );
+void command_alloc_stats( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] );
+void command_hash( int nlhs, mxArray *plhs[],
+                   int nrhs, const mxArray *prhs[] );
+void command_hash_data( int nlhs, mxArray *plhs[],
+                        int nrhs, const mxArray *prhs[] );
+int parse_compose_options( const char *command,
+                           int nrhs, const mxArray *prhs[] );
 void command_help( int nlhs, mxArray *plhs[],
                    int nrhs, const mxArray *prhs[] );
+void yaml_mex_cleanup();
 
 void mexFunction( int nlhs, mxArray *plhs[],
                   int nrhs, const mxArray *prhs[] )
 {
     ymx_debug_msg("Entering mexFunction\n");
-    mexAtExit(ymx_persistent_cleanup);
+    mexAtExit(yaml_mex_cleanup);
+    ymx_alloc_begin_call(nrhs ? prhs[0] : NULL);
     
     if (nrhs == 0) {
         command_help(nlhs, plhs, 0, NULL);
+        ymx_alloc_end_call();
         return;
     }
     if (!mxIsChar(prhs[0]) || mxGetM(prhs[0]) != 1)
@@ -26,8 +83,60 @@ void mexFunction( int nlhs, mxArray *plhs[],
     char *command = mxArrayToString(prhs[0]);
     if (strcmp(command, "load") == 0) {
         command_load(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "load_simple") == 0) {
+        command_load_simple(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "load_columns") == 0) {
+        command_load_columns(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "load_file") == 0) {
+        command_load_file(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "load_file_cached") == 0) {
+        command_load_file_cached(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "extract") == 0) {
+        command_extract(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "events") == 0) {
+        command_events(nlhs, plhs, nrhs-1, prhs+1);
     } else if (strcmp(command, "dump") == 0) {
         command_dump(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "dump_simple") == 0) {
+        command_dump_simple(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "writer_open") == 0) {
+        command_writer_open(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "writer_write") == 0) {
+        command_writer_write(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "writer_close") == 0) {
+        command_writer_close(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "reloader_open") == 0) {
+        command_reloader_open(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "reloader_read") == 0) {
+        command_reloader_read(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "reloader_close") == 0) {
+        command_reloader_close(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "load_async") == 0) {
+        command_load_async(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "ready") == 0) {
+        command_ready(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "fetch") == 0) {
+        command_fetch(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "cancel") == 0) {
+        command_cancel(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "index") == 0) {
+        command_index(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "load_doc") == 0) {
+        command_load_doc(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "cache") == 0) {
+        command_cache(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "limits") == 0) {
+        command_limits(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "scanner") == 0) {
+        command_scanner(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "emitter") == 0) {
+        command_emitter(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "alloc_stats") == 0) {
+        command_alloc_stats(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "hash") == 0) {
+        command_hash(nlhs, plhs, nrhs-1, prhs+1);
+    } else if (strcmp(command, "hash_data") == 0) {
+        command_hash_data(nlhs, plhs, nrhs-1, prhs+1);
     } else if (strcmp(command, "help") == 0) {
         command_help(nlhs, plhs, nrhs-1, prhs+1);
     } else {
@@ -36,14 +145,70 @@ void mexFunction( int nlhs, mxArray *plhs[],
     ymx_debug_msg("plhs: %d\n", plhs);
     ymx_debug_msg("plhs[0]: %d\n", plhs[0]);
     mxFree(command);
+    ymx_alloc_end_call();
     ymx_debug_msg("Exiting mexFunction\n");
 }
 
+/* Release everything held between calls; registered with mexAtExit. */
+void yaml_mex_cleanup() {
+    ymx_persistent_cleanup();
+    ymx_writer_close_all();
+    ymx_reloader_close_all();
+    ymx_load_cancel_all();
+    ymx_cache_flush();
+    ymx_alloc_cleanup();
+}
+
 void command_help( int nlhs, mxArray *plhs[],
                    int nrhs, const mxArray *prhs[] ) {
     mexPrintf("Usage:\n");
     mexPrintf("    doc = yaml_mex('load', yaml_str)\n");
+    mexPrintf("    data = yaml_mex('load_simple', yaml_str)\n");
+    mexPrintf("    data = yaml_mex('load_simple', yaml_str, paths)\n");
+    mexPrintf("    columns = yaml_mex('load_columns', yaml_str)\n");
+    mexPrintf("    columns = yaml_mex('load_columns', yaml_str, 'table')\n");
+    mexPrintf("    doc = yaml_mex('load_file', filename)\n");
+    mexPrintf("    doc = yaml_mex('load_file', filename, opts)\n");
+    mexPrintf("    data = yaml_mex('load_file_cached', filename, cache_dir)\n");
+    mexPrintf("    [values, found] = yaml_mex('extract', yaml_str, "
+            "key_path)\n");
+    mexPrintf("    [values, found] = yaml_mex('extract', filename, key_path, "
+            "'file')\n");
+    mexPrintf("    events = yaml_mex('events', yaml_str)\n");
+    mexPrintf("    events = yaml_mex('events', yaml_str, batch_size)\n");
     mexPrintf("    yaml_str = yaml_mex('dump', doc)\n");
+    mexPrintf("    yaml_str = yaml_mex('dump', doc, options...)\n");
+    mexPrintf("    yaml_str = yaml_mex('dump_simple', data)\n");
+    mexPrintf("    yaml_str = yaml_mex('dump_simple', data, options...)\n");
+    mexPrintf("    h = yaml_mex('writer_open', filename, opts)\n");
+    mexPrintf("    yaml_mex('writer_write', h, data)\n");
+    mexPrintf("    yaml_mex('writer_close', h)\n");
+    mexPrintf("    h = yaml_mex('reloader_open', filename, opts)\n");
+    mexPrintf("    docs = yaml_mex('reloader_read', h)\n");
+    mexPrintf("    docs = yaml_mex('reloader_read', h, skip)\n");
+    mexPrintf("    yaml_mex('reloader_close', h)\n");
+    mexPrintf("    h = yaml_mex('load_async', filename, opts)\n");
+    mexPrintf("    is_ready = yaml_mex('ready', h)\n");
+    mexPrintf("    docs = yaml_mex('fetch', h)\n");
+    mexPrintf("    yaml_mex('cancel', h)\n");
+    mexPrintf("    num_docs = yaml_mex('index', filename)\n");
+    mexPrintf("    doc = yaml_mex('load_doc', filename, k)\n");
+    mexPrintf("    doc = yaml_mex('load_doc', filename, k, opts)\n");
+    mexPrintf("    yaml_mex('cache', 'limit', max_bytes)\n");
+    mexPrintf("    yaml_mex('cache', 'flush')\n");
+    mexPrintf("    stats = yaml_mex('cache', 'stats')\n");
+    mexPrintf("    limits = yaml_mex('limits')\n");
+    mexPrintf("    limits = yaml_mex('limits', new_limits)\n");
+    mexPrintf("    scanner = yaml_mex('scanner')\n");
+    mexPrintf("    scanner = yaml_mex('scanner', 'libyaml', 'json' or "
+            "'fast')\n");
+    mexPrintf("    emitter = yaml_mex('emitter')\n");
+    mexPrintf("    emitter = yaml_mex('emitter', 'fast' or 'libyaml')\n");
+    mexPrintf("    stats = yaml_mex('alloc_stats')\n");
+    mexPrintf("    key = yaml_mex('hash', yaml_str)\n");
+    mexPrintf("    key = yaml_mex('hash', yaml_str, opts)\n");
+    mexPrintf("    key = yaml_mex('hash_data', data)\n");
+    mexPrintf("    key = yaml_mex('hash_data', data, options...)\n");
     mexPrintf("Type \"help yaml_mex\" for more information.\n");
 }
 
@@ -59,10 +224,351 @@ void command_load( int nlhs, mxArray *plhs[],
     ymx_debug_msg("Exiting command_load\n");
 }
 
+void command_load_simple( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'load_simple' requires 1 additional string input, "
+                "and optionally a list of key paths.");
+    }
+    if (nrhs == 2) {
+        ymx_projection_t *projection = ymx_projection_create(prhs[1]);
+        plhs[0] = ymx_construct_stream(prhs[0], projection);
+        ymx_projection_delete(projection);
+    } else {
+        plhs[0] = ymx_cache_construct_stream(prhs[0]);
+    }
+}
+
+void command_load_columns( int nlhs, mxArray *plhs[],
+                           int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'load_columns' requires 1 additional string input, "
+                "and optionally an output format.");
+    }
+    int as_table = 0;
+    if (nrhs == 2) {
+        char *format = mxIsChar(prhs[1]) ? mxArrayToString(prhs[1]) : NULL;
+        if (format && strcmp(format, "table") == 0) {
+            as_table = 1;
+        } else if (!format || strcmp(format, "struct") != 0) {
+            mexErrMsgTxt("Output format must be 'struct' or 'table'.");
+        }
+        mxFree(format);
+    }
+    plhs[0] = ymx_load_columns(prhs[0]);
+    if (as_table) {
+        mxArray *columns = plhs[0];
+        mexCallMATLAB(1, plhs, 1, &columns, "struct2table");
+        mxDestroyArray(columns);
+    }
+}
+
+void command_load_file( int nlhs, mxArray *plhs[],
+                        int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'load_file' requires a filename, and optionally an "
+                "options struct.");
+    }
+    plhs[0] = ymx_load_file(prhs[0], nrhs == 2 ? prhs[1] : NULL);
+}
+
+void command_load_file_cached( int nlhs, mxArray *plhs[],
+                               int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1
+            || !mxIsChar(prhs[1]) || mxGetM(prhs[1]) > 1) {
+        mexErrMsgTxt("'load_file_cached' requires 2 additional string "
+                "inputs.");
+    }
+    plhs[0] = ymx_load_file_cached(prhs[0], prhs[1]);
+}
+
+void command_extract( int nlhs, mxArray *plhs[],
+                      int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 2 || nrhs > 3 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1
+            || !mxIsChar(prhs[1]) || mxGetM(prhs[1]) != 1) {
+        mexErrMsgTxt("'extract' requires 2 additional string inputs, "
+                "and optionally a source type.");
+    }
+    int is_file = 0;
+    if (nrhs == 3) {
+        char *source = mxIsChar(prhs[2]) ? mxArrayToString(prhs[2]) : NULL;
+        if (source && strcmp(source, "file") == 0) {
+            is_file = 1;
+        } else if (!source || strcmp(source, "string") != 0) {
+            mexErrMsgTxt("Source type must be 'string' or 'file'.");
+        }
+        mxFree(source);
+    }
+    plhs[0] = ymx_extract(prhs[0], is_file, prhs[1],
+            nlhs > 1 ? &plhs[1] : NULL);
+}
+
+void command_events( int nlhs, mxArray *plhs[],
+                     int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'events' requires 1 additional string input, "
+                "and optionally a batch size.");
+    }
+    size_t batch_size = 0;
+    if (nrhs == 2) {
+        if (!mxIsNumeric(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1
+                || !(mxGetScalar(prhs[1]) >= 1)) {
+            mexErrMsgTxt("Batch size must be a positive scalar.");
+        }
+        /* Inf, or anything too large for a size_t, means no limit */
+        double value = mxGetScalar(prhs[1]);
+        if (value < (double)(size_t)-1)
+            batch_size = (size_t)value;
+    }
+    plhs[0] = ymx_load_events(prhs[0], batch_size);
+}
+
 void command_dump( int nlhs, mxArray *plhs[],
                    int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1) {
+        mexErrMsgTxt("'dump' requires 1 additional input, and optionally "
+                "'trusted' and 'parallel'.");
+    }
+    int trusted = 0;
+    int parallel = 0;
+    int i;
+    for (i=1; i<nrhs; i++) {
+        char *option = mxIsChar(prhs[i]) ? mxArrayToString(prhs[i]) : NULL;
+        if (option && strcmp(option, "trusted") == 0) {
+            trusted = 1;
+        } else if (option && strcmp(option, "parallel") == 0) {
+            parallel = 1;
+        } else {
+            mexErrMsgTxt("The options for 'dump' are 'trusted' and "
+                    "'parallel'.");
+        }
+        mxFree(option);
+    }
+    if (parallel) {
+        plhs[0] = ymx_dump_stream_parallel(prhs[0], trusted);
+    } else {
+        plhs[0] = ymx_dump_stream(prhs[0], trusted);
+    }
+}
+
+void command_dump_simple( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1) {
+        mexErrMsgTxt("'dump_simple' requires 1 additional input, and "
+                "optionally 'binary' and 'typed'.");
+    }
+    int flags = parse_compose_options("dump_simple", nrhs-1, prhs+1);
+    plhs[0] = ymx_compose_stream(prhs[0], flags);
+}
+
+/* The flags for the options given to dump_simple or hash_data */
+int parse_compose_options( const char *command,
+                           int nrhs, const mxArray *prhs[] ) {
+    int flags = 0;
+    int i;
+    for (i=0; i<nrhs; i++) {
+        char *option = mxIsChar(prhs[i]) ? mxArrayToString(prhs[i]) : NULL;
+        if (option && strcmp(option, "binary") == 0) {
+            flags |= YMX_COMPOSE_BINARY_NUMERIC;
+        } else if (option && strcmp(option, "typed") == 0) {
+            flags |= YMX_COMPOSE_TYPED_ARRAYS;
+        } else {
+            char message[80];
+            snprintf(message, sizeof(message), "The options for '%s' are "
+                    "'binary' and 'typed'.", command);
+            mexErrMsgTxt(message);
+        }
+        mxFree(option);
+    }
+    return flags;
+}
+
+void command_writer_open( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'writer_open' requires 1 additional string input, "
+                "and optionally an options struct.");
+    }
+    plhs[0] = ymx_writer_open(prhs[0], nrhs == 2 ? prhs[1] : NULL);
+}
+
+void command_writer_write( int nlhs, mxArray *plhs[],
+                           int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 2) {
+        mexErrMsgTxt("'writer_write' requires 2 additional inputs.");
+    }
+    ymx_writer_write(prhs[0], prhs[1]);
+}
+
+void command_writer_close( int nlhs, mxArray *plhs[],
+                           int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 1) {
+        mexErrMsgTxt("'writer_close' requires 1 additional input.");
+    }
+    ymx_writer_close(prhs[0]);
+}
+
+void command_reloader_open( int nlhs, mxArray *plhs[],
+                            int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'reloader_open' requires 1 additional string input, "
+                "and optionally an options struct.");
+    }
+    plhs[0] = ymx_reloader_open(prhs[0], nrhs == 2 ? prhs[1] : NULL);
+}
+
+void command_reloader_read( int nlhs, mxArray *plhs[],
+                            int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgTxt("'reloader_read' requires 1 additional input, "
+                "and optionally a number of documents to skip.");
+    }
+    plhs[0] = ymx_reloader_read(prhs[0], nrhs == 2 ? prhs[1] : NULL);
+}
+
+void command_reloader_close( int nlhs, mxArray *plhs[],
+                             int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 1) {
+        mexErrMsgTxt("'reloader_close' requires 1 additional input.");
+    }
+    ymx_reloader_close(prhs[0]);
+}
+
+void command_load_async( int nlhs, mxArray *plhs[],
+                         int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'load_async' requires 1 additional string input, "
+                "and optionally an options struct.");
+    }
+    plhs[0] = ymx_load_async(prhs[0], nrhs == 2 ? prhs[1] : NULL);
+}
+
+void command_ready( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 1) {
+        mexErrMsgTxt("'ready' requires 1 additional input.");
+    }
+    plhs[0] = ymx_load_ready(prhs[0]);
+}
+
+void command_fetch( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] ) {
     if (nrhs != 1) {
-        mexErrMsgTxt("'dump' requires 1 additional input.");
+        mexErrMsgTxt("'fetch' requires 1 additional input.");
+    }
+    plhs[0] = ymx_load_fetch(prhs[0]);
+}
+
+void command_cancel( int nlhs, mxArray *plhs[],
+                     int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 1) {
+        mexErrMsgTxt("'cancel' requires 1 additional input.");
+    }
+    ymx_load_cancel(prhs[0]);
+}
+
+void command_index( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 1 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'index' requires 1 additional string input.");
+    }
+    plhs[0] = ymx_index_file(prhs[0]);
+}
+
+void command_load_doc( int nlhs, mxArray *plhs[],
+                       int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 2 || nrhs > 3 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'load_doc' requires a filename and a document "
+                "number, and optionally an options struct.");
+    }
+    plhs[0] = ymx_load_doc(prhs[0], prhs[1], nrhs == 3 ? prhs[2] : NULL);
+}
+
+void command_cache( int nlhs, mxArray *plhs[],
+                    int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'cache' requires an action: 'limit', 'flush' or "
+                "'stats'.");
+    }
+    char *action = mxArrayToString(prhs[0]);
+    if (strcmp(action, "limit") == 0) {
+        if (nrhs != 2 || !mxIsNumeric(prhs[1])
+                || mxGetNumberOfElements(prhs[1]) != 1
+                || !(mxGetScalar(prhs[1]) >= 0)) {
+            mexErrMsgTxt("'cache', 'limit' requires a nonnegative "
+                    "scalar.");
+        }
+        /* Inf, or anything too large for a size_t, is no limit */
+        double limit = mxGetScalar(prhs[1]);
+        ymx_cache_set_limit(limit < (double)(size_t)-1
+                ? (size_t)limit : (size_t)-1);
+    } else if (strcmp(action, "flush") == 0) {
+        ymx_cache_flush();
+    } else if (strcmp(action, "stats") == 0) {
+        plhs[0] = ymx_cache_stats();
+    } else {
+        mexErrMsgTxt("'cache' requires an action: 'limit', 'flush' or "
+                "'stats'.");
+    }
+    mxFree(action);
+}
+
+void command_limits( int nlhs, mxArray *plhs[],
+                     int nrhs, const mxArray *prhs[] ) {
+    if (nrhs > 1) {
+        mexErrMsgTxt("'limits' takes at most 1 additional input.");
+    }
+    if (nrhs == 1) {
+        ymx_set_limits(prhs[0]);
+    }
+    plhs[0] = ymx_get_limits();
+}
+
+void command_scanner( int nlhs, mxArray *plhs[],
+                      int nrhs, const mxArray *prhs[] ) {
+    if (nrhs > 1) {
+        mexErrMsgTxt("'scanner' takes at most 1 additional input.");
+    }
+    if (nrhs == 1) {
+        ymx_set_scanner(prhs[0]);
+    }
+    plhs[0] = ymx_get_scanner();
+}
+
+void command_emitter( int nlhs, mxArray *plhs[],
+                      int nrhs, const mxArray *prhs[] ) {
+    if (nrhs > 1) {
+        mexErrMsgTxt("'emitter' takes at most 1 additional input.");
+    }
+    if (nrhs == 1) {
+        ymx_set_emitter(prhs[0]);
+    }
+    plhs[0] = ymx_get_emitter();
+}
+
+void command_alloc_stats( int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[] ) {
+    if (nrhs != 0) {
+        mexErrMsgTxt("'alloc_stats' takes no additional inputs.");
+    }
+    plhs[0] = ymx_alloc_stats();
+}
+
+void command_hash( int nlhs, mxArray *plhs[],
+                   int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]) || mxGetM(prhs[0]) > 1) {
+        mexErrMsgTxt("'hash' requires 1 additional string input, and "
+                "optionally an options struct.");
+    }
+    plhs[0] = ymx_hash_stream(prhs[0], nrhs == 2 ? prhs[1] : NULL);
+}
+
+void command_hash_data( int nlhs, mxArray *plhs[],
+                        int nrhs, const mxArray *prhs[] ) {
+    if (nrhs < 1) {
+        mexErrMsgTxt("'hash_data' requires 1 additional input, and "
+                "optionally 'binary' and 'typed'.");
     }
-    plhs[0] = ymx_dump_stream(prhs[0]);
+    int flags = parse_compose_options("hash_data", nrhs-1, prhs+1);
+    plhs[0] = ymx_hash_data(prhs[0], flags);
 }
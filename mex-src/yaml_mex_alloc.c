@@ -0,0 +1,495 @@
+#define YMX_ALLOC_INTERNAL
+#include "yaml_mex_util.h"
+#include <stdlib.h>
+
+/* NOTES
+ *
+ * Allocation counting, for tracking down memory that yaml_mex holds on to.
+ * It is only built in if YMX_COUNT_ALLOCS is defined:
+ *     mex -DYMX_COUNT_ALLOCS yaml_mex.c ...
+ * and then yaml_mex_util.h redefines mxMalloc, mxCalloc, mxRealloc,
+ * mxFree, mxArrayToString, mexMakeMemoryPersistent, mxSetData,
+ * mxSetImagData, mexMakeArrayPersistent and mxDestroyArray, in every file
+ * but this one, as calls to the counting wrappers below. So every block of
+ * Matlab memory that yaml_mex allocates is recorded, with the file and
+ * line that allocated it, until it is freed or handed over to an mxArray;
+ * nothing in the rest of the source has to change, and a normal build has
+ * no wrappers at all.
+ *
+ * Counts are kept per call of the MEX-file. mexFunction starts each call
+ * with ymx_alloc_begin_call and ends it with ymx_alloc_end_call, unless
+ * it's cut short by an error. The next call's begin takes a snapshot of
+ * the call before: what it allocated and freed, its peak, whether it
+ * finished, and the blocks it left behind, which yaml_mex('alloc_stats')
+ * returns. A block left behind that isn't persistent is reclaimed by
+ * Matlab when the call ends, and is only forgotten here then; one that is
+ * persistent is counted until it's freed, however many calls later, so
+ * that memory that grows across a session shows up with where it came
+ * from.
+ *
+ * mxArrays are counted only once they are made persistent (by the cache
+ * and the reloaders), as one block per array, from the call and line that
+ * made it persistent until it is destroyed; its size is an estimate from
+ * its class and dimensions, its sparse storage and what it contains. Every
+ * other mxArray yaml_mex creates is either returned or destroyed within
+ * the call, and isn't counted at all; nor is memory allocated with malloc
+ * (by libyaml, the codecs and the worker threads). The record of blocks
+ * is a hash table on the block's address, in malloc'd memory so that it
+ * isn't counted or freed by Matlab itself.
+ */
+
+#ifdef YMX_COUNT_ALLOCS
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef struct ymx_block_s {
+    void *ptr;           /* NULL if the slot is empty */
+    size_t size;
+    const char *file;    /* Where it was allocated */
+    int line;
+    int persistent;
+    size_t call;         /* Serial number of the call that allocated it */
+} ymx_block_t;
+
+typedef struct ymx_alloc_call_s {
+    size_t serial;
+    char command[64];
+    int completed;       /* Reached ymx_alloc_end_call */
+    size_t allocations;
+    size_t frees;        /* Including blocks handed over to mxArrays */
+    size_t start_bytes;  /* Bytes live when the call began */
+    size_t peak_bytes;   /* Most bytes live at once during the call */
+} ymx_alloc_call_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t ALLOC_TABLE_INITIAL_SIZE = 1024;
+const size_t ALLOC_PENDING_INITIAL_SIZE = 64;
+
+const char *ALLOC_STATS_FIELDS[] = {"command", "completed", "allocations",
+        "frees", "peak_bytes", "unreleased", "persistent",
+        "persistent_bytes"};
+#define ALLOC_STATS_NUM_FIELDS 8
+const char *ALLOC_BLOCK_FIELDS[] = {"file", "line", "bytes"};
+#define ALLOC_BLOCK_NUM_FIELDS 3
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+static ymx_block_t *blocks = NULL;
+static size_t num_block_slots = 0;
+static size_t num_blocks = 0;
+static size_t live_bytes = 0;
+static size_t persistent_bytes = 0;
+
+static ymx_alloc_call_t call;       /* The call in progress */
+static ymx_alloc_call_t last_call;  /* The one before, as it ended */
+static ymx_block_t *last_blocks = NULL; /* What last_call left behind */
+static size_t num_last_blocks = 0;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+size_t ymx_block_slot(const void *ptr);
+ymx_block_t *ymx_find_block(const void *ptr);
+void ymx_add_block(void *ptr, size_t size, const char *file, int line);
+void ymx_remove_block(ymx_block_t *block);
+void ymx_grow_blocks();
+mxArray *ymx_block_list_to_array(int persistent);
+size_t ymx_array_bytes(const mxArray *array);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Counts for the call before this one, as a struct with these fields:
+ *          command: The command string given to that call.
+ *        completed: False if the call ended in an error.
+ *      allocations: Blocks allocated (or reallocated from NULL), and
+ *                   mxArrays made persistent.
+ *            frees: Blocks freed, or handed over to Matlab arrays, and
+ *                   persistent mxArrays destroyed.
+ *       peak_bytes: Most bytes the call had allocated at once, beyond
+ *                   those held at its start.
+ *       unreleased: Struct array of the blocks the call allocated and left
+ *                   for Matlab to reclaim, with fields file, line, bytes.
+ *       persistent: The same, for blocks and mxArrays made persistent by
+ *                   the call and still held.
+ * persistent_bytes: Bytes held in persistent blocks, from any call.
+ */
+mxArray *ymx_alloc_stats() {
+    mxArray *stats = mxCreateStructMatrix(1, 1,
+            ALLOC_STATS_NUM_FIELDS, ALLOC_STATS_FIELDS);
+    mxSetFieldByNumber(stats, 0, 0, mxCreateString(last_call.command));
+    mxSetFieldByNumber(stats, 0, 1,
+            mxCreateLogicalScalar(last_call.completed));
+    mxSetFieldByNumber(stats, 0, 2,
+            mxCreateDoubleScalar((double)last_call.allocations));
+    mxSetFieldByNumber(stats, 0, 3,
+            mxCreateDoubleScalar((double)last_call.frees));
+    mxSetFieldByNumber(stats, 0, 4, mxCreateDoubleScalar(
+            (double)(last_call.peak_bytes - last_call.start_bytes)));
+    mxSetFieldByNumber(stats, 0, 5, ymx_block_list_to_array(0));
+    mxSetFieldByNumber(stats, 0, 6, ymx_block_list_to_array(1));
+    mxSetFieldByNumber(stats, 0, 7,
+            mxCreateDoubleScalar((double)persistent_bytes));
+    return stats;
+}
+
+
+/*
+ * Calls
+ *************************************************************************/
+
+/* Start counting a new call, given its command argument (or NULL), after
+ * taking a snapshot of the last one */
+void ymx_alloc_begin_call(const mxArray *command) {
+    if (call.serial) {
+        last_call = call;
+        free(last_blocks);
+        last_blocks = NULL;
+        num_last_blocks = 0;
+    }
+
+    /* Keep the blocks the last call left behind, and forget those Matlab
+     * has reclaimed since */
+    size_t i;
+    size_t num_left = 0;
+    for (i=0; i<num_block_slots; i++) {
+        if (blocks[i].ptr && blocks[i].call == last_call.serial)
+            num_left++;
+    }
+    if (num_left) {
+        last_blocks = malloc(num_left * sizeof(ymx_block_t));
+        if (!last_blocks)
+            mexErrMsgTxt("Out of memory for counting allocations");
+    }
+    for (i=0; i<num_block_slots; i++) {
+        if (blocks[i].ptr && blocks[i].call == last_call.serial)
+            last_blocks[num_last_blocks++] = blocks[i];
+    }
+    for (i=0; i<num_block_slots; ) {
+        ymx_block_t *block = blocks + i;
+        if (block->ptr && !block->persistent) {
+            /* Removal may move a later block into this slot */
+            ymx_remove_block(block);
+        } else {
+            i++;
+        }
+    }
+
+    memset(&call, 0, sizeof(ymx_alloc_call_t));
+    call.serial = last_call.serial + 1;
+    if (command && mxIsChar(command))
+        mxGetString(command, call.command, sizeof(call.command));
+    call.start_bytes = live_bytes;
+    call.peak_bytes = live_bytes;
+}
+
+/* Mark the call in progress as having finished without an error */
+void ymx_alloc_end_call() {
+    call.completed = 1;
+}
+
+/* Forget everything; called when the MEX-file is cleared, after the rest
+ * of its memory has been freed. */
+void ymx_alloc_cleanup() {
+    free(blocks);
+    blocks = NULL;
+    num_block_slots = 0;
+    num_blocks = 0;
+    live_bytes = 0;
+    persistent_bytes = 0;
+    free(last_blocks);
+    last_blocks = NULL;
+    num_last_blocks = 0;
+    memset(&call, 0, sizeof(ymx_alloc_call_t));
+    memset(&last_call, 0, sizeof(ymx_alloc_call_t));
+}
+
+
+/*
+ * Counting wrappers
+ *************************************************************************/
+
+void *ymx_counted_malloc(size_t size, const char *file, int line) {
+    void *ptr = mxMalloc(size);
+    ymx_add_block(ptr, size, file, line);
+    return ptr;
+}
+
+void *ymx_counted_calloc(size_t num, size_t size, const char *file,
+        int line) {
+    void *ptr = mxCalloc(num, size);
+    ymx_add_block(ptr, num * size, file, line);
+    return ptr;
+}
+
+void *ymx_counted_realloc(void *ptr, size_t size, const char *file,
+        int line) {
+    ymx_block_t *block = ptr ? ymx_find_block(ptr) : NULL;
+    int persistent = block && block->persistent;
+    void *new_ptr = mxRealloc(ptr, size);
+    if (block)
+        ymx_remove_block(block);
+    ymx_add_block(new_ptr, size, file, line);
+    if (ptr)
+        call.allocations--; /* A move, not a new block */
+    if (persistent)
+        ymx_counted_make_persistent(new_ptr);
+    return new_ptr;
+}
+
+void ymx_counted_free(void *ptr) {
+    ymx_block_t *block = ptr ? ymx_find_block(ptr) : NULL;
+    if (block) {
+        ymx_remove_block(block);
+        call.frees++;
+    }
+    mxFree(ptr);
+}
+
+char *ymx_counted_array_to_string(const mxArray *array, const char *file,
+        int line) {
+    char *str = mxArrayToString(array);
+    if (str)
+        ymx_add_block(str, strlen(str) + 1, file, line);
+    return str;
+}
+
+void ymx_counted_make_persistent(void *ptr) {
+    ymx_block_t *block = ymx_find_block(ptr);
+    if (block && !block->persistent) {
+        block->persistent = 1;
+        persistent_bytes += block->size;
+    }
+    mexMakeMemoryPersistent(ptr);
+}
+
+void ymx_counted_make_array_persistent(mxArray *array, const char *file,
+        int line) {
+    if (!ymx_find_block(array)) {
+        size_t size = ymx_array_bytes(array);
+        ymx_add_block(array, size, file, line);
+        ymx_find_block(array)->persistent = 1;
+        persistent_bytes += size;
+    }
+    mexMakeArrayPersistent(array);
+}
+
+void ymx_counted_destroy_array(mxArray *array) {
+    ymx_block_t *block = array ? ymx_find_block(array) : NULL;
+    if (block) {
+        ymx_remove_block(block);
+        call.frees++;
+    }
+    mxDestroyArray(array);
+}
+
+void ymx_counted_set_data(mxArray *array, void *data) {
+    ymx_block_t *block = data ? ymx_find_block(data) : NULL;
+    if (block) {
+        ymx_remove_block(block);
+        call.frees++;
+    }
+    mxSetData(array, data);
+}
+
+void ymx_counted_set_imag_data(mxArray *array, void *data) {
+    ymx_block_t *block = data ? ymx_find_block(data) : NULL;
+    if (block) {
+        ymx_remove_block(block);
+        call.frees++;
+    }
+    mxSetImagData(array, data);
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+size_t ymx_block_slot(const void *ptr) {
+    return (size_t)ymx_hash_mix((uint64_T)(size_t)ptr)
+            & (num_block_slots - 1);
+}
+
+ymx_block_t *ymx_find_block(const void *ptr) {
+    if (!num_block_slots)
+        return NULL;
+    size_t i = ymx_block_slot(ptr);
+    while (blocks[i].ptr) {
+        if (blocks[i].ptr == ptr)
+            return blocks + i;
+        i = (i + 1) & (num_block_slots - 1);
+    }
+    return NULL;
+}
+
+void ymx_add_block(void *ptr, size_t size, const char *file, int line) {
+    if (!ptr)
+        return;
+    if (2*(num_blocks + 1) > num_block_slots)
+        ymx_grow_blocks();
+    size_t i = ymx_block_slot(ptr);
+    while (blocks[i].ptr)
+        i = (i + 1) & (num_block_slots - 1);
+    blocks[i].ptr = ptr;
+    blocks[i].size = size;
+    blocks[i].file = file;
+    blocks[i].line = line;
+    blocks[i].persistent = 0;
+    blocks[i].call = call.serial;
+    num_blocks++;
+
+    call.allocations++;
+    live_bytes += size;
+    if (live_bytes > call.peak_bytes)
+        call.peak_bytes = live_bytes;
+}
+
+/* Empty a slot, moving up any later block of the same run that would
+ * no longer be found past the gap */
+void ymx_remove_block(ymx_block_t *block) {
+    live_bytes -= block->size;
+    if (block->persistent)
+        persistent_bytes -= block->size;
+    num_blocks--;
+
+    size_t mask = num_block_slots - 1;
+    size_t gap = (size_t)(block - blocks);
+    size_t i = gap;
+    while (1) {
+        i = (i + 1) & mask;
+        if (!blocks[i].ptr)
+            break;
+        size_t home = ymx_block_slot(blocks[i].ptr);
+        if (((i - home) & mask) >= ((i - gap) & mask)) {
+            blocks[gap] = blocks[i];
+            gap = i;
+        }
+    }
+    memset(blocks + gap, 0, sizeof(ymx_block_t));
+}
+
+void ymx_grow_blocks() {
+    ymx_block_t *old_blocks = blocks;
+    size_t old_size = num_block_slots;
+    size_t new_size = old_size ? 2*old_size : ALLOC_TABLE_INITIAL_SIZE;
+    blocks = calloc(new_size, sizeof(ymx_block_t));
+    if (!blocks)
+        mexErrMsgTxt("Out of memory for counting allocations");
+    num_block_slots = new_size;
+
+    size_t i;
+    for (i=0; i<old_size; i++) {
+        if (!old_blocks[i].ptr)
+            continue;
+        size_t j = ymx_block_slot(old_blocks[i].ptr);
+        while (blocks[j].ptr)
+            j = (j + 1) & (new_size - 1);
+        blocks[j] = old_blocks[i];
+    }
+    free(old_blocks);
+}
+
+/* The blocks the last call left behind, persistent or not, as a struct
+ * array for ymx_alloc_stats */
+mxArray *ymx_block_list_to_array(int persistent) {
+    size_t i;
+    mwSize num = 0;
+    for (i=0; i<num_last_blocks; i++) {
+        if (last_blocks[i].persistent == persistent)
+            num++;
+    }
+    mxArray *list = mxCreateStructMatrix(num, 1,
+            ALLOC_BLOCK_NUM_FIELDS, ALLOC_BLOCK_FIELDS);
+    mwIndex ind = 0;
+    for (i=0; i<num_last_blocks; i++) {
+        const ymx_block_t *block = last_blocks + i;
+        if (block->persistent != persistent)
+            continue;
+        const char *file = block->file;
+        const char *slash = strrchr(file, '/');
+        if (!slash)
+            slash = strrchr(file, '\\');
+        mxSetFieldByNumber(list, ind, 0, mxCreateString(slash ? slash + 1
+                : file));
+        mxSetFieldByNumber(list, ind, 1,
+                mxCreateDoubleScalar((double)block->line));
+        mxSetFieldByNumber(list, ind, 2,
+                mxCreateDoubleScalar((double)block->size));
+        ind++;
+    }
+    return list;
+}
+
+/* Estimate the bytes of Matlab memory an mxArray holds: its data, any
+ * imaginary part and sparse indices, and the arrays it contains, but not
+ * its header or field names. The arrays still to be counted are kept on a
+ * list rather than visited by recursion. */
+size_t ymx_array_bytes(const mxArray *array) {
+    size_t pending_size = ALLOC_PENDING_INITIAL_SIZE;
+    const mxArray **pending = mxMalloc(pending_size * sizeof(mxArray *));
+    size_t num_pending = 0;
+    size_t bytes = 0;
+    if (array)
+        pending[num_pending++] = array;
+
+    while (num_pending) {
+        array = pending[--num_pending];
+        size_t num = mxGetNumberOfElements(array);
+        size_t num_items = 0;
+        size_t num_fields = 0;
+        size_t i;
+        if (mxIsCell(array)) {
+            num_items = num;
+        } else if (mxIsStruct(array)) {
+            num_fields = (size_t)mxGetNumberOfFields(array);
+            num_items = num * num_fields;
+        } else if (mxIsSparse(array)) {
+            size_t nzmax = mxGetNzmax(array);
+            bytes += nzmax * (mxGetElementSize(array) + sizeof(mwIndex))
+                    + (mxGetN(array) + 1) * sizeof(mwIndex);
+            if (mxIsComplex(array))
+                bytes += nzmax * mxGetElementSize(array);
+        } else {
+            bytes += num * mxGetElementSize(array)
+                    * (mxIsComplex(array) ? 2 : 1);
+        }
+
+        if (num_pending + num_items > pending_size) {
+            while (num_pending + num_items > pending_size)
+                pending_size *= 2;
+            pending = mxRealloc(pending, pending_size * sizeof(mxArray *));
+        }
+        for (i=0; i<num_items; i++) {
+            const mxArray *item = num_fields ? mxGetFieldByNumber(array,
+                    i / num_fields, (int)(i % num_fields))
+                    : mxGetCell(array, i);
+            if (item)
+                pending[num_pending++] = item;
+        }
+    }
+    mxFree(pending);
+    return bytes;
+}
+
+#else
+
+mxArray *ymx_alloc_stats() {
+    ymx_error("Allocation counting wasn't built in (see YMX_COUNT_ALLOCS)");
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,434 @@
+#include "yaml_mex_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* NOTES
+ *
+ * Async loads read and parse a file on a thread of their own, while
+ * Matlab gets on with something else:
+ *     h = yaml_mex('load_async', path, opts);
+ *     ...
+ *     if yaml_mex('ready', h), ... end    % optional polling
+ *     docs = yaml_mex('fetch', h);          % waits if it must
+ * or yaml_mex('cancel', h) to give up on it.
+ *
+ * The worker thread mustn't touch the Matlab API, so it only gets as far
+ * as libyaml's events: it reads the file with the C library, parses it
+ * with a parser of its own, and keeps every event in a malloc'd list.
+ * (The fast scanners aren't used there, since their buffers and state are
+ * shared with loads on Matlab's thread.) Building the mxArrays is left to
+ * the fetch, which hands the list to ymx_parse to replay and then runs the
+ * usual load or simple construction, so the results, the limits on depth
+ * and nodes, and the error messages are all the same as for a load of the
+ * file's contents. Read and parse errors found by the worker are reported
+ * by the fetch.
+ *
+ * A fetch or a cancel waits for the worker and frees its load, whatever
+ * happens, so each handle can be used once. The worker checks for
+ * cancellation between blocks of the file and between events. Loads
+ * live in persistent memory and are identified to Matlab by a double
+ * handle (their slot number, from 1); any still running when the
+ * MEX-file is cleared are cancelled by ymx_load_cancel_all. On Windows the
+ * load is done synchronously, by yaml_mex('load_async') itself.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef enum ymx_async_state_e {
+    YMX_ASYNC_RUNNING,
+    YMX_ASYNC_DONE,
+    YMX_ASYNC_OPEN_FAILED,
+    YMX_ASYNC_READ_FAILED,
+    YMX_ASYNC_PARSE_FAILED,
+    YMX_ASYNC_CANCELLED
+} ymx_async_state_t;
+
+typedef struct ymx_async_s {
+    char *path;
+    int simple;               /* Construct native data, as load_simple */
+#ifndef _WIN32
+    pthread_t thread;
+    pthread_mutex_t lock;     /* Guards state and cancelled */
+#endif
+    ymx_async_state_t state;
+    int cancelled;
+
+    /* Written by the worker, and only read once it has finished */
+    ymx_event_list_t events;  /* malloc'd */
+    size_t length;            /* Bytes read from the file */
+    const char *problem;      /* libyaml's description of a parse error */
+} ymx_async_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t ASYNC_LOADS_INITIAL_SIZE = 8;
+const size_t ASYNC_READ_BLOCK_SIZE = 1 << 20;
+const size_t ASYNC_EVENTS_INITIAL_SIZE = 1024;
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+static ymx_async_t **async_loads = NULL;
+static size_t num_async_slots = 0;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+ymx_async_t *ymx_get_async(const mxArray *handle);
+ymx_async_t *ymx_take_async(const mxArray *handle);
+void ymx_async_cancel(ymx_async_t *async);
+void ymx_async_wait(ymx_async_t *async);
+void ymx_async_delete(ymx_async_t *async);
+void *ymx_async_run(void *data);
+ymx_async_state_t ymx_async_read_parse(ymx_async_t *async);
+int ymx_async_is_cancelled(ymx_async_t *async);
+void ymx_async_set_state(ymx_async_t *async, ymx_async_state_t state);
+ymx_async_state_t ymx_async_get_state(ymx_async_t *async);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Start loading the file at path in the background, and return a handle
+ * for the load. options may be NULL, or a struct with this field:
+ *         simple: If true, documents are constructed as native data, as by
+ *                 yaml_mex('load_simple'); otherwise they are loaded as by
+ *                 yaml_mex('load'). Default false.
+ */
+mxArray *ymx_load_async(const mxArray *path, const mxArray *options) {
+    int simple = 0;
+
+    if (options && !mxIsEmpty(options)) {
+        if (!mxIsStruct(options) || mxGetNumberOfElements(options) != 1)
+            ymx_error("Load options must be a scalar struct");
+
+        mxArray *simple_arr = mxGetField(options, 0, "simple");
+        if (simple_arr) {
+            if (!(mxIsLogical(simple_arr) || mxIsNumeric(simple_arr))
+                    || mxGetNumberOfElements(simple_arr) != 1)
+                ymx_error("Load option 'simple' must be a logical scalar");
+            simple = (mxGetScalar(simple_arr) != 0);
+        }
+    }
+
+    /* Find a free slot, growing the table if there isn't one */
+    size_t slot;
+    for (slot=0; slot<num_async_slots; slot++) {
+        if (!async_loads[slot])
+            break;
+    }
+    if (slot == num_async_slots) {
+        size_t new_size = num_async_slots
+                ? 2*num_async_slots : ASYNC_LOADS_INITIAL_SIZE;
+        ymx_async_t **new_loads = mxCalloc(new_size,
+                sizeof(ymx_async_t *));
+        mexMakeMemoryPersistent(new_loads);
+        if (async_loads) {
+            memcpy(new_loads, async_loads,
+                    num_async_slots * sizeof(ymx_async_t *));
+            mxFree(async_loads);
+        }
+        async_loads = new_loads;
+        num_async_slots = new_size;
+    }
+
+    ymx_async_t *async = mxCalloc(1, sizeof(ymx_async_t));
+    mexMakeMemoryPersistent(async);
+    async->path = mxArrayToString(path);
+    mexMakeMemoryPersistent(async->path);
+    async->simple = simple;
+    async->state = YMX_ASYNC_RUNNING;
+
+#ifdef _WIN32
+    ymx_async_run(async);
+#else
+    pthread_mutex_init(&async->lock, NULL);
+    if (pthread_create(&async->thread, NULL, ymx_async_run, async) != 0) {
+        pthread_mutex_destroy(&async->lock);
+        mxFree(async->path);
+        mxFree(async);
+        ymx_error("Couldn't start a thread for the load");
+    }
+#endif
+    async_loads[slot] = async;
+
+    return mxCreateDoubleScalar((double)(slot + 1));
+}
+
+/* Return true if the load of a handle has finished (successfully or not),
+ * so that fetching it won't have to wait */
+mxArray *ymx_load_ready(const mxArray *handle) {
+    ymx_async_t *async = ymx_get_async(handle);
+    return mxCreateLogicalScalar(
+            ymx_async_get_state(async) != YMX_ASYNC_RUNNING);
+}
+
+/* Wait for the load of a handle to finish, and return its documents: a
+ * document array as from ymx_load_stream (empty if there are none), or
+ * for a simple load, data as from ymx_construct_stream. The handle is
+ * closed. */
+mxArray *ymx_load_fetch(const mxArray *handle) {
+    ymx_async_t *async = ymx_take_async(handle);
+    ymx_async_wait(async);
+
+    /* Take the events before freeing the load, which is done before
+     * anything can fail */
+    ymx_async_state_t state = async->state;
+    const char *problem = async->problem;
+    int simple = async->simple;
+    size_t length = async->length;
+    ymx_event_list_t events;
+    memset(&events, 0, sizeof(ymx_event_list_t));
+    if (state == YMX_ASYNC_DONE) {
+        events = async->events;
+        memset(&async->events, 0, sizeof(ymx_event_list_t));
+    }
+    ymx_async_delete(async);
+
+    switch (state) {
+        case YMX_ASYNC_DONE:
+            break;
+        case YMX_ASYNC_OPEN_FAILED:
+            ymx_error("Couldn't open file for reading");
+            break;
+        case YMX_ASYNC_READ_FAILED:
+            ymx_error("Error while reading file");
+            break;
+        default:
+            mexPrintf("Parser error: %s\n", problem);
+            ymx_error("Error while parsing document");
+            break;
+    }
+
+    yaml_parser_t *parser = ymx_init_parser();
+    ymx_set_replay_input(&events, length);
+
+    mxArray *data;
+    if (simple) {
+        data = ymx_unwrap_documents(ymx_construct_parsed(parser, NULL));
+    } else {
+        data = ymx_load_parsed(parser);
+        if (!data)
+            data = mxCreateStructMatrix(1, 0,
+                    YMX_DOC_NUM_FIELDS, YMX_DOC_FIELD_STRS);
+    }
+    ymx_persistent_cleanup();
+    return data;
+}
+
+/* Stop the load of a handle, and close the handle */
+void ymx_load_cancel(const mxArray *handle) {
+    ymx_async_cancel(ymx_take_async(handle));
+}
+
+/* Cancel every load still open; called when the MEX-file is cleared. */
+void ymx_load_cancel_all() {
+    size_t slot;
+    for (slot=0; slot<num_async_slots; slot++) {
+        if (async_loads[slot])
+            ymx_async_cancel(async_loads[slot]);
+    }
+    if (async_loads)
+        mxFree(async_loads);
+    async_loads = NULL;
+    num_async_slots = 0;
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+ymx_async_t *ymx_get_async(const mxArray *handle) {
+    if (!mxIsDouble(handle) || mxGetNumberOfElements(handle) != 1)
+        ymx_error("Invalid load handle");
+
+    double value = mxGetScalar(handle);
+    if (value < 1 || value > num_async_slots
+            || value != (double)(size_t)value
+            || !async_loads[(size_t)value - 1])
+        ymx_error("Invalid load handle");
+
+    return async_loads[(size_t)value - 1];
+}
+
+/* Look up the load of a handle, and free its slot */
+ymx_async_t *ymx_take_async(const mxArray *handle) {
+    ymx_async_t *async = ymx_get_async(handle);
+    async_loads[(size_t)mxGetScalar(handle) - 1] = NULL;
+    return async;
+}
+
+/* Stop a load's worker, wait for it, and free the load */
+void ymx_async_cancel(ymx_async_t *async) {
+#ifndef _WIN32
+    pthread_mutex_lock(&async->lock);
+    async->cancelled = 1;
+    pthread_mutex_unlock(&async->lock);
+#endif
+    ymx_async_wait(async);
+    ymx_async_delete(async);
+}
+
+void ymx_async_wait(ymx_async_t *async) {
+#ifndef _WIN32
+    pthread_join(async->thread, NULL);
+    pthread_mutex_destroy(&async->lock);
+#endif
+}
+
+/* Free a load whose worker has finished, and whatever events it kept */
+void ymx_async_delete(ymx_async_t *async) {
+    size_t i;
+    for (i=0; i<async->events.num_events; i++)
+        yaml_event_delete(async->events.events + i);
+    free(async->events.events);
+    mxFree(async->path);
+    mxFree(async);
+}
+
+
+/*
+ * The worker
+ *************************************************************************/
+
+/* Read and parse a load's file. This runs on the load's own thread, so it
+ * mustn't call the Matlab API. */
+void *ymx_async_run(void *data) {
+    ymx_async_t *async = data;
+    ymx_async_set_state(async, ymx_async_read_parse(async));
+    return NULL;
+}
+
+ymx_async_state_t ymx_async_read_parse(ymx_async_t *async) {
+    FILE *file = fopen(async->path, "rb");
+    if (!file)
+        return YMX_ASYNC_OPEN_FAILED;
+
+    /* Read the file a block at a time, so a cancel needn't wait for all
+     * of it */
+    char *text = NULL;
+    size_t size = 0;
+    size_t length = 0;
+    while (1) {
+        if (ymx_async_is_cancelled(async)) {
+            fclose(file);
+            free(text);
+            return YMX_ASYNC_CANCELLED;
+        }
+        if (size - length < ASYNC_READ_BLOCK_SIZE) {
+            size_t new_size = size ? 2*size : ASYNC_READ_BLOCK_SIZE;
+            char *new_text = realloc(text, new_size);
+            if (!new_text) {
+                fclose(file);
+                free(text);
+                return YMX_ASYNC_READ_FAILED;
+            }
+            text = new_text;
+            size = new_size;
+        }
+        size_t num_read = fread(text + length, 1, ASYNC_READ_BLOCK_SIZE,
+                file);
+        length += num_read;
+        if (num_read < ASYNC_READ_BLOCK_SIZE)
+            break;
+    }
+    int read_error = ferror(file);
+    fclose(file);
+    if (read_error) {
+        free(text);
+        return YMX_ASYNC_READ_FAILED;
+    }
+    async->length = length;
+
+    /* Parse it all; the events keep copies of their strings, so the text
+     * can go as soon as it's parsed */
+    yaml_parser_t parser;
+    if (!yaml_parser_initialize(&parser)) {
+        free(text);
+        async->problem = "couldn't initialize parser";
+        return YMX_ASYNC_PARSE_FAILED;
+    }
+    yaml_parser_set_input_string(&parser, (const yaml_char_t *)text,
+            length);
+
+    ymx_event_list_t *list = &async->events;
+    ymx_async_state_t state = YMX_ASYNC_DONE;
+    while (1) {
+        if (ymx_async_is_cancelled(async)) {
+            state = YMX_ASYNC_CANCELLED;
+            break;
+        }
+        if (list->num_events == list->size) {
+            size_t new_size = list->size
+                    ? 2*list->size : ASYNC_EVENTS_INITIAL_SIZE;
+            yaml_event_t *events = realloc(list->events,
+                    new_size * sizeof(yaml_event_t));
+            if (!events) {
+                async->problem = "out of memory";
+                state = YMX_ASYNC_PARSE_FAILED;
+                break;
+            }
+            list->events = events;
+            list->size = new_size;
+        }
+        yaml_event_t *event = list->events + list->num_events;
+        if (!yaml_parser_parse(&parser, event)) {
+            async->problem = parser.problem;
+            state = YMX_ASYNC_PARSE_FAILED;
+            break;
+        }
+        list->num_events++;
+        if (event->type == YAML_STREAM_END_EVENT)
+            break;
+    }
+
+    yaml_parser_delete(&parser);
+    free(text);
+    return state;
+}
+
+int ymx_async_is_cancelled(ymx_async_t *async) {
+#ifdef _WIN32
+    return 0;
+#else
+    pthread_mutex_lock(&async->lock);
+    int cancelled = async->cancelled;
+    pthread_mutex_unlock(&async->lock);
+    return cancelled;
+#endif
+}
+
+void ymx_async_set_state(ymx_async_t *async, ymx_async_state_t state) {
+#ifdef _WIN32
+    async->state = state;
+#else
+    pthread_mutex_lock(&async->lock);
+    async->state = state;
+    pthread_mutex_unlock(&async->lock);
+#endif
+}
+
+ymx_async_state_t ymx_async_get_state(ymx_async_t *async) {
+#ifdef _WIN32
+    return async->state;
+#else
+    pthread_mutex_lock(&async->lock);
+    ymx_async_state_t state = async->state;
+    pthread_mutex_unlock(&async->lock);
+    return state;
+#endif
+}
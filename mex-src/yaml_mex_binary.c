@@ -0,0 +1,259 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * Base64 coding for !!binary scalars (tag:yaml.org,2002:binary).
+ *
+ * The encoder works three input bytes at a time, looking up each 12-bit
+ * half of the 24-bit group in a table of character pairs, so that every
+ * group costs two table reads and two 2-byte copies rather than four
+ * shifts, masks and lookups. Output is broken into lines of
+ * YMX_BASE64_LINE_LENGTH characters, each ended by '\n', ready to be
+ * emitted as a literal block scalar.
+ *
+ * The decoder makes one pass to validate the text and count its base64
+ * characters, so that the result can be created at its exact size, and a
+ * second pass to decode straight into the data of that array. Whitespace
+ * anywhere (as left by line folding or indentation) is skipped; padding is
+ * optional, but if present must come at the end.
+ *
+ * Numeric data is always coded as little-endian bytes, whatever the byte
+ * order of the machine.
+ */
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+/* Characters per line of encoded output; a multiple of 4 */
+#define YMX_BASE64_LINE_LENGTH 76
+#define YMX_BASE64_LINE_BYTES (YMX_BASE64_LINE_LENGTH / 4 * 3)
+
+static const char YMX_BASE64_ALPHABET[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Values of the entries of the decoding table that aren't sextets */
+#define YMX_BASE64_INVALID 0xFF
+#define YMX_BASE64_SPACE   0xFE
+#define YMX_BASE64_PAD     0xFD
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+/* Pairs of base64 characters for each 12-bit value, and the value of each
+ * byte as a base64 character; both built on first use. */
+static char base64_pairs[2*4096];
+static unsigned char base64_values[256];
+static int base64_tables_ready = 0;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+void ymx_base64_decode_bytes(const char *text, size_t length,
+        void *bytes);
+void ymx_base64_init_tables();
+int ymx_is_little_endian();
+void ymx_swap_bytes(void *values, size_t num_bytes, size_t element_size);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Return the length of the base64 text ymx_base64_encode writes for
+ * num_bytes bytes (not counting a terminating NUL). */
+size_t ymx_base64_encoded_length(size_t num_bytes) {
+    size_t num_chars = (num_bytes + 2) / 3 * 4;
+    size_t num_lines = (num_chars + YMX_BASE64_LINE_LENGTH - 1)
+            / YMX_BASE64_LINE_LENGTH;
+    return num_chars + num_lines;
+}
+
+/* Encode num_bytes bytes as base64 into text, which must have room for
+ * ymx_base64_encoded_length(num_bytes) + 1 characters, and return the
+ * length written. Every line, including the last, ends with '\n'. */
+size_t ymx_base64_encode(char *text,
+        const unsigned char *bytes, size_t num_bytes) {
+    if (!base64_tables_ready)
+        ymx_base64_init_tables();
+
+    char *out = text;
+    while (num_bytes >= 3) {
+        size_t line_bytes = num_bytes < YMX_BASE64_LINE_BYTES
+                ? num_bytes - num_bytes % 3 : YMX_BASE64_LINE_BYTES;
+        const unsigned char *end = bytes + line_bytes;
+        for (; bytes < end; bytes += 3) {
+            unsigned long group = ((unsigned long)bytes[0] << 16)
+                    | ((unsigned long)bytes[1] << 8) | bytes[2];
+            memcpy(out, base64_pairs + 2*(group >> 12), 2);
+            memcpy(out + 2, base64_pairs + 2*(group & 0xFFF), 2);
+            out += 4;
+        }
+        num_bytes -= line_bytes;
+        if (line_bytes == YMX_BASE64_LINE_BYTES || !num_bytes)
+            *out++ = '\n';
+    }
+
+    if (num_bytes) {
+        unsigned long group = (unsigned long)bytes[0] << 16;
+        if (num_bytes == 2)
+            group |= (unsigned long)bytes[1] << 8;
+        *out++ = YMX_BASE64_ALPHABET[group >> 18];
+        *out++ = YMX_BASE64_ALPHABET[(group >> 12) & 0x3F];
+        *out++ = num_bytes == 2
+                ? YMX_BASE64_ALPHABET[(group >> 6) & 0x3F] : '=';
+        *out++ = '=';
+        *out++ = '\n';
+    }
+
+    *out = '\0';
+    return (size_t)(out - text);
+}
+
+/* Return num_elements elements of element_size bytes each, starting at
+ * values, as base64 text of their little-endian bytes. The text is
+ * allocated with mxMalloc, and its length is stored in *length. */
+char *ymx_base64_encode_elements(const void *values,
+        size_t num_elements, size_t element_size, size_t *length) {
+    size_t num_bytes = num_elements * element_size;
+    const unsigned char *bytes = (const unsigned char *)values;
+
+    unsigned char *swapped = NULL;
+    if (element_size > 1 && !ymx_is_little_endian()) {
+        swapped = mxMalloc(num_bytes);
+        memcpy(swapped, bytes, num_bytes);
+        ymx_swap_bytes(swapped, num_bytes, element_size);
+        bytes = swapped;
+    }
+
+    char *text = mxMalloc(ymx_base64_encoded_length(num_bytes) + 1);
+    *length = ymx_base64_encode(text, bytes, num_bytes);
+
+    if (swapped)
+        mxFree(swapped);
+    return text;
+}
+
+/* Decode base64 text into a new 1-by-N uint8 array */
+mxArray *ymx_base64_decode(const char *text, size_t length) {
+    size_t num_bytes = ymx_base64_decoded_length(text, length);
+    mxArray *array = mxCreateNumericMatrix(1, num_bytes,
+            mxUINT8_CLASS, mxREAL);
+    ymx_base64_decode_bytes(text, length, mxGetData(array));
+    return array;
+}
+
+/* Validate base64 text, and return the number of bytes it decodes to */
+size_t ymx_base64_decoded_length(const char *text, size_t length) {
+    if (!base64_tables_ready)
+        ymx_base64_init_tables();
+
+    size_t num_chars = 0;
+    size_t num_pad = 0;
+    size_t i;
+    for (i=0; i<length; i++) {
+        unsigned char value = base64_values[(unsigned char)text[i]];
+        if (value < 64) {
+            if (num_pad)
+                ymx_error("Invalid !!binary scalar: data after padding");
+            num_chars++;
+        } else if (value == YMX_BASE64_PAD) {
+            num_pad++;
+        } else if (value == YMX_BASE64_INVALID) {
+            ymx_error("Invalid !!binary scalar: not base64");
+        }
+    }
+    if (num_chars % 4 == 1 || num_pad > 2
+            || (num_pad && (num_chars + num_pad) % 4 != 0))
+        ymx_error("Invalid !!binary scalar: wrong length");
+
+    return num_chars / 4 * 3 + (num_chars % 4 ? num_chars % 4 - 1 : 0);
+}
+
+/* Decode base64 text holding exactly num_elements little-endian elements
+ * of element_size bytes each into values, in the machine's byte order. */
+void ymx_base64_decode_elements(const char *text, size_t length,
+        void *values, size_t num_elements, size_t element_size) {
+    size_t num_bytes = num_elements * element_size;
+    if (ymx_base64_decoded_length(text, length) != num_bytes)
+        ymx_error("Size of !!binary data doesn't match its array");
+
+    ymx_base64_decode_bytes(text, length, values);
+    if (element_size > 1 && !ymx_is_little_endian())
+        ymx_swap_bytes(values, num_bytes, element_size);
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+/* Decode base64 text, already validated, into bytes */
+void ymx_base64_decode_bytes(const char *text, size_t length,
+        void *bytes) {
+    unsigned char *out = (unsigned char *)bytes;
+    unsigned long group = 0;
+    int num_in_group = 0;
+    size_t i;
+    for (i=0; i<length; i++) {
+        unsigned char value = base64_values[(unsigned char)text[i]];
+        if (value >= 64)
+            continue;
+        group = (group << 6) | value;
+        if (++num_in_group == 4) {
+            out[0] = (unsigned char)(group >> 16);
+            out[1] = (unsigned char)(group >> 8);
+            out[2] = (unsigned char)group;
+            out += 3;
+            group = 0;
+            num_in_group = 0;
+        }
+    }
+    if (num_in_group == 3) {
+        out[0] = (unsigned char)(group >> 10);
+        out[1] = (unsigned char)(group >> 2);
+    } else if (num_in_group == 2) {
+        out[0] = (unsigned char)(group >> 4);
+    }
+}
+
+void ymx_base64_init_tables() {
+    int i;
+    for (i=0; i<4096; i++) {
+        base64_pairs[2*i] = YMX_BASE64_ALPHABET[i >> 6];
+        base64_pairs[2*i + 1] = YMX_BASE64_ALPHABET[i & 0x3F];
+    }
+    memset(base64_values, YMX_BASE64_INVALID, sizeof(base64_values));
+    for (i=0; i<64; i++) {
+        base64_values[(unsigned char)YMX_BASE64_ALPHABET[i]] =
+                (unsigned char)i;
+    }
+    base64_values[' '] = YMX_BASE64_SPACE;
+    base64_values['\t'] = YMX_BASE64_SPACE;
+    base64_values['\n'] = YMX_BASE64_SPACE;
+    base64_values['\r'] = YMX_BASE64_SPACE;
+    base64_values['='] = YMX_BASE64_PAD;
+    base64_tables_ready = 1;
+}
+
+int ymx_is_little_endian() {
+    const unsigned short probe = 1;
+    return *(const unsigned char *)&probe == 1;
+}
+
+/* Reverse the byte order of each element of values in place */
+void ymx_swap_bytes(void *values, size_t num_bytes, size_t element_size) {
+    unsigned char *bytes = (unsigned char *)values;
+    size_t i, j;
+    for (i=0; i<num_bytes; i+=element_size) {
+        for (j=0; j<element_size/2; j++) {
+            unsigned char byte = bytes[i + j];
+            bytes[i + j] = bytes[i + element_size - 1 - j];
+            bytes[i + element_size - 1 - j] = byte;
+        }
+    }
+}
@@ -0,0 +1,327 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * In-process load cache. When enabled (by giving it a memory limit with
+ * yaml_mex('cache', 'limit', bytes)), the data constructed by
+ * 'load_simple' and 'load_file_cached' is kept between calls, keyed by a
+ * hash of the input, and a later load of the same input returns a copy of
+ * it instead of parsing again. Entries hold a copy of their input, which
+ * is compared in full on a hit, so a hash collision can never return the
+ * wrong data. They also record the limits and scanner they were loaded
+ * under (see ymx_load_settings_key), and only match loads under the same
+ * ones, so that a load that the current limits would refuse isn't
+ * returned from the cache.
+ *
+ * Entries live in persistent memory (mexMakeMemoryPersistent and
+ * mexMakeArrayPersistent) in a chained hash table, and on a doubly-linked
+ * list in order of use. When storing an entry would take the cache over
+ * its limit, the least recently used entries are evicted first. The
+ * memory counted against the limit is an estimate: the input copy plus
+ * the data's element storage and a fixed overhead per mxArray.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef struct ymx_cache_entry_s {
+    uint64_T key;
+    ymx_cache_kind_t kind;
+    uint64_T settings; /* ymx_load_settings_key when it was stored */
+    void *input;   /* Copy of the input bytes */
+    size_t length; /* Length of input, in bytes */
+    mxArray *data;
+    size_t size;   /* Memory counted against the limit, in bytes */
+    struct ymx_cache_entry_s *chain; /* Next entry in the same bucket */
+    struct ymx_cache_entry_s *newer; /* Neighbours in order of use */
+    struct ymx_cache_entry_s *older;
+} ymx_cache_entry_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t CACHE_INITIAL_NUM_BUCKETS = 64;
+/* Rough size of an mxArray header, counted for each array in an entry */
+const size_t CACHE_ARRAY_OVERHEAD = 104;
+const size_t CACHE_PENDING_INITIAL_SIZE = 64;
+const char *YMX_CACHE_STATS_FIELD_STRS[] =
+        {"hits", "misses", "entries", "bytes", "limit"};
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+static ymx_cache_entry_t **cache_buckets = NULL;
+static size_t cache_num_buckets = 0;
+static size_t cache_count = 0;
+static size_t cache_size = 0;
+static size_t cache_limit = 0;
+static double cache_hits = 0;
+static double cache_misses = 0;
+static ymx_cache_entry_t *cache_newest = NULL;
+static ymx_cache_entry_t *cache_oldest = NULL;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+void ymx_cache_unlink(ymx_cache_entry_t *entry);
+void ymx_cache_push_newest(ymx_cache_entry_t *entry);
+void ymx_cache_remove(ymx_cache_entry_t *entry);
+void ymx_cache_evict(size_t size);
+void ymx_cache_grow_buckets();
+size_t ymx_array_size(const mxArray *array);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* ymx_construct_stream, through the cache */
+mxArray *ymx_cache_construct_stream(const mxArray *yaml_stream) {
+    if (!cache_limit)
+        return ymx_construct_stream(yaml_stream, NULL);
+
+    const mxChar *chars = mxGetChars(yaml_stream);
+    size_t length = mxGetNumberOfElements(yaml_stream) * sizeof(mxChar);
+    mxArray *data = ymx_cache_lookup(YMX_CACHE_KIND_STRING, chars, length);
+    if (!data) {
+        data = ymx_construct_stream(yaml_stream, NULL);
+        ymx_cache_store(YMX_CACHE_KIND_STRING, chars, length, data);
+    }
+    return data;
+}
+
+/* Set the cache's memory limit in bytes, evicting entries as needed to
+ * stay within it. A limit of 0 disables the cache. */
+void ymx_cache_set_limit(size_t limit) {
+    cache_limit = limit;
+    if (limit)
+        ymx_cache_evict(0);
+    else
+        ymx_cache_flush();
+}
+
+/* Return a scalar struct of cache statistics */
+mxArray *ymx_cache_stats() {
+    mxArray *stats = mxCreateStructMatrix(1, 1, 5,
+            YMX_CACHE_STATS_FIELD_STRS);
+    mxSetFieldByNumber(stats, 0, 0, mxCreateDoubleScalar(cache_hits));
+    mxSetFieldByNumber(stats, 0, 1, mxCreateDoubleScalar(cache_misses));
+    mxSetFieldByNumber(stats, 0, 2,
+            mxCreateDoubleScalar((double)cache_count));
+    mxSetFieldByNumber(stats, 0, 3,
+            mxCreateDoubleScalar((double)cache_size));
+    mxSetFieldByNumber(stats, 0, 4,
+            mxCreateDoubleScalar((double)cache_limit));
+    return stats;
+}
+
+/* Remove every entry and free the table, keeping the limit and counters */
+void ymx_cache_flush() {
+    while (cache_oldest)
+        ymx_cache_remove(cache_oldest);
+    if (cache_buckets)
+        mxFree(cache_buckets);
+    cache_buckets = NULL;
+    cache_num_buckets = 0;
+}
+
+/* Return a copy of the data cached for the given input, or NULL (counting
+ * a miss) if there is none. */
+mxArray *ymx_cache_lookup(ymx_cache_kind_t kind,
+        const void *input, size_t length) {
+    if (!cache_limit)
+        return NULL;
+
+    uint64_T key = ymx_hash_bytes(input, length, kind);
+    uint64_T settings = ymx_load_settings_key();
+    if (cache_num_buckets) {
+        ymx_cache_entry_t *entry =
+                cache_buckets[key & (cache_num_buckets - 1)];
+        for (; entry; entry = entry->chain) {
+            if (entry->key == key && entry->kind == kind
+                    && entry->settings == settings
+                    && entry->length == length
+                    && memcmp(entry->input, input, length) == 0) {
+                ymx_cache_unlink(entry);
+                ymx_cache_push_newest(entry);
+                cache_hits++;
+                return mxDuplicateArray(entry->data);
+            }
+        }
+    }
+    cache_misses++;
+    return NULL;
+}
+
+/* Cache a copy of data as the result for the given input, if the cache
+ * is enabled and the entry fits within its limit. */
+void ymx_cache_store(ymx_cache_kind_t kind,
+        const void *input, size_t length, const mxArray *data) {
+    if (!cache_limit)
+        return;
+
+    size_t size = length + sizeof(ymx_cache_entry_t) + ymx_array_size(data);
+    if (size > cache_limit)
+        return;
+    ymx_cache_evict(size);
+
+    if (cache_count >= cache_num_buckets)
+        ymx_cache_grow_buckets();
+
+    ymx_cache_entry_t *entry = mxCalloc(1, sizeof(ymx_cache_entry_t));
+    mexMakeMemoryPersistent(entry);
+    entry->key = ymx_hash_bytes(input, length, kind);
+    entry->kind = kind;
+    entry->settings = ymx_load_settings_key();
+    entry->input = mxMalloc(length ? length : 1);
+    mexMakeMemoryPersistent(entry->input);
+    memcpy(entry->input, input, length);
+    entry->length = length;
+    entry->data = mxDuplicateArray(data);
+    mexMakeArrayPersistent(entry->data);
+    entry->size = size;
+
+    size_t bucket = entry->key & (cache_num_buckets - 1);
+    entry->chain = cache_buckets[bucket];
+    cache_buckets[bucket] = entry;
+    ymx_cache_push_newest(entry);
+    cache_count++;
+    cache_size += size;
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+/* Take an entry off the use-order list */
+void ymx_cache_unlink(ymx_cache_entry_t *entry) {
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        cache_newest = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        cache_oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+void ymx_cache_push_newest(ymx_cache_entry_t *entry) {
+    entry->older = cache_newest;
+    entry->newer = NULL;
+    if (cache_newest)
+        cache_newest->newer = entry;
+    cache_newest = entry;
+    if (!cache_oldest)
+        cache_oldest = entry;
+}
+
+/* Remove an entry from the table and the list, and free it */
+void ymx_cache_remove(ymx_cache_entry_t *entry) {
+    ymx_cache_entry_t **link =
+            &cache_buckets[entry->key & (cache_num_buckets - 1)];
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+    ymx_cache_unlink(entry);
+
+    cache_count--;
+    cache_size -= entry->size;
+    mxDestroyArray(entry->data);
+    mxFree(entry->input);
+    mxFree(entry);
+}
+
+/* Evict least recently used entries until size more bytes would fit */
+void ymx_cache_evict(size_t size) {
+    while (cache_oldest && cache_size + size > cache_limit)
+        ymx_cache_remove(cache_oldest);
+}
+
+/* Double the number of buckets (which is always a power of 2) */
+void ymx_cache_grow_buckets() {
+    size_t num_buckets = cache_num_buckets
+            ? 2*cache_num_buckets : CACHE_INITIAL_NUM_BUCKETS;
+    ymx_cache_entry_t **buckets =
+            mxCalloc(num_buckets, sizeof(ymx_cache_entry_t *));
+    mexMakeMemoryPersistent(buckets);
+
+    size_t i;
+    for (i=0; i<cache_num_buckets; i++) {
+        ymx_cache_entry_t *entry = cache_buckets[i];
+        while (entry) {
+            ymx_cache_entry_t *next = entry->chain;
+            size_t bucket = entry->key & (num_buckets - 1);
+            entry->chain = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+
+    if (cache_buckets)
+        mxFree(cache_buckets);
+    cache_buckets = buckets;
+    cache_num_buckets = num_buckets;
+}
+
+/* Estimate the memory used by an array and everything it holds. The
+ * arrays still to be counted are kept on a list, not visited by
+ * recursion, so data of any depth can be cached. */
+size_t ymx_array_size(const mxArray *array) {
+    size_t pending_size = CACHE_PENDING_INITIAL_SIZE;
+    const mxArray **pending = mxMalloc(pending_size * sizeof(mxArray *));
+    size_t num_pending = 0;
+    size_t size = 0;
+    if (array)
+        pending[num_pending++] = array;
+
+    while (num_pending) {
+        array = pending[--num_pending];
+        size += CACHE_ARRAY_OVERHEAD;
+        size_t num_elements = mxGetNumberOfElements(array);
+        size_t num_items = 0;
+        int num_fields = 0;
+        size_t i;
+        if (mxIsCell(array)) {
+            num_items = num_elements;
+            size += num_items * sizeof(mxArray *);
+        } else if (mxIsStruct(array)) {
+            num_fields = mxGetNumberOfFields(array);
+            int field;
+            for (field=0; field<num_fields; field++) {
+                size += strlen(mxGetFieldNameByNumber(array, field)) + 1;
+            }
+            num_items = num_elements * num_fields;
+            size += num_items * sizeof(mxArray *);
+        } else if (mxIsSparse(array)) {
+            size_t nzmax = mxGetNzmax(array);
+            size += nzmax * (mxGetElementSize(array) + sizeof(mwIndex))
+                    + (mxGetN(array) + 1) * sizeof(mwIndex);
+        } else {
+            size += num_elements * mxGetElementSize(array)
+                    * (mxIsComplex(array) ? 2 : 1);
+        }
+
+        if (num_pending + num_items > pending_size) {
+            while (num_pending + num_items > pending_size)
+                pending_size *= 2;
+            pending = mxRealloc(pending, pending_size * sizeof(mxArray *));
+        }
+        for (i=0; i<num_items; i++) {
+            const mxArray *item = num_fields ? mxGetFieldByNumber(array,
+                    i / num_fields, i % num_fields) : mxGetCell(array, i);
+            if (item)
+                pending[num_pending++] = item;
+        }
+    }
+    mxFree(pending);
+    return size;
+}
@@ -0,0 +1,535 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * Columnar loading of "record" sequences: a document whose root is a
+ * sequence of flat mappings, such as
+ *     - {t: 1.2, ch: 3, ok: true}
+ *     - {t: 1.3, ch: 4, ok: false}
+ * is loaded as a struct of N-by-1 columns, one per key, without ever
+ * creating a struct or an mxArray per row. Each key's resolved scalars are
+ * appended to a growable ymx_column_t, which settles on its Matlab type
+ * only once all rows have been read.
+ *
+ * Extraction gathers one scalar from every document of a stream into a
+ * single column: the value at a key path such as 'stats/loss' (mapping
+ * keys separated by '/'; a segment that is a positive whole number also
+ * picks that item, counting from 1, out of a sequence). Each document is
+ * walked event by event, draining the values beside the path with
+ * ymx_skip_node, so nothing but the column itself is ever built.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef struct ymx_path_segment_s {
+    const char *name;
+    size_t length;
+    size_t index;    /* 1-based sequence index, or 0 if name isn't one */
+} ymx_path_segment_t;
+
+typedef struct ymx_named_column_s {
+    char *name;
+    size_t last_row; /* 1 + index of the last row that set this column */
+    ymx_column_t column;
+} ymx_named_column_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t COLUMN_INITIAL_SIZE = 64;
+const size_t COLUMN_LIST_INITIAL_SIZE = 8;
+const size_t PATH_SEGMENTS_INITIAL_SIZE = 4;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+void ymx_column_reserve(ymx_column_t *column, size_t size);
+void ymx_column_make_strings(ymx_column_t *column);
+mxArray *ymx_column_number_string(double number);
+size_t ymx_split_key_path(const char *path, ymx_path_segment_t **segments);
+const yaml_event_t *ymx_find_path(yaml_parser_t *parser,
+        const yaml_event_t *event,
+        const ymx_path_segment_t *segments, size_t num_segments);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Load the first document of a YAML stream, which must be a sequence of
+ * mappings whose values are all scalars, into a 1-by-1 struct with one
+ * N-by-1 column per key (in order of first appearance). Rows lacking a key
+ * are treated as missing values in that column, as are null scalars; see
+ * ymx_column_to_array for how columns are typed.
+ */
+mxArray *ymx_load_columns(const mxArray *yaml_stream) {
+    ymx_debug_msg("Entering ymx_load_columns\n");
+    char *yaml_cstr = mxArrayToString(yaml_stream);
+
+    yaml_parser_t *parser = ymx_init_parser();
+    ymx_set_parser_input(parser, yaml_cstr, strlen(yaml_cstr));
+
+    const yaml_event_t *event = ymx_parse(parser);
+    mxAssert(event->type == YAML_STREAM_START_EVENT,
+            "Expected stream start event!");
+    event = ymx_parse(parser);
+    if (event->type != YAML_DOCUMENT_START_EVENT)
+        ymx_error("Stream holds no document");
+    event = ymx_parse(parser);
+    if (event->type != YAML_SEQUENCE_START_EVENT)
+        ymx_error("Document root must be a sequence of mappings");
+
+    size_t num_columns = 0;
+    size_t columns_size = COLUMN_LIST_INITIAL_SIZE;
+    ymx_named_column_t *columns =
+            mxCalloc(columns_size, sizeof(ymx_named_column_t));
+    size_t num_rows = 0;
+    size_t i;
+
+    event = ymx_parse(parser);
+    while (event->type != YAML_SEQUENCE_END_EVENT) {
+        if (event->type != YAML_MAPPING_START_EVENT)
+            ymx_error("Document root must be a sequence of mappings");
+
+        /* Rows usually list their keys in the same order, so look for
+         * each key first in the column after the previous key's. */
+        size_t hint = 0;
+        event = ymx_parse(parser);
+        while (event->type != YAML_MAPPING_END_EVENT) {
+            if (event->type != YAML_SCALAR_EVENT)
+                ymx_error("Unable to convert mapping key to struct field.");
+            const char *key = (char *)event->data.scalar.value;
+
+            ymx_named_column_t *column = NULL;
+            for (i=0; i<num_columns; i++) {
+                size_t ind = (hint + i) % num_columns;
+                if (strcmp(columns[ind].name, key) == 0) {
+                    column = columns + ind;
+                    hint = ind + 1;
+                    break;
+                }
+            }
+
+            if (!column) {
+                if (!ymx_is_valid_field_name(key, event->data.scalar.length))
+                    ymx_error("Unable to convert mapping key to struct field.");
+                if (num_columns == columns_size) {
+                    columns_size *= 2;
+                    columns = mxRealloc(columns,
+                            columns_size * sizeof(ymx_named_column_t));
+                }
+                column = columns + num_columns;
+                column->name = mxMalloc(event->data.scalar.length + 1);
+                memcpy(column->name, key, event->data.scalar.length + 1);
+                column->last_row = 0;
+                ymx_column_init(&column->column);
+                for (i=0; i<num_rows; i++) {
+                    ymx_column_append_missing(&column->column);
+                }
+                num_columns++;
+                hint = num_columns;
+            }
+
+            if (column->last_row == num_rows + 1)
+                ymx_error("Duplicate mapping key.");
+            column->last_row = num_rows + 1;
+
+            event = ymx_parse(parser);
+            if (event->type != YAML_SCALAR_EVENT)
+                ymx_error("Mapping values must be scalars");
+            ymx_column_append_scalar(&column->column, event);
+
+            event = ymx_parse(parser);
+        }
+
+        num_rows++;
+        for (i=0; i<num_columns; i++) {
+            if (columns[i].last_row != num_rows)
+                ymx_column_append_missing(&columns[i].column);
+        }
+        event = ymx_parse(parser);
+    }
+
+    const char **names = mxCalloc(num_columns + 1, sizeof(char *));
+    for (i=0; i<num_columns; i++) {
+        names[i] = columns[i].name;
+    }
+    mxArray *data = mxCreateStructMatrix(1, 1, num_columns, names);
+    for (i=0; i<num_columns; i++) {
+        mxSetFieldByNumber(data, 0, i,
+                ymx_column_to_array(&columns[i].column));
+        ymx_column_delete(&columns[i].column);
+        mxFree(columns[i].name);
+    }
+
+    mxFree(names);
+    mxFree(columns);
+    mxFree(yaml_cstr);
+    ymx_debug_msg("Exiting ymx_load_columns\n");
+    return data;
+}
+
+/* Extract the scalar at key_path from every document of a YAML stream
+ * (or, if is_file, of the file named by source) into an N-by-1 column,
+ * typed as by ymx_column_to_array. Documents where the path is missing,
+ * or leads to a null or to a sequence, mapping or alias, give a missing
+ * value. If found isn't NULL, it is set to an N-by-1 logical array that
+ * is false for those documents. A file is streamed through the parser
+ * rather than read whole, decompressed as its extension says (see
+ * ymx_get_codec), so only the column is ever held in memory.
+ */
+mxArray *ymx_extract(const mxArray *source, int is_file,
+        const mxArray *key_path, mxArray **found) {
+    ymx_debug_msg("Entering ymx_extract\n");
+    char *path_cstr = mxArrayToString(key_path);
+    ymx_path_segment_t *segments;
+    size_t num_segments = ymx_split_key_path(path_cstr, &segments);
+
+    char *yaml_cstr = NULL;
+    yaml_parser_t *parser = ymx_init_parser();
+    if (is_file) {
+        char *path = mxArrayToString(source);
+        ymx_cfile_t *file = ymx_cfile_open(path,
+                ymx_get_codec(path, NULL), "rb");
+        if (!file)
+            ymx_error("Couldn't open file for reading");
+        ymx_set_file_input(parser, file);
+        mxFree(path);
+    } else {
+        yaml_cstr = mxArrayToString(source);
+        ymx_set_parser_input(parser, yaml_cstr, strlen(yaml_cstr));
+    }
+
+    ymx_column_t column;
+    ymx_column_init(&column);
+
+    const yaml_event_t *event = ymx_parse(parser);
+    mxAssert(event->type == YAML_STREAM_START_EVENT,
+            "Expected stream start event!");
+    event = ymx_parse(parser);
+    while (event->type != YAML_STREAM_END_EVENT) {
+        mxAssert(event->type == YAML_DOCUMENT_START_EVENT,
+                "Expected document start event!");
+        event = ymx_find_path(parser, ymx_parse(parser),
+                segments, num_segments);
+        if (event) {
+            ymx_column_append_scalar(&column, event);
+        } else {
+            ymx_column_append_missing(&column);
+        }
+
+        /* Drain whatever is left of the document */
+        do {
+            event = ymx_parse(parser);
+        } while (event->type != YAML_DOCUMENT_END_EVENT);
+        event = ymx_parse(parser);
+    }
+
+    if (found) {
+        *found = mxCreateLogicalMatrix(column.count, 1);
+        mxLogical *logicals = mxGetLogicals(*found);
+        size_t i;
+        for (i=0; i<column.count; i++) {
+            logicals[i] = !(column.missing && column.missing[i]);
+        }
+    }
+    mxArray *values = ymx_column_to_array(&column);
+
+    if (is_file)
+        ymx_persistent_cleanup();
+    ymx_column_delete(&column);
+    mxFree(segments);
+    mxFree(path_cstr);
+    if (yaml_cstr)
+        mxFree(yaml_cstr);
+    ymx_debug_msg("Exiting ymx_extract\n");
+    return values;
+}
+
+
+/*
+ * ymx_column functions
+ *************************************************************************/
+
+void ymx_column_init(ymx_column_t *column) {
+    memset(column, 0, sizeof(ymx_column_t));
+    column->kind = YMX_COLUMN_KIND_EMPTY;
+}
+
+void ymx_column_delete(ymx_column_t *column) {
+    if (column->numbers)
+        mxFree(column->numbers);
+    if (column->missing)
+        mxFree(column->missing);
+    if (column->strings)
+        mxFree(column->strings);
+    memset(column, 0, sizeof(ymx_column_t));
+}
+
+/* Make room for at least size values. Storage grows geometrically so that
+ * appending N values costs O(N) overall. */
+void ymx_column_reserve(ymx_column_t *column, size_t size) {
+    if (size <= column->capacity)
+        return;
+
+    size_t old_capacity = column->capacity;
+    size_t capacity = old_capacity ? old_capacity : COLUMN_INITIAL_SIZE;
+    while (capacity < size)
+        capacity *= 2;
+
+    if (column->kind == YMX_COLUMN_KIND_STRING) {
+        column->strings = mxRealloc(column->strings,
+                capacity * sizeof(mxArray *));
+    } else {
+        column->numbers = mxRealloc(column->numbers,
+                capacity * sizeof(double));
+    }
+    if (column->missing) {
+        column->missing = mxRealloc(column->missing,
+                capacity * sizeof(mxLogical));
+        memset(column->missing + old_capacity, 0,
+                (capacity - old_capacity) * sizeof(mxLogical));
+    }
+    column->capacity = capacity;
+}
+
+void ymx_column_append_missing(ymx_column_t *column) {
+    ymx_column_reserve(column, column->count + 1);
+    if (!column->missing) {
+        column->missing = mxCalloc(column->capacity, sizeof(mxLogical));
+    }
+    column->missing[column->count] = 1;
+    column->num_missing++;
+
+    if (column->kind == YMX_COLUMN_KIND_STRING) {
+        column->strings[column->count] = mxCreateString("");
+    } else {
+        column->numbers[column->count] = mxGetNaN();
+    }
+    column->count++;
+}
+
+/* Append a scalar event's resolved value. A column holds numbers or bools
+ * for as long as all of its (non-missing) values are of the one kind;
+ * after that it holds strings. */
+void ymx_column_append_scalar(ymx_column_t *column,
+        const yaml_event_t *event) {
+    double number = 0;
+    ymx_scalar_kind_t kind = ymx_resolve_scalar(event, &number);
+
+    if (kind == YMX_SCALAR_KIND_NULL) {
+        ymx_column_append_missing(column);
+        return;
+    }
+
+    ymx_column_kind_t column_kind;
+    switch (kind) {
+        case YMX_SCALAR_KIND_BOOL:
+            column_kind = YMX_COLUMN_KIND_BOOL;
+            break;
+        case YMX_SCALAR_KIND_NUMBER:
+            column_kind = YMX_COLUMN_KIND_NUMBER;
+            break;
+        default:
+            column_kind = YMX_COLUMN_KIND_STRING;
+    }
+
+    if (column->kind == YMX_COLUMN_KIND_EMPTY
+            && column_kind != YMX_COLUMN_KIND_STRING) {
+        /* The missing values so far are already held as NaNs */
+        column->kind = column_kind;
+    } else if (column->kind != column_kind) {
+        /* Also fills in '' for the missing values of an empty column */
+        ymx_column_make_strings(column);
+    }
+
+    ymx_column_reserve(column, column->count + 1);
+    if (column->kind == YMX_COLUMN_KIND_STRING) {
+        switch (kind) {
+            case YMX_SCALAR_KIND_BOOL:
+                column->strings[column->count] =
+                        mxCreateString(number ? "true" : "false");
+                break;
+            case YMX_SCALAR_KIND_NUMBER:
+                column->strings[column->count] =
+                        ymx_column_number_string(number);
+                break;
+            default:
+                column->strings[column->count] =
+                        mxCreateString((char *)event->data.scalar.value);
+        }
+    } else {
+        column->numbers[column->count] = number;
+    }
+    column->count++;
+}
+
+/* Convert a number or bool column to a string column, formatting the
+ * values held so far. */
+void ymx_column_make_strings(ymx_column_t *column) {
+    if (column->kind == YMX_COLUMN_KIND_STRING)
+        return;
+
+    mxArray **strings = mxMalloc(
+            (column->capacity ? column->capacity : 1) * sizeof(mxArray *));
+    size_t i;
+    for (i=0; i<column->count; i++) {
+        if (column->missing && column->missing[i]) {
+            strings[i] = mxCreateString("");
+        } else if (column->kind == YMX_COLUMN_KIND_BOOL) {
+            strings[i] = mxCreateString(
+                    column->numbers[i] ? "true" : "false");
+        } else {
+            strings[i] = ymx_column_number_string(column->numbers[i]);
+        }
+    }
+
+    if (column->numbers)
+        mxFree(column->numbers);
+    column->numbers = NULL;
+    column->strings = strings;
+    column->kind = YMX_COLUMN_KIND_STRING;
+}
+
+/* Split a key path at its '/'s into an mxMalloc'd array of segments,
+ * which point into path, and return the number of segments. */
+size_t ymx_split_key_path(const char *path, ymx_path_segment_t **segments) {
+    size_t size = PATH_SEGMENTS_INITIAL_SIZE;
+    ymx_path_segment_t *list = mxMalloc(size * sizeof(ymx_path_segment_t));
+    size_t count = 0;
+
+    const char *segment = path;
+    while (1) {
+        const char *end = strchr(segment, '/');
+        size_t length = end ? (size_t)(end - segment) : strlen(segment);
+        if (!length)
+            ymx_error("Key paths can't have empty segments");
+
+        if (count == size) {
+            size *= 2;
+            list = mxRealloc(list, size * sizeof(ymx_path_segment_t));
+        }
+        ymx_path_segment_t *item = list + count++;
+        item->name = segment;
+        item->length = length;
+        item->index = 0;
+        size_t i;
+        for (i=0; i<length && segment[i] >= '0' && segment[i] <= '9'; i++) {
+            item->index = 10*item->index + (size_t)(segment[i] - '0');
+        }
+        if (i < length)
+            item->index = 0;
+
+        if (!end)
+            break;
+        segment = end + 1;
+    }
+
+    *segments = list;
+    return count;
+}
+
+/* Follow a key path down from the node starting with event, draining the
+ * nodes passed over on the way. Returns the scalar event at the end of the
+ * path, or NULL if there is none; the parser is left somewhere inside the
+ * document either way. */
+const yaml_event_t *ymx_find_path(yaml_parser_t *parser,
+        const yaml_event_t *event,
+        const ymx_path_segment_t *segments, size_t num_segments) {
+    size_t i;
+    for (i=0; i<num_segments; i++) {
+        const ymx_path_segment_t *segment = segments + i;
+        if (event->type == YAML_MAPPING_START_EVENT) {
+            while (1) {
+                event = ymx_parse(parser);
+                if (event->type == YAML_MAPPING_END_EVENT)
+                    return NULL;
+                int match = (event->type == YAML_SCALAR_EVENT
+                        && event->data.scalar.length == segment->length
+                        && memcmp(event->data.scalar.value, segment->name,
+                            segment->length) == 0);
+                ymx_skip_node(parser, event);
+                event = ymx_parse(parser);
+                if (match)
+                    break;
+                ymx_skip_node(parser, event);
+            }
+        } else if (event->type == YAML_SEQUENCE_START_EVENT
+                && segment->index) {
+            size_t k;
+            for (k=1; ; k++) {
+                event = ymx_parse(parser);
+                if (event->type == YAML_SEQUENCE_END_EVENT)
+                    return NULL;
+                if (k == segment->index)
+                    break;
+                ymx_skip_node(parser, event);
+            }
+        } else {
+            return NULL;
+        }
+    }
+    return event->type == YAML_SCALAR_EVENT ? event : NULL;
+}
+
+mxArray *ymx_column_number_string(double number) {
+    if (mxIsNaN(number))
+        return mxCreateString(".nan");
+    if (mxIsInf(number))
+        return mxCreateString(number > 0 ? ".inf" : "-.inf");
+
+    char buffer[YMX_NUMBER_STRING_SIZE];
+    ymx_format_double(buffer, number);
+    return mxCreateString(buffer);
+}
+
+/* Create an N-by-1 Matlab array from a column. Bool columns without
+ * missing values become logical arrays; number columns, and bool columns
+ * with missing values, become double arrays with NaN for missing values;
+ * string (or mixed) columns become cellstrs with '' for missing values.
+ * Columns with only missing values are double NaN. The column's storage
+ * is handed over where possible, so the column should be deleted, not
+ * reused, afterward.
+ */
+mxArray *ymx_column_to_array(ymx_column_t *column) {
+    size_t n = column->count;
+    size_t i;
+    mxArray *array;
+
+    switch (column->kind) {
+        case YMX_COLUMN_KIND_STRING:
+            array = mxCreateCellMatrix(n, 1);
+            for (i=0; i<n; i++) {
+                mxSetCell(array, i, column->strings[i]);
+            }
+            break;
+        case YMX_COLUMN_KIND_BOOL:
+            if (!column->num_missing) {
+                array = mxCreateLogicalMatrix(n, 1);
+                mxLogical *logicals = mxGetLogicals(array);
+                for (i=0; i<n; i++) {
+                    logicals[i] = (column->numbers[i] != 0);
+                }
+                break;
+            }
+            /* Fall through - with missing values, bools become doubles */
+        default:
+            array = mxCreateDoubleMatrix(0, 0, mxREAL);
+            if (n) {
+                mxSetData(array, column->numbers);
+                mxSetM(array, n);
+                mxSetN(array, 1);
+                column->numbers = NULL;
+            } else {
+                mxSetM(array, 0);
+                mxSetN(array, 1);
+            }
+    }
+    return array;
+}
@@ -0,0 +1,832 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * This file implements "simple" composition of native Matlab data
+ * straight into libyaml events, following the same rules as
+ * yaml_simple_compose.m: char arrays become !!str scalars, numeric and
+ * logical scalars become !!float and !!bool scalars, other numeric and
+ * logical arrays become flow sequences, cell arrays become sequences,
+ * scalar structs become mappings, and empty arrays become !!null. Going
+ * straight to events avoids building (and then validating) the node
+ * struct tree that ymx_dump_stream consumes.
+ *
+ * Unlike yaml_simple_compose, uint8 arrays of more than one element are
+ * raw bytes rather than numbers, and become a single base64 !!binary
+ * block scalar. With the YMX_COMPOSE_BINARY_NUMERIC flag, other real
+ * numeric arrays are composed the same way, as the little-endian bytes of
+ * their elements (their class and size are not recorded).
+ *
+ * To keep class and size, the YMX_COMPOSE_TYPED_ARRAYS flag composes
+ * numeric and logical arrays (all but double and logical scalars) as
+ * mappings with the local tag !matlab/array:
+ *     !matlab/array
+ *     class: single
+ *     size: [4000, 4000]
+ *     data: !!binary |
+ *       ...
+ * where data holds the elements (the real parts, for complex arrays) as
+ * by YMX_COMPOSE_BINARY_NUMERIC, and a complex array has its imaginary
+ * parts in a further !!binary value, imag. Complex arrays have no other
+ * representation, so are always composed this way.
+ *
+ * Sparse matrices are always composed as !matlab/sparse mappings, read
+ * straight from their jc, ir and value arrays:
+ *     !matlab/sparse
+ *     class: double
+ *     size: [1000000, 1000000]
+ *     nnz: 1000000
+ *     jc: [...]
+ *     ir: [...]
+ *     data: [...]
+ * jc and ir are the zero-based column pointers and row indices, as in the
+ * MEX API. The parts are flow sequences, or with YMX_COMPOSE_BINARY_NUMERIC
+ * or YMX_COMPOSE_TYPED_ARRAYS, !!binary (of uint64 indices).
+ *
+ * Struct arrays and tables are dumped as block sequences of mappings. The
+ * keys of such a sequence are prepared once, from the field table (or a
+ * table's variable names), and reused for every row; table variables are
+ * taken from the table one by one, without converting it to a struct,
+ * and read row by row straight from their column data.
+ *
+ * libyaml takes ownership of (and frees) the strings of every event it
+ * emits, so each key event still gets its own copy of the key; what is
+ * saved is everything that leads up to that copy.
+ *
+ * ymx_compose_stream first offers the data to the fast emitter in
+ * yaml_mex_emitter.c, which writes the same text without libyaml for
+ * everything but the cases above that need it; only what it declines is
+ * composed here.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+/* A mapping key, prepared once for emitting many times */
+typedef struct ymx_key_s {
+    yaml_char_t *value;
+    size_t length;
+} ymx_key_t;
+
+typedef enum ymx_compose_frame_kind_e {
+    YMX_COMPOSE_FRAME_CELL,
+    YMX_COMPOSE_FRAME_STRUCT,
+    YMX_COMPOSE_FRAME_TABLE
+} ymx_compose_frame_kind_t;
+
+/* A cell array, struct or table being composed by ymx_compose_node, and
+ * where it is up to: element (or table row) ind, and within it the field
+ * (or variable) before field, -1 before the element's mapping has started.
+ * Of a table's cell variable, items col to num_cols are still to come. */
+typedef struct ymx_compose_frame_s {
+    ymx_compose_frame_kind_t kind;
+    const mxArray *data;
+    mwSize size;
+    mwIndex ind;
+    int field;
+    int num_keys;
+    ymx_key_t *keys;
+    mxArray **columns;    /* A table's variables */
+    mwSize num_cols;
+    mwIndex col;
+    int in_sequence;      /* In a multi-column cell variable's sequence */
+    mxArray *row;         /* A row of a table's char variable */
+    mwSize row_size;      /* How many characters row has room for */
+} ymx_compose_frame_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+yaml_char_t *YMX_COMPOSE_STR_TAG   = (yaml_char_t *)"tag:yaml.org,2002:str";
+yaml_char_t *YMX_COMPOSE_FLOAT_TAG = (yaml_char_t *)"tag:yaml.org,2002:float";
+yaml_char_t *YMX_COMPOSE_BOOL_TAG  = (yaml_char_t *)"tag:yaml.org,2002:bool";
+yaml_char_t *YMX_COMPOSE_NULL_TAG  = (yaml_char_t *)"tag:yaml.org,2002:null";
+yaml_char_t *YMX_COMPOSE_BINARY_TAG =
+        (yaml_char_t *)"tag:yaml.org,2002:binary";
+yaml_char_t *YMX_COMPOSE_ARRAY_TAG = (yaml_char_t *)"!matlab/array";
+yaml_char_t *YMX_COMPOSE_SPARSE_TAG = (yaml_char_t *)"!matlab/sparse";
+yaml_char_t *YMX_COMPOSE_SEQ_TAG   = (yaml_char_t *)"tag:yaml.org,2002:seq";
+yaml_char_t *YMX_COMPOSE_MAP_TAG   = (yaml_char_t *)"tag:yaml.org,2002:map";
+
+const size_t COMPOSE_FRAMES_INITIAL_SIZE = 32;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+void ymx_compose_node(yaml_emitter_t *emitter, const mxArray *data,
+        int flags);
+void ymx_compose_string(yaml_emitter_t *emitter, const mxArray *data);
+void ymx_compose_numeric(yaml_emitter_t *emitter, const mxArray *data,
+        int flags);
+void ymx_compose_typed_array(yaml_emitter_t *emitter, const mxArray *data);
+void ymx_compose_sparse(yaml_emitter_t *emitter, const mxArray *data,
+        int flags);
+void ymx_compose_indices(
+        yaml_emitter_t *emitter,
+        const mwIndex *indices,
+        size_t count,
+        int binary );
+void ymx_compose_binary(
+        yaml_emitter_t *emitter,
+        const void *values,
+        size_t num_elements,
+        size_t element_size );
+void ymx_compose_size(yaml_emitter_t *emitter, const mxArray *data);
+void ymx_compose_numeric_element(
+        yaml_emitter_t *emitter,
+        const mxArray *data,
+        mwIndex ind );
+void ymx_compose_frame_start(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame,
+        const mxArray *data );
+int ymx_compose_frame_next(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame,
+        const mxArray **item );
+void ymx_compose_frame_end(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame );
+void ymx_compose_table_start(
+        ymx_compose_frame_t *frame,
+        const mxArray *data );
+int ymx_compose_table_next(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame,
+        const mxArray **item );
+
+void ymx_emit_scalar(
+        yaml_emitter_t *emitter,
+        yaml_char_t *tag,
+        yaml_char_t *value,
+        size_t length,
+        int quoted );
+void ymx_emit_sequence_start(yaml_emitter_t *emitter,
+        yaml_sequence_style_t style);
+void ymx_emit_sequence_end(yaml_emitter_t *emitter);
+void ymx_emit_mapping_start(yaml_emitter_t *emitter);
+void ymx_emit_mapping_end(yaml_emitter_t *emitter);
+void ymx_emit_key(yaml_emitter_t *emitter, const ymx_key_t *key);
+
+ymx_key_t *ymx_prepare_keys(const mxArray *data);
+ymx_key_t *ymx_prepare_name_keys(const mxArray *names);
+void ymx_delete_keys(ymx_key_t *keys, int num_keys);
+
+
+/*
+ * Main interface function
+ *************************************************************************/
+
+/* Compose Matlab data as a single-document YAML stream, returned as a
+ * string. The document start and end are implicit. flags are any of the
+ * ymx_compose_flag_t values, or'd together. */
+mxArray *ymx_compose_stream(const mxArray *data, int flags) {
+    ymx_debug_msg("Entering ymx_compose_stream\n");
+    ymx_buffer_t buffer;
+    ymx_buffer_init(&buffer, YMX_BUFFER_CHUNK_SIZE);
+
+    if (!ymx_fast_compose_stream(&buffer, data, flags)) {
+        yaml_emitter_t *emitter = ymx_init_emitter();
+        yaml_emitter_set_output(emitter, ymx_buffer_write_handler, &buffer);
+
+        yaml_event_t event;
+        if (!yaml_stream_start_event_initialize(&event, YAML_ANY_ENCODING))
+            ymx_error("Couldn't initialize event");
+        ymx_emit(emitter, &event);
+
+        ymx_compose_document(emitter, data, 1, flags);
+
+        yaml_stream_end_event_initialize(&event);
+        ymx_emit(emitter, &event);
+
+        yaml_emitter_delete(emitter);
+    }
+
+    mxArray *stream = mxCreateString(ymx_buffer_as_string(&buffer));
+    ymx_buffer_delete(&buffer);
+    ymx_debug_msg("Exiting ymx_compose_stream\n");
+    return stream;
+}
+
+
+/*
+ * Functions for composing
+ *************************************************************************/
+
+/* Emit data as one document, with an implicit end and, if start_implicit
+ * is nonzero, an implicit start. */
+void ymx_compose_document(
+        yaml_emitter_t *emitter,
+        const mxArray *data,
+        int start_implicit,
+        int flags ) {
+    yaml_event_t event;
+    yaml_document_start_event_initialize(&event, NULL, NULL, NULL,
+            start_implicit);
+    ymx_emit(emitter, &event);
+
+    ymx_compose_node(emitter, data, flags);
+
+    yaml_document_end_event_initialize(&event, 1);
+    ymx_emit(emitter, &event);
+}
+
+/* Emit data and everything in it. Cell arrays, structs and tables still
+ * open are kept on a stack of frames rather than composed by recursion,
+ * so that data of any depth can be dumped; each frame hands out its
+ * items one at a time, emitting the events that come between them.
+ */
+void ymx_compose_node(yaml_emitter_t *emitter, const mxArray *data,
+        int flags) {
+    size_t frames_size = COMPOSE_FRAMES_INITIAL_SIZE;
+    ymx_compose_frame_t *frames = mxMalloc(frames_size
+            * sizeof(ymx_compose_frame_t));
+    size_t num_frames = 0;
+
+    const mxArray *item = data;
+    while (1) {
+        if (!item) {
+            /* Unset cells and fields are empty matrices */
+            ymx_emit_scalar(emitter, YMX_COMPOSE_NULL_TAG,
+                    (yaml_char_t *)"", 0, 0);
+        } else if (mxIsChar(item)) {
+            ymx_compose_string(emitter, item);
+        } else if (mxIsCell(item) || mxIsClass(item, "table")
+                || (mxIsStruct(item) && !mxIsEmpty(item))) {
+            if (num_frames == frames_size) {
+                frames_size *= 2;
+                frames = mxRealloc(frames,
+                        frames_size * sizeof(ymx_compose_frame_t));
+            }
+            ymx_compose_frame_start(emitter, frames + num_frames++, item);
+        } else if (mxIsEmpty(item)) {
+            ymx_emit_scalar(emitter, YMX_COMPOSE_NULL_TAG,
+                    (yaml_char_t *)"", 0, 0);
+        } else if (mxIsNumeric(item) || mxIsLogical(item)) {
+            ymx_compose_numeric(emitter, item, flags);
+        } else {
+            ymx_error("Can't compose this datatype.");
+        }
+
+        while (num_frames && !ymx_compose_frame_next(emitter,
+                frames + num_frames - 1, &item)) {
+            num_frames--;
+            ymx_compose_frame_end(emitter, frames + num_frames);
+        }
+        if (!num_frames)
+            break;
+    }
+    mxFree(frames);
+}
+
+void ymx_compose_string(yaml_emitter_t *emitter, const mxArray *data) {
+    if (!mxIsEmpty(data) && (mxGetNumberOfDimensions(data) != 2
+            || mxGetM(data) != 1))
+        ymx_error("Can't compose a char array with more than one row.");
+
+    char *value = mxArrayToString(data);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)value, strlen(value), 1);
+    mxFree(value);
+}
+
+/* Sparse matrices become !matlab/sparse mappings; complex arrays (and,
+ * with YMX_COMPOSE_TYPED_ARRAYS, most others) become !matlab/array
+ * mappings; other numeric and logical scalars become
+ * single scalars; other uint8 arrays (or, with YMX_COMPOSE_BINARY_NUMERIC,
+ * any other numeric array) become !!binary scalars; and any other numeric
+ * or logical array becomes a flow sequence of its elements in
+ * column-major order. */
+void ymx_compose_numeric(yaml_emitter_t *emitter, const mxArray *data,
+        int flags) {
+    int is_scalar = (mxGetNumberOfElements(data) == 1);
+    if (mxIsSparse(data)) {
+        if (mxIsComplex(data))
+            ymx_error("Can't compose complex sparse data.");
+        ymx_compose_sparse(emitter, data, flags);
+        return;
+    }
+
+    if (mxIsComplex(data) || ((flags & YMX_COMPOSE_TYPED_ARRAYS)
+            && !(is_scalar && (mxIsDouble(data) || mxIsLogical(data))))) {
+        ymx_compose_typed_array(emitter, data);
+        return;
+    }
+
+    if (is_scalar) {
+        ymx_compose_numeric_element(emitter, data, 0);
+        return;
+    }
+
+    if (mxIsUint8(data)
+            || (mxIsNumeric(data) && (flags & YMX_COMPOSE_BINARY_NUMERIC))) {
+        ymx_compose_binary(emitter, mxGetData(data),
+                mxGetNumberOfElements(data), mxGetElementSize(data));
+        return;
+    }
+
+    ymx_emit_sequence_start(emitter, YAML_FLOW_SEQUENCE_STYLE);
+    mwSize size = mxGetNumberOfElements(data);
+    mwIndex ind;
+    for (ind=0; ind<size; ind++) {
+        ymx_compose_numeric_element(emitter, data, ind);
+    }
+    ymx_emit_sequence_end(emitter);
+}
+
+/* Emit a full numeric or logical array as a !matlab/array mapping */
+void ymx_compose_typed_array(yaml_emitter_t *emitter, const mxArray *data) {
+    yaml_event_t event;
+    if (!yaml_mapping_start_event_initialize(&event, NULL,
+            YMX_COMPOSE_ARRAY_TAG, 0, YAML_BLOCK_MAPPING_STYLE))
+        ymx_error("Couldn't initialize event");
+    ymx_emit(emitter, &event);
+
+    /* The keys and class names are all plain words that resolve to
+     * strings, so needn't be quoted */
+    const char *class_name = mxGetClassName(data);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"class", 5, 0);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)class_name, strlen(class_name), 0);
+
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"size", 4, 0);
+    ymx_compose_size(emitter, data);
+
+    size_t num_elements = mxGetNumberOfElements(data);
+    size_t element_size = mxGetElementSize(data);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"data", 4, 0);
+    ymx_compose_binary(emitter, mxGetData(data),
+            num_elements, element_size);
+    if (mxIsComplex(data)) {
+        ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+                (yaml_char_t *)"imag", 4, 0);
+        ymx_compose_binary(emitter, mxGetImagData(data),
+                num_elements, element_size);
+    }
+
+    ymx_emit_mapping_end(emitter);
+}
+
+/* Emit a sparse double or logical matrix as a !matlab/sparse mapping */
+void ymx_compose_sparse(yaml_emitter_t *emitter, const mxArray *data,
+        int flags) {
+    int binary = (flags
+            & (YMX_COMPOSE_BINARY_NUMERIC | YMX_COMPOSE_TYPED_ARRAYS)) != 0;
+    mwIndex *jc = mxGetJc(data);
+    mwSize num_cols = mxGetN(data);
+    size_t nnz = jc[num_cols];
+
+    yaml_event_t event;
+    if (!yaml_mapping_start_event_initialize(&event, NULL,
+            YMX_COMPOSE_SPARSE_TAG, 0, YAML_BLOCK_MAPPING_STYLE))
+        ymx_error("Couldn't initialize event");
+    ymx_emit(emitter, &event);
+
+    const char *class_name = mxGetClassName(data);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"class", 5, 0);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)class_name, strlen(class_name), 0);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"size", 4, 0);
+    ymx_compose_size(emitter, data);
+
+    char buffer[YMX_NUMBER_STRING_SIZE];
+    size_t length = ymx_format_uint(buffer, nnz);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"nnz", 3, 0);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_FLOAT_TAG,
+            (yaml_char_t *)buffer, length, 0);
+
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"jc", 2, 0);
+    ymx_compose_indices(emitter, jc, num_cols + 1, binary);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"ir", 2, 0);
+    ymx_compose_indices(emitter, mxGetIr(data), nnz, binary);
+
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            (yaml_char_t *)"data", 4, 0);
+    if (binary) {
+        ymx_compose_binary(emitter, mxGetData(data),
+                nnz, mxGetElementSize(data));
+    } else {
+        ymx_emit_sequence_start(emitter, YAML_FLOW_SEQUENCE_STYLE);
+        size_t k;
+        for (k=0; k<nnz; k++) {
+            ymx_compose_numeric_element(emitter, data, k);
+        }
+        ymx_emit_sequence_end(emitter);
+    }
+
+    ymx_emit_mapping_end(emitter);
+}
+
+/* Emit sparse matrix indices as a flow sequence, or as !!binary of their
+ * values as uint64 */
+void ymx_compose_indices(
+        yaml_emitter_t *emitter,
+        const mwIndex *indices,
+        size_t count,
+        int binary ) {
+    size_t i;
+    if (binary) {
+        if (sizeof(mwIndex) == sizeof(uint64_T)) {
+            ymx_compose_binary(emitter, indices, count, sizeof(uint64_T));
+        } else {
+            uint64_T *wide = mxMalloc((count ? count : 1) * sizeof(uint64_T));
+            for (i=0; i<count; i++) {
+                wide[i] = indices[i];
+            }
+            ymx_compose_binary(emitter, wide, count, sizeof(uint64_T));
+            mxFree(wide);
+        }
+        return;
+    }
+
+    ymx_emit_sequence_start(emitter, YAML_FLOW_SEQUENCE_STYLE);
+    for (i=0; i<count; i++) {
+        char buffer[YMX_NUMBER_STRING_SIZE];
+        size_t length = ymx_format_uint(buffer, indices[i]);
+        ymx_emit_scalar(emitter, YMX_COMPOSE_FLOAT_TAG,
+                (yaml_char_t *)buffer, length, 0);
+    }
+    ymx_emit_sequence_end(emitter);
+}
+
+/* Emit the dimensions of an array as a flow sequence */
+void ymx_compose_size(yaml_emitter_t *emitter, const mxArray *data) {
+    ymx_emit_sequence_start(emitter, YAML_FLOW_SEQUENCE_STYLE);
+    mwSize num_dims = mxGetNumberOfDimensions(data);
+    const mwSize *dims = mxGetDimensions(data);
+    mwSize dim;
+    for (dim=0; dim<num_dims; dim++) {
+        char buffer[YMX_NUMBER_STRING_SIZE];
+        size_t length = ymx_format_uint(buffer, dims[dim]);
+        ymx_emit_scalar(emitter, YMX_COMPOSE_FLOAT_TAG,
+                (yaml_char_t *)buffer, length, 0);
+    }
+    ymx_emit_sequence_end(emitter);
+}
+
+/* Emit the little-endian bytes of num_elements elements of element_size
+ * bytes each as one !!binary literal block */
+void ymx_compose_binary(
+        yaml_emitter_t *emitter,
+        const void *values,
+        size_t num_elements,
+        size_t element_size ) {
+    size_t length;
+    char *text = ymx_base64_encode_elements(values,
+            num_elements, element_size, &length);
+
+    yaml_event_t event;
+    if (!yaml_scalar_event_initialize(&event, NULL, YMX_COMPOSE_BINARY_TAG,
+            (yaml_char_t *)text, length, 0, 0, YAML_LITERAL_SCALAR_STYLE))
+        ymx_error("Couldn't initialize event");
+    mxFree(text);
+    ymx_emit(emitter, &event);
+}
+
+/* Emit element ind of a numeric or logical array (or of the nonzeros of a
+ * sparse array), formatted straight from its data. */
+void ymx_compose_numeric_element(
+        yaml_emitter_t *emitter,
+        const mxArray *data,
+        mwIndex ind ) {
+    if (mxIsLogical(data)) {
+        if (mxGetLogicals(data)[ind])
+            ymx_emit_scalar(emitter, YMX_COMPOSE_BOOL_TAG,
+                    (yaml_char_t *)"true", 4, 0);
+        else
+            ymx_emit_scalar(emitter, YMX_COMPOSE_BOOL_TAG,
+                    (yaml_char_t *)"false", 5, 0);
+        return;
+    }
+
+    char buffer[YMX_NUMBER_STRING_SIZE];
+    size_t length = ymx_format_numeric(buffer, data, ind);
+    ymx_emit_scalar(emitter, YMX_COMPOSE_FLOAT_TAG,
+            (yaml_char_t *)buffer, length, 0);
+}
+
+/* Begin a frame for a cell array, a (nonempty) struct or a table. Cell
+ * arrays become sequences; scalar structs become mappings; struct arrays
+ * become block sequences of mappings, all sharing one set of prepared
+ * keys. Tables are block sequences of mappings too, one per row, keyed by
+ * the variable names; see ymx_compose_table_next.
+ */
+void ymx_compose_frame_start(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame,
+        const mxArray *data ) {
+    memset(frame, 0, sizeof(ymx_compose_frame_t));
+    frame->data = data;
+    frame->field = -1;
+    if (mxIsCell(data)) {
+        frame->kind = YMX_COMPOSE_FRAME_CELL;
+        frame->size = mxGetNumberOfElements(data);
+        ymx_emit_sequence_start(emitter, YAML_ANY_SEQUENCE_STYLE);
+    } else if (mxIsStruct(data)) {
+        frame->kind = YMX_COMPOSE_FRAME_STRUCT;
+        frame->size = mxGetNumberOfElements(data);
+        frame->num_keys = mxGetNumberOfFields(data);
+        frame->keys = ymx_prepare_keys(data);
+        if (frame->size != 1)
+            ymx_emit_sequence_start(emitter, YAML_BLOCK_SEQUENCE_STYLE);
+    } else {
+        frame->kind = YMX_COMPOSE_FRAME_TABLE;
+        ymx_compose_table_start(frame, data);
+        ymx_emit_sequence_start(emitter, YAML_BLOCK_SEQUENCE_STYLE);
+    }
+}
+
+/* Emit what comes before the next item of a frame's data, and set *item to
+ * it (NULL for an unset cell or field). Returns 0 instead once the frame
+ * has no more items. */
+int ymx_compose_frame_next(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame,
+        const mxArray **item ) {
+    switch (frame->kind) {
+        case YMX_COMPOSE_FRAME_CELL:
+            if (frame->ind == frame->size)
+                return 0;
+            *item = mxGetCell(frame->data, frame->ind++);
+            return 1;
+        case YMX_COMPOSE_FRAME_STRUCT:
+            while (frame->ind < frame->size) {
+                if (frame->field < 0) {
+                    ymx_emit_mapping_start(emitter);
+                    frame->field = 0;
+                }
+                if (frame->field < frame->num_keys) {
+                    ymx_emit_key(emitter, frame->keys + frame->field);
+                    *item = mxGetFieldByNumber(frame->data, frame->ind,
+                            frame->field++);
+                    return 1;
+                }
+                ymx_emit_mapping_end(emitter);
+                frame->field = -1;
+                frame->ind++;
+            }
+            return 0;
+        default:
+            return ymx_compose_table_next(emitter, frame, item);
+    }
+}
+
+void ymx_compose_frame_end(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame ) {
+    int var;
+    switch (frame->kind) {
+        case YMX_COMPOSE_FRAME_CELL:
+            ymx_emit_sequence_end(emitter);
+            break;
+        case YMX_COMPOSE_FRAME_STRUCT:
+            if (frame->size != 1)
+                ymx_emit_sequence_end(emitter);
+            ymx_delete_keys(frame->keys, frame->num_keys);
+            break;
+        default:
+            ymx_emit_sequence_end(emitter);
+            if (frame->row)
+                mxDestroyArray(frame->row);
+            for (var=0; var<frame->num_keys; var++) {
+                mxDestroyArray(frame->columns[var]);
+            }
+            mxFree(frame->columns);
+            ymx_delete_keys(frame->keys, frame->num_keys);
+    }
+}
+
+/* Read a table's variable names and variables into its frame, checking
+ * that each variable is a column (or columns) that can be composed a row
+ * at a time. Each variable is taken from the table as it is, rather than
+ * converting the whole table to a struct first. */
+void ymx_compose_table_start(
+        ymx_compose_frame_t *frame,
+        const mxArray *data ) {
+    mxArray *props = mxGetProperty(data, 0, "Properties");
+    const mxArray *names = NULL;
+    mxArray *names_copy = NULL;
+    if (props && mxIsStruct(props))
+        names = mxGetField(props, 0, "VariableNames");
+    else if (props)
+        names = names_copy = mxGetProperty(props, 0, "VariableNames");
+    if (!names || !mxIsCell(names))
+        ymx_error("Can't read the variable names of this table.");
+
+    mxArray *rhs[2];
+    mxArray *height_arr;
+    rhs[0] = (mxArray *)data;
+    mexCallMATLAB(1, &height_arr, 1, rhs, "height");
+    frame->size = (mwSize)mxGetScalar(height_arr);
+    mxDestroyArray(height_arr);
+
+    frame->num_keys = (int)mxGetNumberOfElements(names);
+    frame->keys = ymx_prepare_name_keys(names);
+    frame->columns = mxCalloc(frame->num_keys + 1, sizeof(mxArray *));
+
+    int var;
+    for (var=0; var<frame->num_keys; var++) {
+        rhs[1] = mxGetCell(names, var);
+        mexCallMATLAB(1, frame->columns + var, 2, rhs, "getfield");
+        const mxArray *column = frame->columns[var];
+        if ( mxGetM(column) != frame->size
+                || mxGetNumberOfDimensions(column) != 2
+                || mxIsSparse(column) || mxIsComplex(column)
+                || !(mxIsNumeric(column) || mxIsLogical(column)
+                    || mxIsCell(column) || mxIsChar(column)) )
+            ymx_error("Can't compose this table variable.");
+    }
+    if (names_copy)
+        mxDestroyArray(names_copy);
+    mxDestroyArray(props);
+}
+
+/* Emit a table row by row, up to the next item of a cell variable.
+ * Numeric and logical variables are read straight from their column
+ * data: a single-column variable gives a scalar per row, and a
+ * multi-column one a flow sequence per row. Rows of cell variables are
+ * items like any cell element (a sequence of them, for a multi-column
+ * variable), and rows of char matrix variables are strings.
+ */
+int ymx_compose_table_next(
+        yaml_emitter_t *emitter,
+        ymx_compose_frame_t *frame,
+        const mxArray **item ) {
+    mwSize num_rows = frame->size;
+    mwIndex row = frame->ind;
+    mwIndex col;
+    while (1) {
+        if (frame->col < frame->num_cols) {
+            const mxArray *column = frame->columns[frame->field - 1];
+            *item = mxGetCell(column, row + frame->col*num_rows);
+            frame->col++;
+            return 1;
+        }
+        if (frame->in_sequence) {
+            ymx_emit_sequence_end(emitter);
+            frame->in_sequence = 0;
+        }
+        frame->num_cols = 0;
+        frame->col = 0;
+
+        if (row == num_rows)
+            return 0;
+        if (frame->field < 0) {
+            ymx_emit_mapping_start(emitter);
+            frame->field = 0;
+        }
+        if (frame->field == frame->num_keys) {
+            ymx_emit_mapping_end(emitter);
+            frame->field = -1;
+            row = ++frame->ind;
+            continue;
+        }
+
+        ymx_emit_key(emitter, frame->keys + frame->field);
+        const mxArray *column = frame->columns[frame->field++];
+        mwSize num_cols = mxGetN(column);
+
+        if (mxIsCell(column)) {
+            if (num_cols != 1) {
+                ymx_emit_sequence_start(emitter, YAML_ANY_SEQUENCE_STYLE);
+                frame->in_sequence = 1;
+            }
+            frame->num_cols = num_cols;
+        } else if (mxIsChar(column)) {
+            /* A row of a char matrix is its characters taken with a
+             * stride, copied into a char row vector of their own so that
+             * they are converted to UTF-8 like any other string. */
+            if (!frame->row || num_cols > frame->row_size) {
+                mwSize dims[2];
+                dims[0] = 1;
+                dims[1] = num_cols;
+                if (frame->row)
+                    mxDestroyArray(frame->row);
+                frame->row = mxCreateCharArray(2, dims);
+                frame->row_size = num_cols;
+            }
+            mxSetN(frame->row, num_cols);
+            const mxChar *chars = mxGetChars(column);
+            mxChar *row_chars = mxGetChars(frame->row);
+            for (col=0; col<num_cols; col++) {
+                row_chars[col] = chars[row + col*num_rows];
+            }
+            ymx_compose_string(emitter, frame->row);
+        } else {
+            if (num_cols != 1)
+                ymx_emit_sequence_start(emitter,
+                        YAML_FLOW_SEQUENCE_STYLE);
+            for (col=0; col<num_cols; col++) {
+                ymx_compose_numeric_element(emitter, column,
+                        row + col*num_rows);
+            }
+            if (num_cols != 1)
+                ymx_emit_sequence_end(emitter);
+        }
+    }
+}
+
+
+/*
+ * Event helpers
+ *************************************************************************/
+
+/* Emit a scalar with an implicit tag; quoted selects whether the tag is
+ * implied by a quoted style (as for strings) or a plain style. */
+void ymx_emit_scalar(
+        yaml_emitter_t *emitter,
+        yaml_char_t *tag,
+        yaml_char_t *value,
+        size_t length,
+        int quoted ) {
+    yaml_event_t event;
+    if (!yaml_scalar_event_initialize(&event, NULL, tag, value, length,
+            !quoted, quoted, YAML_ANY_SCALAR_STYLE))
+        ymx_error("Couldn't initialize event");
+    ymx_emit(emitter, &event);
+}
+
+void ymx_emit_sequence_start(yaml_emitter_t *emitter,
+        yaml_sequence_style_t style) {
+    yaml_event_t event;
+    if (!yaml_sequence_start_event_initialize(&event, NULL,
+            YMX_COMPOSE_SEQ_TAG, 1, style))
+        ymx_error("Couldn't initialize event");
+    ymx_emit(emitter, &event);
+}
+
+void ymx_emit_sequence_end(yaml_emitter_t *emitter) {
+    yaml_event_t event;
+    yaml_sequence_end_event_initialize(&event);
+    ymx_emit(emitter, &event);
+}
+
+void ymx_emit_mapping_start(yaml_emitter_t *emitter) {
+    yaml_event_t event;
+    if (!yaml_mapping_start_event_initialize(&event, NULL,
+            YMX_COMPOSE_MAP_TAG, 1, YAML_ANY_MAPPING_STYLE))
+        ymx_error("Couldn't initialize event");
+    ymx_emit(emitter, &event);
+}
+
+void ymx_emit_mapping_end(yaml_emitter_t *emitter) {
+    yaml_event_t event;
+    yaml_mapping_end_event_initialize(&event);
+    ymx_emit(emitter, &event);
+}
+
+void ymx_emit_key(yaml_emitter_t *emitter, const ymx_key_t *key) {
+    ymx_emit_scalar(emitter, YMX_COMPOSE_STR_TAG,
+            key->value, key->length, 1);
+}
+
+/* Prepare the field names of a struct as mapping keys */
+ymx_key_t *ymx_prepare_keys(const mxArray *data) {
+    int num_fields = mxGetNumberOfFields(data);
+    ymx_key_t *keys = mxCalloc(num_fields + 1, sizeof(ymx_key_t));
+    int field;
+    for (field=0; field<num_fields; field++) {
+        const char *name = mxGetFieldNameByNumber(data, field);
+        keys[field].length = strlen(name);
+        keys[field].value = mxMalloc(keys[field].length + 1);
+        memcpy(keys[field].value, name, keys[field].length + 1);
+    }
+    return keys;
+}
+
+/* Prepare the variable names of a table, a cell array of strings, as
+ * mapping keys */
+ymx_key_t *ymx_prepare_name_keys(const mxArray *names) {
+    int num_names = (int)mxGetNumberOfElements(names);
+    ymx_key_t *keys = mxCalloc(num_names + 1, sizeof(ymx_key_t));
+    int name;
+    for (name=0; name<num_names; name++) {
+        const mxArray *str = mxGetCell(names, name);
+        if (!str || !mxIsChar(str))
+            ymx_error("Can't read the variable names of this table.");
+        keys[name].value = (yaml_char_t *)mxArrayToString(str);
+        keys[name].length = strlen((char *)keys[name].value);
+    }
+    return keys;
+}
+
+void ymx_delete_keys(ymx_key_t *keys, int num_keys) {
+    int field;
+    for (field=0; field<num_keys; field++) {
+        mxFree(keys[field].value);
+    }
+    mxFree(keys);
+}
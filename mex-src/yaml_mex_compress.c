@@ -0,0 +1,404 @@
+#include "yaml_mex_util.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef YMX_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+/* NOTES
+ *
+ * Compressed files are read and written as streams, through libyaml's
+ * read and write handlers, so neither the compressed nor the decompressed
+ * text of a file is ever held in memory all at once: only the codec's
+ * window and a block of input or output.
+ *     data = yaml_mex('load_file', 'log.yaml.gz', struct('simple', true));
+ *     h = yaml_mex('writer_open', 'log.yaml.zst');
+ * The codec is chosen by the file's extension (".gz" for gzip, ".zst" for
+ * zstd, anything else for none), unless a 'compression' option of 'gzip',
+ * 'zstd', 'none' or 'auto' says otherwise.
+ *
+ * gzip goes through zlib's gzFile functions, which also read files that
+ * aren't compressed at all, and files of several gzip members, as
+ * appending to a .gz writer makes. zstd needs libzstd, and is only built
+ * in if YMX_WITH_ZSTD is defined (mex -DYMX_WITH_ZSTD ... -lzstd);
+ * without it, asking for zstd is an error. Appending to a .zst writer
+ * adds a frame, which readers take in turn like gzip members.
+ *
+ * A ymx_cfile_t is allocated with malloc rather than mxMalloc, so that
+ * a writer's can persist between calls, and a load's survives an error
+ * until the next ymx_persistent_cleanup closes it. It doesn't touch the
+ * Matlab API. The byte limit on loads applies to the decompressed text
+ * (see ymx_set_file_input), so a small file can't expand without bound.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+struct ymx_cfile_s {
+    ymx_codec_t codec;
+    FILE *file;          /* Uncompressed and zstd files */
+    gzFile gz;           /* gzip files */
+#ifdef YMX_WITH_ZSTD
+    ZSTD_DStream *dstream;
+    ZSTD_CStream *cstream;
+    ZSTD_inBuffer in;    /* Compressed input not yet decompressed */
+    size_t frame_left;   /* From the last decompress; 0 between frames */
+    void *buffer;        /* Compressed input or output */
+    size_t buffer_size;
+#endif
+    const char *problem; /* Why a read or write failed, if one has */
+};
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const unsigned GZIP_BUFFER_SIZE = 131072;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+int ymx_has_extension(const char *path, const char *extension);
+#ifdef YMX_WITH_ZSTD
+size_t ymx_zstd_read(ymx_cfile_t *file, void *buffer, size_t size);
+int ymx_zstd_write(ymx_cfile_t *file, const void *data, size_t size,
+        ZSTD_EndDirective mode);
+#endif
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Load the YAML file at path, decompressing it on the way if need be.
+ * Returns a document array as from ymx_load_stream, or with the 'simple'
+ * option, data as from ymx_construct_stream. options may be NULL, or a
+ * struct with any of these fields:
+ *         simple: If true, documents are constructed as native data, as by
+ *                 yaml_mex('load_simple'); otherwise they are loaded as by
+ *                 yaml_mex('load'). Default false.
+ *    compression: 'auto' (by the file's extension), 'gzip', 'zstd' or
+ *                 'none'. Default 'auto'.
+ */
+mxArray *ymx_load_file(const mxArray *filename, const mxArray *options) {
+    int simple = 0;
+    const mxArray *compression = NULL;
+    if (options && !mxIsEmpty(options)) {
+        if (!mxIsStruct(options) || mxGetNumberOfElements(options) != 1)
+            ymx_error("Load options must be a scalar struct");
+        mxArray *simple_arr = mxGetField(options, 0, "simple");
+        if (simple_arr) {
+            if (!(mxIsLogical(simple_arr) || mxIsNumeric(simple_arr))
+                    || mxGetNumberOfElements(simple_arr) != 1)
+                ymx_error("Load option 'simple' must be a logical scalar");
+            simple = (mxGetScalar(simple_arr) != 0);
+        }
+        compression = mxGetField(options, 0, "compression");
+    }
+
+    char *path = mxArrayToString(filename);
+    ymx_codec_t codec = ymx_get_codec(path, compression);
+    mxArray *data;
+    if (codec == YMX_CODEC_NONE) {
+        /* Read it whole, so the fast scanners can be used */
+        struct stat info;
+        if (stat(path, &info) != 0)
+            ymx_error("Couldn't open file for reading");
+        size_t size = (size_t)info.st_size;
+        char *text = ymx_read_file(path, size);
+        if (simple) {
+            data = ymx_construct_string(text, size, NULL);
+        } else {
+            data = ymx_load_string(text, size);
+        }
+        mxFree(text);
+    } else {
+        ymx_cfile_t *file = ymx_cfile_open(path, codec, "rb");
+        if (!file)
+            ymx_error("Couldn't open file for reading");
+        yaml_parser_t *parser = ymx_init_parser();
+        ymx_set_file_input(parser, file);
+        if (simple) {
+            data = ymx_unwrap_documents(ymx_construct_parsed(parser, NULL));
+        } else {
+            data = ymx_load_parsed(parser);
+        }
+        ymx_persistent_cleanup();
+    }
+    mxFree(path);
+
+    if (!data)
+        data = mxCreateStructMatrix(1, 0,
+                YMX_DOC_NUM_FIELDS, YMX_DOC_FIELD_STRS);
+    return data;
+}
+
+
+/*
+ * Compressed files
+ *************************************************************************/
+
+/* The codec for the file at path: by option, if it is given and isn't
+ * 'auto', or else by the path's extension */
+ymx_codec_t ymx_get_codec(const char *path, const mxArray *option) {
+    ymx_codec_t codec = YMX_CODEC_NONE;
+    char *name = NULL;
+    if (option) {
+        name = mxIsChar(option) ? mxArrayToString(option) : NULL;
+        if (!name || (strcmp(name, "auto") != 0
+                && strcmp(name, "none") != 0
+                && strcmp(name, "gzip") != 0
+                && strcmp(name, "zstd") != 0))
+            ymx_error("Option 'compression' must be 'auto', 'gzip', "
+                    "'zstd' or 'none'");
+    }
+    if (name && strcmp(name, "auto") != 0) {
+        if (strcmp(name, "gzip") == 0)
+            codec = YMX_CODEC_GZIP;
+        else if (strcmp(name, "zstd") == 0)
+            codec = YMX_CODEC_ZSTD;
+    } else if (ymx_has_extension(path, ".gz")) {
+        codec = YMX_CODEC_GZIP;
+    } else if (ymx_has_extension(path, ".zst")) {
+        codec = YMX_CODEC_ZSTD;
+    }
+    if (name)
+        mxFree(name);
+
+#ifndef YMX_WITH_ZSTD
+    if (codec == YMX_CODEC_ZSTD)
+        ymx_error("zstd support wasn't built in (see YMX_WITH_ZSTD)");
+#endif
+    return codec;
+}
+
+/* Open the file at path, compressed with codec, in mode "rb" (to read),
+ * "wb" or "ab" (to write or append). Returns NULL if it can't. */
+ymx_cfile_t *ymx_cfile_open(const char *path, ymx_codec_t codec,
+        const char *mode) {
+    ymx_cfile_t *file = calloc(1, sizeof(ymx_cfile_t));
+    if (!file)
+        return NULL;
+    file->codec = codec;
+
+    if (codec == YMX_CODEC_GZIP) {
+        file->gz = gzopen(path, mode);
+        if (!file->gz) {
+            free(file);
+            return NULL;
+        }
+        gzbuffer(file->gz, GZIP_BUFFER_SIZE);
+        return file;
+    }
+
+    file->file = fopen(path, mode);
+    if (!file->file) {
+        free(file);
+        return NULL;
+    }
+#ifdef YMX_WITH_ZSTD
+    if (codec == YMX_CODEC_ZSTD) {
+        if (mode[0] == 'r') {
+            file->dstream = ZSTD_createDStream();
+            file->buffer_size = ZSTD_DStreamInSize();
+        } else {
+            file->cstream = ZSTD_createCStream();
+            file->buffer_size = ZSTD_CStreamOutSize();
+        }
+        file->buffer = malloc(file->buffer_size);
+        if (!file->buffer || !(file->dstream || file->cstream)) {
+            ymx_cfile_close(file);
+            return NULL;
+        }
+        file->in.src = file->buffer;
+    }
+#endif
+    return file;
+}
+
+/* Read up to size bytes of decompressed text, and return how many were
+ * read: fewer only at the end of the file, or if the read failed, when
+ * ymx_cfile_problem says why. */
+size_t ymx_cfile_read(ymx_cfile_t *file, void *buffer, size_t size) {
+    if (file->problem)
+        return 0;
+    switch (file->codec) {
+        case YMX_CODEC_GZIP: {
+            size_t total = 0;
+            while (total < size) {
+                unsigned request = size - total > INT_MAX
+                        ? INT_MAX : (unsigned)(size - total);
+                int num_read = gzread(file->gz, (char *)buffer + total,
+                        request);
+                if (num_read <= 0) {
+                    /* A gzip stream cut short reads as far as it goes,
+                     * and only then reports the error */
+                    int error;
+                    gzerror(file->gz, &error);
+                    if (error == Z_BUF_ERROR)
+                        file->problem = "Compressed file is truncated";
+                    else if (num_read < 0 || error != Z_OK)
+                        file->problem = "Error while decompressing file";
+                    break;
+                }
+                total += (size_t)num_read;
+            }
+            return total;
+        }
+#ifdef YMX_WITH_ZSTD
+        case YMX_CODEC_ZSTD:
+            return ymx_zstd_read(file, buffer, size);
+#endif
+        default: {
+            size_t num_read = fread(buffer, 1, size, file->file);
+            if (num_read < size && ferror(file->file))
+                file->problem = "Error while reading file";
+            return num_read;
+        }
+    }
+}
+
+/* Compress and write size bytes. Returns 0 if that failed. */
+int ymx_cfile_write(ymx_cfile_t *file, const void *data, size_t size) {
+    if (file->problem)
+        return 0;
+    switch (file->codec) {
+        case YMX_CODEC_GZIP:
+            if (size && gzwrite(file->gz, data, (unsigned)size)
+                    != (int)size)
+                file->problem = "Error while writing file";
+            break;
+#ifdef YMX_WITH_ZSTD
+        case YMX_CODEC_ZSTD:
+            ymx_zstd_write(file, data, size, ZSTD_e_continue);
+            break;
+#endif
+        default:
+            if (fwrite(data, 1, size, file->file) != size)
+                file->problem = "Error while writing file";
+    }
+    return !file->problem;
+}
+
+/* Push everything written so far through to the file, so that a reader
+ * could decompress it all. Returns 0 if that failed. */
+int ymx_cfile_flush(ymx_cfile_t *file) {
+    if (file->problem)
+        return 0;
+    switch (file->codec) {
+        case YMX_CODEC_GZIP:
+            if (gzflush(file->gz, Z_SYNC_FLUSH) != Z_OK)
+                file->problem = "Error while writing file";
+            break;
+#ifdef YMX_WITH_ZSTD
+        case YMX_CODEC_ZSTD:
+            if (ymx_zstd_write(file, NULL, 0, ZSTD_e_flush)
+                    && fflush(file->file) != 0)
+                file->problem = "Error while writing file";
+            break;
+#endif
+        default:
+            if (fflush(file->file) != 0)
+                file->problem = "Error while writing file";
+    }
+    return !file->problem;
+}
+
+/* Finish and close a file, and free it. Returns 0 if anything written
+ * to it didn't make it to the file. */
+int ymx_cfile_close(ymx_cfile_t *file) {
+    int ok = !file->problem;
+    if (file->gz)
+        ok = (gzclose(file->gz) == Z_OK) && ok;
+#ifdef YMX_WITH_ZSTD
+    if (file->cstream && ok)
+        ok = ymx_zstd_write(file, NULL, 0, ZSTD_e_end);
+    ZSTD_freeDStream(file->dstream);
+    ZSTD_freeCStream(file->cstream);
+    free(file->buffer);
+#endif
+    if (file->file)
+        ok = (fclose(file->file) == 0) && ok;
+    free(file);
+    return ok;
+}
+
+/* The reason a read or write of a file failed, or NULL if none has */
+const char *ymx_cfile_problem(const ymx_cfile_t *file) {
+    return file->problem;
+}
+
+/* libyaml write handler, writing an emitter's output to a ymx_cfile_t */
+int ymx_cfile_write_handler(void *data, unsigned char *buffer, size_t size) {
+    return ymx_cfile_write(data, buffer, size);
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+int ymx_has_extension(const char *path, const char *extension) {
+    size_t length = strlen(path);
+    size_t extension_length = strlen(extension);
+    return length > extension_length && strcmp(path + length
+            - extension_length, extension) == 0;
+}
+
+#ifdef YMX_WITH_ZSTD
+size_t ymx_zstd_read(ymx_cfile_t *file, void *buffer, size_t size) {
+    ZSTD_outBuffer out = {buffer, size, 0};
+    while (out.pos < out.size) {
+        if (file->in.pos == file->in.size) {
+            size_t num_read = fread(file->buffer, 1, file->buffer_size,
+                    file->file);
+            if (num_read == 0) {
+                if (ferror(file->file))
+                    file->problem = "Error while reading file";
+                else if (file->frame_left)
+                    file->problem = "Compressed file is truncated";
+                break;
+            }
+            file->in.size = num_read;
+            file->in.pos = 0;
+        }
+        size_t result = ZSTD_decompressStream(file->dstream, &out,
+                &file->in);
+        if (ZSTD_isError(result)) {
+            file->problem = "Error while decompressing file";
+            break;
+        }
+        file->frame_left = result;
+    }
+    return out.pos;
+}
+
+/* Compress input with a zstd end directive, writing out whatever output
+ * that makes; with ZSTD_e_flush or ZSTD_e_end, until all of it is out.
+ * Returns 0 (and sets file->problem) if that failed. */
+int ymx_zstd_write(ymx_cfile_t *file, const void *data, size_t size,
+        ZSTD_EndDirective mode) {
+    ZSTD_inBuffer in = {data, size, 0};
+    while (1) {
+        ZSTD_outBuffer out = {file->buffer, file->buffer_size, 0};
+        size_t left = ZSTD_compressStream2(file->cstream, &out, &in, mode);
+        if (ZSTD_isError(left)) {
+            file->problem = "Error while compressing file";
+            return 0;
+        }
+        if (fwrite(file->buffer, 1, out.pos, file->file) != out.pos) {
+            file->problem = "Error while writing file";
+            return 0;
+        }
+        if (mode == ZSTD_e_continue ? in.pos == in.size : left == 0)
+            return 1;
+    }
+}
+#endif
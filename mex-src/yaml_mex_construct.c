@@ -0,0 +1,1389 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * This file implements "simple" construction of native Matlab data
+ * directly from the libyaml event stream, following the same rules as
+ * yaml_simple_construct.m: mappings become scalar structs, sequences
+ * become cell arrays, and scalars are resolved according to the YAML core
+ * schema. Constructing natively avoids building the intermediate node
+ * struct tree that ymx_load_stream produces.
+ *
+ * One addition over yaml_simple_construct's original behavior: a sequence
+ * of two or more mappings that all have the same keys in the same order is
+ * constructed as an N-by-1 struct array rather than a cell array of
+ * scalar structs. The rows of such a sequence are held as bare field
+ * values until the end of the sequence, so that only one field name table
+ * is ever created for the whole array.
+ *
+ * Another: scalars tagged !!binary are decoded from base64 into 1-by-N
+ * uint8 arrays, and mappings tagged !matlab/array (as composed with the
+ * YMX_COMPOSE_TYPED_ARRAYS flag) into arrays of their class and size. The
+ * array is created once its class, size and data have been read, and its
+ * !!binary data decoded straight into it. Likewise, mappings tagged
+ * !matlab/sparse become sparse matrices, created with exactly the number
+ * of nonzeros they hold once all their parts have been read, and their
+ * parts then stored straight into the matrix's jc, ir and value arrays.
+ * Neither is created before its data is known to fill it, so a small
+ * document can't ask for a huge array.
+ *
+ * A load may be restricted by a projection, a set of key paths; keys and
+ * sequence items it doesn't select are passed over by ymx_skip_node,
+ * which reads their events without constructing anything.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+/* The keys and values of a mapping, prior to building a struct. Keys are
+ * owned (allocated with mxMalloc); values are unowned mxArrays. */
+typedef struct ymx_fields_s {
+    size_t capacity;
+    size_t count;
+    char **keys;
+    mxArray **values;
+} ymx_fields_t;
+
+/* A !matlab/array mapping being constructed. Its data and imag values
+ * are copied into parts if they come before the class and size, and are
+ * decoded once the array has been created. */
+typedef struct ymx_typed_array_s {
+    mxClassID class_id;   /* mxUNKNOWN_CLASS until read */
+    size_t element_size;
+    mwSize num_dims;      /* 0 until the size is read */
+    mwSize dims[YMX_MAX_ARRAY_DIMS];
+    mxArray *array;       /* NULL until the class, size and data are read */
+    int seen;             /* Bit per key already read */
+    char *parts[2];       /* Copies of the data and imag values */
+    size_t part_lengths[2];
+} ymx_typed_array_t;
+
+/* One of the jc, ir and data parts of a !matlab/sparse mapping, as read
+ * before the matrix has been created: either a copy of its !!binary
+ * value, or the values of its sequence. */
+typedef struct ymx_sparse_part_s {
+    char *text;
+    size_t length;
+    double *values;
+    size_t count;
+    size_t capacity;
+} ymx_sparse_part_t;
+
+/* A !matlab/sparse mapping being constructed */
+typedef struct ymx_sparse_s {
+    mxClassID class_id;  /* mxUNKNOWN_CLASS until read */
+    int have_size;
+    mwSize num_rows;
+    mwSize num_cols;
+    int have_nnz;
+    size_t nnz;
+    mxArray *array;      /* NULL until the whole mapping is read */
+    int seen;            /* Bit per key already read */
+    ymx_sparse_part_t parts[3];
+} ymx_sparse_t;
+
+/* A growable array of mxArray pointers */
+typedef struct ymx_array_list_s {
+    size_t capacity;
+    size_t count;
+    mxArray **items;
+} ymx_array_list_t;
+
+/* A sequence or mapping still being constructed by ymx_construct_node.
+ * Sequences use items, and, while uniform, rows and first_fields (see
+ * ymx_construct_row); mappings use fields. */
+typedef struct ymx_construct_frame_s {
+    int is_mapping;
+    const ymx_projection_t *projection;
+    const ymx_projection_t *item_projection;  /* Of the next item or value */
+    int take_items;
+    int uniform;
+    size_t num_rows;
+    ymx_array_list_t items;
+    ymx_array_list_t rows;
+    ymx_fields_t first_fields;
+    ymx_fields_t fields;
+} ymx_construct_frame_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const char *YMX_NULL_TAG  = "tag:yaml.org,2002:null";
+const char *YMX_BOOL_TAG  = "tag:yaml.org,2002:bool";
+const char *YMX_INT_TAG   = "tag:yaml.org,2002:int";
+const char *YMX_FLOAT_TAG = "tag:yaml.org,2002:float";
+const char *YMX_STR_TAG   = "tag:yaml.org,2002:str";
+const char *YMX_BINARY_TAG = "tag:yaml.org,2002:binary";
+const char *YMX_ARRAY_TAG = "!matlab/array";
+
+/* Keys of a !matlab/array mapping, and the classes its class may name */
+const char *YMX_ARRAY_KEY_STRS[] = {"class", "size", "data", "imag"};
+typedef enum ymx_array_key_e {
+    YMX_ARRAY_KEY_CLASS,
+    YMX_ARRAY_KEY_SIZE,
+    YMX_ARRAY_KEY_DATA,
+    YMX_ARRAY_KEY_IMAG,
+    YMX_ARRAY_NUM_KEYS
+} ymx_array_key_t;
+const char *YMX_ARRAY_CLASS_STRS[] = {"double", "single", "int8", "uint8",
+        "int16", "uint16", "int32", "uint32", "int64", "uint64", "logical"};
+const mxClassID YMX_ARRAY_CLASS_IDS[] = {mxDOUBLE_CLASS, mxSINGLE_CLASS,
+        mxINT8_CLASS, mxUINT8_CLASS, mxINT16_CLASS, mxUINT16_CLASS,
+        mxINT32_CLASS, mxUINT32_CLASS, mxINT64_CLASS, mxUINT64_CLASS,
+        mxLOGICAL_CLASS};
+const size_t YMX_ARRAY_CLASS_SIZES[] = {8, 4, 1, 1, 2, 2, 4, 4, 8, 8, 1};
+const size_t YMX_ARRAY_NUM_CLASSES = 11;
+
+const char *YMX_SPARSE_TAG = "!matlab/sparse";
+
+/* Keys of a !matlab/sparse mapping. The parts (jc, ir, data) come last,
+ * in the same order as the parts of ymx_sparse_t. */
+const char *YMX_SPARSE_KEY_STRS[] =
+        {"class", "size", "nnz", "jc", "ir", "data"};
+typedef enum ymx_sparse_key_e {
+    YMX_SPARSE_KEY_CLASS,
+    YMX_SPARSE_KEY_SIZE,
+    YMX_SPARSE_KEY_NNZ,
+    YMX_SPARSE_KEY_JC,
+    YMX_SPARSE_KEY_IR,
+    YMX_SPARSE_KEY_DATA,
+    YMX_SPARSE_NUM_KEYS
+} ymx_sparse_key_t;
+typedef enum ymx_sparse_part_index_e {
+    YMX_SPARSE_PART_JC,
+    YMX_SPARSE_PART_IR,
+    YMX_SPARSE_PART_DATA,
+    YMX_SPARSE_NUM_PARTS
+} ymx_sparse_part_index_t;
+
+/* Matches the result of namelengthmax */
+const size_t YMX_MAX_FIELD_NAME_LENGTH = 63;
+const size_t ARRAY_LIST_INITIAL_SIZE = 16;
+const size_t CONSTRUCT_FRAMES_INITIAL_SIZE = 32;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+mxArray *ymx_construct_node(
+        yaml_parser_t *parser,
+        const yaml_event_t *first_event,
+        const ymx_projection_t *projection );
+mxArray *ymx_construct_scalar(const yaml_event_t *event);
+void ymx_construct_frame_start(
+        ymx_construct_frame_t *frame,
+        const yaml_event_t *first_event,
+        const ymx_projection_t *projection );
+const yaml_event_t *ymx_construct_frame_next(
+        ymx_construct_frame_t *frame,
+        yaml_parser_t *parser );
+void ymx_construct_row(ymx_construct_frame_t *frame, ymx_fields_t *row);
+mxArray *ymx_construct_sequence_end(ymx_construct_frame_t *frame);
+void ymx_rows_to_items(
+        ymx_array_list_t *items,
+        const ymx_fields_t *first_fields,
+        const ymx_array_list_t *rows,
+        size_t num_rows );
+mxArray *ymx_struct_from_fields(
+        char **keys,
+        mxArray **values,
+        size_t num_fields );
+int ymx_is_typed_array(const yaml_event_t *event);
+mxArray *ymx_construct_typed_array(yaml_parser_t *parser);
+void ymx_typed_array_read_size(
+        ymx_typed_array_t *typed,
+        yaml_parser_t *parser );
+void ymx_typed_array_read_part(
+        ymx_typed_array_t *typed,
+        int part,
+        const yaml_event_t *event );
+void ymx_typed_array_create(
+        ymx_typed_array_t *typed,
+        const char *text,
+        size_t length );
+void ymx_typed_array_decode_part(
+        ymx_typed_array_t *typed,
+        int part,
+        const char *text,
+        size_t length );
+int ymx_is_sparse_array(const yaml_event_t *event);
+mxArray *ymx_construct_sparse(yaml_parser_t *parser);
+void ymx_sparse_read_part(
+        ymx_sparse_t *sparse,
+        int part,
+        yaml_parser_t *parser,
+        const yaml_event_t *event );
+void ymx_sparse_decode_part(
+        ymx_sparse_t *sparse,
+        int part,
+        const char *text,
+        size_t length );
+void ymx_sparse_set_value(
+        ymx_sparse_t *sparse,
+        int part,
+        size_t ind,
+        double value );
+size_t ymx_sparse_part_length(const ymx_sparse_t *sparse, int part);
+size_t ymx_sparse_pending_length(const ymx_sparse_t *sparse, int part);
+void ymx_sparse_check(const mxArray *array, size_t nnz);
+double ymx_read_number(const yaml_event_t *event);
+
+void ymx_fields_init(ymx_fields_t *fields);
+void ymx_fields_delete(ymx_fields_t *fields);
+void ymx_array_list_init(ymx_array_list_t *list);
+void ymx_array_list_append(ymx_array_list_t *list, mxArray *item);
+void ymx_array_list_delete(ymx_array_list_t *list);
+
+
+/*
+ * Main interface function
+ *************************************************************************/
+
+/* Construct native Matlab data from a YAML stream given as a string. If
+ * the stream holds exactly one document, returns the constructed data of
+ * that document; otherwise returns a 1-by-N cell array with one element
+ * per document. If projection isn't NULL, only the parts of each document
+ * it selects are constructed (see yaml_mex_projection.c).
+ */
+mxArray *ymx_construct_stream(
+        const mxArray *yaml_stream,
+        const ymx_projection_t *projection ) {
+    ymx_debug_msg("Entering ymx_construct_stream\n");
+    char *yaml_cstr = mxArrayToString(yaml_stream);
+    mxArray *data = ymx_construct_string(yaml_cstr, strlen(yaml_cstr),
+            projection);
+    mxFree(yaml_cstr);
+    ymx_debug_msg("Exiting ymx_construct_stream\n");
+    return data;
+}
+
+/* As ymx_construct_stream, but with the stream given as length bytes of
+ * UTF-8 (which need not be NUL-terminated). */
+mxArray *ymx_construct_string(const char *yaml_str, size_t length,
+        const ymx_projection_t *projection) {
+    return ymx_unwrap_documents(
+            ymx_construct_documents(yaml_str, length, projection));
+}
+
+/* Turn the 1-by-N cell array of a stream's documents into the result of a
+ * simple load: the data of its document if it has just one, or an empty
+ * cell array if it has none, or else the cell array itself. */
+mxArray *ymx_unwrap_documents(mxArray *docs) {
+    mwSize num_docs = mxGetNumberOfElements(docs);
+    if (num_docs == 1) {
+        mxArray *data = mxGetCell(docs, 0);
+        mxSetCell(docs, 0, NULL);
+        mxDestroyArray(docs);
+        return data;
+    } else if (num_docs == 0) {
+        mxDestroyArray(docs);
+        return mxCreateCellMatrix(0, 0);
+    }
+    return docs;
+}
+
+/* Construct every document of a stream given as length bytes of UTF-8,
+ * returning a 1-by-N cell array with the data of each, even if N is 0 or
+ * 1. */
+mxArray *ymx_construct_documents(const char *yaml_str, size_t length,
+        const ymx_projection_t *projection) {
+    yaml_parser_t *parser = ymx_init_parser();
+    ymx_set_parser_input(parser, yaml_str, length);
+    return ymx_construct_parsed(parser, projection);
+}
+
+/* As ymx_construct_documents, but reading the stream from a parser whose
+ * input has already been set */
+mxArray *ymx_construct_parsed(yaml_parser_t *parser,
+        const ymx_projection_t *projection) {
+    ymx_array_list_t docs;
+    ymx_array_list_init(&docs);
+
+    const yaml_event_t *event = ymx_parse(parser);
+    mxAssert(event->type == YAML_STREAM_START_EVENT,
+            "Expected stream start event!");
+    event = ymx_parse(parser);
+    while (event->type != YAML_STREAM_END_EVENT) {
+        mxAssert(event->type == YAML_DOCUMENT_START_EVENT,
+                "Expected document start event!");
+        event = ymx_parse(parser);
+        ymx_array_list_append(&docs,
+                ymx_construct_node(parser, event, projection));
+        event = ymx_parse(parser);
+        mxAssert(event->type == YAML_DOCUMENT_END_EVENT,
+                "Expected document end!");
+        event = ymx_parse(parser);
+    }
+
+    mxArray *data = mxCreateCellMatrix(1, docs.count);
+    mwIndex i;
+    for (i=0; i<docs.count; i++) {
+        mxSetCell(data, i, docs.items[i]);
+    }
+
+    ymx_array_list_delete(&docs);
+    return data;
+}
+
+
+/*
+ * Functions for constructing
+ *************************************************************************/
+
+/* Construct the node that starts with first_event, and everything in it.
+ * Sequences and mappings still open are kept on a stack of frames rather
+ * than constructed by recursion, so that the depth of a document is bound
+ * only by the limits on it; the frames' buffers are kept for reuse by
+ * later collections at the same depth, until the whole node is done.
+ */
+mxArray *ymx_construct_node(
+        yaml_parser_t *parser,
+        const yaml_event_t *first_event,
+        const ymx_projection_t *projection ) {
+    ymx_debug_msg("Entering ymx_construct_node\n");
+    size_t frames_size = CONSTRUCT_FRAMES_INITIAL_SIZE;
+    ymx_construct_frame_t *frames = mxCalloc(frames_size,
+            sizeof(ymx_construct_frame_t));
+    size_t num_frames = 0;
+
+    const yaml_event_t *event = first_event;
+    mxArray *item = NULL;
+    while (1) {
+        ymx_construct_frame_t *frame;
+        switch (event->type) {
+            case YAML_SCALAR_EVENT:
+                item = ymx_construct_scalar(event);
+                break;
+            case YAML_MAPPING_START_EVENT:
+                if (ymx_is_typed_array(event)) {
+                    item = ymx_construct_typed_array(parser);
+                    break;
+                }
+                if (ymx_is_sparse_array(event)) {
+                    item = ymx_construct_sparse(parser);
+                    break;
+                }
+                /* fall through */
+            case YAML_SEQUENCE_START_EVENT:
+                if (num_frames == frames_size) {
+                    frames = mxRealloc(frames,
+                            2*frames_size * sizeof(ymx_construct_frame_t));
+                    memset(frames + frames_size, 0,
+                            frames_size * sizeof(ymx_construct_frame_t));
+                    frames_size *= 2;
+                }
+                frame = frames + num_frames;
+                ymx_construct_frame_start(frame, event, num_frames
+                        ? frames[num_frames-1].item_projection : projection);
+                num_frames++;
+                event = ymx_construct_frame_next(frame, parser);
+                continue;
+            case YAML_SEQUENCE_END_EVENT:
+                num_frames--;
+                item = ymx_construct_sequence_end(frames + num_frames);
+                break;
+            case YAML_MAPPING_END_EVENT:
+                num_frames--;
+                frame = frames + num_frames;
+                if (num_frames && !frames[num_frames-1].is_mapping
+                        && frames[num_frames-1].uniform) {
+                    /* A row of a sequence that may be a struct array */
+                    ymx_construct_row(frames + num_frames - 1,
+                            &frame->fields);
+                    event = ymx_construct_frame_next(
+                            frames + num_frames - 1, parser);
+                    continue;
+                }
+                item = ymx_struct_from_fields(frame->fields.keys,
+                        frame->fields.values, frame->fields.count);
+                break;
+            case YAML_ALIAS_EVENT:
+                ymx_error("Cannot construct alias nodes.");
+                break;
+            default:
+                ymx_error("Unexpected event while constructing node");
+        }
+
+        if (!num_frames)
+            break;
+        frame = frames + num_frames - 1;
+        if (frame->is_mapping) {
+            frame->fields.values[frame->fields.count++] = item;
+        } else {
+            if (frame->uniform) {
+                ymx_rows_to_items(&frame->items, &frame->first_fields,
+                        &frame->rows, frame->num_rows);
+                frame->uniform = 0;
+            }
+            ymx_array_list_append(&frame->items, item);
+        }
+        event = ymx_construct_frame_next(frame, parser);
+    }
+
+    size_t i;
+    for (i=0; i<frames_size; i++) {
+        ymx_array_list_delete(&frames[i].items);
+        ymx_array_list_delete(&frames[i].rows);
+        ymx_fields_delete(&frames[i].first_fields);
+        ymx_fields_delete(&frames[i].fields);
+    }
+    mxFree(frames);
+    ymx_debug_msg("Exiting ymx_construct_node\n");
+    return item;
+}
+
+mxArray *ymx_construct_scalar(const yaml_event_t *event) {
+    const char *tag = (char *)event->data.scalar.tag;
+    if (tag && strcmp(tag, YMX_BINARY_TAG) == 0)
+        return ymx_base64_decode((char *)event->data.scalar.value,
+                event->data.scalar.length);
+
+    double number = 0;
+    switch (ymx_resolve_scalar(event, &number)) {
+        case YMX_SCALAR_KIND_NULL:
+            return mxCreateDoubleMatrix(0, 0, mxREAL);
+        case YMX_SCALAR_KIND_BOOL:
+            return mxCreateLogicalScalar(number != 0);
+        case YMX_SCALAR_KIND_NUMBER:
+            return mxCreateDoubleScalar(number);
+        default:
+            return mxCreateString((char *)event->data.scalar.value);
+    }
+}
+
+/* Begin a frame for the sequence or (plain) mapping started by
+ * first_event, to be constructed under projection. Under a projection, a
+ * sequence's items are skipped unless it has a '*' segment here. */
+void ymx_construct_frame_start(
+        ymx_construct_frame_t *frame,
+        const yaml_event_t *first_event,
+        const ymx_projection_t *projection ) {
+    frame->is_mapping = (first_event->type == YAML_MAPPING_START_EVENT);
+    frame->projection = projection;
+    frame->item_projection = NULL;
+    if (frame->is_mapping) {
+        frame->fields.count = 0;
+    } else {
+        frame->take_items = !projection || ymx_projection_select(
+                projection, NULL, 0, &frame->item_projection);
+        frame->uniform = 1;
+        frame->num_rows = 0;
+        frame->items.count = 0;
+        frame->rows.count = 0;
+        frame->first_fields.count = 0;
+    }
+}
+
+/* Parse up to the start of the next item of a frame's sequence, or the
+ * next value of its mapping, and return its event, or else the event that
+ * ends the frame. Items and keys that the frame's projection doesn't
+ * select are skipped, along with their values, whatever they are. Every
+ * other key of a mapping must be a scalar that is a valid Matlab struct
+ * field name, and keys may not be repeated; the key is added to the
+ * frame's fields, and its value is expected next.
+ */
+const yaml_event_t *ymx_construct_frame_next(
+        ymx_construct_frame_t *frame,
+        yaml_parser_t *parser ) {
+    const yaml_event_t *event = ymx_parse(parser);
+    if (!frame->is_mapping) {
+        while (!frame->take_items
+                && event->type != YAML_SEQUENCE_END_EVENT) {
+            ymx_skip_node(parser, event);
+            event = ymx_parse(parser);
+        }
+        return event;
+    }
+
+    ymx_fields_t *fields = &frame->fields;
+    while (event->type != YAML_MAPPING_END_EVENT) {
+        frame->item_projection = NULL;
+        if ( frame->projection && (event->type != YAML_SCALAR_EVENT
+                || !ymx_projection_select(frame->projection,
+                    (char *)event->data.scalar.value,
+                    event->data.scalar.length,
+                    &frame->item_projection)) ) {
+            ymx_skip_node(parser, event);
+            ymx_skip_node(parser, ymx_parse(parser));
+            event = ymx_parse(parser);
+            continue;
+        }
+
+        if ( event->type != YAML_SCALAR_EVENT
+                || !ymx_is_valid_field_name(
+                    (char *)event->data.scalar.value,
+                    event->data.scalar.length ) )
+            ymx_error("Unable to convert mapping key to struct field.");
+
+        size_t i;
+        for (i=0; i<fields->count; i++) {
+            if (strcmp(fields->keys[i],
+                    (char *)event->data.scalar.value) == 0)
+                ymx_error("Duplicate mapping key.");
+        }
+
+        if (fields->count == fields->capacity) {
+            size_t old_capacity = fields->capacity;
+            fields->capacity = old_capacity
+                    ? 2*old_capacity : ARRAY_LIST_INITIAL_SIZE;
+            fields->keys = mxRealloc(fields->keys,
+                    fields->capacity * sizeof(char *));
+            memset(fields->keys + old_capacity, 0,
+                    (fields->capacity - old_capacity) * sizeof(char *));
+            fields->values = mxRealloc(fields->values,
+                    fields->capacity * sizeof(mxArray *));
+        }
+
+        /* Keys are kept across mappings, so free any previous occupant */
+        size_t length = event->data.scalar.length;
+        char *key = mxRealloc(fields->keys[fields->count], length + 1);
+        memcpy(key, event->data.scalar.value, length + 1);
+        fields->keys[fields->count] = key;
+
+        return ymx_parse(parser);
+    }
+    return event;
+}
+
+/* Add the fields of a mapping just read to the row table of the frame of
+ * the sequence it's an item of, while every item of the sequence so far
+ * has been a mapping with the same keys as the first; the items' values
+ * are kept in frame->rows (num_fields values per row) rather than being
+ * turned into structs. Otherwise the rows become structs of their own.
+ */
+void ymx_construct_row(ymx_construct_frame_t *frame, ymx_fields_t *row) {
+    size_t num_fields = frame->first_fields.count;
+    size_t i;
+    if (frame->num_rows == 0) {
+        /* Take over the keys; the mapping's frame gets the empty table */
+        ymx_fields_t first_fields = frame->first_fields;
+        frame->first_fields = *row;
+        *row = first_fields;
+        row->count = 0;
+        num_fields = frame->first_fields.count;
+        row = &frame->first_fields;
+    } else if (row->count != num_fields) {
+        frame->uniform = 0;
+    } else {
+        for (i=0; i<num_fields; i++) {
+            if (strcmp(row->keys[i], frame->first_fields.keys[i]) != 0) {
+                frame->uniform = 0;
+                break;
+            }
+        }
+    }
+
+    if (frame->uniform) {
+        for (i=0; i<num_fields; i++) {
+            ymx_array_list_append(&frame->rows, row->values[i]);
+        }
+        frame->num_rows++;
+    } else {
+        ymx_rows_to_items(&frame->items, &frame->first_fields,
+                &frame->rows, frame->num_rows);
+        ymx_array_list_append(&frame->items, ymx_struct_from_fields(
+                row->keys, row->values, row->count ));
+    }
+}
+
+/* Finish a sequence's frame. Sequences of two or more mappings with
+ * identical ordered key sets become N-by-1 struct arrays; all other
+ * sequences become 1-by-N cell arrays (0-by-0 if empty).
+ */
+mxArray *ymx_construct_sequence_end(ymx_construct_frame_t *frame) {
+    size_t num_fields = frame->first_fields.count;
+    size_t num_rows = frame->num_rows;
+    mxArray *data;
+    size_t i;
+    if (frame->uniform && num_rows >= 2) {
+        data = mxCreateStructMatrix(num_rows, 1,
+                num_fields, (const char **)frame->first_fields.keys);
+        size_t r;
+        for (r=0; r<num_rows; r++) {
+            for (i=0; i<num_fields; i++) {
+                mxSetFieldByNumber(data, r, i,
+                        frame->rows.items[r*num_fields + i]);
+            }
+        }
+    } else {
+        if (frame->uniform) {
+            /* A single mapping stays in a cell so that it can still be
+             * told apart from a bare mapping. */
+            ymx_rows_to_items(&frame->items, &frame->first_fields,
+                    &frame->rows, num_rows);
+        }
+        if (frame->items.count) {
+            data = mxCreateCellMatrix(1, frame->items.count);
+            for (i=0; i<frame->items.count; i++) {
+                mxSetCell(data, i, frame->items.items[i]);
+            }
+        } else {
+            data = mxCreateCellMatrix(0, 0);
+        }
+    }
+    return data;
+}
+
+/* Give each row held in a sequence's row table its own scalar struct,
+ * appending them to items; used when the sequence turns out not to be
+ * uniform. */
+void ymx_rows_to_items(
+        ymx_array_list_t *items,
+        const ymx_fields_t *first_fields,
+        const ymx_array_list_t *rows,
+        size_t num_rows ) {
+    size_t num_fields = first_fields->count;
+    size_t r;
+    for (r=0; r<num_rows; r++) {
+        ymx_array_list_append(items, ymx_struct_from_fields(
+                first_fields->keys,
+                rows->items + r*num_fields,
+                num_fields ));
+    }
+}
+
+mxArray *ymx_struct_from_fields(
+        char **keys,
+        mxArray **values,
+        size_t num_fields ) {
+    mxArray *data = mxCreateStructMatrix(1, 1,
+            num_fields, (const char **)keys);
+    size_t i;
+    for (i=0; i<num_fields; i++) {
+        mxSetFieldByNumber(data, 0, i, values[i]);
+    }
+    return data;
+}
+
+
+
+/*
+ * Typed arrays
+ *************************************************************************/
+
+int ymx_is_typed_array(const yaml_event_t *event) {
+    const char *tag = (char *)event->data.mapping_start.tag;
+    return tag && strcmp(tag, YMX_ARRAY_TAG) == 0;
+}
+
+/* Construct the array described by a !matlab/array mapping, whose start
+ * event has just been parsed. Its keys are class, size, data, and, for
+ * complex arrays, imag; data and imag must be !!binary. */
+mxArray *ymx_construct_typed_array(yaml_parser_t *parser) {
+    ymx_typed_array_t typed;
+    memset(&typed, 0, sizeof(typed));
+    typed.class_id = mxUNKNOWN_CLASS;
+
+    const yaml_event_t *event = ymx_parse(parser);
+    while (event->type != YAML_MAPPING_END_EVENT) {
+        int key = YMX_ARRAY_NUM_KEYS;
+        if (event->type == YAML_SCALAR_EVENT) {
+            for (key=0; key<YMX_ARRAY_NUM_KEYS; key++) {
+                if (strcmp((char *)event->data.scalar.value,
+                        YMX_ARRAY_KEY_STRS[key]) == 0)
+                    break;
+            }
+        }
+        if (key == YMX_ARRAY_NUM_KEYS)
+            ymx_error("Unrecognized key in !matlab/array");
+        if (typed.seen & (1 << key))
+            ymx_error("Duplicate mapping key.");
+        typed.seen |= 1 << key;
+
+        event = ymx_parse(parser);
+        if (key == YMX_ARRAY_KEY_SIZE) {
+            if (event->type != YAML_SEQUENCE_START_EVENT)
+                ymx_error("!matlab/array size must be a sequence");
+            ymx_typed_array_read_size(&typed, parser);
+        } else {
+            if (event->type != YAML_SCALAR_EVENT)
+                ymx_error("!matlab/array values must be scalars");
+            if (key == YMX_ARRAY_KEY_CLASS) {
+                size_t i;
+                for (i=0; i<YMX_ARRAY_NUM_CLASSES; i++) {
+                    if (strcmp((char *)event->data.scalar.value,
+                            YMX_ARRAY_CLASS_STRS[i]) == 0)
+                        break;
+                }
+                if (i == YMX_ARRAY_NUM_CLASSES)
+                    ymx_error("Unsupported !matlab/array class");
+                typed.class_id = YMX_ARRAY_CLASS_IDS[i];
+                typed.element_size = YMX_ARRAY_CLASS_SIZES[i];
+            } else {
+                ymx_typed_array_read_part(&typed,
+                        key - YMX_ARRAY_KEY_DATA, event);
+            }
+        }
+
+        if (!typed.array && typed.class_id != mxUNKNOWN_CLASS
+                && typed.num_dims && typed.parts[0])
+            ymx_typed_array_create(&typed, typed.parts[0],
+                    typed.part_lengths[0]);
+
+        event = ymx_parse(parser);
+    }
+
+    if (!typed.array || !(typed.seen & (1 << YMX_ARRAY_KEY_DATA)))
+        ymx_error("!matlab/array needs a class, size, and data");
+
+    int part;
+    for (part=0; part<2; part++) {
+        if (typed.parts[part]) {
+            ymx_typed_array_decode_part(&typed, part,
+                    typed.parts[part], typed.part_lengths[part]);
+            mxFree(typed.parts[part]);
+        }
+    }
+    return typed.array;
+}
+
+/* Read the dimensions of a !matlab/array from its size sequence, whose
+ * start event has just been parsed. */
+void ymx_typed_array_read_size(
+        ymx_typed_array_t *typed,
+        yaml_parser_t *parser ) {
+    double number;
+    mwSize num_dims = 0;
+    const yaml_event_t *event = ymx_parse(parser);
+    while (event->type != YAML_SEQUENCE_END_EVENT) {
+        number = ymx_read_number(event);
+        if (!ymx_is_size_number(number))
+            ymx_error("!matlab/array size must hold nonnegative integers");
+        if (num_dims == YMX_MAX_ARRAY_DIMS)
+            ymx_error("!matlab/array has too many dimensions");
+        typed->dims[num_dims++] = (mwSize)number;
+        event = ymx_parse(parser);
+    }
+    if (num_dims < 2)
+        ymx_error("!matlab/array size must have at least 2 dimensions");
+    typed->num_dims = num_dims;
+}
+
+/* Decode the data (part 0) or imag (part 1) value of a !matlab/array from
+ * its scalar event, or keep a copy to decode once the array exists. */
+void ymx_typed_array_read_part(
+        ymx_typed_array_t *typed,
+        int part,
+        const yaml_event_t *event ) {
+    const char *tag = (char *)event->data.scalar.tag;
+    if (!tag || strcmp(tag, YMX_BINARY_TAG) != 0)
+        ymx_error("!matlab/array data must be !!binary");
+
+    const char *text = (char *)event->data.scalar.value;
+    size_t length = event->data.scalar.length;
+    if (!typed->array && part == 0 && typed->class_id != mxUNKNOWN_CLASS
+            && typed->num_dims)
+        ymx_typed_array_create(typed, text, length);
+    if (typed->array) {
+        ymx_typed_array_decode_part(typed, part, text, length);
+    } else {
+        typed->parts[part] = mxMalloc(length + 1);
+        memcpy(typed->parts[part], text, length + 1);
+        typed->part_lengths[part] = length;
+    }
+}
+
+/* Create the array, given the text of its data. The size is checked
+ * against the data first, so that a short mapping can't ask for more
+ * memory than its data fills. */
+void ymx_typed_array_create(
+        ymx_typed_array_t *typed,
+        const char *text,
+        size_t length ) {
+    size_t num_bytes = typed->element_size;
+    mwSize i;
+    for (i=0; i<typed->num_dims; i++) {
+        if (typed->dims[i] && num_bytes > (size_t)-1 / typed->dims[i])
+            ymx_error("Size of !!binary data doesn't match its array");
+        num_bytes *= typed->dims[i];
+    }
+    if (ymx_base64_decoded_length(text, length) != num_bytes)
+        ymx_error("Size of !!binary data doesn't match its array");
+
+    if (typed->class_id == mxLOGICAL_CLASS)
+        typed->array = mxCreateLogicalArray(typed->num_dims, typed->dims);
+    else
+        typed->array = mxCreateNumericArray(typed->num_dims,
+                typed->dims, typed->class_id, mxREAL);
+}
+
+void ymx_typed_array_decode_part(
+        ymx_typed_array_t *typed,
+        int part,
+        const char *text,
+        size_t length ) {
+    mxArray *array = typed->array;
+    size_t num_elements = mxGetNumberOfElements(array);
+    size_t element_size = mxGetElementSize(array);
+    if (part == 0) {
+        ymx_base64_decode_elements(text, length,
+                mxGetData(array), num_elements, element_size);
+    } else {
+        if (mxIsLogical(array))
+            ymx_error("A logical !matlab/array can't have imag data");
+        void *imag = mxCalloc(num_elements ? num_elements : 1,
+                element_size);
+        ymx_base64_decode_elements(text, length,
+                imag, num_elements, element_size);
+        mxSetImagData(array, imag);
+    }
+}
+
+
+/*
+ * Sparse matrices
+ *************************************************************************/
+
+int ymx_is_sparse_array(const yaml_event_t *event) {
+    const char *tag = (char *)event->data.mapping_start.tag;
+    return tag && strcmp(tag, YMX_SPARSE_TAG) == 0;
+}
+
+/* Construct the sparse matrix described by a !matlab/sparse mapping, whose
+ * start event has just been parsed. Its keys are class (double or
+ * logical), size, nnz, and the matrix's column pointers jc, row indices ir
+ * (both zero-based) and nonzero values data, each either a sequence or
+ * !!binary (of uint64 indices, or of the values). nnz may be left out, in
+ * which case it is the number of row indices. The matrix is created at the
+ * end of the mapping, once the lengths of the parts have been checked
+ * against its size and nnz.
+ */
+mxArray *ymx_construct_sparse(yaml_parser_t *parser) {
+    ymx_sparse_t sparse;
+    memset(&sparse, 0, sizeof(sparse));
+    sparse.class_id = mxUNKNOWN_CLASS;
+
+    const yaml_event_t *event = ymx_parse(parser);
+    while (event->type != YAML_MAPPING_END_EVENT) {
+        int key = YMX_SPARSE_NUM_KEYS;
+        if (event->type == YAML_SCALAR_EVENT) {
+            for (key=0; key<YMX_SPARSE_NUM_KEYS; key++) {
+                if (strcmp((char *)event->data.scalar.value,
+                        YMX_SPARSE_KEY_STRS[key]) == 0)
+                    break;
+            }
+        }
+        if (key == YMX_SPARSE_NUM_KEYS)
+            ymx_error("Unrecognized key in !matlab/sparse");
+        if (sparse.seen & (1 << key))
+            ymx_error("Duplicate mapping key.");
+        sparse.seen |= 1 << key;
+
+        event = ymx_parse(parser);
+        double number;
+        switch (key) {
+            case YMX_SPARSE_KEY_CLASS:
+                if (event->type != YAML_SCALAR_EVENT)
+                    ymx_error("!matlab/sparse class must be a scalar");
+                if (strcmp((char *)event->data.scalar.value, "double") == 0)
+                    sparse.class_id = mxDOUBLE_CLASS;
+                else if (strcmp((char *)event->data.scalar.value,
+                        "logical") == 0)
+                    sparse.class_id = mxLOGICAL_CLASS;
+                else
+                    ymx_error("Unsupported !matlab/sparse class");
+                break;
+            case YMX_SPARSE_KEY_SIZE:
+                if (event->type != YAML_SEQUENCE_START_EVENT)
+                    ymx_error("!matlab/sparse size must be a sequence");
+                event = ymx_parse(parser);
+                number = ymx_read_number(event);
+                if (!ymx_is_size_number(number))
+                    ymx_error("!matlab/sparse size must be two "
+                            "nonnegative integers");
+                sparse.num_rows = (mwSize)number;
+                event = ymx_parse(parser);
+                number = ymx_read_number(event);
+                if (!ymx_is_size_number(number))
+                    ymx_error("!matlab/sparse size must be two "
+                            "nonnegative integers");
+                sparse.num_cols = (mwSize)number;
+                event = ymx_parse(parser);
+                if (event->type != YAML_SEQUENCE_END_EVENT)
+                    ymx_error("!matlab/sparse size must be two "
+                            "nonnegative integers");
+                sparse.have_size = 1;
+                break;
+            case YMX_SPARSE_KEY_NNZ:
+                number = ymx_read_number(event);
+                if (!ymx_is_size_number(number))
+                    ymx_error("!matlab/sparse nnz must be a nonnegative "
+                            "integer");
+                sparse.nnz = (size_t)number;
+                sparse.have_nnz = 1;
+                break;
+            default:
+                ymx_sparse_read_part(&sparse, key - YMX_SPARSE_KEY_JC,
+                        parser, event);
+        }
+
+        event = ymx_parse(parser);
+    }
+
+    int required = ((1 << YMX_SPARSE_NUM_KEYS) - 1)
+            & ~(1 << YMX_SPARSE_KEY_NNZ);
+    if ((sparse.seen & required) != required)
+        ymx_error("!matlab/sparse needs a class, size, jc, ir, and data");
+
+    /* Check the parts against the size and nnz before asking for memory
+     * for them: jc has a pointer per column and one more, and ir and data
+     * a value per nonzero */
+    size_t num_jc = ymx_sparse_pending_length(&sparse, YMX_SPARSE_PART_JC);
+    size_t num_ir = ymx_sparse_pending_length(&sparse, YMX_SPARSE_PART_IR);
+    if (num_jc == 0 || num_jc - 1 != sparse.num_cols)
+        ymx_error("Wrong number of values in !matlab/sparse");
+    if (sparse.have_nnz && sparse.nnz != num_ir)
+        ymx_error("Wrong number of values in !matlab/sparse");
+    sparse.nnz = num_ir;
+    if (ymx_sparse_pending_length(&sparse, YMX_SPARSE_PART_DATA)
+            != sparse.nnz)
+        ymx_error("Wrong number of values in !matlab/sparse");
+
+    if (sparse.class_id == mxLOGICAL_CLASS)
+        sparse.array = mxCreateSparseLogicalMatrix(
+                sparse.num_rows, sparse.num_cols, sparse.nnz);
+    else
+        sparse.array = mxCreateSparse(
+                sparse.num_rows, sparse.num_cols, sparse.nnz, mxREAL);
+
+    int part;
+    for (part=0; part<YMX_SPARSE_NUM_PARTS; part++) {
+        ymx_sparse_part_t *pending = sparse.parts + part;
+        if (pending->text) {
+            ymx_sparse_decode_part(&sparse, part,
+                    pending->text, pending->length);
+            mxFree(pending->text);
+        } else if (pending->values) {
+            size_t i;
+            for (i=0; i<pending->count; i++) {
+                ymx_sparse_set_value(&sparse, part, i, pending->values[i]);
+            }
+            mxFree(pending->values);
+        }
+    }
+
+    ymx_sparse_check(sparse.array, sparse.nnz);
+    return sparse.array;
+}
+
+/* Read a jc, ir or data part of a !matlab/sparse mapping, whose first
+ * event has just been parsed, into sparse->parts, to be stored once the
+ * matrix has been created */
+void ymx_sparse_read_part(
+        ymx_sparse_t *sparse,
+        int part,
+        yaml_parser_t *parser,
+        const yaml_event_t *event ) {
+    ymx_sparse_part_t *pending = sparse->parts + part;
+
+    if (event->type == YAML_SCALAR_EVENT) {
+        const char *tag = (char *)event->data.scalar.tag;
+        if (!tag || strcmp(tag, YMX_BINARY_TAG) != 0)
+            ymx_error("!matlab/sparse parts must be sequences or !!binary");
+        const char *text = (char *)event->data.scalar.value;
+        size_t length = event->data.scalar.length;
+        pending->text = mxMalloc(length + 1);
+        memcpy(pending->text, text, length + 1);
+        pending->length = length;
+        return;
+    }
+
+    if (event->type != YAML_SEQUENCE_START_EVENT)
+        ymx_error("!matlab/sparse parts must be sequences or !!binary");
+
+    size_t count = 0;
+    event = ymx_parse(parser);
+    while (event->type != YAML_SEQUENCE_END_EVENT) {
+        double value = ymx_read_number(event);
+        if (count == pending->capacity) {
+            pending->capacity = pending->capacity
+                    ? 2*pending->capacity : ARRAY_LIST_INITIAL_SIZE;
+            pending->values = mxRealloc(pending->values,
+                    pending->capacity * sizeof(double));
+        }
+        pending->values[count++] = value;
+        event = ymx_parse(parser);
+    }
+
+    pending->count = count;
+    if (!pending->values)
+        pending->values = mxMalloc(sizeof(double));
+}
+
+/* Decode a !!binary jc, ir or data part straight into the matrix */
+void ymx_sparse_decode_part(
+        ymx_sparse_t *sparse,
+        int part,
+        const char *text,
+        size_t length ) {
+    mxArray *array = sparse->array;
+    size_t count = ymx_sparse_part_length(sparse, part);
+    if (part == YMX_SPARSE_PART_DATA) {
+        ymx_base64_decode_elements(text, length, mxGetData(array),
+                count, mxGetElementSize(array));
+        return;
+    }
+
+    mwIndex *indices = part == YMX_SPARSE_PART_JC
+            ? mxGetJc(array) : mxGetIr(array);
+    if (sizeof(mwIndex) == sizeof(uint64_T)) {
+        ymx_base64_decode_elements(text, length, indices,
+                count, sizeof(uint64_T));
+    } else {
+        uint64_T *wide = mxMalloc((count ? count : 1) * sizeof(uint64_T));
+        ymx_base64_decode_elements(text, length, wide,
+                count, sizeof(uint64_T));
+        size_t i;
+        for (i=0; i<count; i++) {
+            if (wide[i] != (uint64_T)(mwIndex)wide[i])
+                ymx_error("!matlab/sparse index is too large");
+            indices[i] = (mwIndex)wide[i];
+        }
+        mxFree(wide);
+    }
+}
+
+/* Store one value of a jc, ir or data part in the matrix */
+void ymx_sparse_set_value(
+        ymx_sparse_t *sparse,
+        int part,
+        size_t ind,
+        double value ) {
+    mxArray *array = sparse->array;
+    if (part == YMX_SPARSE_PART_DATA) {
+        if (mxIsLogical(array))
+            mxGetLogicals(array)[ind] = (value != 0);
+        else
+            mxGetPr(array)[ind] = value;
+        return;
+    }
+
+    if (!ymx_is_size_number(value))
+        ymx_error("!matlab/sparse indices must be nonnegative integers");
+    mwIndex index = (mwIndex)value;
+    if (part == YMX_SPARSE_PART_JC)
+        mxGetJc(array)[ind] = index;
+    else
+        mxGetIr(array)[ind] = index;
+}
+
+/* Return the number of values a jc, ir or data part of the created
+ * matrix has */
+size_t ymx_sparse_part_length(const ymx_sparse_t *sparse, int part) {
+    if (part == YMX_SPARSE_PART_JC)
+        return sparse->num_cols + 1;
+    return sparse->nnz;
+}
+
+/* Return the number of values a jc, ir or data part was read with. Its
+ * class must be known. !!binary that doesn't hold a whole number of
+ * values is rounded down here, and rejected when decoded. */
+size_t ymx_sparse_pending_length(const ymx_sparse_t *sparse, int part) {
+    const ymx_sparse_part_t *pending = sparse->parts + part;
+    if (!pending->text)
+        return pending->count;
+
+    size_t element_size = sizeof(uint64_T);
+    if (part == YMX_SPARSE_PART_DATA)
+        element_size = sparse->class_id == mxLOGICAL_CLASS
+                ? sizeof(mxLogical) : sizeof(double);
+    return ymx_base64_decoded_length(pending->text, pending->length)
+            / element_size;
+}
+
+/* Check that the jc and ir arrays of a sparse matrix are consistent with
+ * its size and nnz nonzeros, as Matlab requires */
+void ymx_sparse_check(const mxArray *array, size_t nnz) {
+    mwIndex *jc = mxGetJc(array);
+    mwIndex *ir = mxGetIr(array);
+    mwSize num_rows = mxGetM(array);
+    mwSize num_cols = mxGetN(array);
+
+    if (jc[0] != 0 || jc[num_cols] != nnz)
+        ymx_error("Invalid column pointers in !matlab/sparse");
+    mwIndex col, k;
+    for (col=0; col<num_cols; col++) {
+        if (jc[col+1] < jc[col] || jc[col+1] > jc[num_cols])
+            ymx_error("Invalid column pointers in !matlab/sparse");
+        for (k=jc[col]; k<jc[col+1]; k++) {
+            if (ir[k] >= num_rows || (k > jc[col] && ir[k] <= ir[k-1]))
+                ymx_error("Invalid row indices in !matlab/sparse");
+        }
+    }
+}
+
+/* Whether number is a nonnegative whole number that an mwSize can hold.
+ * Casting a double that is out of range (or NaN) to an integer is
+ * undefined, so numbers from the input are checked with this first. */
+int ymx_is_size_number(double number) {
+    return number >= 0 && number < (double)(mwSize)-1
+            && number == (double)(mwSize)number;
+}
+
+/* Return the value of a scalar event that must be a number (or a bool) */
+double ymx_read_number(const yaml_event_t *event) {
+    double number = 0;
+    if (event->type != YAML_SCALAR_EVENT)
+        ymx_error("Expected a number");
+    switch (ymx_resolve_scalar(event, &number)) {
+        case YMX_SCALAR_KIND_NUMBER:
+        case YMX_SCALAR_KIND_BOOL:
+            return number;
+        default:
+            ymx_error("Expected a number");
+    }
+    return 0;
+}
+
+
+/*
+ * Scalar resolution
+ *************************************************************************/
+
+/* Resolve a scalar event according to the YAML core schema, as
+ * yaml_simple_construct does. Untagged plain scalars are resolved as null,
+ * bool, int, or float if they match, or as strings otherwise; untagged
+ * quoted scalars and scalars tagged !!str or ! are always strings. A
+ * scalar with an explicit core tag that its value doesn't match, or with
+ * any other tag, is an error. For bools and numbers, *number receives the
+ * value.
+ */
+ymx_scalar_kind_t ymx_resolve_scalar(
+        const yaml_event_t *event,
+        double *number ) {
+    const char *tag = (char *)event->data.scalar.tag;
+    const char *value = (char *)event->data.scalar.value;
+    size_t length = event->data.scalar.length;
+
+    int nonspecific = 0;
+    if (!tag) {
+        if (event->data.scalar.style != YAML_PLAIN_SCALAR_STYLE)
+            return YMX_SCALAR_KIND_STRING;
+        nonspecific = 1;
+    } else if (strcmp(tag, "!") == 0 || strcmp(tag, YMX_STR_TAG) == 0) {
+        return YMX_SCALAR_KIND_STRING;
+    }
+
+    if (nonspecific || strcmp(tag, YMX_NULL_TAG) == 0) {
+        if (ymx_match_null(value, length))
+            return YMX_SCALAR_KIND_NULL;
+        if (!nonspecific)
+            ymx_error("Scalar value didn't match its tag!");
+    }
+
+    if (nonspecific || strcmp(tag, YMX_BOOL_TAG) == 0) {
+        if (ymx_match_bool(value, number))
+            return YMX_SCALAR_KIND_BOOL;
+        if (!nonspecific)
+            ymx_error("Scalar value didn't match its tag!");
+    }
+
+    if (nonspecific || strcmp(tag, YMX_INT_TAG) == 0) {
+        if (ymx_match_int(value, length, number))
+            return YMX_SCALAR_KIND_NUMBER;
+        if (!nonspecific)
+            ymx_error("Scalar value didn't match its tag!");
+    }
+
+    if (nonspecific || strcmp(tag, YMX_FLOAT_TAG) == 0) {
+        if (ymx_match_float(value, length, number))
+            return YMX_SCALAR_KIND_NUMBER;
+        if (!nonspecific)
+            ymx_error("Scalar value didn't match its tag!");
+    }
+
+    if (!nonspecific)
+        ymx_error("Unrecognized tag");
+
+    return YMX_SCALAR_KIND_STRING;
+}
+
+/* Returns 1 iff name is a valid Matlab struct field name: a letter
+ * followed by letters, digits, or underscores, no longer than
+ * YMX_MAX_FIELD_NAME_LENGTH characters.
+ */
+int ymx_is_valid_field_name(const char *name, size_t length) {
+    if (length == 0 || length > YMX_MAX_FIELD_NAME_LENGTH)
+        return 0;
+
+    if (!((name[0] >= 'a' && name[0] <= 'z')
+            || (name[0] >= 'A' && name[0] <= 'Z')))
+        return 0;
+
+    size_t i;
+    for (i=1; i<length; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                || (c >= '0' && c <= '9') || c == '_'))
+            return 0;
+    }
+
+    return 1;
+}
+
+int ymx_match_null(const char *value, size_t length) {
+    return length == 0
+            || strcmp(value, "~") == 0
+            || strcmp(value, "null") == 0
+            || strcmp(value, "Null") == 0
+            || strcmp(value, "NULL") == 0;
+}
+
+int ymx_match_bool(const char *value, double *number) {
+    if ( strcmp(value, "true") == 0
+            || strcmp(value, "True") == 0
+            || strcmp(value, "TRUE") == 0 ) {
+        *number = 1;
+        return 1;
+    }
+    if ( strcmp(value, "false") == 0
+            || strcmp(value, "False") == 0
+            || strcmp(value, "FALSE") == 0 ) {
+        *number = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/* Matches decimal (^[-+]?[0-9]+$), hexadecimal (^0x[0-9a-fA-F]+$), and
+ * octal (^0o[0-7]+$) integers. */
+int ymx_match_int(const char *value, size_t length, double *number) {
+    size_t i = 0;
+    if (length > 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'o')) {
+        int base = (value[1] == 'x') ? 16 : 8;
+        double result = 0;
+        for (i=2; i<length; i++) {
+            char c = value[i];
+            int digit;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (base == 16 && c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else if (base == 16 && c >= 'A' && c <= 'F')
+                digit = c - 'A' + 10;
+            else
+                return 0;
+            if (digit >= base)
+                return 0;
+            result = result*base + digit;
+        }
+        *number = result;
+        return 1;
+    }
+
+    if (i < length && (value[i] == '-' || value[i] == '+'))
+        i++;
+    if (i == length)
+        return 0;
+    for (; i<length; i++) {
+        if (value[i] < '0' || value[i] > '9')
+            return 0;
+    }
+    *number = strtod(value, NULL);
+    return 1;
+}
+
+/* Matches ^[-+]?(\.[0-9]+|[0-9]+(\.[0-9]*)?)([eE][-+]?[0-9]+)?$ and the
+ * special values [-+]?.inf and .nan (in the three YAML capitalizations).
+ */
+int ymx_match_float(const char *value, size_t length, double *number) {
+    size_t i = 0;
+    int negative = 0;
+    if (i < length && (value[i] == '-' || value[i] == '+')) {
+        negative = (value[i] == '-');
+        i++;
+    }
+
+    const char *rest = value + i;
+    if ( strcmp(rest, ".inf") == 0
+            || strcmp(rest, ".Inf") == 0
+            || strcmp(rest, ".INF") == 0 ) {
+        *number = negative ? -mxGetInf() : mxGetInf();
+        return 1;
+    }
+    if ( strcmp(value, ".nan") == 0
+            || strcmp(value, ".NaN") == 0
+            || strcmp(value, ".NAN") == 0 ) {
+        *number = mxGetNaN();
+        return 1;
+    }
+
+    size_t num_digits = 0;
+    while (i < length && value[i] >= '0' && value[i] <= '9') {
+        i++;
+        num_digits++;
+    }
+    if (i < length && value[i] == '.') {
+        i++;
+        size_t num_fraction_digits = 0;
+        while (i < length && value[i] >= '0' && value[i] <= '9') {
+            i++;
+            num_fraction_digits++;
+        }
+        /* ".5" and "5." are fine, "." is not */
+        if (num_digits == 0 && num_fraction_digits == 0)
+            return 0;
+    } else if (num_digits == 0) {
+        return 0;
+    }
+    if (i < length && (value[i] == 'e' || value[i] == 'E')) {
+        i++;
+        if (i < length && (value[i] == '-' || value[i] == '+'))
+            i++;
+        if (i == length)
+            return 0;
+        while (i < length && value[i] >= '0' && value[i] <= '9')
+            i++;
+    }
+    if (i != length)
+        return 0;
+
+    *number = strtod(value, NULL);
+    return 1;
+}
+
+
+/*
+ * ymx_fields and ymx_array_list functions
+ *************************************************************************/
+
+void ymx_fields_init(ymx_fields_t *fields) {
+    memset(fields, 0, sizeof(ymx_fields_t));
+}
+
+void ymx_fields_delete(ymx_fields_t *fields) {
+    size_t i;
+    for (i=0; i<fields->capacity; i++) {
+        if (fields->keys[i])
+            mxFree(fields->keys[i]);
+    }
+    if (fields->keys)
+        mxFree(fields->keys);
+    if (fields->values)
+        mxFree(fields->values);
+    memset(fields, 0, sizeof(ymx_fields_t));
+}
+
+void ymx_array_list_init(ymx_array_list_t *list) {
+    memset(list, 0, sizeof(ymx_array_list_t));
+}
+
+void ymx_array_list_append(ymx_array_list_t *list, mxArray *item) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity
+                ? 2*list->capacity : ARRAY_LIST_INITIAL_SIZE;
+        list->items = mxRealloc(list->items,
+                list->capacity * sizeof(mxArray *));
+    }
+    list->items[list->count++] = item;
+}
+
+void ymx_array_list_delete(ymx_array_list_t *list) {
+    if (list->items)
+        mxFree(list->items);
+    memset(list, 0, sizeof(ymx_array_list_t));
+}
@@ -0,0 +1,541 @@
+#include "yaml_mex_util.h"
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define YMX_EMITTER_SSE2
+#endif
+
+/* NOTES
+ *
+ * A fast path for yaml_mex('dump_simple'). The events that
+ * yaml_mex_compose.c hands to libyaml already fix every style and tag, but
+ * libyaml still analyzes each scalar a character at a time to choose how
+ * to write it, and steps each event through its state machine. This file
+ * writes the same YAML straight into the output buffer instead. It follows
+ * libyaml's emitter (its indentation, its line wrapping at 80 columns and
+ * its spacing around indicators) for the little of YAML that simple
+ * composition produces, so the output is the same byte for byte:
+ *   - strings are single-quoted, with ' doubled, and folded at a space
+ *     once a line has passed 80 columns (but keys never are);
+ *   - numbers and bools are plain, and numeric arrays are flow sequences,
+ *     wrapped before any item that starts past column 80;
+ *   - cell arrays and struct arrays are block sequences (indentless under
+ *     a key), scalar structs are block mappings, and empty ones are [] and
+ *     {}; empty arrays are empty plain scalars.
+ *
+ * Anything else -- a document that is a lone scalar, strings with
+ * characters other than printable ASCII, !!binary and typed arrays,
+ * sparse matrices, tables, data nested more than EMITTER_MAX_DEPTH deep,
+ * and anything that can't be composed at all -- makes the fast emitter
+ * give up, and the whole document is composed again through libyaml (so
+ * errors are reported from there, too). The check and narrowing of a
+ * string's characters is the inner loop; with SSE2 it handles 8
+ * characters at a time.
+ *
+ * Writers keep using libyaml, since their emitter carries its state from
+ * one document to the next. yaml_mex('emitter', 'libyaml') turns the fast
+ * path off for dump_simple too.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+/* The state of libyaml's emitter that matters for our subset */
+typedef struct ymx_fast_emitter_s {
+    ymx_buffer_t *buffer;
+    int flags;
+    long indent;                /* -1 outside any collection */
+    size_t column;
+    int whitespace;             /* Last character written was whitespace */
+    int indention;              /* Only indentation so far on this line */
+    size_t depth;               /* Cell arrays and structs open */
+
+    char *text;                 /* A string's characters, as bytes */
+    size_t text_size;
+} ymx_fast_emitter_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+/* libyaml's defaults, which ymx_init_emitter leaves alone */
+const size_t EMITTER_BEST_WIDTH = 80;
+const long EMITTER_BEST_INDENT = 2;
+
+/* libyaml writes longer keys as complex keys, with '?' */
+const size_t EMITTER_MAX_SIMPLE_KEY_LENGTH = 128;
+
+const size_t EMITTER_TEXT_INITIAL_SIZE = 256;
+
+/* The fast emitter recurses, so deeper data is left to the composer */
+const size_t EMITTER_MAX_DEPTH = 256;
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+static int fast_emitter_enabled = 1;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+int ymx_write_node(ymx_fast_emitter_t *e, const mxArray *data,
+        int mapping_context);
+int ymx_write_string(ymx_fast_emitter_t *e, const mxArray *data);
+int ymx_write_numeric(ymx_fast_emitter_t *e, const mxArray *data);
+void ymx_write_numeric_element(ymx_fast_emitter_t *e, const mxArray *data,
+        mwIndex ind);
+int ymx_write_cell(ymx_fast_emitter_t *e, const mxArray *data,
+        int mapping_context);
+int ymx_write_struct(ymx_fast_emitter_t *e, const mxArray *data,
+        int mapping_context);
+int ymx_write_mapping(ymx_fast_emitter_t *e, const mxArray *data,
+        mwIndex ind);
+
+void ymx_write_quoted(ymx_fast_emitter_t *e, const char *text,
+        size_t length, int allow_breaks);
+void ymx_write_plain(ymx_fast_emitter_t *e, const char *text,
+        size_t length);
+void ymx_write_indicator(ymx_fast_emitter_t *e, const char *indicator,
+        int need_whitespace, int is_whitespace, int is_indention);
+void ymx_write_indent(ymx_fast_emitter_t *e);
+long ymx_write_increase_indent(ymx_fast_emitter_t *e, int flow,
+        int indentless);
+void ymx_write_bytes(ymx_fast_emitter_t *e, const char *bytes,
+        size_t length);
+void ymx_write_char(ymx_fast_emitter_t *e, char c);
+
+int ymx_write_narrow(const mxChar *chars, size_t length, char *text);
+int ymx_write_is_printable(const char *text, size_t length);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+mxArray *ymx_get_emitter() {
+    return mxCreateString(fast_emitter_enabled ? "fast" : "libyaml");
+}
+
+/* Choose the emitter for later simple dumps: 'fast' (the default) or
+ * 'libyaml'. The choice lasts until the MEX-file is cleared. */
+void ymx_set_emitter(const mxArray *mode) {
+    char *mode_str = mxIsChar(mode) ? mxArrayToString(mode) : NULL;
+    if (mode_str && strcmp(mode_str, "fast") == 0) {
+        fast_emitter_enabled = 1;
+    } else if (mode_str && strcmp(mode_str, "libyaml") == 0) {
+        fast_emitter_enabled = 0;
+    } else {
+        mxFree(mode_str);
+        ymx_error("Emitter must be 'libyaml' or 'fast'");
+    }
+    mxFree(mode_str);
+}
+
+
+/*
+ * Internal interface, for ymx_compose_stream
+ *************************************************************************/
+
+/* Write data to buffer as a stream of one document with implicit start and
+ * end, exactly as composing it through libyaml would. Returns whether it
+ * did; if not, the buffer is as it was, and the document should be
+ * composed through libyaml. flags are as for ymx_compose_document. */
+int ymx_fast_compose_stream(ymx_buffer_t *buffer, const mxArray *data,
+        int flags) {
+    if (!fast_emitter_enabled)
+        return 0;
+
+    /* A document that is a lone scalar is short, and libyaml ends one by
+     * its own rules, so those are left to it */
+    if (!mxIsCell(data) && !mxIsStruct(data)
+            && (mxIsChar(data) || mxIsEmpty(data)
+                || mxGetNumberOfElements(data) == 1))
+        return 0;
+
+    ymx_fast_emitter_t e;
+    memset(&e, 0, sizeof(e));
+    e.buffer = buffer;
+    e.flags = flags;
+    e.indent = -1;
+    e.whitespace = 1;
+    e.indention = 1;
+
+    size_t start = buffer->used_size;
+    int ok = ymx_write_node(&e, data, 0);
+    if (ok) {
+        /* The implicit document end breaks the last line */
+        ymx_write_indent(&e);
+    } else {
+        buffer->used_size = start;
+    }
+
+    if (e.text)
+        mxFree(e.text);
+    return ok;
+}
+
+
+/*
+ * Functions for writing nodes
+ *************************************************************************/
+
+/* Write data as ymx_compose_node would compose it, or return 0 if this
+ * file doesn't handle it. mapping_context is whether data is the value of
+ * a mapping. */
+int ymx_write_node(ymx_fast_emitter_t *e, const mxArray *data,
+        int mapping_context) {
+    if (mxIsChar(data)) {
+        return ymx_write_string(e, data);
+    } else if (mxIsCell(data)) {
+        return ymx_write_cell(e, data, mapping_context);
+    } else if (mxIsClass(data, "table")) {
+        return 0;
+    } else if (mxIsEmpty(data)) {
+        ymx_write_plain(e, "", 0);
+        return 1;
+    } else if (mxIsNumeric(data) || mxIsLogical(data)) {
+        return ymx_write_numeric(e, data);
+    } else if (mxIsStruct(data)) {
+        return ymx_write_struct(e, data, mapping_context);
+    }
+    return 0;
+}
+
+int ymx_write_string(ymx_fast_emitter_t *e, const mxArray *data) {
+    if (!mxIsEmpty(data) && (mxGetNumberOfDimensions(data) != 2
+            || mxGetM(data) != 1))
+        return 0;
+
+    size_t length = mxGetNumberOfElements(data);
+    if (length > e->text_size) {
+        size_t new_size = e->text_size
+                ? e->text_size : EMITTER_TEXT_INITIAL_SIZE;
+        while (new_size < length)
+            new_size *= 2;
+        if (e->text)
+            mxFree(e->text);
+        e->text = mxMalloc(new_size);
+        e->text_size = new_size;
+    }
+    if (!ymx_write_narrow(mxGetChars(data), length, e->text))
+        return 0;
+
+    ymx_write_quoted(e, e->text, length, 1);
+    return 1;
+}
+
+/* As ymx_compose_numeric, leaving out everything but plain scalars and
+ * flow sequences */
+int ymx_write_numeric(ymx_fast_emitter_t *e, const mxArray *data) {
+    int is_scalar = (mxGetNumberOfElements(data) == 1);
+    if (mxIsSparse(data) || mxIsComplex(data))
+        return 0;
+    if ((e->flags & YMX_COMPOSE_TYPED_ARRAYS)
+            && !(is_scalar && (mxIsDouble(data) || mxIsLogical(data))))
+        return 0;
+
+    if (is_scalar) {
+        ymx_write_numeric_element(e, data, 0);
+        return 1;
+    }
+
+    if (mxIsUint8(data) || (mxIsNumeric(data)
+            && (e->flags & YMX_COMPOSE_BINARY_NUMERIC)))
+        return 0;
+
+    ymx_write_indicator(e, "[", 1, 1, 0);
+    long indent = ymx_write_increase_indent(e, 1, 0);
+    mwSize size = mxGetNumberOfElements(data);
+    mwIndex ind;
+    for (ind=0; ind<size; ind++) {
+        if (ind)
+            ymx_write_indicator(e, ",", 0, 0, 0);
+        if (e->column > EMITTER_BEST_WIDTH)
+            ymx_write_indent(e);
+        ymx_write_numeric_element(e, data, ind);
+    }
+    e->indent = indent;
+    ymx_write_indicator(e, "]", 0, 0, 0);
+    return 1;
+}
+
+void ymx_write_numeric_element(ymx_fast_emitter_t *e, const mxArray *data,
+        mwIndex ind) {
+    if (mxIsLogical(data)) {
+        if (mxGetLogicals(data)[ind])
+            ymx_write_plain(e, "true", 4);
+        else
+            ymx_write_plain(e, "false", 5);
+        return;
+    }
+
+    char buffer[YMX_NUMBER_STRING_SIZE];
+    size_t length = ymx_format_numeric(buffer, data, ind);
+    ymx_write_plain(e, buffer, length);
+}
+
+int ymx_write_cell(ymx_fast_emitter_t *e, const mxArray *data,
+        int mapping_context) {
+    mwSize size = mxGetNumberOfElements(data);
+    if (!size) {
+        ymx_write_indicator(e, "[", 1, 1, 0);
+        ymx_write_indicator(e, "]", 0, 0, 0);
+        return 1;
+    }
+    if (++e->depth > EMITTER_MAX_DEPTH)
+        return 0;
+
+    long indent = ymx_write_increase_indent(e, 0,
+            mapping_context && !e->indention);
+    mwIndex ind;
+    for (ind=0; ind<size; ind++) {
+        ymx_write_indent(e);
+        ymx_write_indicator(e, "-", 1, 0, 1);
+        const mxArray *item = mxGetCell(data, ind);
+        if (item) {
+            if (!ymx_write_node(e, item, 0))
+                return 0;
+        } else {
+            ymx_write_plain(e, "", 0);
+        }
+    }
+    e->indent = indent;
+    e->depth--;
+    return 1;
+}
+
+/* Scalar structs become mappings, and struct arrays (which aren't empty,
+ * or they'd be null) block sequences of mappings */
+int ymx_write_struct(ymx_fast_emitter_t *e, const mxArray *data,
+        int mapping_context) {
+    int num_fields = mxGetNumberOfFields(data);
+    mwSize size = mxGetNumberOfElements(data);
+    int field;
+    for (field=0; field<num_fields; field++) {
+        const char *name = mxGetFieldNameByNumber(data, field);
+        size_t length = strlen(name);
+        if (length > EMITTER_MAX_SIMPLE_KEY_LENGTH
+                || !ymx_write_is_printable(name, length))
+            return 0;
+    }
+
+    if (++e->depth > EMITTER_MAX_DEPTH)
+        return 0;
+    if (size == 1) {
+        if (!ymx_write_mapping(e, data, 0))
+            return 0;
+        e->depth--;
+        return 1;
+    }
+
+    long indent = ymx_write_increase_indent(e, 0,
+            mapping_context && !e->indention);
+    mwIndex ind;
+    for (ind=0; ind<size; ind++) {
+        ymx_write_indent(e);
+        ymx_write_indicator(e, "-", 1, 0, 1);
+        if (!ymx_write_mapping(e, data, ind))
+            return 0;
+    }
+    e->indent = indent;
+    e->depth--;
+    return 1;
+}
+
+/* Write element ind of a struct array as a mapping; its field names have
+ * been checked by ymx_write_struct. */
+int ymx_write_mapping(ymx_fast_emitter_t *e, const mxArray *data,
+        mwIndex ind) {
+    int num_fields = mxGetNumberOfFields(data);
+    if (!num_fields) {
+        ymx_write_indicator(e, "{", 1, 1, 0);
+        ymx_write_indicator(e, "}", 0, 0, 0);
+        return 1;
+    }
+
+    long indent = ymx_write_increase_indent(e, 0, 0);
+    int field;
+    for (field=0; field<num_fields; field++) {
+        const char *name = mxGetFieldNameByNumber(data, field);
+        ymx_write_indent(e);
+        ymx_write_quoted(e, name, strlen(name), 0);
+        ymx_write_indicator(e, ":", 0, 0, 0);
+        const mxArray *value = mxGetFieldByNumber(data, ind, field);
+        if (value) {
+            if (!ymx_write_node(e, value, 1))
+                return 0;
+        } else {
+            ymx_write_plain(e, "", 0);
+        }
+    }
+    e->indent = indent;
+    return 1;
+}
+
+
+/*
+ * Functions for writing scalars and indicators, after libyaml's
+ *************************************************************************/
+
+/* Write text (all printable ASCII) as a single-quoted scalar. Unless it's
+ * a key, allow_breaks lets a space be written as a line break, as libyaml
+ * does once the line is past the best width. */
+void ymx_write_quoted(ymx_fast_emitter_t *e, const char *text,
+        size_t length, int allow_breaks) {
+    long indent = ymx_write_increase_indent(e, 1, 0);
+    ymx_write_indicator(e, "'", 1, 0, 0);
+
+    /* No break can come within the best width, so without quotes to
+     * double, most strings are copied as they are. (An empty string's
+     * text may be NULL, which memchr mustn't see even with no length.) */
+    if (length == 0) {
+        /* Just the quotes */
+    } else if (!memchr(text, '\'', length) && (!allow_breaks
+            || e->column + length <= EMITTER_BEST_WIDTH
+            || !memchr(text, ' ', length))) {
+        ymx_write_bytes(e, text, length);
+    } else {
+        int spaces = 0;
+        size_t i;
+        for (i=0; i<length; i++) {
+            if (text[i] == ' ') {
+                if (allow_breaks && !spaces
+                        && e->column > EMITTER_BEST_WIDTH
+                        && i != 0 && i != length - 1 && text[i+1] != ' ')
+                    ymx_write_indent(e);
+                else
+                    ymx_write_char(e, ' ');
+                spaces = 1;
+            } else {
+                if (text[i] == '\'')
+                    ymx_write_char(e, '\'');
+                ymx_write_char(e, text[i]);
+                e->indention = 0;
+                spaces = 0;
+            }
+        }
+    }
+
+    ymx_write_indicator(e, "'", 0, 0, 0);
+    e->whitespace = 0;
+    e->indention = 0;
+    e->indent = indent;
+}
+
+/* Write a plain scalar that needs no analysis: a number, a bool or the
+ * empty null. */
+void ymx_write_plain(ymx_fast_emitter_t *e, const char *text,
+        size_t length) {
+    if (!length) {
+        /* Nothing at all in block context, not even a space */
+        e->whitespace = 0;
+        e->indention = 0;
+        return;
+    }
+    if (!e->whitespace)
+        ymx_write_char(e, ' ');
+    ymx_write_bytes(e, text, length);
+    e->whitespace = 0;
+    e->indention = 0;
+}
+
+void ymx_write_indicator(ymx_fast_emitter_t *e, const char *indicator,
+        int need_whitespace, int is_whitespace, int is_indention) {
+    if (need_whitespace && !e->whitespace)
+        ymx_write_char(e, ' ');
+    ymx_write_bytes(e, indicator, strlen(indicator));
+    e->whitespace = is_whitespace;
+    e->indention = e->indention && is_indention;
+}
+
+/* Start a new line at the current indent, unless this line is already
+ * just indentation that reaches no further than it */
+void ymx_write_indent(ymx_fast_emitter_t *e) {
+    size_t indent = e->indent >= 0 ? (size_t)e->indent : 0;
+    if (!e->indention || e->column > indent
+            || (e->column == indent && !e->whitespace)) {
+        ymx_write_char(e, '\n');
+        e->column = 0;
+    }
+    if (e->column < indent) {
+        char *out = ymx_buffer_reserve(e->buffer, indent - e->column);
+        memset(out, ' ', indent - e->column);
+        e->buffer->used_size += indent - e->column;
+        e->column = indent;
+    }
+    e->whitespace = 1;
+    e->indention = 1;
+}
+
+/* Indent for a new collection or scalar, returning the indent to restore
+ * after it */
+long ymx_write_increase_indent(ymx_fast_emitter_t *e, int flow,
+        int indentless) {
+    long indent = e->indent;
+    if (e->indent < 0)
+        e->indent = flow ? EMITTER_BEST_INDENT : 0;
+    else if (!indentless)
+        e->indent += EMITTER_BEST_INDENT;
+    return indent;
+}
+
+void ymx_write_bytes(ymx_fast_emitter_t *e, const char *bytes,
+        size_t length) {
+    if (length == 0)
+        return;
+    char *out = ymx_buffer_reserve(e->buffer, length);
+    memcpy(out, bytes, length);
+    e->buffer->used_size += length;
+    e->column += length;
+}
+
+void ymx_write_char(ymx_fast_emitter_t *e, char c) {
+    char *out = ymx_buffer_reserve(e->buffer, 1);
+    *out = c;
+    e->buffer->used_size++;
+    e->column++;
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+/* Copy length characters to text as bytes, returning 0 as soon as one
+ * isn't printable ASCII */
+int ymx_write_narrow(const mxChar *chars, size_t length, char *text) {
+    size_t i = 0;
+#ifdef YMX_EMITTER_SSE2
+    const __m128i space = _mm_set1_epi16(' ');
+    const __m128i tilde = _mm_set1_epi16('~');
+    for (; i + 8 <= length; i += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(chars + i));
+        /* Signed, so characters of 0x8000 and up count as below ' ' too */
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi16(c, space),
+                _mm_cmpgt_epi16(c, tilde));
+        if (_mm_movemask_epi8(bad))
+            return 0;
+        _mm_storel_epi64((__m128i *)(text + i), _mm_packus_epi16(c, c));
+    }
+#endif
+    for (; i < length; i++) {
+        if (chars[i] < ' ' || chars[i] > '~')
+            return 0;
+        text[i] = (char)chars[i];
+    }
+    return 1;
+}
+
+int ymx_write_is_printable(const char *text, size_t length) {
+    size_t i;
+    for (i=0; i<length; i++) {
+        if (text[i] < ' ' || text[i] > '~')
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,321 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * Raw event export: every libyaml event of a stream becomes one row of a
+ * set of columns, so that custom constructors can work on the event
+ * stream with vectorized Matlab code rather than with the node tree of
+ * ymx_load_stream or a callback per event. Events are split into batches
+ * of at most batch_size rows, each a scalar struct of N-by-1 columns.
+ * Scalar values, tags and anchors are not stored as separate strings;
+ * instead each batch has one char buffer, text, holding them end to end,
+ * and the columns hold each string's start and length in that buffer.
+ *
+ * Columns are built in mxMalloc'd storage that grows geometrically and is
+ * handed over to the output arrays when a batch is finished, so the cost
+ * is O(1) amortized per event and there is no per-event mxArray.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef enum ymx_event_int_field_e {
+    YMX_EVENT_FIELD_TYPE,
+    YMX_EVENT_FIELD_STYLE,
+    YMX_EVENT_FIELD_IMPLICIT,
+    YMX_EVENT_NUM_INT_FIELDS
+} ymx_event_int_field_t;
+
+typedef enum ymx_event_index_field_e {
+    YMX_EVENT_FIELD_START_INDEX,
+    YMX_EVENT_FIELD_END_INDEX,
+    YMX_EVENT_FIELD_VALUE_START,
+    YMX_EVENT_FIELD_VALUE_LENGTH,
+    YMX_EVENT_FIELD_TAG_START,
+    YMX_EVENT_FIELD_TAG_LENGTH,
+    YMX_EVENT_FIELD_ANCHOR_START,
+    YMX_EVENT_FIELD_ANCHOR_LENGTH,
+    YMX_EVENT_NUM_INDEX_FIELDS
+} ymx_event_index_field_t;
+
+typedef struct ymx_event_batch_s {
+    size_t count;
+    size_t capacity;
+    int32_T *ints[YMX_EVENT_NUM_INT_FIELDS];
+    double *indices[YMX_EVENT_NUM_INDEX_FIELDS];
+    mxChar *text;
+    size_t text_length;
+    size_t text_capacity;
+} ymx_event_batch_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+/* Field names of a batch: the int32 columns, then the double columns,
+ * then the text buffer, in the order of the enums above. */
+const char *YMX_EVENT_FIELD_STRS[] = {
+    "type", "style", "implicit",
+    "start_index", "end_index",
+    "value_start", "value_length",
+    "tag_start", "tag_length",
+    "anchor_start", "anchor_length",
+    "text"
+};
+const int YMX_EVENT_NUM_FIELDS =
+        YMX_EVENT_NUM_INT_FIELDS + YMX_EVENT_NUM_INDEX_FIELDS + 1;
+
+const size_t EVENT_BATCH_INITIAL_SIZE = 256;
+const size_t EVENT_TEXT_INITIAL_SIZE = 4096;
+const size_t EVENT_BATCH_LIST_INITIAL_SIZE = 8;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+void ymx_event_batch_append(ymx_event_batch_t *batch,
+        const yaml_event_t *event);
+void ymx_event_batch_append_string(ymx_event_batch_t *batch,
+        const yaml_char_t *str, size_t length,
+        ymx_event_index_field_t start_field);
+void ymx_event_batch_reserve_text(ymx_event_batch_t *batch, size_t size);
+void ymx_event_batch_to_struct(ymx_event_batch_t *batch,
+        mxArray *batches, mwIndex ind);
+
+
+/*
+ * Main interface function
+ *************************************************************************/
+
+/* Parse a YAML stream and return its events as a 1-by-K struct array of
+ * batches, each holding at most batch_size events (batch_size == 0 means
+ * all events go in one batch). See yaml_mex.m for the batch fields.
+ */
+mxArray *ymx_load_events(const mxArray *yaml_stream, size_t batch_size) {
+    ymx_debug_msg("Entering ymx_load_events\n");
+    char *yaml_cstr = mxArrayToString(yaml_stream);
+
+    yaml_parser_t *parser = ymx_init_parser();
+    ymx_set_libyaml_input(parser, yaml_cstr, strlen(yaml_cstr));
+
+    size_t batches_size = EVENT_BATCH_LIST_INITIAL_SIZE;
+    ymx_event_batch_t *batches =
+            mxCalloc(batches_size, sizeof(ymx_event_batch_t));
+    ymx_event_batch_t *batch = batches;
+    size_t num_batches = 1;
+
+    const yaml_event_t *event;
+    do {
+        event = ymx_parse(parser);
+        if (batch_size && batch->count == batch_size) {
+            if (num_batches == batches_size) {
+                batches_size *= 2;
+                batches = mxRealloc(batches,
+                        batches_size * sizeof(ymx_event_batch_t));
+            }
+            batch = batches + num_batches;
+            memset(batch, 0, sizeof(ymx_event_batch_t));
+            num_batches++;
+        }
+        ymx_event_batch_append(batch, event);
+    } while (event->type != YAML_STREAM_END_EVENT);
+
+    mxArray *result = mxCreateStructMatrix(1, num_batches,
+            YMX_EVENT_NUM_FIELDS, YMX_EVENT_FIELD_STRS);
+    size_t i;
+    for (i=0; i<num_batches; i++) {
+        ymx_event_batch_to_struct(batches + i, result, i);
+    }
+
+    mxFree(batches);
+    mxFree(yaml_cstr);
+    ymx_debug_msg("Exiting ymx_load_events\n");
+    return result;
+}
+
+
+/*
+ * ymx_event_batch functions
+ *************************************************************************/
+
+void ymx_event_batch_append(ymx_event_batch_t *batch,
+        const yaml_event_t *event) {
+    int i;
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity
+                ? 2*batch->capacity : EVENT_BATCH_INITIAL_SIZE;
+        for (i=0; i<YMX_EVENT_NUM_INT_FIELDS; i++) {
+            batch->ints[i] = mxRealloc(batch->ints[i],
+                    batch->capacity * sizeof(int32_T));
+        }
+        for (i=0; i<YMX_EVENT_NUM_INDEX_FIELDS; i++) {
+            batch->indices[i] = mxRealloc(batch->indices[i],
+                    batch->capacity * sizeof(double));
+        }
+    }
+
+    size_t row = batch->count;
+    int32_T style = 0;
+    int32_T implicit = 0;
+    const yaml_char_t *anchor = NULL;
+    const yaml_char_t *tag = NULL;
+
+    /* Strings default to absent (start 0, length 0) */
+    for (i=YMX_EVENT_FIELD_VALUE_START; i<YMX_EVENT_NUM_INDEX_FIELDS; i++) {
+        batch->indices[i][row] = 0;
+    }
+
+    switch (event->type) {
+        case YAML_DOCUMENT_START_EVENT:
+            implicit = event->data.document_start.implicit;
+            break;
+        case YAML_DOCUMENT_END_EVENT:
+            implicit = event->data.document_end.implicit;
+            break;
+        case YAML_ALIAS_EVENT:
+            anchor = event->data.alias.anchor;
+            break;
+        case YAML_SCALAR_EVENT:
+            anchor = event->data.scalar.anchor;
+            tag = event->data.scalar.tag;
+            style = event->data.scalar.style;
+            if (event->data.scalar.plain_implicit) {
+                implicit = YMX_SCALAR_IMPLICIT_PLAIN;
+            } else if (event->data.scalar.quoted_implicit) {
+                implicit = YMX_SCALAR_IMPLICIT_QUOTED;
+            } else {
+                implicit = YMX_SCALAR_IMPLICIT_FALSE;
+            }
+            ymx_event_batch_append_string(batch, event->data.scalar.value,
+                    event->data.scalar.length, YMX_EVENT_FIELD_VALUE_START);
+            break;
+        case YAML_SEQUENCE_START_EVENT:
+            anchor = event->data.sequence_start.anchor;
+            tag = event->data.sequence_start.tag;
+            style = event->data.sequence_start.style;
+            implicit = event->data.sequence_start.implicit;
+            break;
+        case YAML_MAPPING_START_EVENT:
+            anchor = event->data.mapping_start.anchor;
+            tag = event->data.mapping_start.tag;
+            style = event->data.mapping_start.style;
+            implicit = event->data.mapping_start.implicit;
+            break;
+        default:
+            break;
+    }
+
+    if (tag) {
+        ymx_event_batch_append_string(batch, tag, strlen((char *)tag),
+                YMX_EVENT_FIELD_TAG_START);
+    }
+    if (anchor) {
+        ymx_event_batch_append_string(batch, anchor, strlen((char *)anchor),
+                YMX_EVENT_FIELD_ANCHOR_START);
+    }
+
+    batch->ints[YMX_EVENT_FIELD_TYPE][row] = event->type;
+    batch->ints[YMX_EVENT_FIELD_STYLE][row] = style;
+    batch->ints[YMX_EVENT_FIELD_IMPLICIT][row] = implicit;
+    batch->indices[YMX_EVENT_FIELD_START_INDEX][row] =
+            (double)event->start_mark.index + 1;
+    batch->indices[YMX_EVENT_FIELD_END_INDEX][row] =
+            (double)event->end_mark.index;
+    batch->count++;
+}
+
+/* Append a UTF-8 string to the batch's text, decoded to Matlab's UTF-16
+ * chars, and record its 1-based start and its length (both in chars) in
+ * the current row's start_field and the length field that follows it. */
+void ymx_event_batch_append_string(ymx_event_batch_t *batch,
+        const yaml_char_t *str, size_t length,
+        ymx_event_index_field_t start_field) {
+    /* A UTF-8 string never decodes to more UTF-16 units than it has bytes */
+    ymx_event_batch_reserve_text(batch, batch->text_length + length);
+
+    size_t start = batch->text_length;
+    mxChar *out = batch->text + start;
+    size_t i = 0;
+    while (i < length) {
+        unsigned int c = str[i];
+        if (c < 0x80) {
+            *out++ = (mxChar)c;
+            i += 1;
+        } else if (c < 0xE0 && i + 1 < length) {
+            *out++ = (mxChar)(((c & 0x1F) << 6) | (str[i+1] & 0x3F));
+            i += 2;
+        } else if (c < 0xF0 && i + 2 < length) {
+            *out++ = (mxChar)(((c & 0x0F) << 12)
+                    | ((str[i+1] & 0x3F) << 6) | (str[i+2] & 0x3F));
+            i += 3;
+        } else if (i + 3 < length) {
+            unsigned long code = ((unsigned long)(c & 0x07) << 18)
+                    | ((str[i+1] & 0x3F) << 12)
+                    | ((str[i+2] & 0x3F) << 6) | (str[i+3] & 0x3F);
+            code -= 0x10000;
+            *out++ = (mxChar)(0xD800 | (code >> 10));
+            *out++ = (mxChar)(0xDC00 | (code & 0x3FF));
+            i += 4;
+        } else {
+            /* Truncated sequence; libyaml doesn't produce these */
+            *out++ = (mxChar)c;
+            i += 1;
+        }
+    }
+    batch->text_length = out - batch->text;
+
+    size_t row = batch->count;
+    batch->indices[start_field][row] = (double)start + 1;
+    batch->indices[start_field + 1][row] =
+            (double)(batch->text_length - start);
+}
+
+void ymx_event_batch_reserve_text(ymx_event_batch_t *batch, size_t size) {
+    if (size <= batch->text_capacity)
+        return;
+    size_t capacity = batch->text_capacity
+            ? batch->text_capacity : EVENT_TEXT_INITIAL_SIZE;
+    while (capacity < size)
+        capacity *= 2;
+    batch->text = mxRealloc(batch->text, capacity * sizeof(mxChar));
+    batch->text_capacity = capacity;
+}
+
+/* Hand a batch's storage over to the fields of element ind of batches.
+ * The batch must not be used afterward. */
+void ymx_event_batch_to_struct(ymx_event_batch_t *batch,
+        mxArray *batches, mwIndex ind) {
+    int field = 0;
+    int i;
+    mxArray *array;
+
+    for (i=0; i<YMX_EVENT_NUM_INT_FIELDS; i++, field++) {
+        array = mxCreateNumericMatrix(0, 1, mxINT32_CLASS, mxREAL);
+        if (batch->count) {
+            mxSetData(array, batch->ints[i]);
+            mxSetM(array, batch->count);
+        }
+        mxSetFieldByNumber(batches, ind, field, array);
+    }
+    for (i=0; i<YMX_EVENT_NUM_INDEX_FIELDS; i++, field++) {
+        array = mxCreateDoubleMatrix(0, 1, mxREAL);
+        if (batch->count) {
+            mxSetData(array, batch->indices[i]);
+            mxSetM(array, batch->count);
+        }
+        mxSetFieldByNumber(batches, ind, field, array);
+    }
+
+    mwSize dims[2] = {1, 0};
+    array = mxCreateCharArray(2, dims);
+    if (batch->text_length) {
+        mxSetData(array, batch->text);
+        mxSetN(array, batch->text_length);
+    } else if (batch->text) {
+        mxFree(batch->text);
+    }
+    mxSetFieldByNumber(batches, ind, field, array);
+}
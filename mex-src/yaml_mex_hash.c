@@ -0,0 +1,512 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * A structural hash is a 128-bit digest of what a YAML stream means
+ * rather than how it's written, for use as a cache key:
+ *     key = yaml_mex('hash', yaml_str);
+ *     key = yaml_mex('hash_data', data);
+ * Streams that load (by yaml_mex('load_simple'), say) to the same data
+ * hash the same: mappings are hashed without regard to the order of their
+ * keys, and scalars by what they resolve to under the core schema, so
+ * 1, 1.0 and 0x1 are the same number, and 'a', "a" and a the same string.
+ * Comments, indentation and anchor names never count, and aliases hash as
+ * the nodes they refer to. Scalar and collection styles only count with
+ * the 'styles' option. Tags other than the core schema's count, as do
+ * core tags on values they don't match.
+ *
+ * Hashing Matlab data runs the composer (see yaml_mex_compose.c) with its
+ * events handed straight to the hasher rather than to an emitter, so
+ * hash_data(data) is hash(dump_simple(data)) without the text ever being
+ * written or parsed. Text is only hashed as events are parsed, so neither
+ * command holds more than a stack of open collections and the anchors
+ * defined so far.
+ *
+ * Values are the same on every machine: words are put together from
+ * bytes explicitly rather than read from memory as ymx_hash_bytes does,
+ * and numbers are hashed by the bits of their IEEE doubles, with -0 made
+ * 0 and every NaN the same NaN. The hash is two 64-bit lanes, each a
+ * multiply-and-mix chain like ymx_hash_bytes's, fed the same words with
+ * different seeds and salts. A mapping's hash is built from the lane-wise
+ * sum of its pairs' hashes, which doesn't depend on their order. None of
+ * this is cryptographic; it's meant to tell apart honest inputs, not to
+ * stand up to contrived ones.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef struct ymx_hash128_s {
+    uint64_T lo;
+    uint64_T hi;
+} ymx_hash128_t;
+
+/* What a hashed node is; the first word of every node's hash */
+typedef enum ymx_hash_kind_e {
+    YMX_HASH_KIND_NULL = 1,
+    YMX_HASH_KIND_BOOL,
+    YMX_HASH_KIND_NUMBER,
+    YMX_HASH_KIND_STRING,
+    YMX_HASH_KIND_TAGGED,   /* A scalar that doesn't resolve to the above */
+    YMX_HASH_KIND_SEQUENCE,
+    YMX_HASH_KIND_MAPPING,
+    YMX_HASH_KIND_PAIR
+} ymx_hash_kind_t;
+
+/* A sequence or mapping being hashed. For a sequence, state has taken in
+ * its items so far, in order; for a mapping, it waits for the end, and sum
+ * holds the total of the pairs' hashes so far. */
+typedef struct ymx_hash_frame_s {
+    int is_mapping;
+    ymx_hash128_t state;
+    ymx_hash128_t sum;
+    ymx_hash128_t key;   /* A key waiting for its value */
+    int have_key;
+    size_t count;
+    char *anchor;        /* The collection's anchor, if it has one */
+} ymx_hash_frame_t;
+
+typedef struct ymx_hash_anchor_s {
+    char *name;
+    ymx_hash128_t hash;
+} ymx_hash_anchor_t;
+
+/* The state of a whole stream's hash. frames[0] is the stream itself,
+ * treated as a sequence of documents' roots. */
+typedef struct ymx_hasher_s {
+    int styles;
+    ymx_hash_frame_t *frames;
+    size_t depth;
+    size_t frames_size;
+    ymx_hash_anchor_t *anchors;
+    size_t num_anchors;
+    size_t anchors_size;
+    ymx_hash128_t first_root;
+} ymx_hasher_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const uint64_T YMX_HASH_LO_SEED = 0x6D61742D79616D6CULL;
+const uint64_T YMX_HASH_HI_SEED = 0x2D73747275637421ULL;
+const uint64_T YMX_HASH_HI_SALT = 0xA0761D6478BD642FULL;
+const uint64_T YMX_HASH_HI_MULTIPLIER = 0xE7037ED1A0B428DBULL;
+const uint64_T YMX_HASH_CANONICAL_NAN = 0x7FF8000000000000ULL;
+#define YMX_HASH_INITIAL_FRAMES 16
+#define YMX_HASH_INITIAL_ANCHORS 16
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+void ymx_hasher_init(ymx_hasher_t *hasher, int styles);
+void ymx_hasher_event(void *data, const yaml_event_t *event);
+mxArray *ymx_hasher_finish(ymx_hasher_t *hasher);
+void ymx_hasher_push(
+        ymx_hasher_t *hasher,
+        int is_mapping,
+        const yaml_char_t *tag,
+        int style,
+        const yaml_char_t *anchor );
+void ymx_hasher_pop(ymx_hasher_t *hasher);
+void ymx_hasher_add_node(
+        ymx_hasher_t *hasher,
+        ymx_hash128_t hash,
+        const char *anchor );
+void ymx_hasher_define_anchor(
+        ymx_hasher_t *hasher,
+        const char *name,
+        ymx_hash128_t hash );
+ymx_hash128_t ymx_hasher_find_anchor(
+        const ymx_hasher_t *hasher,
+        const char *name );
+ymx_hash128_t ymx_hash_scalar(const ymx_hasher_t *hasher,
+        const yaml_event_t *event);
+ymx_hash_kind_t ymx_hash_resolve(const yaml_event_t *event, double *number);
+
+ymx_hash128_t ymx_hash_start(ymx_hash_kind_t kind);
+void ymx_hash_add(ymx_hash128_t *hash, uint64_T word);
+void ymx_hash_add_hash(ymx_hash128_t *hash, ymx_hash128_t value);
+void ymx_hash_add_bytes(ymx_hash128_t *hash, const unsigned char *bytes,
+        size_t length);
+void ymx_hash_add_tag(ymx_hash128_t *hash, const yaml_char_t *tag);
+ymx_hash128_t ymx_hash_end(ymx_hash128_t hash);
+int ymx_is_plain_collection_tag(const char *tag);
+mxArray *ymx_hash_to_string(ymx_hash128_t hash);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Hash the YAML stream in the string yaml_stream, returning the hash as a
+ * string of 32 hex digits. options may be NULL, or a struct with the
+ * field:
+ *     styles: If true, scalar and collection styles (quoted or plain, flow
+ *             or block, and so on) count toward the hash. Default false.
+ */
+mxArray *ymx_hash_stream(const mxArray *yaml_stream, const mxArray *options) {
+    int styles = 0;
+    if (options && !mxIsEmpty(options)) {
+        if (!mxIsStruct(options) || mxGetNumberOfElements(options) != 1)
+            ymx_error("Hash options must be a scalar struct");
+        mxArray *styles_arr = mxGetField(options, 0, "styles");
+        if (styles_arr) {
+            if (!(mxIsLogical(styles_arr) || mxIsNumeric(styles_arr))
+                    || mxGetNumberOfElements(styles_arr) != 1)
+                ymx_error("Hash option 'styles' must be a logical scalar");
+            styles = (mxGetScalar(styles_arr) != 0);
+        }
+    }
+
+    char *yaml_cstr = mxArrayToString(yaml_stream);
+    yaml_parser_t *parser = ymx_init_parser();
+    ymx_set_parser_input(parser, yaml_cstr, strlen(yaml_cstr));
+
+    ymx_hasher_t hasher;
+    ymx_hasher_init(&hasher, styles);
+    const yaml_event_t *event;
+    do {
+        event = ymx_parse(parser);
+        ymx_hasher_event(&hasher, event);
+    } while (event->type != YAML_STREAM_END_EVENT);
+    ymx_persistent_cleanup();
+    mxFree(yaml_cstr);
+
+    return ymx_hasher_finish(&hasher);
+}
+
+/* Hash Matlab data as yaml_mex('hash') would hash the text that
+ * ymx_compose_stream makes of it, with the same flags, but without making
+ * it. */
+mxArray *ymx_hash_data(const mxArray *data, int flags) {
+    ymx_hasher_t hasher;
+    ymx_hasher_init(&hasher, 0);
+    ymx_persistent_cleanup();
+    ymx_set_emit_handler(ymx_hasher_event, &hasher);
+    /* The composer only passes the emitter on to ymx_emit, which doesn't
+     * use it while there's a handler */
+    ymx_compose_document(NULL, data, 1, flags);
+    ymx_persistent_cleanup();
+
+    return ymx_hasher_finish(&hasher);
+}
+
+
+/*
+ * Building hashes from events
+ *************************************************************************/
+
+void ymx_hasher_init(ymx_hasher_t *hasher, int styles) {
+    memset(hasher, 0, sizeof(ymx_hasher_t));
+    hasher->styles = styles;
+    hasher->frames_size = YMX_HASH_INITIAL_FRAMES;
+    hasher->frames = mxMalloc(hasher->frames_size
+            * sizeof(ymx_hash_frame_t));
+    ymx_hasher_push(hasher, 0, NULL, 0, NULL);
+}
+
+/* Take in the next event of the stream; a ymx_emit_handler_t. */
+void ymx_hasher_event(void *data, const yaml_event_t *event) {
+    ymx_hasher_t *hasher = data;
+    switch (event->type) {
+        case YAML_DOCUMENT_START_EVENT:
+            /* Anchors only reach as far as the end of their document */
+            while (hasher->num_anchors)
+                mxFree(hasher->anchors[--hasher->num_anchors].name);
+            break;
+        case YAML_SCALAR_EVENT:
+            ymx_hasher_add_node(hasher, ymx_hash_scalar(hasher, event),
+                    (char *)event->data.scalar.anchor);
+            break;
+        case YAML_ALIAS_EVENT:
+            ymx_hasher_add_node(hasher, ymx_hasher_find_anchor(hasher,
+                    (char *)event->data.alias.anchor), NULL);
+            break;
+        case YAML_SEQUENCE_START_EVENT:
+            ymx_hasher_push(hasher, 0, event->data.sequence_start.tag,
+                    event->data.sequence_start.style,
+                    event->data.sequence_start.anchor);
+            break;
+        case YAML_MAPPING_START_EVENT:
+            ymx_hasher_push(hasher, 1, event->data.mapping_start.tag,
+                    event->data.mapping_start.style,
+                    event->data.mapping_start.anchor);
+            break;
+        case YAML_SEQUENCE_END_EVENT:
+        case YAML_MAPPING_END_EVENT:
+            ymx_hasher_pop(hasher);
+            break;
+        default:
+            break;
+    }
+}
+
+/* The stream's hash is that of its document's root if it has one, or
+ * else of the sequence of its roots, as yaml_mex('load_simple') would
+ * return it. Frees everything the hasher holds. */
+mxArray *ymx_hasher_finish(ymx_hasher_t *hasher) {
+    ymx_hash_frame_t *stream = hasher->frames;
+    ymx_hash128_t hash = hasher->first_root;
+    if (stream->count != 1) {
+        ymx_hash_add(&stream->state, stream->count);
+        hash = ymx_hash_end(stream->state);
+    }
+    while (hasher->num_anchors)
+        mxFree(hasher->anchors[--hasher->num_anchors].name);
+    mxFree(hasher->anchors);
+    mxFree(hasher->frames);
+    return ymx_hash_to_string(hash);
+}
+
+/* Open a sequence or mapping. Its tag is left out if it's one a collection
+ * of its kind would have anyway. */
+void ymx_hasher_push(
+        ymx_hasher_t *hasher,
+        int is_mapping,
+        const yaml_char_t *tag,
+        int style,
+        const yaml_char_t *anchor ) {
+    if (hasher->depth == hasher->frames_size) {
+        hasher->frames_size *= 2;
+        hasher->frames = mxRealloc(hasher->frames,
+                hasher->frames_size * sizeof(ymx_hash_frame_t));
+    }
+    ymx_hash_frame_t *frame = hasher->frames + hasher->depth++;
+    memset(frame, 0, sizeof(ymx_hash_frame_t));
+    frame->is_mapping = is_mapping;
+    frame->state = ymx_hash_start(is_mapping
+            ? YMX_HASH_KIND_MAPPING : YMX_HASH_KIND_SEQUENCE);
+    ymx_hash_add_tag(&frame->state,
+            tag && !ymx_is_plain_collection_tag((char *)tag) ? tag : NULL);
+    if (hasher->styles)
+        ymx_hash_add(&frame->state, style);
+    if (anchor) {
+        frame->anchor = mxMalloc(strlen((char *)anchor) + 1);
+        strcpy(frame->anchor, (char *)anchor);
+    }
+}
+
+/* Close the innermost sequence or mapping, and add it to its parent */
+void ymx_hasher_pop(ymx_hasher_t *hasher) {
+    ymx_hash_frame_t *frame = hasher->frames + --hasher->depth;
+    if (frame->is_mapping)
+        ymx_hash_add_hash(&frame->state, frame->sum);
+    ymx_hash_add(&frame->state, frame->count);
+    ymx_hasher_add_node(hasher, ymx_hash_end(frame->state), frame->anchor);
+    if (frame->anchor)
+        mxFree(frame->anchor);
+}
+
+/* Add a finished node, with the given hash, to the collection it's in */
+void ymx_hasher_add_node(
+        ymx_hasher_t *hasher,
+        ymx_hash128_t hash,
+        const char *anchor ) {
+    if (anchor)
+        ymx_hasher_define_anchor(hasher, anchor, hash);
+
+    ymx_hash_frame_t *frame = hasher->frames + hasher->depth - 1;
+    if (!frame->is_mapping) {
+        if (hasher->depth == 1 && frame->count == 0)
+            hasher->first_root = hash;
+        ymx_hash_add_hash(&frame->state, hash);
+        frame->count++;
+    } else if (!frame->have_key) {
+        frame->key = hash;
+        frame->have_key = 1;
+    } else {
+        ymx_hash128_t pair = ymx_hash_start(YMX_HASH_KIND_PAIR);
+        ymx_hash_add_hash(&pair, frame->key);
+        ymx_hash_add_hash(&pair, hash);
+        pair = ymx_hash_end(pair);
+        frame->sum.lo += pair.lo;
+        frame->sum.hi += pair.hi;
+        frame->have_key = 0;
+        frame->count++;
+    }
+}
+
+/* Anchors may be redefined; the latest definition is the one found */
+void ymx_hasher_define_anchor(
+        ymx_hasher_t *hasher,
+        const char *name,
+        ymx_hash128_t hash ) {
+    if (hasher->num_anchors == hasher->anchors_size) {
+        hasher->anchors_size = hasher->anchors_size
+                ? 2*hasher->anchors_size : YMX_HASH_INITIAL_ANCHORS;
+        hasher->anchors = hasher->anchors
+                ? mxRealloc(hasher->anchors,
+                    hasher->anchors_size * sizeof(ymx_hash_anchor_t))
+                : mxMalloc(hasher->anchors_size * sizeof(ymx_hash_anchor_t));
+    }
+    ymx_hash_anchor_t *entry = hasher->anchors + hasher->num_anchors++;
+    entry->name = mxMalloc(strlen(name) + 1);
+    strcpy(entry->name, name);
+    entry->hash = hash;
+}
+
+/* An alias to a collection that hasn't ended yet would make a cycle, so
+ * it's an error, like one to an anchor that isn't defined at all. */
+ymx_hash128_t ymx_hasher_find_anchor(
+        const ymx_hasher_t *hasher,
+        const char *name ) {
+    size_t i = hasher->num_anchors;
+    while (i--) {
+        if (strcmp(hasher->anchors[i].name, name) == 0)
+            return hasher->anchors[i].hash;
+    }
+    ymx_error("Can't hash an alias to an undefined or unfinished anchor");
+    return hasher->first_root; /* Not reached */
+}
+
+ymx_hash128_t ymx_hash_scalar(const ymx_hasher_t *hasher,
+        const yaml_event_t *event) {
+    const yaml_char_t *tag = event->data.scalar.tag;
+    const unsigned char *value = event->data.scalar.value;
+    size_t length = event->data.scalar.length;
+    double number = 0;
+    ymx_hash_kind_t kind = ymx_hash_resolve(event, &number);
+
+    ymx_hash128_t hash = ymx_hash_start(kind);
+    if (kind == YMX_HASH_KIND_BOOL) {
+        ymx_hash_add(&hash, number != 0);
+    } else if (kind == YMX_HASH_KIND_NUMBER) {
+        uint64_T bits;
+        if (number == 0)
+            number = 0;
+        memcpy(&bits, &number, sizeof(bits));
+        if (number != number)
+            bits = YMX_HASH_CANONICAL_NAN;
+        ymx_hash_add(&hash, bits);
+    } else if (kind == YMX_HASH_KIND_STRING) {
+        ymx_hash_add_bytes(&hash, value, length);
+    } else if (kind == YMX_HASH_KIND_TAGGED) {
+        ymx_hash_add_tag(&hash, tag);
+        if (strcmp((char *)tag, YMX_BINARY_TAG) == 0) {
+            /* Base64 may be broken across lines any which way */
+            ymx_hash128_t text = ymx_hash_start(YMX_HASH_KIND_STRING);
+            size_t i, n = 0;
+            for (i=0; i<length; i++) {
+                if (value[i] != ' ' && value[i] != '\t'
+                        && value[i] != '\n' && value[i] != '\r') {
+                    ymx_hash_add(&text, value[i]);
+                    n++;
+                }
+            }
+            ymx_hash_add(&text, n);
+            ymx_hash_add_hash(&hash, ymx_hash_end(text));
+        } else {
+            ymx_hash_add_bytes(&hash, value, length);
+        }
+    }
+    if (hasher->styles)
+        ymx_hash_add(&hash, event->data.scalar.style);
+    return ymx_hash_end(hash);
+}
+
+/* Resolve a scalar as ymx_resolve_scalar does, except that a scalar with
+ * a tag outside the core schema, or with a core tag its value doesn't
+ * match, is kept as a tagged value rather than being an error. */
+ymx_hash_kind_t ymx_hash_resolve(const yaml_event_t *event, double *number) {
+    const char *tag = (char *)event->data.scalar.tag;
+    const char *value = (char *)event->data.scalar.value;
+    size_t length = event->data.scalar.length;
+
+    if (!tag || strcmp(tag, "!") == 0 || strcmp(tag, YMX_STR_TAG) == 0) {
+        switch (ymx_resolve_scalar(event, number)) {
+            case YMX_SCALAR_KIND_NULL:   return YMX_HASH_KIND_NULL;
+            case YMX_SCALAR_KIND_BOOL:   return YMX_HASH_KIND_BOOL;
+            case YMX_SCALAR_KIND_NUMBER: return YMX_HASH_KIND_NUMBER;
+            default:                     return YMX_HASH_KIND_STRING;
+        }
+    }
+    if (strcmp(tag, YMX_NULL_TAG) == 0 && ymx_match_null(value, length))
+        return YMX_HASH_KIND_NULL;
+    if (strcmp(tag, YMX_BOOL_TAG) == 0
+            && ymx_match_bool(value, number))
+        return YMX_HASH_KIND_BOOL;
+    if ((strcmp(tag, YMX_INT_TAG) == 0
+                && ymx_match_int(value, length, number))
+            || (strcmp(tag, YMX_FLOAT_TAG) == 0
+                && ymx_match_float(value, length, number)))
+        return YMX_HASH_KIND_NUMBER;
+    return YMX_HASH_KIND_TAGGED;
+}
+
+
+/*
+ * Hash arithmetic
+ *************************************************************************/
+
+ymx_hash128_t ymx_hash_start(ymx_hash_kind_t kind) {
+    ymx_hash128_t hash = {YMX_HASH_LO_SEED, YMX_HASH_HI_SEED};
+    ymx_hash_add(&hash, kind);
+    return hash;
+}
+
+void ymx_hash_add(ymx_hash128_t *hash, uint64_T word) {
+    hash->lo = (hash->lo ^ ymx_hash_mix(word)) * YMX_HASH_MULTIPLIER;
+    hash->hi = (hash->hi ^ ymx_hash_mix(word ^ YMX_HASH_HI_SALT))
+            * YMX_HASH_HI_MULTIPLIER;
+}
+
+void ymx_hash_add_hash(ymx_hash128_t *hash, ymx_hash128_t value) {
+    ymx_hash_add(hash, value.lo);
+    ymx_hash_add(hash, value.hi);
+}
+
+/* Add length bytes, eight to a word, least significant first */
+void ymx_hash_add_bytes(ymx_hash128_t *hash, const unsigned char *bytes,
+        size_t length) {
+    ymx_hash_add(hash, length);
+    while (length) {
+        size_t n = length < 8 ? length : 8;
+        uint64_T word = 0;
+        size_t i;
+        for (i=0; i<n; i++)
+            word |= (uint64_T)bytes[i] << (8*i);
+        ymx_hash_add(hash, word);
+        bytes += n;
+        length -= n;
+    }
+}
+
+void ymx_hash_add_tag(ymx_hash128_t *hash, const yaml_char_t *tag) {
+    if (tag) {
+        ymx_hash_add(hash, 1);
+        ymx_hash_add_bytes(hash, tag, strlen((char *)tag));
+    } else {
+        ymx_hash_add(hash, 0);
+    }
+}
+
+ymx_hash128_t ymx_hash_end(ymx_hash128_t hash) {
+    ymx_hash128_t result;
+    result.lo = ymx_hash_mix(hash.lo ^ (hash.hi >> 32));
+    result.hi = ymx_hash_mix(hash.hi ^ result.lo);
+    return result;
+}
+
+/* Whether tag is one that says no more than an untagged collection does */
+int ymx_is_plain_collection_tag(const char *tag) {
+    return strcmp(tag, "!") == 0
+        || strcmp(tag, "tag:yaml.org,2002:seq") == 0
+        || strcmp(tag, "tag:yaml.org,2002:map") == 0;
+}
+
+mxArray *ymx_hash_to_string(ymx_hash128_t hash) {
+    const char *digits = "0123456789abcdef";
+    char text[33];
+    int i;
+    for (i=0; i<16; i++) {
+        text[i] = digits[(hash.hi >> (60 - 4*i)) & 0xF];
+        text[16+i] = digits[(hash.lo >> (60 - 4*i)) & 0xF];
+    }
+    text[32] = '\0';
+    return mxCreateString(text);
+}
@@ -0,0 +1,422 @@
+#include "yaml_mex_util.h"
+#include <stdio.h>
+#include <sys/stat.h>
+
+/* NOTES
+ *
+ * Document indexes give random access to the documents of a long
+ * multi-document file (a log, say) without parsing everything before
+ * the one that's wanted:
+ *     n = yaml_mex('index', path);           % optional
+ *     doc = yaml_mex('load_doc', path, k);   % document k of n
+ *
+ * The index is a sidecar file, path with ".ymxi" appended, holding the
+ * byte offset at which each document starts. It's built by one pass over
+ * the file that only looks at the start of each line, so it runs at about
+ * the speed of reading the file, and records the source's size and
+ * modification time; load_doc builds (or rebuilds) it whenever there's no
+ * index matching the file as it is now, and then reads just the header
+ * and the two offsets it needs. As with snapshots, the sidecar is purely
+ * an optimization: if it can't be written, load_doc still works, only
+ * scanning the file every time.
+ *
+ * A document starts at a document start marker line ("---", followed by
+ * whitespace or the end of the line) or the directives just before it,
+ * or else at the first line of content after the start of the stream or
+ * a document end marker line ("..."). Only lines starting in the first
+ * column can do any of that, and a '%' line is only a directive outside
+ * a document: inside one, libyaml reads it as more of a plain scalar.
+ * Markers can't appear inside a document, and libyaml never gives a block
+ * scalar's content less than one space of indentation, so whatever a
+ * document holds (block scalars included) is never mistaken for a
+ * boundary. The bytes from one start to the next then parse as exactly
+ * that one document.
+ *
+ * The sidecar is a header (see ymx_index_header_t) followed by the start
+ * of each document and then the size of the file, all as uint64.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef struct ymx_index_header_s {
+    char magic[4];
+    uint32_T version;
+    uint32_T byte_order;
+    uint32_T reserved;
+    uint64_T source_size;
+    int64_T source_mtime;
+    uint64_T num_docs;
+} ymx_index_header_t;
+
+/* What a line tells us about where documents start */
+typedef enum ymx_line_kind_e {
+    YMX_LINE_BLANK,     /* Empty, whitespace or a comment */
+    YMX_LINE_DIRECTIVE,
+    YMX_LINE_DOC_START, /* "---" */
+    YMX_LINE_DOC_END,   /* "..." */
+    YMX_LINE_CONTENT
+} ymx_line_kind_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const char YMX_INDEX_MAGIC[4] = {'Y', 'M', 'X', 'I'};
+const uint32_T YMX_INDEX_VERSION = 1;
+const uint32_T YMX_INDEX_BYTE_ORDER = 0x01020304;
+const char YMX_INDEX_SUFFIX[] = ".ymxi";
+const size_t YMX_INDEX_BLOCK_SIZE = 1048576;
+const size_t DOC_STARTS_INITIAL_SIZE = 1024;
+/* More than any file could hold, and small enough to be a size_t */
+const double YMX_INDEX_MAX_DOCS = 4294967295.0;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+char *ymx_index_path(const char *path);
+size_t ymx_index_scan(const char *path, uint64_T **starts);
+ymx_line_kind_t ymx_classify_line(const char *line, size_t length);
+int ymx_index_lookup(const char *index_path,
+        const ymx_index_header_t *expected, size_t number,
+        uint64_T *num_docs, uint64_T range[2]);
+int ymx_index_save(const char *index_path, ymx_index_header_t *header,
+        const uint64_T *starts);
+void ymx_index_init_header(ymx_index_header_t *header,
+        const struct stat *info);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Scan the file at path for its documents, write its index, and return
+ * the number of documents. */
+mxArray *ymx_index_file(const mxArray *path_arr) {
+    char *path = mxArrayToString(path_arr);
+    struct stat info;
+    if (stat(path, &info) != 0)
+        ymx_error("Couldn't open file for reading");
+
+    ymx_index_header_t header;
+    ymx_index_init_header(&header, &info);
+    uint64_T *starts;
+    header.num_docs = ymx_index_scan(path, &starts);
+    if ((uint64_T)info.st_size != starts[header.num_docs])
+        ymx_error("File changed while it was being indexed");
+
+    char *index_path = ymx_index_path(path);
+    if (!ymx_index_save(index_path, &header, starts))
+        ymx_error("Couldn't write index file");
+
+    mxFree(index_path);
+    mxFree(starts);
+    mxFree(path);
+    return mxCreateDoubleScalar((double)header.num_docs);
+}
+
+/* Load document number (from 1) of the file at path, using its index,
+ * which is built first if there isn't an up-to-date one. options may be
+ * NULL, or a struct with the field
+ *         simple: If true, the document is constructed as native data, as
+ *                 by yaml_mex('load_simple'); otherwise it is loaded as by
+ *                 yaml_mex('load'). Default false.
+ */
+mxArray *ymx_load_doc(const mxArray *path_arr, const mxArray *number_arr,
+        const mxArray *options) {
+    int simple = 0;
+    if (options && !mxIsEmpty(options)) {
+        if (!mxIsStruct(options) || mxGetNumberOfElements(options) != 1)
+            ymx_error("Load options must be a scalar struct");
+        mxArray *simple_arr = mxGetField(options, 0, "simple");
+        if (simple_arr) {
+            if (!(mxIsLogical(simple_arr) || mxIsNumeric(simple_arr))
+                    || mxGetNumberOfElements(simple_arr) != 1)
+                ymx_error("Load option 'simple' must be a logical scalar");
+            simple = (mxGetScalar(simple_arr) != 0);
+        }
+    }
+    if (!mxIsNumeric(number_arr) || mxGetNumberOfElements(number_arr) != 1)
+        ymx_error("Document number must be a positive integer");
+    double value = mxGetScalar(number_arr);
+    if (!(value >= 1 && value <= YMX_INDEX_MAX_DOCS)
+            || value != (double)(size_t)value)
+        ymx_error("Document number must be a positive integer");
+    size_t number = (size_t)value;
+
+    char *path = mxArrayToString(path_arr);
+    struct stat info;
+    if (stat(path, &info) != 0)
+        ymx_error("Couldn't open file for reading");
+    ymx_index_header_t header;
+    ymx_index_init_header(&header, &info);
+
+    char *index_path = ymx_index_path(path);
+    uint64_T num_docs;
+    uint64_T range[2];
+    if (!ymx_index_lookup(index_path, &header, number, &num_docs, range)) {
+        uint64_T *starts;
+        num_docs = ymx_index_scan(path, &starts);
+        header.num_docs = num_docs;
+        /* A file that changed under the scan gets indexed next time */
+        if ((uint64_T)info.st_size == starts[num_docs])
+            ymx_index_save(index_path, &header, starts);
+        if (number <= num_docs) {
+            range[0] = starts[number-1];
+            range[1] = starts[number];
+        }
+        mxFree(starts);
+    }
+    mxFree(index_path);
+    if (number > num_docs)
+        ymx_error("Document number is past the end of the file");
+
+    size_t length = (size_t)(range[1] - range[0]);
+    char *text = ymx_read_file_range(path, (size_t)range[0], length);
+    mxFree(path);
+
+    mxArray *doc;
+    if (simple) {
+        mxArray *docs = ymx_construct_documents(text, length, NULL);
+        if (mxGetNumberOfElements(docs) != 1)
+            ymx_error("Index doesn't match the file; rebuild it with "
+                    "yaml_mex('index', path)");
+        doc = ymx_unwrap_documents(docs);
+    } else {
+        doc = ymx_load_string(text, length);
+        if (!doc || mxGetNumberOfElements(doc) != 1)
+            ymx_error("Index doesn't match the file; rebuild it with "
+                    "yaml_mex('index', path)");
+    }
+    mxFree(text);
+    return doc;
+}
+
+
+/*
+ * Scanning
+ *************************************************************************/
+
+/* Find where the documents of the file at path start. Stores an
+ * mxMalloc'd array of the starts in *starts, followed by the number of
+ * bytes scanned as the end of the last document, and returns the number
+ * of documents. */
+size_t ymx_index_scan(const char *path, uint64_T **starts) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        ymx_error("Couldn't open file for reading");
+
+    size_t size = DOC_STARTS_INITIAL_SIZE;
+    uint64_T *list = mxMalloc(size * sizeof(uint64_T));
+    size_t count = 0;
+
+    size_t capacity = YMX_INDEX_BLOCK_SIZE;
+    char *block = mxMalloc(capacity);
+    size_t filled = 0;    /* Bytes of block holding file data */
+    uint64_T base = 0;    /* File offset of block[0] */
+    ymx_doc_scan_t scan = {0, 0};
+    int at_eof = 0;
+    while (!at_eof) {
+        size_t num_read = fread(block + filled, 1, capacity - filled, file);
+        if (num_read < capacity - filled) {
+            if (ferror(file)) {
+                fclose(file);
+                ymx_error("Error while reading file");
+            }
+            at_eof = 1;
+        }
+        filled += num_read;
+
+        /* Look at every whole line, and at the end of the file, the last
+         * one too */
+        size_t line = 0;
+        while (line < filled) {
+            const char *end = memchr(block + line, '\n', filled - line);
+            if (!end && !at_eof)
+                break;
+            size_t next = end ? (size_t)(end - block) + 1 : filled;
+            const char *text = block + line;
+            size_t length = next - line;
+            if (base + line == 0 && length >= 3
+                    && memcmp(text, "\xEF\xBB\xBF", 3) == 0) {
+                text += 3;
+                length -= 3;
+            }
+
+            uint64_T start = ymx_doc_scan_line(&scan, text, length,
+                    base + line);
+            if (start) {
+                if (count + 1 == size) {
+                    size *= 2;
+                    list = mxRealloc(list, size * sizeof(uint64_T));
+                }
+                list[count++] = start - 1;
+            }
+            line = next;
+        }
+
+        /* Keep the partial line at the end for the next block, making
+         * room for more if it fills the block */
+        memmove(block, block + line, filled - line);
+        filled -= line;
+        base += line;
+        if (filled == capacity) {
+            capacity *= 2;
+            block = mxRealloc(block, capacity);
+        }
+    }
+    fclose(file);
+    mxFree(block);
+
+    list[count] = base + filled;
+    *starts = list;
+    return count;
+}
+
+/* Take the next line of a stream, which starts at offset, and return 1
+ * plus the offset at which a document starts on or just before it (at
+ * the directives before a "---"), or 0 if none does. */
+uint64_T ymx_doc_scan_line(ymx_doc_scan_t *scan, const char *line,
+        size_t length, uint64_T offset) {
+    uint64_T start = 0;
+    switch (ymx_classify_line(line, length)) {
+        case YMX_LINE_DOC_START:
+            start = scan->pending ? scan->pending : offset + 1;
+            scan->in_doc = 1;
+            scan->pending = 0;
+            break;
+        case YMX_LINE_DOC_END:
+            scan->in_doc = 0;
+            scan->pending = 0;
+            break;
+        case YMX_LINE_DIRECTIVE:
+            /* Inside a document, a '%' line continues a plain scalar;
+             * directives only come after a "..." */
+            if (scan->in_doc)
+                break;
+            if (!scan->pending)
+                scan->pending = offset + 1;
+            break;
+        case YMX_LINE_CONTENT:
+            if (!scan->in_doc)
+                start = scan->pending ? scan->pending : offset + 1;
+            scan->in_doc = 1;
+            scan->pending = 0;
+            break;
+        case YMX_LINE_BLANK:
+            break;
+    }
+    return start;
+}
+
+ymx_line_kind_t ymx_classify_line(const char *line, size_t length) {
+    if (length == 0)
+        return YMX_LINE_BLANK;
+    if (length >= 3 && (memcmp(line, "---", 3) == 0
+                || memcmp(line, "...", 3) == 0)
+            && (length == 3 || line[3] == ' ' || line[3] == '\t'
+                || line[3] == '\r' || line[3] == '\n'))
+        return line[0] == '-' ? YMX_LINE_DOC_START : YMX_LINE_DOC_END;
+    if (line[0] == '%')
+        return YMX_LINE_DIRECTIVE;
+
+    size_t i = 0;
+    while (i < length && (line[i] == ' ' || line[i] == '\t'))
+        i++;
+    if (i == length || line[i] == '#' || line[i] == '\r' || line[i] == '\n')
+        return YMX_LINE_BLANK;
+    return YMX_LINE_CONTENT;
+}
+
+
+/*
+ * Index files
+ *************************************************************************/
+
+char *ymx_index_path(const char *path) {
+    size_t size = strlen(path) + sizeof(YMX_INDEX_SUFFIX);
+    char *index_path = mxMalloc(size);
+    snprintf(index_path, size, "%s%s", path, YMX_INDEX_SUFFIX);
+    return index_path;
+}
+
+void ymx_index_init_header(ymx_index_header_t *header,
+        const struct stat *info) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, YMX_INDEX_MAGIC, sizeof(header->magic));
+    header->version = YMX_INDEX_VERSION;
+    header->byte_order = YMX_INDEX_BYTE_ORDER;
+    header->source_size = (uint64_T)info->st_size;
+    header->source_mtime = (int64_T)info->st_mtime;
+}
+
+/* Read the number of documents, and the start and end of document number
+ * (from 1) if there is one, from the index at index_path. Returns 0 if
+ * there is no index matching expected (whose num_docs is ignored). */
+int ymx_index_lookup(const char *index_path,
+        const ymx_index_header_t *expected, size_t number,
+        uint64_T *num_docs, uint64_T range[2]) {
+    struct stat info;
+    if (stat(index_path, &info) != 0)
+        return 0;
+    FILE *file = fopen(index_path, "rb");
+    if (!file)
+        return 0;
+
+    ymx_index_header_t header;
+    int ok = fread(&header, sizeof(header), 1, file) == 1
+            && memcmp(header.magic, expected->magic,
+                    sizeof(header.magic)) == 0
+            && header.version == expected->version
+            && header.byte_order == expected->byte_order
+            && header.source_size == expected->source_size
+            && header.source_mtime == expected->source_mtime
+            && header.num_docs < (uint64_T)info.st_size
+            && (uint64_T)info.st_size == sizeof(header)
+                    + (header.num_docs + 1) * sizeof(uint64_T);
+    if (ok && number <= header.num_docs) {
+        ok = ymx_seek_file(file, sizeof(header)
+                        + (number - 1) * sizeof(uint64_T)) == 0
+                && fread(range, sizeof(uint64_T), 2, file) == 2
+                && range[0] <= range[1]
+                && range[1] <= header.source_size;
+    }
+    fclose(file);
+    if (ok)
+        *num_docs = header.num_docs;
+    return ok;
+}
+
+/* Write an index, with header->num_docs starts and the end of the file,
+ * to index_path. Returns 0 if it couldn't be written. */
+int ymx_index_save(const char *index_path, ymx_index_header_t *header,
+        const uint64_T *starts) {
+    size_t size = strlen(index_path) + 32;
+    char *temp_path = mxMalloc(size);
+    snprintf(temp_path, size, "%s.%lu.tmp", index_path,
+            (unsigned long)header->source_size);
+
+    int ok = 0;
+    FILE *file = fopen(temp_path, "wb");
+    if (file) {
+        size_t count = (size_t)header->num_docs + 1;
+        ok = fwrite(header, sizeof(*header), 1, file) == 1
+                && fwrite(starts, sizeof(uint64_T), count, file) == count;
+        ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+        /* rename won't replace an existing file here */
+        if (ok)
+            remove(index_path);
+#endif
+        if (ok && rename(temp_path, index_path) != 0)
+            ok = 0;
+        if (!ok)
+            remove(temp_path);
+    }
+    mxFree(temp_path);
+    return ok;
+}
@@ -0,0 +1,278 @@
+#include "yaml_mex_util.h"
+#include <stdlib.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* NOTES
+ *
+ * yaml_mex('dump', docs, 'parallel') emits the documents of a stream on
+ * several threads at once. Reading the document array needs the Matlab
+ * API, which may only be called from Matlab's own thread, so that part
+ * stays serial: each document is walked by ymx_dump_document as usual,
+ * but ymx_emit records its events instead of emitting them. An event
+ * holds its own copies of its strings, allocated by libyaml, so the
+ * recorded events are a snapshot of the stream that needs nothing from
+ * Matlab. The events are then split into jobs of whole documents, each
+ * job is emitted by its own libyaml emitter into its own buffer on a
+ * worker thread, and the buffers are joined in order.
+ *
+ * The output is the same as a serial dump's. The only state libyaml's
+ * emitter carries from one document to the next is whether it is at the
+ * first document, and whether the last document was left open-ended:
+ *   - every document but the first starts with "---", so the first
+ *     document of each job but the first is made explicit;
+ *   - a document with directives is preceded by "..." if the one before
+ *     it was left open-ended, so each job reports how its emitter was left
+ *     and the "..." is added between jobs where it is needed;
+ *   - only the last job ends the stream, and the others are just flushed,
+ *     since the end of the stream may also be preceded by "...".
+ *
+ * Worker threads only call libyaml and the C library's allocator. Errors
+ * (which come only from libyaml, since the input has been checked while
+ * it was recorded) are reported once all the threads have finished. With
+ * a single processor (and on Windows) this is just a serial dump; when
+ * there is too little to share out, the jobs are emitted on the calling
+ * thread.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+/* A run of whole documents, as recorded events, and their emitted text */
+typedef struct ymx_emit_job_s {
+    yaml_event_t *events;
+    size_t num_events;
+    int is_last;        /* End the stream after the documents */
+    int has_directives; /* The first document has directives */
+
+    char *output;       /* malloc'd, since it's filled on a worker thread */
+    size_t output_length;
+    size_t output_size;
+    int open_ended;     /* The emitter's open_ended, after the documents */
+    const char *problem; /* Set if emitting failed */
+} ymx_emit_job_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+/* Most threads to emit on at once */
+#define YMX_MAX_EMIT_JOBS 64
+/* Fewest events worth starting a job for */
+const size_t EMIT_JOB_MIN_EVENTS = 4096;
+const size_t EMIT_JOB_OUTPUT_INITIAL_SIZE = 4096;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+size_t ymx_num_processors();
+void ymx_run_emit_jobs(ymx_emit_job_t *jobs, size_t num_jobs);
+void *ymx_emit_job_run(void *data);
+int ymx_emit_job_write_handler(void *data,
+        unsigned char *buffer, size_t size);
+int ymx_has_directives(const yaml_event_t *document_start);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+mxArray *ymx_dump_stream_parallel(const mxArray *docs_array, int trusted) {
+    /* Recording only adds work if there's nothing to share it with */
+    if (ymx_num_processors() < 2)
+        return ymx_dump_stream(docs_array, trusted);
+
+    ymx_persistent_cleanup();
+    if (!ymx_is_valid_doc_array(docs_array))
+        ymx_error("Invalid document array");
+
+    /* Record the events of every document, noting where each starts */
+    mwSize num_docs = mxGetNumberOfElements(docs_array);
+    size_t *doc_starts = mxMalloc((num_docs + 1) * sizeof(size_t));
+    ymx_event_list_t *list = ymx_start_recording();
+    mwIndex ind;
+    for (ind=0; ind<num_docs; ind++) {
+        doc_starts[ind] = list->num_events;
+        ymx_dump_document(NULL, docs_array, ind, 0, trusted);
+    }
+    doc_starts[num_docs] = list->num_events;
+    ymx_stop_recording();
+
+    /* Share the documents out into jobs of about the same number of
+     * events each */
+    size_t num_jobs = ymx_num_processors();
+    if (num_jobs > YMX_MAX_EMIT_JOBS)
+        num_jobs = YMX_MAX_EMIT_JOBS;
+    if (num_jobs > list->num_events / EMIT_JOB_MIN_EVENTS)
+        num_jobs = list->num_events / EMIT_JOB_MIN_EVENTS;
+    if (num_jobs > num_docs)
+        num_jobs = num_docs;
+    if (num_jobs < 1)
+        num_jobs = 1;
+
+    ymx_emit_job_t *jobs = mxCalloc(num_jobs, sizeof(ymx_emit_job_t));
+    size_t job_ind;
+    mwIndex first_doc = 0;
+    for (job_ind=0; job_ind<num_jobs; job_ind++) {
+        /* Leave at least one document for each job after this one */
+        size_t target = list->num_events / num_jobs * (job_ind + 1);
+        mwIndex end_doc = first_doc + 1;
+        if (job_ind == num_jobs - 1) {
+            end_doc = num_docs;
+        } else {
+            while (end_doc < num_docs - (num_jobs - job_ind - 1)
+                    && doc_starts[end_doc] < target)
+                end_doc++;
+        }
+        ymx_emit_job_t *job = jobs + job_ind;
+        job->events = list->events + doc_starts[first_doc];
+        job->num_events = doc_starts[end_doc] - doc_starts[first_doc];
+        job->is_last = (job_ind == num_jobs - 1);
+        if (job_ind > 0) {
+            job->events[0].data.document_start.implicit = 0;
+            job->has_directives = ymx_has_directives(job->events);
+        }
+        first_doc = end_doc;
+    }
+
+    ymx_run_emit_jobs(jobs, num_jobs);
+
+    ymx_buffer_t buffer;
+    ymx_buffer_init(&buffer, YMX_BUFFER_CHUNK_SIZE);
+    const char *problem = NULL;
+    for (job_ind=0; job_ind<num_jobs; job_ind++) {
+        ymx_emit_job_t *job = jobs + job_ind;
+        if (job->problem && !problem)
+            problem = job->problem;
+        if (!problem) {
+            if (job_ind > 0 && jobs[job_ind-1].open_ended
+                    && job->has_directives)
+                ymx_buffer_append(&buffer, "...\n", 4);
+            ymx_buffer_append(&buffer, job->output, job->output_length);
+        }
+        free(job->output);
+    }
+    mxFree(jobs);
+    mxFree(doc_starts);
+    if (problem) {
+        mexPrintf("Emitter error: %s\n", problem);
+        ymx_error("Error while emitting document");
+    }
+    ymx_persistent_cleanup();
+
+    mxArray *stream = mxCreateString(ymx_buffer_as_string(&buffer));
+
+    ymx_buffer_delete(&buffer);
+
+    return stream;
+}
+
+
+/*
+ * Running jobs
+ *************************************************************************/
+
+size_t ymx_num_processors() {
+#ifdef _WIN32
+    return 1;
+#else
+    long num = sysconf(_SC_NPROCESSORS_ONLN);
+    return num > 0 ? (size_t)num : 1;
+#endif
+}
+
+/* Run every job, on threads of their own where possible; the first is
+ * always run on the calling thread. Returns once they have all finished.
+ */
+void ymx_run_emit_jobs(ymx_emit_job_t *jobs, size_t num_jobs) {
+    size_t i;
+#ifdef _WIN32
+    for (i=0; i<num_jobs; i++)
+        ymx_emit_job_run(jobs + i);
+#else
+    pthread_t threads[YMX_MAX_EMIT_JOBS];
+    int started[YMX_MAX_EMIT_JOBS];
+    for (i=1; i<num_jobs; i++) {
+        started[i] = (pthread_create(threads + i, NULL,
+                ymx_emit_job_run, jobs + i) == 0);
+    }
+    ymx_emit_job_run(jobs);
+    for (i=1; i<num_jobs; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            ymx_emit_job_run(jobs + i);
+        }
+    }
+#endif
+}
+
+/* Emit a job's documents with an emitter of its own. This runs on a worker
+ * thread, so it mustn't call the Matlab API. The events are emitted (and
+ * so freed) as it goes; any it doesn't get to are left for
+ * ymx_persistent_cleanup.
+ */
+void *ymx_emit_job_run(void *data) {
+    ymx_emit_job_t *job = data;
+    yaml_emitter_t emitter;
+    yaml_event_t event;
+
+    if (!yaml_emitter_initialize(&emitter)) {
+        job->problem = "couldn't initialize emitter";
+        return NULL;
+    }
+    yaml_emitter_set_output(&emitter, ymx_emit_job_write_handler, job);
+
+    int ok = yaml_stream_start_event_initialize(&event, YAML_ANY_ENCODING)
+            && yaml_emitter_emit(&emitter, &event);
+    size_t i;
+    for (i=0; ok && i<job->num_events; i++) {
+        ok = yaml_emitter_emit(&emitter, job->events + i);
+        memset(job->events + i, 0, sizeof(yaml_event_t));
+    }
+    if (ok) {
+        if (job->is_last) {
+            ok = yaml_stream_end_event_initialize(&event)
+                    && yaml_emitter_emit(&emitter, &event);
+        } else {
+            ok = yaml_emitter_flush(&emitter);
+        }
+    }
+
+    job->open_ended = emitter.open_ended;
+    if (!ok)
+        job->problem = emitter.problem ? emitter.problem : "unknown error";
+    yaml_emitter_delete(&emitter);
+    return NULL;
+}
+
+int ymx_emit_job_write_handler(void *data,
+        unsigned char *buffer, size_t size) {
+    ymx_emit_job_t *job = data;
+    if (job->output_length + size > job->output_size) {
+        size_t new_size = job->output_size
+                ? job->output_size : EMIT_JOB_OUTPUT_INITIAL_SIZE;
+        while (new_size < job->output_length + size)
+            new_size *= 2;
+        char *output = realloc(job->output, new_size);
+        if (!output)
+            return 0;
+        job->output = output;
+        job->output_size = new_size;
+    }
+    memcpy(job->output + job->output_length, buffer, size);
+    job->output_length += size;
+    return 1;
+}
+
+int ymx_has_directives(const yaml_event_t *document_start) {
+    return document_start->data.document_start.version_directive
+            || document_start->data.document_start.tag_directives.start
+                != document_start->data.document_start.tag_directives.end;
+}
@@ -0,0 +1,226 @@
+#include "yaml_mex_util.h"
+
+/* NOTES
+ *
+ * A projection restricts a simple load to the parts of each document named
+ * by a list of key paths. Each path is a list of segments separated by
+ * '/', such as 'meta/version'; a segment matches the mapping key of that
+ * name, and a segment of '*' matches any key, or any item of a sequence.
+ * Whatever a whole path reaches is constructed in full, and scalars are
+ * taken whole wherever a path reaches them; everything that no path can
+ * reach is drained from the parser without being constructed.
+ *
+ * The paths are compiled into a trie, with a named child per distinct key
+ * and one child for '*'. Once every path has been added, the '*' subtree of
+ * each node is merged into each of its named siblings, so that while
+ * loading, choosing the child for a key is a single lookup: the named
+ * child if there is one, otherwise the '*' child.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+struct ymx_projection_s {
+    int complete;               /* A path ends here: take everything below */
+    size_t num_children;
+    size_t children_size;
+    char **names;               /* Key of each named child */
+    size_t *name_lengths;
+    ymx_projection_t **children;
+    ymx_projection_t *any;      /* Child for '*'; NULL if none */
+};
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t PROJECTION_CHILDREN_INITIAL_SIZE = 4;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+ymx_projection_t *ymx_projection_new();
+void ymx_projection_add_path(ymx_projection_t *root, const char *path);
+ymx_projection_t *ymx_projection_find(
+        const ymx_projection_t *projection,
+        const char *name, size_t length );
+ymx_projection_t *ymx_projection_find_or_add(
+        ymx_projection_t *projection,
+        const char *name, size_t length );
+void ymx_projection_merge(ymx_projection_t *dst, const ymx_projection_t *src);
+void ymx_projection_spread_any(ymx_projection_t *projection);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Compile a projection from paths, a string or a cell array of strings.
+ * Delete it with ymx_projection_delete. */
+ymx_projection_t *ymx_projection_create(const mxArray *paths) {
+    ymx_projection_t *root = ymx_projection_new();
+    if (mxIsChar(paths)) {
+        char *path = mxArrayToString(paths);
+        ymx_projection_add_path(root, path);
+        mxFree(path);
+    } else if (mxIsCell(paths)) {
+        mwSize num_paths = mxGetNumberOfElements(paths);
+        mwIndex i;
+        for (i=0; i<num_paths; i++) {
+            const mxArray *path_arr = mxGetCell(paths, i);
+            if (!path_arr || !mxIsChar(path_arr))
+                ymx_error("Projection paths must be strings");
+            char *path = mxArrayToString(path_arr);
+            ymx_projection_add_path(root, path);
+            mxFree(path);
+        }
+    } else {
+        ymx_error("Projection must be a string or a cell array of strings");
+    }
+    ymx_projection_spread_any(root);
+    return root;
+}
+
+void ymx_projection_delete(ymx_projection_t *projection) {
+    if (!projection)
+        return;
+    size_t i;
+    for (i=0; i<projection->num_children; i++) {
+        mxFree(projection->names[i]);
+        ymx_projection_delete(projection->children[i]);
+    }
+    ymx_projection_delete(projection->any);
+    if (projection->names) {
+        mxFree(projection->names);
+        mxFree(projection->name_lengths);
+        mxFree(projection->children);
+    }
+    mxFree(projection);
+}
+
+/* Decide whether the value under key (length bytes, or NULL for an item of
+ * a sequence) is wanted. Returns 0 if it isn't; otherwise returns 1 and
+ * stores in *child the projection for the value, or NULL if all of it is
+ * wanted. */
+int ymx_projection_select(
+        const ymx_projection_t *projection,
+        const char *key, size_t length,
+        const ymx_projection_t **child ) {
+    const ymx_projection_t *next = key
+            ? ymx_projection_find(projection, key, length) : NULL;
+    if (!next)
+        next = projection->any;
+    if (!next)
+        return 0;
+    *child = next->complete ? NULL : next;
+    return 1;
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+ymx_projection_t *ymx_projection_new() {
+    return mxCalloc(1, sizeof(ymx_projection_t));
+}
+
+void ymx_projection_add_path(ymx_projection_t *root, const char *path) {
+    ymx_projection_t *node = root;
+    const char *segment = path;
+    while (1) {
+        const char *end = strchr(segment, '/');
+        size_t length = end ? (size_t)(end - segment) : strlen(segment);
+        if (!length)
+            ymx_error("Projection paths can't have empty segments");
+
+        if (length == 1 && segment[0] == '*') {
+            if (!node->any)
+                node->any = ymx_projection_new();
+            node = node->any;
+        } else {
+            node = ymx_projection_find_or_add(node, segment, length);
+        }
+
+        if (!end)
+            break;
+        segment = end + 1;
+    }
+    node->complete = 1;
+}
+
+ymx_projection_t *ymx_projection_find(
+        const ymx_projection_t *projection,
+        const char *name, size_t length ) {
+    size_t i;
+    for (i=0; i<projection->num_children; i++) {
+        if (projection->name_lengths[i] == length
+                && memcmp(projection->names[i], name, length) == 0)
+            return projection->children[i];
+    }
+    return NULL;
+}
+
+ymx_projection_t *ymx_projection_find_or_add(
+        ymx_projection_t *projection,
+        const char *name, size_t length ) {
+    ymx_projection_t *child = ymx_projection_find(projection, name, length);
+    if (child)
+        return child;
+
+    if (projection->num_children == projection->children_size) {
+        size_t new_size = projection->children_size
+                ? 2*projection->children_size
+                : PROJECTION_CHILDREN_INITIAL_SIZE;
+        projection->names = mxRealloc(projection->names,
+                new_size * sizeof(char *));
+        projection->name_lengths = mxRealloc(projection->name_lengths,
+                new_size * sizeof(size_t));
+        projection->children = mxRealloc(projection->children,
+                new_size * sizeof(ymx_projection_t *));
+        projection->children_size = new_size;
+    }
+
+    size_t i = projection->num_children++;
+    projection->names[i] = mxMalloc(length + 1);
+    memcpy(projection->names[i], name, length);
+    projection->names[i][length] = '\0';
+    projection->name_lengths[i] = length;
+    projection->children[i] = child = ymx_projection_new();
+    return child;
+}
+
+/* Add everything src selects to dst, copying src's subtrees */
+void ymx_projection_merge(ymx_projection_t *dst, const ymx_projection_t *src) {
+    if (src->complete)
+        dst->complete = 1;
+    size_t i;
+    for (i=0; i<src->num_children; i++) {
+        ymx_projection_merge(
+                ymx_projection_find_or_add(dst,
+                    src->names[i], src->name_lengths[i]),
+                src->children[i] );
+    }
+    if (src->any) {
+        if (!dst->any)
+            dst->any = ymx_projection_new();
+        ymx_projection_merge(dst->any, src->any);
+    }
+}
+
+/* Merge the '*' child of every node into its named children, so that a
+ * key's named child (if any) selects everything the key should. */
+void ymx_projection_spread_any(ymx_projection_t *projection) {
+    size_t i;
+    for (i=0; i<projection->num_children; i++) {
+        if (projection->any)
+            ymx_projection_merge(projection->children[i], projection->any);
+        ymx_projection_spread_any(projection->children[i]);
+    }
+    if (projection->any)
+        ymx_projection_spread_any(projection->any);
+}
@@ -0,0 +1,491 @@
+/* For a 64-bit off_t, so fseeko reaches past 2 GB on 32-bit systems */
+#define _FILE_OFFSET_BITS 64
+#include "yaml_mex_util.h"
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* NOTES
+ *
+ * Reloaders load the same multi-document file again and again (a status
+ * file that some other process keeps appending to, say), parsing only the
+ * documents that are new or have changed since the last read:
+ *     h = yaml_mex('reloader_open', path, opts);
+ *     docs = yaml_mex('reloader_read', h);   % as often as needed
+ *     yaml_mex('reloader_close', h);
+ *
+ * Each read splits the file into chunks where its documents start,
+ * found just as for a document index (see yaml_mex_index.c): at lines
+ * beginning with "---" (followed by whitespace or the end of the line),
+ * together with any directives before them, or at the first content
+ * after a "...". Every chunk holds whole documents (normally exactly one)
+ * and can be parsed on its own. Each chunk is remembered by its byte
+ * range and a hash of its bytes, along with its loaded documents and the
+ * index of the first of them in the file; a chunk whose length and hash
+ * match a remembered one reuses its documents rather than being parsed
+ * again.
+ *
+ * With the 'append' option, the file is trusted only ever to grow: the
+ * bytes before the start of the last remembered chunk are assumed not to
+ * have changed, and only the rest of the file is read. (The last chunk is
+ * read again, as the writer may have been part way through it.) If the
+ * file has shrunk past that point, it is read in full.
+ *
+ * The documents of each chunk are kept as persistent arrays, and copied
+ * into the result. Copying every document on every read would make each
+ * read cost as much as the whole file again, so a read can skip the
+ * documents the caller already has, and only those after them are
+ * copied; the chunks holding them are found from the end of the chunk
+ * table. An append reloader polled this way does work proportional to
+ * the new data only:
+ *     n = max(numel(docs) - 1, 0);   % the last may have been partial
+ *     docs = [docs(1:n), yaml_mex('reloader_read', h, n)];
+ *
+ * A read builds its new chunk table in temporary memory and only
+ * replaces the old one once every chunk has loaded, so a parse error
+ * leaves the reloader as it was.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+/* A run of whole documents in the file, and what they loaded as */
+typedef struct ymx_chunk_s {
+    size_t offset;
+    size_t length;
+    uint64_T hash;
+    mxArray *docs; /* 1-by-K document array, or cell array of data */
+    size_t first_doc; /* Index of its first document in the file */
+} ymx_chunk_t;
+
+typedef struct ymx_reloader_s {
+    char *path;
+    int simple;               /* Construct native data, as load_simple */
+    int append;               /* Trust the file only to be appended to */
+    ymx_chunk_t *chunks;
+    size_t num_chunks;
+} ymx_reloader_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t RELOADERS_INITIAL_SIZE = 8;
+const size_t CHUNKS_INITIAL_SIZE = 16;
+const uint64_T YMX_CHUNK_HASH_SEED = 0x636875;
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+static ymx_reloader_t **reloaders = NULL;
+static size_t num_reloader_slots = 0;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+ymx_reloader_t *ymx_get_reloader(const mxArray *handle);
+char *ymx_read_file_range(const char *path, size_t offset, size_t length);
+size_t ymx_split_documents(const char *text, size_t length,
+        size_t **starts);
+ymx_chunk_t *ymx_find_chunk(const ymx_reloader_t *reloader,
+        mxLogical *claimed, size_t guess, size_t length, uint64_T hash);
+mxArray *ymx_load_chunk(const ymx_reloader_t *reloader,
+        const char *text, size_t length);
+mxArray *ymx_join_chunks(const ymx_reloader_t *reloader,
+        const ymx_chunk_t *chunks, size_t num_chunks, size_t skip,
+        int unwrap);
+void ymx_reloader_delete(ymx_reloader_t *reloader);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Open a reloader on the file at path, and return its handle. Nothing is
+ * read until ymx_reloader_read. options may be NULL, or a struct with any
+ * of these fields:
+ *         append: If true, the file is trusted only to be appended to
+ *                 (see the notes above). Default false.
+ *         simple: If true, documents are constructed as native data, as by
+ *                 yaml_mex('load_simple'); otherwise they are loaded as by
+ *                 yaml_mex('load'). Default false.
+ */
+mxArray *ymx_reloader_open(const mxArray *path, const mxArray *options) {
+    int append = 0;
+    int simple = 0;
+
+    if (options && !mxIsEmpty(options)) {
+        if (!mxIsStruct(options) || mxGetNumberOfElements(options) != 1)
+            ymx_error("Reloader options must be a scalar struct");
+
+        mxArray *append_arr = mxGetField(options, 0, "append");
+        if (append_arr) {
+            if (!(mxIsLogical(append_arr) || mxIsNumeric(append_arr))
+                    || mxGetNumberOfElements(append_arr) != 1)
+                ymx_error("Reloader option 'append' must be a logical "
+                        "scalar");
+            append = (mxGetScalar(append_arr) != 0);
+        }
+
+        mxArray *simple_arr = mxGetField(options, 0, "simple");
+        if (simple_arr) {
+            if (!(mxIsLogical(simple_arr) || mxIsNumeric(simple_arr))
+                    || mxGetNumberOfElements(simple_arr) != 1)
+                ymx_error("Reloader option 'simple' must be a logical "
+                        "scalar");
+            simple = (mxGetScalar(simple_arr) != 0);
+        }
+    }
+
+    /* Find a free slot, growing the table if there isn't one */
+    size_t slot;
+    for (slot=0; slot<num_reloader_slots; slot++) {
+        if (!reloaders[slot])
+            break;
+    }
+    if (slot == num_reloader_slots) {
+        size_t new_size = num_reloader_slots
+                ? 2*num_reloader_slots : RELOADERS_INITIAL_SIZE;
+        ymx_reloader_t **new_reloaders = mxCalloc(new_size,
+                sizeof(ymx_reloader_t *));
+        mexMakeMemoryPersistent(new_reloaders);
+        if (reloaders) {
+            memcpy(new_reloaders, reloaders,
+                    num_reloader_slots * sizeof(ymx_reloader_t *));
+            mxFree(reloaders);
+        }
+        reloaders = new_reloaders;
+        num_reloader_slots = new_size;
+    }
+
+    ymx_reloader_t *reloader = mxCalloc(1, sizeof(ymx_reloader_t));
+    mexMakeMemoryPersistent(reloader);
+    reloader->path = mxArrayToString(path);
+    mexMakeMemoryPersistent(reloader->path);
+    reloader->append = append;
+    reloader->simple = simple;
+    reloaders[slot] = reloader;
+
+    return mxCreateDoubleScalar((double)(slot + 1));
+}
+
+/* Read the file of a reloader again, and return its documents: a
+ * document array as from ymx_load_stream, or for a simple reloader, data
+ * as from ymx_construct_stream. Only chunks of the file not seen before
+ * are parsed. skip may be NULL, or a count of documents at the start of
+ * the file to leave out of the result; with it, the result is always a
+ * document array or cell array, even of one document. */
+mxArray *ymx_reloader_read(const mxArray *handle, const mxArray *skip) {
+    ymx_reloader_t *reloader = ymx_get_reloader(handle);
+
+    size_t num_skipped = 0;
+    if (skip) {
+        if (!mxIsNumeric(skip) || mxGetNumberOfElements(skip) != 1
+                || !(mxGetScalar(skip) >= 0))
+            ymx_error("Number of documents to skip must be a "
+                    "nonnegative integer");
+        /* Inf, or anything too large for a size_t, skips them all */
+        double value = mxGetScalar(skip);
+        num_skipped = value < (double)(size_t)-1
+                ? (size_t)value : (size_t)-1;
+        if (num_skipped != (size_t)-1 && (double)num_skipped != value)
+            ymx_error("Number of documents to skip must be a "
+                    "nonnegative integer");
+    }
+
+    struct stat info;
+    if (stat(reloader->path, &info) != 0)
+        ymx_error("Couldn't open file for reading");
+    size_t size = (size_t)info.st_size;
+
+    /* Chunks before the first are kept as they are */
+    size_t num_kept = 0;
+    size_t offset = 0;
+    if (reloader->append && reloader->num_chunks) {
+        const ymx_chunk_t *last = reloader->chunks
+                + reloader->num_chunks - 1;
+        if (size >= last->offset + last->length) {
+            num_kept = reloader->num_chunks - 1;
+            offset = last->offset;
+        }
+    }
+    char *text = ymx_read_file_range(reloader->path, offset, size - offset);
+
+    size_t *starts;
+    size_t num_new = ymx_split_documents(text, size - offset, &starts);
+    size_t num_chunks = num_kept + num_new;
+    ymx_chunk_t *chunks = mxCalloc(num_chunks ? num_chunks : 1,
+            sizeof(ymx_chunk_t));
+    if (num_kept)
+        memcpy(chunks, reloader->chunks, num_kept * sizeof(ymx_chunk_t));
+
+    /* Reuse or load every other chunk; loaded chunks are temporary until
+     * all of them have loaded. An old chunk's documents are reused by one
+     * new chunk at most (identical chunks are common enough, such as
+     * repeated heartbeat documents), so no two chunks share them. */
+    mxLogical *claimed = mxCalloc(reloader->num_chunks + 1,
+            sizeof(mxLogical));
+    size_t i;
+    for (i=0; i<num_kept; i++)
+        claimed[i] = 1;
+    for (i=0; i<num_new; i++) {
+        ymx_chunk_t *chunk = chunks + num_kept + i;
+        chunk->offset = offset + starts[i];
+        chunk->length = starts[i+1] - starts[i];
+        chunk->hash = ymx_hash_bytes(text + starts[i], chunk->length,
+                YMX_CHUNK_HASH_SEED);
+        ymx_chunk_t *old = ymx_find_chunk(reloader, claimed, num_kept + i,
+                chunk->length, chunk->hash);
+        if (old) {
+            chunk->docs = old->docs;
+        } else {
+            chunk->docs = ymx_load_chunk(reloader,
+                    text + starts[i], chunk->length);
+        }
+    }
+    mxFree(claimed);
+    mxFree(starts);
+    mxFree(text);
+    for (i=num_kept; i<num_chunks; i++) {
+        chunks[i].first_doc = i ? chunks[i-1].first_doc
+                + mxGetNumberOfElements(chunks[i-1].docs) : 0;
+    }
+
+    mxArray *result = ymx_join_chunks(reloader, chunks, num_chunks,
+            num_skipped, !skip);
+
+    /* Commit: keep the new chunks, and destroy the documents of the old
+     * ones that weren't reused */
+    for (i=num_kept; i<reloader->num_chunks; i++) {
+        mxArray *docs = reloader->chunks[i].docs;
+        size_t j;
+        for (j=num_kept; j<num_chunks; j++) {
+            if (chunks[j].docs == docs)
+                break;
+        }
+        if (j == num_chunks)
+            mxDestroyArray(docs);
+    }
+    for (i=num_kept; i<num_chunks; i++) {
+        mexMakeArrayPersistent(chunks[i].docs);
+    }
+    mexMakeMemoryPersistent(chunks);
+    if (reloader->chunks)
+        mxFree(reloader->chunks);
+    reloader->chunks = chunks;
+    reloader->num_chunks = num_chunks;
+
+    return result;
+}
+
+/* Close a reloader, releasing the documents it remembers */
+void ymx_reloader_close(const mxArray *handle) {
+    ymx_reloader_t *reloader = ymx_get_reloader(handle);
+    size_t slot = (size_t)mxGetScalar(handle) - 1;
+    reloaders[slot] = NULL;
+    ymx_reloader_delete(reloader);
+}
+
+/* Close every open reloader; called when the MEX-file is cleared. */
+void ymx_reloader_close_all() {
+    size_t slot;
+    for (slot=0; slot<num_reloader_slots; slot++) {
+        if (reloaders[slot])
+            ymx_reloader_delete(reloaders[slot]);
+    }
+    if (reloaders)
+        mxFree(reloaders);
+    reloaders = NULL;
+    num_reloader_slots = 0;
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+ymx_reloader_t *ymx_get_reloader(const mxArray *handle) {
+    if (!mxIsDouble(handle) || mxGetNumberOfElements(handle) != 1)
+        ymx_error("Invalid reloader handle");
+
+    double value = mxGetScalar(handle);
+    if (value < 1 || value > num_reloader_slots
+            || value != (double)(size_t)value
+            || !reloaders[(size_t)value - 1])
+        ymx_error("Invalid reloader handle");
+
+    return reloaders[(size_t)value - 1];
+}
+
+/* Read length bytes of a file, from offset, into an mxMalloc'd buffer */
+char *ymx_read_file_range(const char *path, size_t offset, size_t length) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        ymx_error("Couldn't open file for reading");
+    char *contents = mxMalloc(length + 1);
+    size_t num_read = 0;
+    if (ymx_seek_file(file, offset) == 0)
+        num_read = fread(contents, 1, length, file);
+    fclose(file);
+    if (num_read != length)
+        ymx_error("Error while reading file");
+    contents[length] = '\0';
+    return contents;
+}
+
+/* Seek to offset bytes from the start of file, returning 0 on success as
+ * fseek does. fseek takes a long, which stops at 2 GB on Windows (and on
+ * 32-bit systems), and the files read in pieces are mostly long logs. */
+int ymx_seek_file(FILE *file, uint64_T offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/* Find where the chunks of text start: at 0, and wherever a document
+ * starts, as for a document index (see ymx_doc_scan_line). Stores an
+ * mxMalloc'd array of the starts in *starts, followed by length as the
+ * end of the last chunk, and returns the number of chunks. */
+size_t ymx_split_documents(const char *text, size_t length,
+        size_t **starts) {
+    size_t size = CHUNKS_INITIAL_SIZE;
+    size_t *list = mxMalloc(size * sizeof(size_t));
+    size_t count = 0;
+    list[count++] = 0;
+
+    ymx_doc_scan_t scan = {0, 0};
+    size_t line = 0;
+    while (line < length) {
+        const char *end = memchr(text + line, '\n', length - line);
+        size_t next = end ? (size_t)(end - text) + 1 : length;
+
+        uint64_T start = ymx_doc_scan_line(&scan, text + line, next - line,
+                line);
+        if (start && start - 1 > list[count-1]) {
+            if (count + 1 == size) {
+                size *= 2;
+                list = mxRealloc(list, size * sizeof(size_t));
+            }
+            list[count++] = (size_t)(start - 1);
+        }
+        line = next;
+    }
+
+    list[count] = length;
+    if (count == 1 && length == 0)
+        count = 0;
+    *starts = list;
+    return count;
+}
+
+/* Find a chunk of the last read with the given length and hash that
+ * isn't yet claimed, looking first at the one in the same place, and
+ * claim it. */
+ymx_chunk_t *ymx_find_chunk(const ymx_reloader_t *reloader,
+        mxLogical *claimed, size_t guess, size_t length, uint64_T hash) {
+    size_t i = guess;
+    if (!(i < reloader->num_chunks && !claimed[i]
+            && reloader->chunks[i].length == length
+            && reloader->chunks[i].hash == hash)) {
+        for (i=0; i<reloader->num_chunks; i++) {
+            if (!claimed[i] && reloader->chunks[i].length == length
+                    && reloader->chunks[i].hash == hash)
+                break;
+        }
+        if (i == reloader->num_chunks)
+            return NULL;
+    }
+    claimed[i] = 1;
+    return reloader->chunks + i;
+}
+
+mxArray *ymx_load_chunk(const ymx_reloader_t *reloader,
+        const char *text, size_t length) {
+    if (reloader->simple)
+        return ymx_construct_documents(text, length, NULL);
+
+    mxArray *docs = ymx_load_string(text, length);
+    if (!docs)
+        docs = mxCreateStructMatrix(1, 0,
+                YMX_DOC_NUM_FIELDS, YMX_DOC_FIELD_STRS);
+    return docs;
+}
+
+/* Copy the documents of the chunks into one result, leaving out the first
+ * skip of them. With unwrap, a simple reloader's lone document is
+ * returned as it is rather than in a cell array. */
+mxArray *ymx_join_chunks(const ymx_reloader_t *reloader,
+        const ymx_chunk_t *chunks, size_t num_chunks, size_t skip,
+        int unwrap) {
+    /* The chunks from first on hold every document past the skipped
+     * ones; they are found from the end, so that reads that skip all but
+     * the newest documents don't visit the older chunks at all */
+    size_t first = num_chunks;
+    while (first > 0 && chunks[first-1].first_doc
+            + mxGetNumberOfElements(chunks[first-1].docs) > skip)
+        first--;
+
+    size_t num_docs = 0;
+    size_t i;
+    for (i=first; i<num_chunks; i++) {
+        num_docs += mxGetNumberOfElements(chunks[i].docs);
+    }
+    if (first < num_chunks && chunks[first].first_doc < skip)
+        num_docs -= skip - chunks[first].first_doc;
+
+    mxArray *result;
+    if (reloader->simple) {
+        result = mxCreateCellMatrix(num_docs ? 1 : 0, num_docs);
+    } else {
+        result = mxCreateStructMatrix(1, num_docs,
+                YMX_DOC_NUM_FIELDS, YMX_DOC_FIELD_STRS);
+    }
+
+    mwIndex ind = 0;
+    for (i=first; i<num_chunks; i++) {
+        const mxArray *docs = chunks[i].docs;
+        mwSize count = mxGetNumberOfElements(docs);
+        mwIndex k = chunks[i].first_doc < skip
+                ? skip - chunks[i].first_doc : 0;
+        for (; k<count; k++, ind++) {
+            if (reloader->simple) {
+                mxSetCell(result, ind, mxDuplicateArray(mxGetCell(docs, k)));
+                continue;
+            }
+            int field;
+            for (field=0; field<YMX_DOC_NUM_FIELDS; field++) {
+                const mxArray *value = mxGetFieldByNumber(docs, k, field);
+                if (value)
+                    mxSetFieldByNumber(result, ind, field,
+                            mxDuplicateArray(value));
+            }
+        }
+    }
+
+    if (reloader->simple && unwrap && num_docs == 1) {
+        mxArray *data = mxGetCell(result, 0);
+        mxSetCell(result, 0, NULL);
+        mxDestroyArray(result);
+        return data;
+    }
+    return result;
+}
+
+void ymx_reloader_delete(ymx_reloader_t *reloader) {
+    size_t i;
+    for (i=0; i<reloader->num_chunks; i++) {
+        mxDestroyArray(reloader->chunks[i].docs);
+    }
+    if (reloader->chunks)
+        mxFree(reloader->chunks);
+    mxFree(reloader->path);
+    mxFree(reloader);
+}
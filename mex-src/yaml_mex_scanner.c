@@ -0,0 +1,1424 @@
+#include "yaml_mex_util.h"
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define YMX_SCANNER_SSE2
+#endif
+
+/* NOTES
+ *
+ * An optional fast path for parsing, enabled with yaml_mex('scanner',
+ * 'fast'). Most of our files are plain block mappings and sequences of
+ * plain or quoted scalars, with perhaps some one-line flow collections,
+ * and for these, libyaml's scanner (which reads a character at a time,
+ * through several layers of queues) is much of the cost of a load. This
+ * file scans that subset directly, a line at a time, producing exactly the
+ * events libyaml would. It hands them out through ymx_parse, so every
+ * load that uses ymx_set_parser_input gets them unchanged, limits and all.
+ *
+ * Each document is scanned whole into a buffer of events before the first
+ * of them is handed out. Anything outside the subset -- directives, tags,
+ * anchors and aliases, block scalars, complex keys, plain scalars that
+ * continue onto another line, flow collections that do, tabs, non-ASCII
+ * text -- makes the scan of that document give up, and libyaml parses the
+ * rest of the input from the start of that document (see
+ * ymx_scanner_fall_back). Malformed input is just another thing the
+ * scanner doesn't handle, so every error message comes from libyaml.
+ * (Non-ASCII input is checked for up front, and goes to libyaml whole.)
+ *
+ * The scans for line breaks, indentation and the characters that end a
+ * scalar are the inner loops; with SSE2 they test 16 bytes at a time.
+ *
+ * Marks aren't filled in, so the 'events' command, which reports them,
+ * always uses libyaml.
+ *
+ * Input that looks like JSON -- its first character other than a space or
+ * line break is '{' or '[' -- is first tried as strict JSON, which is the
+ * default for every load (yaml_mex('scanner', 'json')). All of it is
+ * scanned into events before the first is handed out, as the flow
+ * collections, double-quoted keys and strings, and plain numbers and
+ * literals libyaml makes of the same text. Text that isn't strictly JSON,
+ * or that is but that libyaml reads some other way (a key on a different
+ * line from its ':', a tab outside the root collection, escapes of
+ * surrogate pairs, raw characters that libyaml takes as line breaks or
+ * rejects), goes to the block scanner in 'fast' mode, and otherwise to
+ * libyaml. Unlike the block scanner, JSON strings may hold any UTF-8.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+/* An event of the document being handed out. A scalar's value is at
+ * offset value in the scanner's text, followed by a NUL. */
+typedef struct ymx_fast_event_s {
+    yaml_event_type_t type;
+    int style;
+    int implicit;
+    size_t value;
+    size_t length;
+} ymx_fast_event_t;
+
+typedef enum ymx_scanner_mode_e {
+    YMX_SCANNER_MODE_LIBYAML,   /* libyaml for everything */
+    YMX_SCANNER_MODE_JSON,      /* This file for JSON only */
+    YMX_SCANNER_MODE_FAST       /* This file for JSON and the block subset */
+} ymx_scanner_mode_t;
+
+/* What ymx_scan_json_space passed over */
+typedef enum ymx_json_space_e {
+    YMX_JSON_SPACE_BREAK = 1,
+    YMX_JSON_SPACE_TAB = 2
+} ymx_json_space_t;
+
+typedef struct ymx_scanner_s {
+    int active;                 /* Handing out events for this load */
+    int stream_started;
+    int stream_ended;
+    const char *input;
+    const char *input_end;
+
+    /* The current line: its start, the next character not yet scanned,
+     * and its end (before any CR LF). Columns are counted from line. */
+    const char *line;
+    const char *content;
+    const char *end;
+    const char *next_line;
+    int at_end;                 /* No lines left */
+    size_t depth;
+    size_t num_served;          /* Events handed out, with the stream start */
+
+    ymx_fast_event_t *events;
+    size_t num_events;
+    size_t events_size;
+    size_t next_event;
+
+    char *text;
+    size_t text_length;
+    size_t text_size;
+} ymx_scanner_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t SCANNER_EVENTS_INITIAL_SIZE = 256;
+const size_t SCANNER_TEXT_INITIAL_SIZE = 4096;
+
+/* Deeper nesting than this is left to libyaml, to bound the recursion */
+const size_t SCANNER_MAX_DEPTH = 256;
+
+/* libyaml won't look further than this for the ':' after a simple key */
+const size_t SCANNER_MAX_KEY_LENGTH = 1024;
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+static ymx_scanner_mode_t scanner_mode = YMX_SCANNER_MODE_JSON;
+static ymx_scanner_t scanner;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+void ymx_scanner_fall_back(ymx_scanner_t *s, yaml_parser_t *parser,
+        const char *start);
+int ymx_scan_document(ymx_scanner_t *s);
+int ymx_scan_block_node(ymx_scanner_t *s, long parent);
+int ymx_scan_block_mapping(ymx_scanner_t *s, long column, int have_key);
+int ymx_scan_block_sequence(ymx_scanner_t *s, long column);
+int ymx_scan_inline_value(ymx_scanner_t *s, long parent);
+int ymx_scan_end_inline(ymx_scanner_t *s, long parent);
+int ymx_scan_flow_collection(ymx_scanner_t *s);
+int ymx_scan_flow_node(ymx_scanner_t *s);
+int ymx_scan_scalar(ymx_scanner_t *s, int flow);
+int ymx_scan_plain(ymx_scanner_t *s, int flow);
+int ymx_scan_single_quoted(ymx_scanner_t *s);
+int ymx_scan_double_quoted(ymx_scanner_t *s);
+int ymx_scan_escape(ymx_scanner_t *s, const char **p, char **out);
+
+int ymx_scan_json(ymx_scanner_t *s);
+int ymx_scan_json_value(ymx_scanner_t *s, const char **p);
+int ymx_scan_json_collection(ymx_scanner_t *s, const char **p);
+int ymx_scan_json_string(ymx_scanner_t *s, const char **p);
+int ymx_scan_json_number(ymx_scanner_t *s, const char **p);
+int ymx_scan_json_plain(ymx_scanner_t *s, const char **p, const char *stop);
+const char *ymx_scan_json_space(const char *p, const char *end, int *seen);
+
+void ymx_scan_line(ymx_scanner_t *s);
+void ymx_scan_skip_blank_lines(ymx_scanner_t *s);
+void ymx_scan_skip_spaces(ymx_scanner_t *s);
+int ymx_scan_rest_is_blank(const ymx_scanner_t *s);
+int ymx_scan_at_marker(const ymx_scanner_t *s, const char *marker);
+int ymx_scan_at_entry(const ymx_scanner_t *s);
+int ymx_scan_at_value_indicator(const ymx_scanner_t *s);
+
+ymx_fast_event_t *ymx_scan_push(ymx_scanner_t *s, yaml_event_type_t type,
+        int style);
+void ymx_scan_insert_start(ymx_scanner_t *s, size_t index,
+        yaml_event_type_t type);
+void ymx_scan_push_empty(ymx_scanner_t *s);
+char *ymx_scan_reserve_text(ymx_scanner_t *s, size_t length);
+void ymx_scan_set_event(const ymx_scanner_t *s,
+        const ymx_fast_event_t *fast, yaml_event_t *event);
+
+int ymx_scan_check_bytes(const char *p, const char *end);
+const char *ymx_scan_count_spaces(const char *p, const char *end);
+const char *ymx_scan_find_plain_stop(const char *p, const char *end,
+        int flow);
+const char *ymx_scan_find_double_stop(const char *p, const char *end);
+const char *ymx_scan_find_json_stop(const char *p, const char *end);
+size_t ymx_scan_utf8_length(const char *p, const char *end);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+mxArray *ymx_get_scanner() {
+    switch (scanner_mode) {
+        case YMX_SCANNER_MODE_LIBYAML:
+            return mxCreateString("libyaml");
+        case YMX_SCANNER_MODE_FAST:
+            return mxCreateString("fast");
+        default:
+            return mxCreateString("json");
+    }
+}
+
+/* Choose the scanner for later loads: 'libyaml', 'json' (the default) or
+ * 'fast'. The choice lasts until the MEX-file is cleared. */
+void ymx_set_scanner(const mxArray *mode) {
+    char *mode_str = mxIsChar(mode) ? mxArrayToString(mode) : NULL;
+    if (mode_str && strcmp(mode_str, "fast") == 0) {
+        scanner_mode = YMX_SCANNER_MODE_FAST;
+    } else if (mode_str && strcmp(mode_str, "json") == 0) {
+        scanner_mode = YMX_SCANNER_MODE_JSON;
+    } else if (mode_str && strcmp(mode_str, "libyaml") == 0) {
+        scanner_mode = YMX_SCANNER_MODE_LIBYAML;
+    } else {
+        mxFree(mode_str);
+        ymx_error("Scanner must be 'libyaml', 'json' or 'fast'");
+    }
+    mxFree(mode_str);
+}
+
+
+/*
+ * Internal interface, for ymx_parse and friends
+ *************************************************************************/
+
+/* The scanner chosen, as a ymx_scanner_mode_t, for ymx_load_settings_key */
+int ymx_scanner_mode() {
+    return (int)scanner_mode;
+}
+
+/* Take over the parsing of input, if it's JSON, or if the fast scanner is
+ * enabled and the input is all ASCII. Returns whether it did; if not,
+ * libyaml should be given the input. */
+int ymx_scanner_start(const char *input, size_t length) {
+    ymx_scanner_reset();
+    if (scanner_mode == YMX_SCANNER_MODE_LIBYAML)
+        return 0;
+
+    ymx_scanner_t *s = &scanner;
+    int seen = 0;
+    const char *first = ymx_scan_json_space(input, input + length, &seen);
+    if (first < input + length && (first[0] == '{' || first[0] == '[')) {
+        s->input = input;
+        s->input_end = input + length;
+        if (ymx_scan_json(s)) {
+            /* Every event is ready, and no lines are left to scan */
+            s->next_line = s->input_end;
+            s->active = 1;
+            s->num_served = 1;
+            return 1;
+        }
+        ymx_scanner_reset();
+    }
+
+    if (scanner_mode != YMX_SCANNER_MODE_FAST
+            || !ymx_scan_check_bytes(input, input + length))
+        return 0;
+
+    s->input = input;
+    s->input_end = input + length;
+    s->next_line = input;
+    s->active = 1;
+    s->num_served = 1;
+    return 1;
+}
+
+/* Produce the next event into event, returning 1, if the fast scanner is
+ * handling this load. Returns 0 if libyaml is (or, having just been given
+ * the rest of the input, now is) handling it instead. The event's strings
+ * belong to the scanner, so it mustn't be deleted with yaml_event_delete.
+ */
+int ymx_scanner_parse(yaml_parser_t *parser, yaml_event_t *event) {
+    ymx_scanner_t *s = &scanner;
+    if (!s->active)
+        return 0;
+
+    memset(event, 0, sizeof(yaml_event_t));
+    if (s->stream_ended) {
+        /* As libyaml does, answer with no event at all */
+        return 1;
+    }
+    if (!s->stream_started) {
+        s->stream_started = 1;
+        ymx_scan_line(s);
+        event->type = YAML_STREAM_START_EVENT;
+        event->data.stream_start.encoding = YAML_UTF8_ENCODING;
+        return 1;
+    }
+
+    if (s->next_event == s->num_events) {
+        ymx_scan_skip_blank_lines(s);
+        if (s->at_end) {
+            ymx_scanner_reset();
+            s->active = 1;
+            s->stream_ended = 1;
+            event->type = YAML_STREAM_END_EVENT;
+            return 1;
+        }
+
+        const char *start = s->line;
+        if (!ymx_scan_document(s)) {
+            ymx_scanner_fall_back(s, parser, start);
+            return 0;
+        }
+    }
+
+    s->num_served++;
+    ymx_scan_set_event(s, s->events + s->next_event++, event);
+    return 1;
+}
+
+/* Hand the rest of the input over to libyaml, from start, the start of a
+ * document the scanner couldn't handle. Only a document at the start of
+ * the stream, or after a "---" or directive, can be handed over as it is:
+ * libyaml doesn't treat other documents alike when they come first. For
+ * the rest, libyaml is given the whole input, and the events already
+ * handed out are parsed and dropped again. */
+void ymx_scanner_fall_back(ymx_scanner_t *s, yaml_parser_t *parser,
+        const char *start) {
+    size_t num_served = 0;
+    if (s->num_served > 1 && start[0] != '%'
+            && !(ymx_scan_at_marker(s, "---") && s->line == start)) {
+        num_served = s->num_served;
+        start = s->input;
+    }
+    size_t length = (size_t)(s->input_end - start);
+    ymx_scanner_reset();
+    yaml_parser_set_input_string(parser, (const yaml_char_t *)start, length);
+
+    /* libyaml starts over with a stream start, which the consumer has
+     * already seen */
+    if (!num_served)
+        num_served = 1;
+    yaml_event_t event;
+    while (num_served--) {
+        if (!yaml_parser_parse(parser, &event))
+            break;
+        yaml_event_delete(&event);
+    }
+}
+
+/* Forget the current load and release the scanner's buffers */
+void ymx_scanner_reset() {
+    ymx_scanner_t *s = &scanner;
+    if (s->events)
+        mxFree(s->events);
+    if (s->text)
+        mxFree(s->text);
+    memset(s, 0, sizeof(ymx_scanner_t));
+}
+
+
+/*
+ * Scanning the subset
+ *************************************************************************/
+
+/* Each of these returns 1 if it scanned its part, or 0 if the part is
+ * outside the subset. Nodes are scanned from s->content, and leave the
+ * scanner at the first line after them that isn't blank (or at the end).
+ */
+
+int ymx_scan_document(ymx_scanner_t *s) {
+    s->num_events = 0;
+    s->next_event = 0;
+    s->text_length = 0;
+    s->depth = 0;
+
+    /* libyaml only allows the first document to start without a "---" */
+    int explicit_start = ymx_scan_at_marker(s, "---");
+    if (!explicit_start && (s->num_served > 1 || ymx_scan_at_marker(s, "...")))
+        return 0;
+    ymx_scan_push(s, YAML_DOCUMENT_START_EVENT, 0)->implicit =
+            !explicit_start;
+
+    if (explicit_start) {
+        s->content = s->line + 3;
+        ymx_scan_skip_spaces(s);
+        if (!ymx_scan_rest_is_blank(s)) {
+            if (!ymx_scan_inline_value(s, -1))
+                return 0;
+        } else {
+            ymx_scan_line(s);
+            ymx_scan_skip_blank_lines(s);
+            if (s->at_end || ymx_scan_at_marker(s, "---")
+                    || ymx_scan_at_marker(s, "...")) {
+                ymx_scan_push_empty(s);
+            } else if (!ymx_scan_block_node(s, -1)) {
+                return 0;
+            }
+        }
+    } else if (!ymx_scan_block_node(s, -1)) {
+        return 0;
+    }
+
+    int explicit_end = 0;
+    if (ymx_scan_at_marker(s, "...")) {
+        s->content = s->line + 3;
+        ymx_scan_skip_spaces(s);
+        if (!ymx_scan_rest_is_blank(s))
+            return 0;
+        ymx_scan_line(s);
+        explicit_end = 1;
+    } else if (!s->at_end && !ymx_scan_at_marker(s, "---")) {
+        return 0;
+    }
+    ymx_scan_push(s, YAML_DOCUMENT_END_EVENT, 0)->implicit = !explicit_end;
+    return 1;
+}
+
+/* Scan the block node at s->content, inside a collection (or document)
+ * whose entries are at column parent. */
+int ymx_scan_block_node(ymx_scanner_t *s, long parent) {
+    if (++s->depth > SCANNER_MAX_DEPTH)
+        return 0;
+
+    const char *c = s->content;
+    long column = (long)(c - s->line);
+    int ok;
+    if (c[0] == '-' && (c + 1 == s->end || c[1] == ' ')) {
+        ok = ymx_scan_block_sequence(s, column);
+    } else if (c[0] == '[' || c[0] == '{') {
+        ok = ymx_scan_inline_value(s, parent);
+    } else {
+        /* A scalar, which is a key if a ':' follows */
+        size_t start = s->num_events;
+        ok = ymx_scan_scalar(s, 0);
+        if (ok && ymx_scan_at_value_indicator(s)) {
+            if ((size_t)(s->content - c) > SCANNER_MAX_KEY_LENGTH)
+                return 0;
+            ymx_scan_insert_start(s, start, YAML_MAPPING_START_EVENT);
+            ok = ymx_scan_block_mapping(s, column, 1);
+        } else if (ok) {
+            ok = ymx_scan_end_inline(s, parent);
+        }
+    }
+
+    s->depth--;
+    return ok;
+}
+
+/* Scan a block mapping whose keys are at column. If have_key, its start
+ * and first key have been scanned already, and s->content is at the ':'
+ * after that key. */
+int ymx_scan_block_mapping(ymx_scanner_t *s, long column, int have_key) {
+    if (!have_key)
+        ymx_scan_push(s, YAML_MAPPING_START_EVENT, YAML_BLOCK_MAPPING_STYLE);
+
+    while (1) {
+        if (!have_key) {
+            const char *key = s->content;
+            if (!ymx_scan_scalar(s, 0) || !ymx_scan_at_value_indicator(s)
+                    || (size_t)(s->content - key) > SCANNER_MAX_KEY_LENGTH)
+                return 0;
+        }
+        have_key = 0;
+
+        s->content++;
+        ymx_scan_skip_spaces(s);
+        if (!ymx_scan_rest_is_blank(s)) {
+            if (!ymx_scan_inline_value(s, column))
+                return 0;
+        } else {
+            ymx_scan_line(s);
+            ymx_scan_skip_blank_lines(s);
+            long indent = (long)(s->content - s->line);
+            if (s->at_end || ymx_scan_at_marker(s, "---")
+                    || ymx_scan_at_marker(s, "...")) {
+                ymx_scan_push_empty(s);
+            } else if (indent > column) {
+                if (!ymx_scan_block_node(s, column))
+                    return 0;
+            } else if (indent == column && ymx_scan_at_entry(s)) {
+                /* A sequence may sit at the same indentation as its key */
+                if (++s->depth > SCANNER_MAX_DEPTH
+                        || !ymx_scan_block_sequence(s, column))
+                    return 0;
+                s->depth--;
+            } else {
+                ymx_scan_push_empty(s);
+            }
+        }
+
+        if (s->at_end || ymx_scan_at_marker(s, "---")
+                || ymx_scan_at_marker(s, "..."))
+            break;
+        long indent = (long)(s->content - s->line);
+        if (indent < column)
+            break;
+        if (indent > column)
+            return 0;
+    }
+
+    ymx_scan_push(s, YAML_MAPPING_END_EVENT, 0);
+    return 1;
+}
+
+/* Scan a block sequence whose "- " entries are at column */
+int ymx_scan_block_sequence(ymx_scanner_t *s, long column) {
+    ymx_scan_push(s, YAML_SEQUENCE_START_EVENT, YAML_BLOCK_SEQUENCE_STYLE);
+
+    while (1) {
+        s->content++;
+        ymx_scan_skip_spaces(s);
+        if (!ymx_scan_rest_is_blank(s)) {
+            if (!ymx_scan_block_node(s, column))
+                return 0;
+        } else {
+            ymx_scan_line(s);
+            ymx_scan_skip_blank_lines(s);
+            if (!s->at_end && !ymx_scan_at_marker(s, "---")
+                    && !ymx_scan_at_marker(s, "...")
+                    && (long)(s->content - s->line) > column) {
+                if (!ymx_scan_block_node(s, column))
+                    return 0;
+            } else {
+                ymx_scan_push_empty(s);
+            }
+        }
+
+        if (s->at_end || ymx_scan_at_marker(s, "---")
+                || ymx_scan_at_marker(s, "..."))
+            break;
+        long indent = (long)(s->content - s->line);
+        if (indent < column)
+            break;
+        if (indent > column)
+            return 0;
+        /* Anything else at this column belongs to an enclosing mapping */
+        if (!ymx_scan_at_entry(s))
+            break;
+    }
+
+    ymx_scan_push(s, YAML_SEQUENCE_END_EVENT, 0);
+    return 1;
+}
+
+/* Scan a scalar or flow collection that must end its line, in a block
+ * collection whose entries are at column parent. */
+int ymx_scan_inline_value(ymx_scanner_t *s, long parent) {
+    if (s->content[0] == '[' || s->content[0] == '{') {
+        if (!ymx_scan_flow_collection(s))
+            return 0;
+        ymx_scan_skip_spaces(s);
+    } else if (!ymx_scan_scalar(s, 0)) {
+        return 0;
+    }
+    return ymx_scan_end_inline(s, parent);
+}
+
+/* Finish the line of a value scanned by ymx_scan_inline_value */
+int ymx_scan_end_inline(ymx_scanner_t *s, long parent) {
+    if (!ymx_scan_rest_is_blank(s))
+        return 0;
+
+    ymx_scan_line(s);
+    ymx_scan_skip_blank_lines(s);
+    /* A deeper line would continue a plain scalar, or be an error */
+    return s->at_end || ymx_scan_at_marker(s, "---")
+            || ymx_scan_at_marker(s, "...")
+            || (long)(s->content - s->line) <= parent;
+}
+
+/* Scan a flow sequence or mapping, which must end on the same line */
+int ymx_scan_flow_collection(ymx_scanner_t *s) {
+    if (++s->depth > SCANNER_MAX_DEPTH)
+        return 0;
+
+    int is_mapping = (s->content[0] == '{');
+    char closer = is_mapping ? '}' : ']';
+    ymx_scan_push(s,
+            is_mapping ? YAML_MAPPING_START_EVENT : YAML_SEQUENCE_START_EVENT,
+            is_mapping ? YAML_FLOW_MAPPING_STYLE : YAML_FLOW_SEQUENCE_STYLE);
+    s->content++;
+    ymx_scan_skip_spaces(s);
+
+    if (s->content < s->end && s->content[0] == closer) {
+        s->content++;
+    } else {
+        while (1) {
+            if (is_mapping) {
+                const char *key = s->content;
+                if (!ymx_scan_scalar(s, 1) || !ymx_scan_at_value_indicator(s)
+                        || s->content + 1 == s->end
+                        || (size_t)(s->content - key) > SCANNER_MAX_KEY_LENGTH)
+                    return 0;
+                s->content++;
+                ymx_scan_skip_spaces(s);
+            }
+            if (!ymx_scan_flow_node(s))
+                return 0;
+
+            if (s->content == s->end)
+                return 0;
+            if (s->content[0] == closer) {
+                s->content++;
+                break;
+            }
+            if (s->content[0] != ',')
+                return 0;
+            s->content++;
+            ymx_scan_skip_spaces(s);
+            /* libyaml allows a trailing ',', but leave that to it */
+            if (s->content == s->end || s->content[0] == closer)
+                return 0;
+        }
+    }
+
+    ymx_scan_push(s,
+            is_mapping ? YAML_MAPPING_END_EVENT : YAML_SEQUENCE_END_EVENT, 0);
+    s->depth--;
+    return 1;
+}
+
+/* Scan an item of a flow collection, and the spaces after it */
+int ymx_scan_flow_node(ymx_scanner_t *s) {
+    if (s->content == s->end)
+        return 0;
+    if (s->content[0] == '[' || s->content[0] == '{') {
+        if (!ymx_scan_flow_collection(s))
+            return 0;
+        ymx_scan_skip_spaces(s);
+        return 1;
+    }
+    return ymx_scan_scalar(s, 1);
+}
+
+/* Scan a plain or quoted scalar, and the spaces after it */
+int ymx_scan_scalar(ymx_scanner_t *s, int flow) {
+    int ok;
+    switch (s->content[0]) {
+        case '\'':
+            ok = ymx_scan_single_quoted(s);
+            break;
+        case '"':
+            ok = ymx_scan_double_quoted(s);
+            break;
+        default:
+            ok = ymx_scan_plain(s, flow);
+    }
+    if (ok)
+        ymx_scan_skip_spaces(s);
+    return ok;
+}
+
+int ymx_scan_plain(ymx_scanner_t *s, int flow) {
+    const char *start = s->content;
+    const char *end = s->end;
+    if (start == end)
+        return 0;
+
+    /* Indicators can't start a plain scalar, though "-", "?" and ":" can
+     * if something other than a space follows */
+    switch (start[0]) {
+        case '-':
+            if (start + 1 == end || start[1] == ' ' || (flow
+                    && strchr(",[]{}", start[1])))
+                return 0;
+            break;
+        case '?': case ':':
+            if (flow || start + 1 == end || start[1] == ' ')
+                return 0;
+            break;
+        case ',': case '[': case ']': case '{': case '}': case '#':
+        case '&': case '*': case '!': case '|': case '>': case '\'':
+        case '"': case '%': case '@': case '`':
+            return 0;
+        default:
+            break;
+    }
+
+    /* The scalar ends at ": ", " #", or in a flow collection, a flow
+     * indicator */
+    const char *stop = start + 1;
+    while (1) {
+        stop = ymx_scan_find_plain_stop(stop, end, flow);
+        if (stop == end)
+            break;
+        if (stop[0] == ':') {
+            if (stop + 1 == end || stop[1] == ' ')
+                break;
+            /* libyaml versions disagree on ':' inside flow scalars */
+            if (flow)
+                return 0;
+        } else if (stop[0] == '#') {
+            if (stop[-1] == ' ')
+                break;
+        } else {
+            break;
+        }
+        stop++;
+    }
+
+    const char *value_end = stop;
+    while (value_end > start && value_end[-1] == ' ')
+        value_end--;
+    size_t length = (size_t)(value_end - start);
+    char *out = ymx_scan_reserve_text(s, length);
+    memcpy(out, start, length);
+    out[length] = '\0';
+
+    ymx_fast_event_t *event = ymx_scan_push(s, YAML_SCALAR_EVENT,
+            YAML_PLAIN_SCALAR_STYLE);
+    event->value = s->text_length;
+    event->length = length;
+    s->text_length += length + 1;
+    s->content = stop;
+    return 1;
+}
+
+int ymx_scan_single_quoted(ymx_scanner_t *s) {
+    const char *p = s->content + 1;
+    const char *end = s->end;
+    /* The value is never longer than the line */
+    char *out = ymx_scan_reserve_text(s, (size_t)(end - p));
+    char *start = out;
+
+    while (1) {
+        const char *quote = memchr(p, '\'', (size_t)(end - p));
+        if (!quote)
+            return 0;
+        memcpy(out, p, (size_t)(quote - p));
+        out += quote - p;
+        if (quote + 1 < end && quote[1] == '\'') {
+            *out++ = '\'';
+            p = quote + 2;
+        } else {
+            p = quote + 1;
+            break;
+        }
+    }
+    *out = '\0';
+
+    ymx_fast_event_t *event = ymx_scan_push(s, YAML_SCALAR_EVENT,
+            YAML_SINGLE_QUOTED_SCALAR_STYLE);
+    event->value = s->text_length;
+    event->length = (size_t)(out - start);
+    s->text_length += event->length + 1;
+    s->content = p;
+    return 1;
+}
+
+int ymx_scan_double_quoted(ymx_scanner_t *s) {
+    const char *p = s->content + 1;
+    const char *end = s->end;
+    /* Escapes decode to at most 3 bytes for every 2 they take up */
+    char *out = ymx_scan_reserve_text(s, (size_t)(end - p) / 2 * 3 + 1);
+    char *start = out;
+
+    while (1) {
+        const char *stop = ymx_scan_find_double_stop(p, end);
+        if (stop == end)
+            return 0;
+        memcpy(out, p, (size_t)(stop - p));
+        out += stop - p;
+        p = stop + 1;
+        if (stop[0] == '"')
+            break;
+        if (!ymx_scan_escape(s, &p, &out))
+            return 0;
+    }
+    *out = '\0';
+
+    ymx_fast_event_t *event = ymx_scan_push(s, YAML_SCALAR_EVENT,
+            YAML_DOUBLE_QUOTED_SCALAR_STYLE);
+    event->value = s->text_length;
+    event->length = (size_t)(out - start);
+    s->text_length += event->length + 1;
+    s->content = p;
+    return 1;
+}
+
+/* Decode the escape after a '\' at *p to UTF-8 at *out, advancing both */
+int ymx_scan_escape(ymx_scanner_t *s, const char **p, char **out) {
+    const char *in = *p;
+    if (in == s->end)
+        return 0;
+
+    unsigned long code;
+    int num_digits = 0;
+    switch (*in++) {
+        case '0': code = 0x00; break;
+        case 'a': code = 0x07; break;
+        case 'b': code = 0x08; break;
+        case 't': code = 0x09; break;
+        case 'n': code = 0x0A; break;
+        case 'v': code = 0x0B; break;
+        case 'f': code = 0x0C; break;
+        case 'r': code = 0x0D; break;
+        case 'e': code = 0x1B; break;
+        case ' ': code = 0x20; break;
+        case '"': code = 0x22; break;
+        case '/': code = 0x2F; break;
+        case '\\': code = 0x5C; break;
+        case 'N': code = 0x85; break;
+        case '_': code = 0xA0; break;
+        case 'L': code = 0x2028; break;
+        case 'P': code = 0x2029; break;
+        case 'x': num_digits = 2; break;
+        case 'u': num_digits = 4; break;
+        case 'U': num_digits = 8; break;
+        default:
+            return 0;
+    }
+
+    if (num_digits) {
+        if (s->end - in < num_digits)
+            return 0;
+        code = 0;
+        int i;
+        for (i=0; i<num_digits; i++) {
+            char c = in[i];
+            int digit;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                digit = c - 'A' + 10;
+            else
+                return 0;
+            code = (code << 4) | (unsigned long)digit;
+        }
+        in += num_digits;
+        /* libyaml rejects these, with its own message */
+        if ((code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF)
+            return 0;
+    }
+
+    char *o = *out;
+    if (code < 0x80) {
+        *o++ = (char)code;
+    } else if (code < 0x800) {
+        *o++ = (char)(0xC0 | (code >> 6));
+        *o++ = (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        *o++ = (char)(0xE0 | (code >> 12));
+        *o++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *o++ = (char)(0x80 | (code & 0x3F));
+    } else {
+        *o++ = (char)(0xF0 | (code >> 18));
+        *o++ = (char)(0x80 | ((code >> 12) & 0x3F));
+        *o++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *o++ = (char)(0x80 | (code & 0x3F));
+    }
+    *out = o;
+    *p = in;
+    return 1;
+}
+
+
+/*
+ * Scanning JSON
+ *************************************************************************/
+
+/* Scan the whole input, which starts like JSON, as one document. These
+ * functions work through the input with a pointer of their own, and return
+ * 0 if it isn't strictly JSON, or if libyaml might read it differently
+ * from the way they would. */
+int ymx_scan_json(ymx_scanner_t *s) {
+    s->num_events = 0;
+    s->next_event = 0;
+    s->text_length = 0;
+    s->depth = 0;
+    /* ymx_scan_escape stops at s->end */
+    s->end = s->input_end;
+
+    /* libyaml takes a tab outside a flow collection only after something
+     * else on its line, so leave any there to libyaml */
+    int seen = 0;
+    const char *p = ymx_scan_json_space(s->input, s->input_end, &seen);
+    ymx_scan_push(s, YAML_DOCUMENT_START_EVENT, 0)->implicit = 1;
+    if (!ymx_scan_json_collection(s, &p))
+        return 0;
+    p = ymx_scan_json_space(p, s->input_end, &seen);
+    if (p != s->input_end || (seen & YMX_JSON_SPACE_TAB))
+        return 0;
+    ymx_scan_push(s, YAML_DOCUMENT_END_EVENT, 0)->implicit = 1;
+    return 1;
+}
+
+int ymx_scan_json_value(ymx_scanner_t *s, const char **p) {
+    const char *start = *p;
+    const char *end = s->input_end;
+    if (start == end)
+        return 0;
+
+    switch (start[0]) {
+        case '{': case '[':
+            return ymx_scan_json_collection(s, p);
+        case '"':
+            return ymx_scan_json_string(s, p);
+        case 't':
+            return end - start >= 4 && memcmp(start, "true", 4) == 0
+                    && ymx_scan_json_plain(s, p, start + 4);
+        case 'f':
+            return end - start >= 5 && memcmp(start, "false", 5) == 0
+                    && ymx_scan_json_plain(s, p, start + 5);
+        case 'n':
+            return end - start >= 4 && memcmp(start, "null", 4) == 0
+                    && ymx_scan_json_plain(s, p, start + 4);
+        default:
+            return ymx_scan_json_number(s, p);
+    }
+}
+
+/* Scan an object or array, as a flow mapping or sequence */
+int ymx_scan_json_collection(ymx_scanner_t *s, const char **p) {
+    if (++s->depth > SCANNER_MAX_DEPTH)
+        return 0;
+
+    const char *in = *p;
+    const char *end = s->input_end;
+    int is_mapping = (in[0] == '{');
+    char closer = is_mapping ? '}' : ']';
+    ymx_scan_push(s,
+            is_mapping ? YAML_MAPPING_START_EVENT : YAML_SEQUENCE_START_EVENT,
+            is_mapping ? YAML_FLOW_MAPPING_STYLE : YAML_FLOW_SEQUENCE_STYLE);
+
+    int seen = 0;
+    in = ymx_scan_json_space(in + 1, end, &seen);
+    if (in < end && in[0] == closer) {
+        in++;
+    } else {
+        while (1) {
+            if (is_mapping) {
+                const char *key = in;
+                if (in == end || in[0] != '"' || !ymx_scan_json_string(s, &in))
+                    return 0;
+                /* libyaml only takes a key that's on the same line as its
+                 * ':', and not too far before it */
+                seen = 0;
+                in = ymx_scan_json_space(in, end, &seen);
+                if (in == end || in[0] != ':' || (seen & YMX_JSON_SPACE_BREAK)
+                        || (size_t)(in - key) > SCANNER_MAX_KEY_LENGTH)
+                    return 0;
+                in = ymx_scan_json_space(in + 1, end, &seen);
+            }
+            if (!ymx_scan_json_value(s, &in))
+                return 0;
+
+            in = ymx_scan_json_space(in, end, &seen);
+            if (in == end)
+                return 0;
+            if (in[0] == closer) {
+                in++;
+                break;
+            }
+            if (in[0] != ',')
+                return 0;
+            in = ymx_scan_json_space(in + 1, end, &seen);
+        }
+    }
+
+    ymx_scan_push(s,
+            is_mapping ? YAML_MAPPING_END_EVENT : YAML_SEQUENCE_END_EVENT, 0);
+    s->depth--;
+    *p = in;
+    return 1;
+}
+
+/* Scan a string, as a double-quoted scalar. JSON's escapes are all YAML
+ * escapes too, and mean the same. */
+int ymx_scan_json_string(ymx_scanner_t *s, const char **p) {
+    const char *in = *p + 1;
+    const char *end = s->input_end;
+    size_t length = 0;
+    char *out;
+
+    while (1) {
+        const char *stop = ymx_scan_find_json_stop(in, end);
+        if (stop == end)
+            return 0;
+        /* Room for the run, and what the character at stop becomes */
+        size_t run = (size_t)(stop - in);
+        out = ymx_scan_reserve_text(s, length + run + 4);
+        memcpy(out + length, in, run);
+        length += run;
+        in = stop;
+
+        unsigned char c = (unsigned char)in[0];
+        if (c == '"') {
+            in++;
+            break;
+        } else if (c == '\\') {
+            in++;
+            if (in == end || !in[0] || !strchr("\"\\/bfnrtu", in[0]))
+                return 0;
+            char *o = out + length;
+            if (!ymx_scan_escape(s, &in, &o))
+                return 0;
+            length = (size_t)(o - out);
+        } else {
+            size_t n = c >= 0x80 ? ymx_scan_utf8_length(in, end) : 0;
+            if (!n)
+                return 0;
+            memcpy(out + length, in, n);
+            length += n;
+            in += n;
+        }
+    }
+
+    out = ymx_scan_reserve_text(s, length);
+    out[length] = '\0';
+    ymx_fast_event_t *event = ymx_scan_push(s, YAML_SCALAR_EVENT,
+            YAML_DOUBLE_QUOTED_SCALAR_STYLE);
+    event->value = s->text_length;
+    event->length = length;
+    s->text_length += length + 1;
+    *p = in;
+    return 1;
+}
+
+int ymx_scan_json_number(ymx_scanner_t *s, const char **p) {
+    const char *in = *p;
+    const char *end = s->input_end;
+    if (in < end && in[0] == '-')
+        in++;
+    if (in == end)
+        return 0;
+    if (in[0] == '0') {
+        in++;
+    } else if (in[0] >= '1' && in[0] <= '9') {
+        while (in < end && in[0] >= '0' && in[0] <= '9')
+            in++;
+    } else {
+        return 0;
+    }
+
+    if (in < end && in[0] == '.') {
+        in++;
+        if (in == end || in[0] < '0' || in[0] > '9')
+            return 0;
+        while (in < end && in[0] >= '0' && in[0] <= '9')
+            in++;
+    }
+    if (in < end && (in[0] == 'e' || in[0] == 'E')) {
+        in++;
+        if (in < end && (in[0] == '+' || in[0] == '-'))
+            in++;
+        if (in == end || in[0] < '0' || in[0] > '9')
+            return 0;
+        while (in < end && in[0] >= '0' && in[0] <= '9')
+            in++;
+    }
+    return ymx_scan_json_plain(s, p, in);
+}
+
+/* Push the number or literal from *p to stop as a plain scalar, if it ends
+ * there, as it must for libyaml to end it there too */
+int ymx_scan_json_plain(ymx_scanner_t *s, const char **p, const char *stop) {
+    if (stop < s->input_end && !(stop[0] && strchr(" \t\r\n,]}", stop[0])))
+        return 0;
+
+    size_t length = (size_t)(stop - *p);
+    char *out = ymx_scan_reserve_text(s, length);
+    memcpy(out, *p, length);
+    out[length] = '\0';
+
+    ymx_fast_event_t *event = ymx_scan_push(s, YAML_SCALAR_EVENT,
+            YAML_PLAIN_SCALAR_STYLE);
+    event->value = s->text_length;
+    event->length = length;
+    s->text_length += length + 1;
+    *p = stop;
+    return 1;
+}
+
+/* Return the first character from p that isn't JSON whitespace, or end,
+ * adding to *seen any line breaks and tabs passed over */
+const char *ymx_scan_json_space(const char *p, const char *end, int *seen) {
+    while (p < end) {
+        switch (p[0]) {
+            case ' ':
+                p = ymx_scan_count_spaces(p, end);
+                continue;
+            case '\n': case '\r':
+                *seen |= YMX_JSON_SPACE_BREAK;
+                break;
+            case '\t':
+                *seen |= YMX_JSON_SPACE_TAB;
+                break;
+            default:
+                return p;
+        }
+        p++;
+    }
+    return p;
+}
+
+
+/*
+ * Lines
+ *************************************************************************/
+
+/* Move to the next line, and past its indentation */
+void ymx_scan_line(ymx_scanner_t *s) {
+    if (s->next_line == s->input_end) {
+        s->at_end = 1;
+        s->line = s->content = s->end = s->input_end;
+        return;
+    }
+    s->line = s->next_line;
+    const char *newline = memchr(s->line, '\n',
+            (size_t)(s->input_end - s->line));
+    s->end = newline ? newline : s->input_end;
+    s->next_line = newline ? newline + 1 : s->input_end;
+    if (s->end > s->line && s->end[-1] == '\r')
+        s->end--;
+    s->content = ymx_scan_count_spaces(s->line, s->end);
+}
+
+void ymx_scan_skip_blank_lines(ymx_scanner_t *s) {
+    while (!s->at_end && ymx_scan_rest_is_blank(s))
+        ymx_scan_line(s);
+}
+
+void ymx_scan_skip_spaces(ymx_scanner_t *s) {
+    s->content = ymx_scan_count_spaces(s->content, s->end);
+}
+
+/* Whether nothing but a comment is left of the line. s->content must be
+ * past any spaces, and a '#' there must follow one (or start the line). */
+int ymx_scan_rest_is_blank(const ymx_scanner_t *s) {
+    return s->content == s->end || (s->content[0] == '#'
+            && (s->content == s->line || s->content[-1] == ' '));
+}
+
+/* Whether the line is a "---" or "..." document marker */
+int ymx_scan_at_marker(const ymx_scanner_t *s, const char *marker) {
+    return !s->at_end && s->content == s->line && s->end - s->line >= 3
+            && memcmp(s->line, marker, 3) == 0
+            && (s->end - s->line == 3 || s->line[3] == ' ');
+}
+
+/* Whether s->content is at a "- " block sequence entry */
+int ymx_scan_at_entry(const ymx_scanner_t *s) {
+    return s->content[0] == '-'
+            && (s->content + 1 == s->end || s->content[1] == ' ');
+}
+
+/* Whether s->content is at the ':' after a key */
+int ymx_scan_at_value_indicator(const ymx_scanner_t *s) {
+    return s->content < s->end && s->content[0] == ':'
+            && (s->content + 1 == s->end || s->content[1] == ' ');
+}
+
+
+/*
+ * Events and text
+ *************************************************************************/
+
+ymx_fast_event_t *ymx_scan_push(ymx_scanner_t *s, yaml_event_type_t type,
+        int style) {
+    if (s->num_events == s->events_size) {
+        s->events_size = s->events_size
+                ? 2*s->events_size : SCANNER_EVENTS_INITIAL_SIZE;
+        s->events = mxRealloc(s->events,
+                s->events_size * sizeof(ymx_fast_event_t));
+        mexMakeMemoryPersistent(s->events);
+    }
+    ymx_fast_event_t *event = s->events + s->num_events++;
+    memset(event, 0, sizeof(ymx_fast_event_t));
+    event->type = type;
+    event->style = style;
+    return event;
+}
+
+/* Insert the start of a block collection before the event at index */
+void ymx_scan_insert_start(ymx_scanner_t *s, size_t index,
+        yaml_event_type_t type) {
+    ymx_scan_push(s, type, 0);
+    memmove(s->events + index + 1, s->events + index,
+            (s->num_events - 1 - index) * sizeof(ymx_fast_event_t));
+    memset(s->events + index, 0, sizeof(ymx_fast_event_t));
+    s->events[index].type = type;
+    s->events[index].style = (type == YAML_MAPPING_START_EVENT)
+            ? YAML_BLOCK_MAPPING_STYLE : YAML_BLOCK_SEQUENCE_STYLE;
+}
+
+/* Push the empty plain scalar that stands for a missing node */
+void ymx_scan_push_empty(ymx_scanner_t *s) {
+    char *out = ymx_scan_reserve_text(s, 0);
+    out[0] = '\0';
+    ymx_fast_event_t *event = ymx_scan_push(s, YAML_SCALAR_EVENT,
+            YAML_PLAIN_SCALAR_STYLE);
+    event->value = s->text_length;
+    s->text_length++;
+}
+
+/* Make room for a value of up to length bytes and its NUL at the end of
+ * the text, and return where it goes */
+char *ymx_scan_reserve_text(ymx_scanner_t *s, size_t length) {
+    size_t needed = s->text_length + length + 1;
+    if (needed > s->text_size) {
+        size_t size = s->text_size ? s->text_size : SCANNER_TEXT_INITIAL_SIZE;
+        while (size < needed)
+            size *= 2;
+        s->text = mxRealloc(s->text, size);
+        mexMakeMemoryPersistent(s->text);
+        s->text_size = size;
+    }
+    return s->text + s->text_length;
+}
+
+/* Fill in a libyaml event (already zeroed) from a scanned one, as libyaml
+ * would for the same text */
+void ymx_scan_set_event(const ymx_scanner_t *s,
+        const ymx_fast_event_t *fast, yaml_event_t *event) {
+    event->type = fast->type;
+    switch (fast->type) {
+        case YAML_DOCUMENT_START_EVENT:
+            event->data.document_start.implicit = fast->implicit;
+            break;
+        case YAML_DOCUMENT_END_EVENT:
+            event->data.document_end.implicit = fast->implicit;
+            break;
+        case YAML_SCALAR_EVENT:
+            event->data.scalar.value = (yaml_char_t *)(s->text + fast->value);
+            event->data.scalar.length = fast->length;
+            event->data.scalar.plain_implicit =
+                    (fast->style == YAML_PLAIN_SCALAR_STYLE);
+            event->data.scalar.quoted_implicit =
+                    (fast->style != YAML_PLAIN_SCALAR_STYLE);
+            event->data.scalar.style = (yaml_scalar_style_t)fast->style;
+            break;
+        case YAML_SEQUENCE_START_EVENT:
+            event->data.sequence_start.implicit = 1;
+            event->data.sequence_start.style =
+                    (yaml_sequence_style_t)fast->style;
+            break;
+        case YAML_MAPPING_START_EVENT:
+            event->data.mapping_start.implicit = 1;
+            event->data.mapping_start.style =
+                    (yaml_mapping_style_t)fast->style;
+            break;
+        default:
+            break;
+    }
+}
+
+
+/*
+ * Character classification
+ *************************************************************************/
+
+/* Whether every byte is printable ASCII or a line break (LF, or CR LF) */
+int ymx_scan_check_bytes(const char *p, const char *end) {
+#ifdef YMX_SCANNER_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        /* Signed, so bytes of 0x80 and up count as below ' ' too */
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi8(bytes, space),
+                _mm_cmpeq_epi8(bytes, del));
+        __m128i breaks = _mm_or_si128(_mm_cmpeq_epi8(bytes, lf),
+                _mm_cmpeq_epi8(bytes, cr));
+        int mask = _mm_movemask_epi8(_mm_andnot_si128(breaks, bad));
+        if (mask)
+            return 0;
+        int crs = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, cr));
+        while (crs) {
+            int i = __builtin_ctz(crs);
+            if (p + i + 1 == end || p[i + 1] != '\n')
+                return 0;
+            crs &= crs - 1;
+        }
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '\r') {
+            if (p + 1 == end || p[1] != '\n')
+                return 0;
+        } else if ((c < ' ' && c != '\n') || c >= 0x7F) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Return the first character from p that isn't a space */
+const char *ymx_scan_count_spaces(const char *p, const char *end) {
+#ifdef YMX_SCANNER_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)) & 0xFFFF;
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p == ' ')
+        p++;
+    return p;
+}
+
+/* Return the first ':' or '#' from p (or in a flow collection, also the
+ * first flow indicator), or end if there is none */
+const char *ymx_scan_find_plain_stop(const char *p, const char *end,
+        int flow) {
+#ifdef YMX_SCANNER_SSE2
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i open_bracket = _mm_set1_epi8('[');
+    const __m128i close_bracket = _mm_set1_epi8(']');
+    const __m128i open_brace = _mm_set1_epi8('{');
+    const __m128i close_brace = _mm_set1_epi8('}');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i stops = _mm_or_si128(_mm_cmpeq_epi8(bytes, colon),
+                _mm_cmpeq_epi8(bytes, hash));
+        if (flow) {
+            __m128i brackets = _mm_or_si128(
+                    _mm_cmpeq_epi8(bytes, open_bracket),
+                    _mm_cmpeq_epi8(bytes, close_bracket));
+            __m128i braces = _mm_or_si128(
+                    _mm_cmpeq_epi8(bytes, open_brace),
+                    _mm_cmpeq_epi8(bytes, close_brace));
+            stops = _mm_or_si128(stops, _mm_or_si128(
+                    _mm_cmpeq_epi8(bytes, comma),
+                    _mm_or_si128(brackets, braces)));
+        }
+        int mask = _mm_movemask_epi8(stops);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        char c = *p;
+        if (c == ':' || c == '#')
+            return p;
+        if (flow && (c == ',' || c == '[' || c == ']' || c == '{'
+                || c == '}'))
+            return p;
+    }
+    return end;
+}
+
+/* Return the first '"' or '\' from p, or end if there is none */
+const char *ymx_scan_find_double_stop(const char *p, const char *end) {
+#ifdef YMX_SCANNER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(bytes, quote),
+                _mm_cmpeq_epi8(bytes, backslash)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == '"' || *p == '\\')
+            return p;
+    }
+    return end;
+}
+
+/* Return the first '"', '\', or byte that isn't printable ASCII, from p,
+ * or end if there is none */
+const char *ymx_scan_find_json_stop(const char *p, const char *end) {
+#ifdef YMX_SCANNER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7F);
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        /* Signed, so bytes of 0x80 and up count as below ' ' too */
+        __m128i stops = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, quote),
+                    _mm_cmpeq_epi8(bytes, backslash)),
+                _mm_or_si128(_mm_cmplt_epi8(bytes, space),
+                    _mm_cmpeq_epi8(bytes, del)));
+        int mask = _mm_movemask_epi8(stops);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\' || c < ' ' || c >= 0x7F)
+            return p;
+    }
+    return end;
+}
+
+/* Return the length of the UTF-8 character at p, if it's one that libyaml
+ * takes as it is inside a quoted scalar, or 0 if it isn't: if it's
+ * malformed, a C1 control, a surrogate or a noncharacter (which libyaml
+ * rejects), or U+2028, U+2029 or a BOM (which it treats specially). */
+size_t ymx_scan_utf8_length(const char *p, const char *end) {
+    const unsigned char *u = (const unsigned char *)p;
+    size_t length;
+    unsigned long code;
+    if (u[0] >= 0xC2 && u[0] <= 0xDF) {
+        length = 2;
+        code = u[0] & 0x1F;
+    } else if (u[0] >= 0xE0 && u[0] <= 0xEF) {
+        length = 3;
+        code = u[0] & 0x0F;
+    } else if (u[0] >= 0xF0 && u[0] <= 0xF4) {
+        length = 4;
+        code = u[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if ((size_t)(end - p) < length)
+        return 0;
+
+    size_t i;
+    for (i=1; i<length; i++) {
+        if ((u[i] & 0xC0) != 0x80)
+            return 0;
+        code = (code << 6) | (u[i] & 0x3F);
+    }
+
+    if ((length == 3 && code < 0x800)
+            || (length == 4 && (code < 0x10000 || code > 0x10FFFF)))
+        return 0;
+    if (code < 0xA0 || (code >= 0xD800 && code <= 0xDFFF)
+            || code == 0x2028 || code == 0x2029 || code == 0xFEFF
+            || code == 0xFFFE || code == 0xFFFF)
+        return 0;
+    return length;
+}
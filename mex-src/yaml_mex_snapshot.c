@@ -0,0 +1,791 @@
+#include "yaml_mex_util.h"
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/* Limit on the dimensions of a snapshot array, used to size a buffer */
+#define YMX_SNAPSHOT_MAX_DIMS 64
+/* Number of sparse indices converted at a time when writing */
+#define YMX_SNAPSHOT_INDEX_CHUNK 1024
+
+/* NOTES
+ *
+ * Snapshot cache for yaml_file_load. The first time a file is loaded with
+ * a cache directory, the data constructed from it is serialized to a
+ * snapshot file in that directory; later loads of the unchanged file map
+ * the snapshot and rebuild the mxArrays from it directly, without running
+ * libyaml at all.
+ *
+ * A snapshot is named after a hash of the source file's path, and its
+ * header records the source's size, modification time and a hash of its
+ * contents, and the limits and scanner it was loaded under (as for the
+ * load cache). A snapshot is only used if all of these match the source
+ * file and settings as they are now, and if its version, byte order,
+ * payload size and payload hash all check out; anything else (a stale,
+ * truncated or corrupt snapshot, or one from another version of yaml_mex
+ * or other settings) is simply rebuilt. The payload is also
+ * bounds-checked as it is read. Snapshots are written to a temporary file
+ * and renamed into place, so a reader never sees a partly written one.
+ * The cache is purely an optimization: if a snapshot can't be written,
+ * the load still succeeds.
+ *
+ * The payload is a preorder serialization of the constructed data, which
+ * holds numeric, logical and char arrays (from !matlab/array and
+ * !matlab/sparse nodes, of any numeric class, complex or sparse), cells
+ * and structs:
+ *     uint8  class (one of ymx_snapshot_class_t), with the
+ *            YMX_SNAPSHOT_COMPLEX and YMX_SNAPSHOT_SPARSE bits set for
+ *            complex and sparse arrays
+ *     uint32 number of dimensions, then a uint64 per dimension
+ *     numeric/char: the elements' raw data, then for a complex array the
+ *             raw data of their imaginary parts
+ *     sparse: uint64 number of nonzeros; jc and ir, as uint64 each; then
+ *             the nonzeros' raw data (and imaginary parts)
+ *     cell:   each element, in order
+ *     struct: uint32 number of fields; per field a uint32 name length and
+ *             the name; then each element's field values, in order
+ * A sparse array's jc and ir are checked as they are read, so that a
+ * malformed one is rejected rather than handed to Matlab.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef struct ymx_snapshot_header_s {
+    char magic[4];
+    uint32_T version;
+    uint32_T byte_order;
+    uint32_T reserved;
+    uint64_T source_size;
+    int64_T source_mtime;
+    uint64_T source_hash;
+    uint64_T payload_size;
+    uint64_T payload_hash;
+    uint64_T settings;      /* ymx_load_settings_key */
+} ymx_snapshot_header_t;
+
+/* Classes in the order of YMX_SNAPSHOT_CLASS_IDS */
+typedef enum ymx_snapshot_class_e {
+    YMX_SNAPSHOT_CLASS_DOUBLE,
+    YMX_SNAPSHOT_CLASS_LOGICAL,
+    YMX_SNAPSHOT_CLASS_CHAR,
+    YMX_SNAPSHOT_CLASS_CELL,
+    YMX_SNAPSHOT_CLASS_STRUCT,
+    YMX_SNAPSHOT_CLASS_SINGLE,
+    YMX_SNAPSHOT_CLASS_INT8,
+    YMX_SNAPSHOT_CLASS_UINT8,
+    YMX_SNAPSHOT_CLASS_INT16,
+    YMX_SNAPSHOT_CLASS_UINT16,
+    YMX_SNAPSHOT_CLASS_INT32,
+    YMX_SNAPSHOT_CLASS_UINT32,
+    YMX_SNAPSHOT_CLASS_INT64,
+    YMX_SNAPSHOT_CLASS_UINT64,
+    YMX_SNAPSHOT_NUM_CLASSES
+} ymx_snapshot_class_t;
+
+/* A bounds-checked read position in a snapshot's payload */
+typedef struct ymx_snapshot_reader_s {
+    const char *pos;
+    const char *end;
+    int ok;
+} ymx_snapshot_reader_t;
+
+/* A cell or struct being read or written, with num_items elements (for a
+ * struct, num_fields per element) of which next are done */
+typedef struct ymx_snapshot_frame_s {
+    mxArray *array;
+    size_t num_items;
+    size_t num_fields;
+    size_t next;
+} ymx_snapshot_frame_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const char YMX_SNAPSHOT_MAGIC[4] = {'Y', 'M', 'X', 'S'};
+/* Increment whenever the snapshot format or the construction rules
+ * change, so that existing snapshots are rebuilt. Version 2 added
+ * !matlab/array and !matlab/sparse results, and the classes they bring. */
+const uint32_T YMX_SNAPSHOT_VERSION = 2;
+const uint32_T YMX_SNAPSHOT_BYTE_ORDER = 0x01020304;
+const uint64_T YMX_SNAPSHOT_PATH_SEED = 0x70617468;
+const uint64_T YMX_SNAPSHOT_SOURCE_SEED = 0x736f7572;
+const uint64_T YMX_SNAPSHOT_PAYLOAD_SEED = 0x7061796c;
+const size_t YMX_SNAPSHOT_CHUNK_SIZE = 65536;
+const size_t SNAPSHOT_FRAMES_INITIAL_SIZE = 32;
+const mxClassID YMX_SNAPSHOT_CLASS_IDS[] = {mxDOUBLE_CLASS,
+        mxLOGICAL_CLASS, mxCHAR_CLASS, mxCELL_CLASS, mxSTRUCT_CLASS,
+        mxSINGLE_CLASS, mxINT8_CLASS, mxUINT8_CLASS, mxINT16_CLASS,
+        mxUINT16_CLASS, mxINT32_CLASS, mxUINT32_CLASS, mxINT64_CLASS,
+        mxUINT64_CLASS};
+const uint8_T YMX_SNAPSHOT_COMPLEX = 0x40;
+const uint8_T YMX_SNAPSHOT_SPARSE = 0x80;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+char *ymx_snapshot_path(const char *source_path, const char *cache_dir);
+
+mxArray *ymx_snapshot_load(const char *snapshot_path,
+        const ymx_snapshot_header_t *expected);
+mxArray *ymx_snapshot_decode(const char *payload, size_t size);
+mxArray *ymx_snapshot_read_array(
+        ymx_snapshot_reader_t *reader,
+        size_t *num_items,
+        size_t *num_fields );
+mxArray *ymx_snapshot_read_sparse(
+        ymx_snapshot_reader_t *reader,
+        mxClassID class_id,
+        int is_complex,
+        const mwSize *dims );
+int ymx_snapshot_read_indices(ymx_snapshot_reader_t *reader,
+        mwIndex *indices, size_t count);
+int ymx_snapshot_read(ymx_snapshot_reader_t *reader,
+        void *output, size_t size);
+
+void ymx_snapshot_save(const char *snapshot_path,
+        ymx_snapshot_header_t *header, const mxArray *data);
+int ymx_snapshot_write_data(ymx_buffer_t *buffer, const mxArray *data);
+int ymx_snapshot_write_array(
+        ymx_buffer_t *buffer,
+        const mxArray *data,
+        size_t *num_items,
+        size_t *num_fields );
+void ymx_snapshot_write_sparse(ymx_buffer_t *buffer, const mxArray *data);
+void ymx_snapshot_write_indices(ymx_buffer_t *buffer,
+        const mwIndex *indices, size_t count);
+
+
+/*
+ * Main interface function
+ *************************************************************************/
+
+/* Load and construct the YAML file at filename as ymx_construct_stream
+ * would, using (and if need be, creating) a snapshot of the result in
+ * cache_dir. The file is read as bytes, so it should be UTF-8.
+ */
+mxArray *ymx_load_file_cached(
+        const mxArray *filename,
+        const mxArray *cache_dir ) {
+    ymx_debug_msg("Entering ymx_load_file_cached\n");
+    char *path = mxArrayToString(filename);
+    char *dir = mxArrayToString(cache_dir);
+
+    struct stat info;
+    if (stat(path, &info) != 0)
+        ymx_error("Couldn't open file for reading");
+    size_t size = (size_t)info.st_size;
+    char *source = ymx_read_file(path, size);
+
+    ymx_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, YMX_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = YMX_SNAPSHOT_VERSION;
+    header.byte_order = YMX_SNAPSHOT_BYTE_ORDER;
+    header.source_size = size;
+    header.source_mtime = (int64_T)info.st_mtime;
+    header.source_hash =
+            ymx_hash_bytes(source, size, YMX_SNAPSHOT_SOURCE_SEED);
+    header.settings = ymx_load_settings_key();
+
+    mxArray *data = ymx_cache_lookup(YMX_CACHE_KIND_FILE, source, size);
+    if (data) {
+        mxFree(source);
+        mxFree(dir);
+        mxFree(path);
+        return data;
+    }
+
+    char *snapshot_path = ymx_snapshot_path(path, dir);
+    data = ymx_snapshot_load(snapshot_path, &header);
+    if (!data) {
+        data = ymx_construct_string(source, size, NULL);
+        ymx_snapshot_save(snapshot_path, &header, data);
+    }
+    ymx_cache_store(YMX_CACHE_KIND_FILE, source, size, data);
+
+    mxFree(snapshot_path);
+    mxFree(source);
+    mxFree(dir);
+    mxFree(path);
+    ymx_debug_msg("Exiting ymx_load_file_cached\n");
+    return data;
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+/* Read the whole of a file of the given size into an mxMalloc'd buffer */
+char *ymx_read_file(const char *path, size_t size) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        ymx_error("Couldn't open file for reading");
+    char *contents = mxMalloc(size + 1);
+    size_t num_read = fread(contents, 1, size, file);
+    fclose(file);
+    if (num_read != size)
+        ymx_error("Error while reading file");
+    contents[size] = '\0';
+    return contents;
+}
+
+char *ymx_snapshot_path(const char *source_path, const char *cache_dir) {
+    uint64_T key = ymx_hash_bytes(source_path, strlen(source_path),
+            YMX_SNAPSHOT_PATH_SEED);
+    size_t size = strlen(cache_dir) + 32;
+    char *snapshot_path = mxMalloc(size);
+    snprintf(snapshot_path, size, "%s/yaml_%08lx%08lx.ymxs", cache_dir,
+            (unsigned long)(key >> 32), (unsigned long)(key & 0xFFFFFFFF));
+    return snapshot_path;
+}
+
+
+/*
+ * Functions for reading snapshots
+ *************************************************************************/
+
+/* Map the snapshot at snapshot_path and decode it, if it exists and its
+ * header matches expected. Returns NULL if there is no usable snapshot.
+ */
+mxArray *ymx_snapshot_load(const char *snapshot_path,
+        const ymx_snapshot_header_t *expected) {
+    const size_t header_size = sizeof(ymx_snapshot_header_t);
+    mxArray *data = NULL;
+
+#ifndef _WIN32
+    int fd = open(snapshot_path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < header_size) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)info.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return NULL;
+    const char *contents = mapped;
+#else
+    FILE *file = fopen(snapshot_path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (file_size < (long)header_size) {
+        fclose(file);
+        return NULL;
+    }
+    size_t size = (size_t)file_size;
+    char *contents = mxMalloc(size);
+    size_t num_read = fread(contents, 1, size, file);
+    fclose(file);
+    if (num_read != size) {
+        mxFree(contents);
+        return NULL;
+    }
+#endif
+
+    ymx_snapshot_header_t header;
+    memcpy(&header, contents, header_size);
+    const char *payload = contents + header_size;
+    size_t payload_size = size - header_size;
+    if (memcmp(header.magic, expected->magic, sizeof(header.magic)) == 0
+            && header.version == expected->version
+            && header.byte_order == expected->byte_order
+            && header.source_size == expected->source_size
+            && header.source_mtime == expected->source_mtime
+            && header.source_hash == expected->source_hash
+            && header.settings == expected->settings
+            && header.payload_size == payload_size
+            && header.payload_hash == ymx_hash_bytes(payload,
+                    payload_size, YMX_SNAPSHOT_PAYLOAD_SEED)) {
+        data = ymx_snapshot_decode(payload, payload_size);
+    }
+
+#ifndef _WIN32
+    munmap(mapped, size);
+#else
+    mxFree(contents);
+#endif
+    return data;
+}
+
+/* Decode a whole payload; returns NULL if it is malformed. Cells and
+ * structs whose elements are still to be read are kept on a stack of
+ * frames rather than read by recursion. */
+mxArray *ymx_snapshot_decode(const char *payload, size_t size) {
+    ymx_snapshot_reader_t reader;
+    reader.pos = payload;
+    reader.end = payload + size;
+    reader.ok = 1;
+
+    size_t frames_size = SNAPSHOT_FRAMES_INITIAL_SIZE;
+    ymx_snapshot_frame_t *frames = mxMalloc(frames_size
+            * sizeof(ymx_snapshot_frame_t));
+    size_t num_frames = 0;
+
+    mxArray *data = NULL;
+    while (1) {
+        ymx_snapshot_frame_t item;
+        item.array = ymx_snapshot_read_array(&reader,
+                &item.num_items, &item.num_fields);
+        item.next = 0;
+        if (num_frames) {
+            /* An element of the innermost cell or struct */
+            ymx_snapshot_frame_t *parent = frames + num_frames - 1;
+            size_t ind = parent->next - 1;
+            if (parent->num_fields)
+                mxSetFieldByNumber(parent->array, ind / parent->num_fields,
+                        ind % parent->num_fields, item.array);
+            else
+                mxSetCell(parent->array, ind, item.array);
+        } else {
+            data = item.array;
+        }
+        if (!reader.ok)
+            break;
+
+        if (item.num_items) {
+            if (num_frames == frames_size) {
+                frames_size *= 2;
+                frames = mxRealloc(frames,
+                        frames_size * sizeof(ymx_snapshot_frame_t));
+            }
+            frames[num_frames++] = item;
+        }
+        while (num_frames && frames[num_frames-1].next
+                == frames[num_frames-1].num_items)
+            num_frames--;
+        if (!num_frames)
+            break;
+        frames[num_frames-1].next++;
+    }
+    mxFree(frames);
+
+    if (data && (!reader.ok || reader.pos != reader.end)) {
+        mxDestroyArray(data);
+        data = NULL;
+    }
+    return data;
+}
+
+/* Read one array, less the elements of a cell or struct: *num_items is
+ * set to how many follow (for a struct, num_fields per element), to be
+ * read and stored by the caller. On malformed input, clears reader->ok
+ * and returns whatever was built so far (possibly NULL), for the caller
+ * to discard.
+ */
+mxArray *ymx_snapshot_read_array(
+        ymx_snapshot_reader_t *reader,
+        size_t *num_items,
+        size_t *num_fields ) {
+    *num_items = 0;
+    *num_fields = 0;
+    uint8_T class_byte;
+    uint32_T num_dims;
+    if (!ymx_snapshot_read(reader, &class_byte, sizeof(class_byte))
+            || !ymx_snapshot_read(reader, &num_dims, sizeof(num_dims)))
+        return NULL;
+    int is_complex = (class_byte & YMX_SNAPSHOT_COMPLEX) != 0;
+    int is_sparse = (class_byte & YMX_SNAPSHOT_SPARSE) != 0;
+    uint8_T class_id = class_byte
+            & ~(YMX_SNAPSHOT_COMPLEX | YMX_SNAPSHOT_SPARSE);
+    if (num_dims < 2 || num_dims > YMX_SNAPSHOT_MAX_DIMS
+            || class_id >= YMX_SNAPSHOT_NUM_CLASSES
+            || (is_sparse && num_dims != 2)) {
+        reader->ok = 0;
+        return NULL;
+    }
+    mxClassID mx_class = YMX_SNAPSHOT_CLASS_IDS[class_id];
+    if ((is_complex && (mx_class == mxLOGICAL_CLASS
+                || mx_class == mxCHAR_CLASS || mx_class == mxCELL_CLASS
+                || mx_class == mxSTRUCT_CLASS))
+            || (is_sparse && mx_class != mxDOUBLE_CLASS
+                && mx_class != mxLOGICAL_CLASS)) {
+        reader->ok = 0;
+        return NULL;
+    }
+
+    /* Every element takes at least one byte of payload, so a valid
+     * element count is bounded by the bytes remaining. A sparse array's
+     * zeros take none; ymx_snapshot_read_sparse bounds its columns. */
+    size_t remaining = reader->end - reader->pos;
+    mwSize dims[YMX_SNAPSHOT_MAX_DIMS];
+    size_t num_elements = 1;
+    uint32_T i;
+    for (i=0; i<num_dims; i++) {
+        uint64_T dim;
+        if (!ymx_snapshot_read(reader, &dim, sizeof(dim)))
+            return NULL;
+        dims[i] = (mwSize)dim;
+        if ((uint64_T)dims[i] != dim || (!is_sparse && (dim > remaining
+                || (dim && num_elements > remaining / dim)))) {
+            reader->ok = 0;
+            return NULL;
+        }
+        num_elements *= (size_t)dim;
+    }
+
+    if (is_sparse)
+        return ymx_snapshot_read_sparse(reader, mx_class, is_complex, dims);
+
+    mxArray *array = NULL;
+    switch (class_id) {
+        case YMX_SNAPSHOT_CLASS_LOGICAL:
+            array = mxCreateLogicalArray(num_dims, dims);
+            ymx_snapshot_read(reader, mxGetData(array),
+                    num_elements * sizeof(mxLogical));
+            break;
+        case YMX_SNAPSHOT_CLASS_CHAR:
+            array = mxCreateCharArray(num_dims, dims);
+            ymx_snapshot_read(reader, mxGetData(array),
+                    num_elements * sizeof(mxChar));
+            break;
+        case YMX_SNAPSHOT_CLASS_CELL:
+            array = mxCreateCellArray(num_dims, dims);
+            *num_items = num_elements;
+            break;
+        case YMX_SNAPSHOT_CLASS_STRUCT: {
+            uint32_T count;
+            if (!ymx_snapshot_read(reader, &count, sizeof(count)))
+                return NULL;
+            if (count > (size_t)(reader->end - reader->pos)) {
+                reader->ok = 0;
+                return NULL;
+            }
+
+            array = mxCreateStructArray(num_dims, dims, 0, NULL);
+            char name[64];
+            uint32_T field;
+            for (field=0; field<count && reader->ok; field++) {
+                uint32_T length;
+                if (!ymx_snapshot_read(reader, &length, sizeof(length)))
+                    break;
+                if (length == 0 || length >= sizeof(name)
+                        || !ymx_snapshot_read(reader, name, length)
+                        || !ymx_is_valid_field_name(name, length)) {
+                    reader->ok = 0;
+                    break;
+                }
+                name[length] = '\0';
+                if (mxGetFieldNumber(array, name) >= 0
+                        || mxAddField(array, name) < 0) {
+                    reader->ok = 0;
+                    break;
+                }
+            }
+            *num_fields = count;
+            *num_items = num_elements * count;
+            break;
+        }
+        default:
+            array = mxCreateNumericArray(num_dims, dims, mx_class,
+                    is_complex ? mxCOMPLEX : mxREAL);
+            ymx_snapshot_read(reader, mxGetData(array),
+                    num_elements * mxGetElementSize(array));
+            if (is_complex)
+                ymx_snapshot_read(reader, mxGetImagData(array),
+                        num_elements * mxGetElementSize(array));
+    }
+    return array;
+}
+
+/* Read the rest of a sparse array, from its number of nonzeros on. On
+ * malformed input, clears reader->ok and returns NULL or the array so
+ * far, as ymx_snapshot_read_array does. */
+mxArray *ymx_snapshot_read_sparse(
+        ymx_snapshot_reader_t *reader,
+        mxClassID class_id,
+        int is_complex,
+        const mwSize *dims ) {
+    uint64_T nnz;
+    if (!ymx_snapshot_read(reader, &nnz, sizeof(nnz)))
+        return NULL;
+    /* Every nonzero takes at least an ir index of the payload, and every
+     * column a jc pointer, so both are bounded by the bytes remaining */
+    size_t remaining = reader->end - reader->pos;
+    if (nnz > remaining / sizeof(uint64_T)
+            || dims[1] >= remaining / sizeof(uint64_T)
+            || (dims[0] == 0 && nnz)) {
+        reader->ok = 0;
+        return NULL;
+    }
+
+    mxArray *array;
+    if (class_id == mxLOGICAL_CLASS)
+        array = mxCreateSparseLogicalMatrix(dims[0], dims[1], (mwSize)nnz);
+    else
+        array = mxCreateSparse(dims[0], dims[1], (mwSize)nnz,
+                is_complex ? mxCOMPLEX : mxREAL);
+    mwIndex *jc = mxGetJc(array);
+    mwIndex *ir = mxGetIr(array);
+    if (!ymx_snapshot_read_indices(reader, jc, dims[1] + 1)
+            || !ymx_snapshot_read_indices(reader, ir, (size_t)nnz))
+        return array;
+
+    /* The columns' pointers must run from 0 to nnz, and within a column
+     * the row indices must rise and stay below the number of rows */
+    size_t col;
+    size_t ind;
+    if (jc[0] != 0 || jc[dims[1]] != nnz)
+        reader->ok = 0;
+    for (col=0; col<dims[1] && reader->ok; col++) {
+        if (jc[col+1] < jc[col]) {
+            reader->ok = 0;
+            break;
+        }
+        for (ind=jc[col]; ind<jc[col+1]; ind++) {
+            if (ir[ind] >= dims[0] || (ind > jc[col] && ir[ind] <= ir[ind-1])) {
+                reader->ok = 0;
+                break;
+            }
+        }
+    }
+
+    size_t element_size = mxGetElementSize(array);
+    ymx_snapshot_read(reader, mxGetData(array), (size_t)nnz * element_size);
+    if (is_complex)
+        ymx_snapshot_read(reader, mxGetImagData(array),
+                (size_t)nnz * element_size);
+    return array;
+}
+
+/* Read count uint64 indices of the payload into indices, as mwIndex.
+ * Returns 0 (and clears reader->ok) if there aren't that many left, or
+ * one doesn't fit an mwIndex. */
+int ymx_snapshot_read_indices(ymx_snapshot_reader_t *reader,
+        mwIndex *indices, size_t count) {
+    if (count > (size_t)(reader->end - reader->pos) / sizeof(uint64_T)) {
+        reader->ok = 0;
+        return 0;
+    }
+    size_t i;
+    for (i=0; i<count; i++) {
+        uint64_T index;
+        memcpy(&index, reader->pos, sizeof(index));
+        reader->pos += sizeof(index);
+        indices[i] = (mwIndex)index;
+        if ((uint64_T)indices[i] != index) {
+            reader->ok = 0;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Copy the next size bytes of the payload to output. Returns 0 (and
+ * clears reader->ok) if there aren't that many left. */
+int ymx_snapshot_read(ymx_snapshot_reader_t *reader,
+        void *output, size_t size) {
+    if (!reader->ok || size > (size_t)(reader->end - reader->pos)) {
+        reader->ok = 0;
+        return 0;
+    }
+    memcpy(output, reader->pos, size);
+    reader->pos += size;
+    return 1;
+}
+
+
+/*
+ * Functions for writing snapshots
+ *************************************************************************/
+
+/* Serialize data and write it, under header (whose payload fields are
+ * filled in here), to snapshot_path. Failure is silently ignored. */
+void ymx_snapshot_save(const char *snapshot_path,
+        ymx_snapshot_header_t *header, const mxArray *data) {
+    ymx_buffer_t buffer;
+    ymx_buffer_init(&buffer, YMX_SNAPSHOT_CHUNK_SIZE);
+    if (!ymx_snapshot_write_data(&buffer, data)) {
+        ymx_buffer_delete(&buffer);
+        return;
+    }
+    header->payload_size = buffer.used_size;
+    header->payload_hash = ymx_hash_bytes(buffer.head, buffer.used_size,
+            YMX_SNAPSHOT_PAYLOAD_SEED);
+
+    size_t size = strlen(snapshot_path) + 32;
+    char *temp_path = mxMalloc(size);
+    snprintf(temp_path, size, "%s.%lu.tmp", snapshot_path,
+            (unsigned long)header->source_hash);
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file) {
+        int ok = fwrite(header, sizeof(*header), 1, file) == 1
+                && fwrite(buffer.head, 1, buffer.used_size, file)
+                        == buffer.used_size;
+        ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+        /* rename won't replace an existing file here */
+        if (ok)
+            remove(snapshot_path);
+#endif
+        if (!ok || rename(temp_path, snapshot_path) != 0)
+            remove(temp_path);
+    }
+
+    mxFree(temp_path);
+    ymx_buffer_delete(&buffer);
+}
+
+/* Append the serialization of data to buffer. Returns 0 if data holds
+ * anything that snapshots can't represent. Cells and structs whose
+ * elements are still to be written are kept on a stack of frames rather
+ * than written by recursion. */
+int ymx_snapshot_write_data(ymx_buffer_t *buffer, const mxArray *data) {
+    size_t frames_size = SNAPSHOT_FRAMES_INITIAL_SIZE;
+    ymx_snapshot_frame_t *frames = mxMalloc(frames_size
+            * sizeof(ymx_snapshot_frame_t));
+    size_t num_frames = 0;
+
+    int ok = 1;
+    const mxArray *array = data;
+    while (1) {
+        ymx_snapshot_frame_t item;
+        if (!array || !ymx_snapshot_write_array(buffer, array,
+                &item.num_items, &item.num_fields)) {
+            ok = 0;
+            break;
+        }
+        if (item.num_items) {
+            if (num_frames == frames_size) {
+                frames_size *= 2;
+                frames = mxRealloc(frames,
+                        frames_size * sizeof(ymx_snapshot_frame_t));
+            }
+            item.array = (mxArray *)array;
+            item.next = 0;
+            frames[num_frames++] = item;
+        }
+        while (num_frames && frames[num_frames-1].next
+                == frames[num_frames-1].num_items)
+            num_frames--;
+        if (!num_frames)
+            break;
+
+        ymx_snapshot_frame_t *parent = frames + num_frames - 1;
+        size_t ind = parent->next++;
+        if (parent->num_fields)
+            array = mxGetFieldByNumber(parent->array,
+                    ind / parent->num_fields, ind % parent->num_fields);
+        else
+            array = mxGetCell(parent->array, ind);
+    }
+    mxFree(frames);
+    return ok;
+}
+
+/* Append the serialization of one array to buffer, less the elements of a
+ * cell or struct: *num_items is set to how many must follow (for a
+ * struct, num_fields per element), in order. Returns 0 if the array is
+ * of a class that snapshots can't represent. */
+int ymx_snapshot_write_array(
+        ymx_buffer_t *buffer,
+        const mxArray *data,
+        size_t *num_items,
+        size_t *num_fields ) {
+    *num_items = 0;
+    *num_fields = 0;
+    mxClassID mx_class = mxGetClassID(data);
+    uint8_T class_id;
+    for (class_id=0; class_id<YMX_SNAPSHOT_NUM_CLASSES; class_id++) {
+        if (YMX_SNAPSHOT_CLASS_IDS[class_id] == mx_class)
+            break;
+    }
+    /* Objects are classes of their own, even if stored as structs */
+    if (class_id == YMX_SNAPSHOT_NUM_CLASSES
+            || (mx_class == mxSTRUCT_CLASS && !mxIsStruct(data)))
+        return 0;
+    int is_numeric = !(mxIsCell(data) || mxIsStruct(data));
+
+    uint8_T class_byte = class_id;
+    if (mxIsComplex(data))
+        class_byte |= YMX_SNAPSHOT_COMPLEX;
+    if (mxIsSparse(data))
+        class_byte |= YMX_SNAPSHOT_SPARSE;
+    uint32_T num_dims = (uint32_T)mxGetNumberOfDimensions(data);
+    const mwSize *dims = mxGetDimensions(data);
+    ymx_buffer_append(buffer, &class_byte, sizeof(class_byte));
+    ymx_buffer_append(buffer, &num_dims, sizeof(num_dims));
+    uint32_T i;
+    for (i=0; i<num_dims; i++) {
+        uint64_T dim = dims[i];
+        ymx_buffer_append(buffer, &dim, sizeof(dim));
+    }
+
+    size_t num_elements = mxGetNumberOfElements(data);
+    if (mxIsSparse(data)) {
+        ymx_snapshot_write_sparse(buffer, data);
+    } else if (is_numeric) {
+        size_t num_bytes = num_elements * mxGetElementSize(data);
+        if (num_bytes) {
+            ymx_buffer_append(buffer, mxGetData(data), num_bytes);
+            if (mxIsComplex(data))
+                ymx_buffer_append(buffer, mxGetImagData(data), num_bytes);
+        }
+    } else if (class_id == YMX_SNAPSHOT_CLASS_CELL) {
+        *num_items = num_elements;
+    } else {
+        uint32_T count = (uint32_T)mxGetNumberOfFields(data);
+        ymx_buffer_append(buffer, &count, sizeof(count));
+        uint32_T field;
+        for (field=0; field<count; field++) {
+            const char *name = mxGetFieldNameByNumber(data, field);
+            uint32_T length = (uint32_T)strlen(name);
+            ymx_buffer_append(buffer, &length, sizeof(length));
+            ymx_buffer_append(buffer, (void *)name, length);
+        }
+        *num_fields = count;
+        *num_items = num_elements * count;
+    }
+    return 1;
+}
+
+/* Append a sparse array's number of nonzeros, jc, ir and nonzeros */
+void ymx_snapshot_write_sparse(ymx_buffer_t *buffer, const mxArray *data) {
+    size_t num_cols = mxGetN(data);
+    const mwIndex *jc = mxGetJc(data);
+    uint64_T nnz = jc[num_cols];
+    ymx_buffer_append(buffer, &nnz, sizeof(nnz));
+    ymx_snapshot_write_indices(buffer, jc, num_cols + 1);
+    ymx_snapshot_write_indices(buffer, mxGetIr(data), (size_t)nnz);
+
+    size_t num_bytes = (size_t)nnz * mxGetElementSize(data);
+    if (num_bytes) {
+        ymx_buffer_append(buffer, mxGetData(data), num_bytes);
+        if (mxIsComplex(data))
+            ymx_buffer_append(buffer, mxGetImagData(data), num_bytes);
+    }
+}
+
+/* Append count indices as uint64, a chunk at a time */
+void ymx_snapshot_write_indices(ymx_buffer_t *buffer,
+        const mwIndex *indices, size_t count) {
+    uint64_T chunk[YMX_SNAPSHOT_INDEX_CHUNK];
+    size_t start;
+    for (start=0; start<count; start+=YMX_SNAPSHOT_INDEX_CHUNK) {
+        size_t num = count - start < YMX_SNAPSHOT_INDEX_CHUNK
+                ? count - start : YMX_SNAPSHOT_INDEX_CHUNK;
+        size_t i;
+        for (i=0; i<num; i++) {
+            chunk[i] = indices[start + i];
+        }
+        ymx_buffer_append(buffer, chunk, num * sizeof(uint64_T));
+    }
+}
@@ -1,4 +1,5 @@
 #include "yaml_mex_util.h"
+#include <stdlib.h>
 
 /* NOTES
  * 
@@ -15,6 +16,15 @@
  * need to strip off the BOM (since Matlab doesn't use it internally). I'll
  * also need to figure out some way to determine whether Matlab is always
  * big-endian, or if it varies by machine, and if so, how to tell.
+ *
+ * Resource limits: every load goes through ymx_init_parser and ymx_parse,
+ * so the limits on input size, nesting depth and number of nodes (see
+ * ymx_set_limits) are enforced there, for every kind of load at once. The
+ * checks in ymx_parse are an increment and a compare per event. They
+ * guard against untrusted input, so they don't apply to dumps. Loading,
+ * constructing, dumping and composing keep their own stacks on the heap
+ * rather than recursing, so the depth they can handle is bounded only by
+ * the limit (for dumps, only by memory), and the limit may be Inf.
  */
 
 /*
@@ -38,18 +48,69 @@ typedef struct ymx_node_s {
     mxArray *style;
 } ymx_node_t;
 
-typedef struct ymx_buffer_s {
-    size_t chunk_size; /* Size of a chunk, in bytes */
-    size_t total_size; /* Current total size of the buffer, in bytes */
-    size_t used_size;  /* Amount of the buffer currently used, in bytes */
-    void *head; /* Pointer to the head of the buffer */
-} ymx_buffer_t;
-typedef char ymx_buffer_char_t;
+/* A sequence or mapping being loaded, and the nodes of its items so far
+ * (keys and values alternating, for a mapping) */
+typedef struct ymx_load_frame_s {
+    ymx_node_t node;
+    int is_mapping;
+    ymx_node_t *items;
+    size_t num_items;
+    size_t items_size;
+} ymx_load_frame_t;
+
+/* A sequence or mapping being dumped: its node array, and the index of its
+ * next node to dump */
+typedef struct ymx_dump_frame_s {
+    const mxArray *items;
+    mwIndex next;
+    mwSize size;
+    int is_mapping;
+} ymx_dump_frame_t;
+
+/* Limits on what a load will accept; see ymx_set_limits */
+typedef struct ymx_limits_s {
+    size_t max_depth;
+    size_t max_nodes;
+    size_t max_bytes;
+} ymx_limits_t;
+
+/* Number of node array layouts remembered while dumping a document */
+#define YMX_LAYOUT_CACHE_SIZE 16
+
+/* An interned string: the mxChars it was made from, and their conversion */
+typedef struct ymx_interned_s {
+    uint64_T key;
+    size_t length;
+    mxChar *chars;
+    char *str;
+} ymx_interned_t;
+
+/* State kept while dumping one document.
+ *
+ * Node arrays whose layout has been checked are remembered by the
+ * addresses of their field names, in a small direct-mapped table. The
+ * input isn't modified while it is dumped, so any array whose field names
+ * are at the same addresses as a checked array's has the same layout, and
+ * needn't be checked again; struct arrays built the same way usually
+ * share their field name storage.
+ *
+ * Tags are converted to C strings once per distinct tag, rather than once
+ * per node, and kept in an open-addressed table. libyaml copies tags into
+ * its events, so the table owns the strings until the document is done.
+ */
+typedef struct ymx_dump_context_s {
+    int trusted; /* Skip checks of individual node fields */
+    const char *layouts[YMX_LAYOUT_CACHE_SIZE][YMX_NODE_NUM_FIELDS];
+    ymx_interned_t *tags;
+    size_t num_tags;
+    size_t tags_size;
+} ymx_dump_context_t;
 
 
 /*
  * Constant definitions
  *************************************************************************/
+const size_t TAGS_INITIAL_SIZE = 16;
 const char *YMX_NODE_TYPE_STRS[] =
         {"none", "scalar", "sequence", "mapping", "alias"};
 const char *YMX_NODE_FIELD_STRS[] =
@@ -62,6 +123,15 @@ const char *YMX_TAGDIR_FIELD_STRS[] =
 const size_t YMX_BUFFER_TAIL_SIZE = sizeof(ymx_buffer_char_t);
 const size_t YMX_BUFFER_CHUNK_SIZE = 1024;
 const size_t NODES_BUFFER_CHUNK_SIZE = 128;
+const size_t FRAMES_INITIAL_SIZE = 32;
+const size_t EVENTS_INITIAL_SIZE = 1024;
+const uint64_T YMX_SETTINGS_HASH_SEED = 0x736574;
+#define YMX_NO_LIMIT ((size_t)-1)
+#define YMX_DEFAULT_MAX_DEPTH 1000
+const char *YMX_LIMITS_FIELD_STRS[] =
+        {"max_depth", "max_nodes", "max_bytes"};
+#define YMX_LIMITS_NUM_FIELDS 3
+const uint64_T YMX_HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
 
 
 /*
@@ -69,14 +139,11 @@ const size_t NODES_BUFFER_CHUNK_SIZE = 128;
  *************************************************************************/
 
 mxArray *ymx_create_int_scalar(int32_T value);
+void ymx_record_event(yaml_event_t *event);
 int32_T  ymx_get_int_scalar(mxArray *scalar);
 
 void ymx_set_node_fields(mxArray *array, mwIndex ind, ymx_node_t *node);
 
-const yaml_event_t *ymx_parse(yaml_parser_t *parser);
-void ymx_emit(yaml_emitter_t *emitter, yaml_event_t *event);
-void ymx_error(const char* message);
-
 void ymx_load_document(
         ymx_document_t *doc,
         yaml_parser_t *parser,
@@ -87,50 +154,51 @@ void ymx_load_node(
         const yaml_event_t *first_event );
 void ymx_load_scalar(
         ymx_node_t *node,
-        yaml_parser_t *parser,
         const yaml_event_t *first_event );
 void ymx_load_alias(
         ymx_node_t *node,
-        yaml_parser_t *parser,
         const yaml_event_t *first_event );
-void ymx_load_sequence(
-        ymx_node_t *node,
-        yaml_parser_t *parser,
-        const yaml_event_t *first_event );
-void ymx_load_mapping(
-        ymx_node_t *node,
-        yaml_parser_t *parser,
+void ymx_load_collection_start(
+        ymx_load_frame_t *frame,
         const yaml_event_t *first_event );
+void ymx_load_collection_end(ymx_load_frame_t *frame);
+void ymx_load_frame_append(ymx_load_frame_t *frame, ymx_node_t *item);
 
-void ymx_dump_document(
+void ymx_dump_tree(
         yaml_emitter_t *emitter,
-        const mxArray *docs_array,
-        mwIndex ind );
-void ymx_dump_node(
+        ymx_dump_context_t *context,
+        const mxArray *root );
+int ymx_dump_node(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         const mxArray *node,
-        mwIndex ind );
+        mwIndex ind,
+        const mxArray **items );
 void ymx_dump_scalar(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         mxArray *value_arr,
         yaml_char_t *tag,
         yaml_char_t *anchor,
         int32_T implicit,
         int32_T style );
-void ymx_dump_sequence(
+const mxArray *ymx_dump_sequence_start(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         mxArray *value_arr,
         yaml_char_t *tag,
         yaml_char_t *anchor,
         int32_T implicit,
         int32_T style );
-void ymx_dump_mapping(
+const mxArray *ymx_dump_mapping_start(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         mxArray *value_arr,
         yaml_char_t *tag,
         yaml_char_t *anchor,
         int32_T implicit,
         int32_T style );
+void ymx_dump_collection_end(yaml_emitter_t *emitter, int is_mapping);
 void ymx_dump_alias(
         yaml_emitter_t *emitter,
         yaml_char_t *anchor );
@@ -140,16 +208,21 @@ int ymx_is_valid_version_array(const mxArray *version);
 int ymx_is_valid_tagdirs_array(const mxArray *tagdirs);
 int ymx_is_valid_doc_root(const mxArray *root);
 int ymx_is_valid_node_array(const mxArray *node);
+int ymx_is_known_node_array(
+        ymx_dump_context_t *context,
+        const mxArray *node );
+yaml_char_t *ymx_intern_tag(
+        ymx_dump_context_t *context,
+        const mxArray *tag );
+void ymx_dump_context_delete(ymx_dump_context_t *context);
 int ymx_is_valid_int_scalar(const mxArray *scalar);
 int ymx_is_valid_string(const mxArray *string);
 
-void ymx_buffer_init(ymx_buffer_t *buffer, size_t chunk_size);
-void ymx_buffer_delete(ymx_buffer_t *buffer);
-void ymx_buffer_append(ymx_buffer_t *buffer, 
-        void *input, size_t size);
-ymx_buffer_char_t *ymx_buffer_as_string(ymx_buffer_t *buffer);
-static int ymx_buffer_write_handler(void *data,
-        unsigned char *buffer, size_t size);
+size_t ymx_get_limit_option(const mxArray *options, const char *name,
+        size_t current);
+mxArray *ymx_limit_to_array(size_t limit);
+int ymx_file_read_handler(void *data, unsigned char *buffer, size_t size,
+        size_t *size_read);
 
 
 /*
@@ -159,11 +232,69 @@ static int ymx_buffer_write_handler(void *data,
 static yaml_parser_t   persistent_parser;
 static yaml_emitter_t  persistent_emitter;
 static yaml_event_t    persistent_event;
+static int             persistent_event_is_fast = 0; /* See ymx_parse */
+
+/* While recording, ymx_emit keeps events here instead of emitting them;
+ * see yaml_mex_parallel.c. Whatever hasn't been emitted yet is freed by
+ * ymx_persistent_cleanup. */
+static ymx_event_list_t persistent_recording;
+static int              recording = 0;
+
+/* While there's an emit handler, ymx_emit passes events to it instead of
+ * emitting them; see yaml_mex_hash.c. ymx_persistent_cleanup unsets it. */
+static ymx_emit_handler_t emit_handler = NULL;
+static void              *emit_handler_data = NULL;
+
+/* While replaying, ymx_parse serves events parsed ahead of time (see
+ * yaml_mex_async.c) instead of parsing. The list was malloc'd on a worker
+ * thread; each event is handed over to persistent_event as it's served,
+ * and ymx_persistent_cleanup frees the rest. */
+static ymx_event_list_t persistent_replay;
+static size_t           replay_next = 0;
+static int              replaying = 0;
+
+/* A file being streamed into the parser (see ymx_set_file_input), which
+ * ymx_persistent_cleanup closes; and the bytes read from it so far. */
+static ymx_cfile_t *persistent_input = NULL;
+static size_t       input_bytes = 0;
+static int          input_too_long = 0;
+
+/* Limits persist between calls, until the MEX-file is cleared. The counts
+ * are those of the current load (or, for depth, compose). */
+static ymx_limits_t limits =
+        {YMX_DEFAULT_MAX_DEPTH, YMX_NO_LIMIT, YMX_NO_LIMIT};
+static size_t num_nodes = 0;
+static size_t depth = 0;
 
 void ymx_persistent_cleanup() {
     yaml_parser_delete(&persistent_parser);
     yaml_emitter_delete(&persistent_emitter);
-    yaml_event_delete(&persistent_event);
+    if (persistent_event_is_fast) {
+        memset(&persistent_event, 0, sizeof(yaml_event_t));
+        persistent_event_is_fast = 0;
+    } else {
+        yaml_event_delete(&persistent_event);
+    }
+    ymx_scanner_reset();
+    ymx_stop_recording();
+    ymx_set_emit_handler(NULL, NULL);
+    size_t i;
+    for (i=0; i<persistent_recording.num_events; i++)
+        yaml_event_delete(persistent_recording.events + i);
+    if (persistent_recording.events)
+        mxFree(persistent_recording.events);
+    memset(&persistent_recording, 0, sizeof(ymx_event_list_t));
+    for (i=replay_next; i<persistent_replay.num_events; i++)
+        yaml_event_delete(persistent_replay.events + i);
+    free(persistent_replay.events);
+    memset(&persistent_replay, 0, sizeof(ymx_event_list_t));
+    replay_next = 0;
+    replaying = 0;
+    if (persistent_input)
+        ymx_cfile_close(persistent_input);
+    persistent_input = NULL;
+    input_bytes = 0;
+    input_too_long = 0;
 }
 
 /*
@@ -192,24 +323,191 @@ void ymx_set_node_fields(mxArray *array, mwIndex ind, ymx_node_t *node) {
     ymx_debug_msg("Exiting ymx_set_node_fields\n");
 }
 
+/* Reset the persistent parser and return it ready for its input to be set.
+ * Any parser left over from an earlier (possibly aborted) call is deleted
+ * first.
+ */
+yaml_parser_t *ymx_init_parser() {
+    ymx_persistent_cleanup();
+    ymx_reset_limit_counts();
+    yaml_parser_t *parser = &persistent_parser;
+    yaml_parser_initialize(parser);
+    return parser;
+}
+
+/* Reset the persistent emitter and return it ready for its output to be
+ * set. */
+yaml_emitter_t *ymx_init_emitter() {
+    ymx_persistent_cleanup();
+    yaml_emitter_t *emitter = &persistent_emitter;
+    yaml_emitter_initialize(emitter);
+    return emitter;
+}
+
 const yaml_event_t *ymx_parse(yaml_parser_t *parser) {
     /* I really hate doing this, but I can't think of another good way to
-     * keep from leaking memory if Matlab generates an error. */
-    yaml_event_delete(&persistent_event);
-    if (!yaml_parser_parse(parser, &persistent_event)) {
-        mexPrintf("Parser error: %s\n", parser->problem);
-        ymx_error("Error while parsing document");
+     * keep from leaking memory if Matlab generates an error. Events from
+     * the fast scanner point into its buffers, and aren't deleted. */
+    if (!persistent_event_is_fast)
+        yaml_event_delete(&persistent_event);
+    if (replaying) {
+        ymx_event_list_t *list = &persistent_replay;
+        if (replay_next == list->num_events)
+            ymx_error("Unexpected end of stream");
+        persistent_event = list->events[replay_next];
+        memset(list->events + replay_next++, 0, sizeof(yaml_event_t));
+        persistent_event_is_fast = 0;
+    } else {
+        persistent_event_is_fast = ymx_scanner_parse(parser,
+                &persistent_event);
+        if (!persistent_event_is_fast
+                && !yaml_parser_parse(parser, &persistent_event)) {
+            if (input_too_long)
+                ymx_error("Input exceeds the maximum size");
+            if (persistent_input && ymx_cfile_problem(persistent_input))
+                ymx_error(ymx_cfile_problem(persistent_input));
+            mexPrintf("Parser error: %s\n", parser->problem);
+            ymx_error("Error while parsing document");
+        }
+    }
+    switch (persistent_event.type) {
+        case YAML_SEQUENCE_START_EVENT:
+        case YAML_MAPPING_START_EVENT:
+            if (++depth > limits.max_depth)
+                ymx_error("Document exceeds the maximum nesting depth");
+            /* Fall through */
+        case YAML_SCALAR_EVENT:
+        case YAML_ALIAS_EVENT:
+            if (++num_nodes > limits.max_nodes)
+                ymx_error("Stream exceeds the maximum number of nodes");
+            break;
+        case YAML_SEQUENCE_END_EVENT:
+        case YAML_MAPPING_END_EVENT:
+            depth--;
+            break;
+        default:
+            break;
     }
     return &persistent_event;
 }
 
+/* Read past the node that starts with first_event, and everything in it,
+ * without constructing any of it. */
+void ymx_skip_node(yaml_parser_t *parser, const yaml_event_t *first_event) {
+    if (first_event->type != YAML_SEQUENCE_START_EVENT
+            && first_event->type != YAML_MAPPING_START_EVENT)
+        return;
+    
+    size_t open = 1;
+    while (open) {
+        switch (ymx_parse(parser)->type) {
+            case YAML_SEQUENCE_START_EVENT:
+            case YAML_MAPPING_START_EVENT:
+                open++;
+                break;
+            case YAML_SEQUENCE_END_EVENT:
+            case YAML_MAPPING_END_EVENT:
+                open--;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
 void ymx_emit(yaml_emitter_t *emitter, yaml_event_t *event) {
-    if (!yaml_emitter_emit(emitter, event)) {
+    if (recording) {
+        ymx_record_event(event);
+        return;
+    }
+    if (emit_handler) {
+        /* Hold the event where ymx_persistent_cleanup will free it, should
+         * the handler raise an error */
+        if (persistent_event_is_fast)
+            persistent_event_is_fast = 0;
+        else
+            yaml_event_delete(&persistent_event);
+        persistent_event = *event;
+        memset(event, 0, sizeof(yaml_event_t));
+        emit_handler(emit_handler_data, &persistent_event);
+        return;
+    }
+    /* The emitter takes ownership of the event's data, even on failure, so
+     * forget it here; otherwise ymx_persistent_cleanup would free it a
+     * second time when this is the persistent event. */
+    int ok = yaml_emitter_emit(emitter, event);
+    memset(event, 0, sizeof(yaml_event_t));
+    if (!ok) {
         mexPrintf("Emitter error: %s\n", emitter->problem);
         ymx_error("Error while emitting document");
     }
 }
 
+/* Start keeping the events passed to ymx_emit, rather than emitting them,
+ * and return the (empty) list they are kept in. The events' data is still
+ * allocated by libyaml, so the list can be handed to other threads. */
+ymx_event_list_t *ymx_start_recording() {
+    ymx_persistent_cleanup();
+    recording = 1;
+    return &persistent_recording;
+}
+
+void ymx_stop_recording() {
+    recording = 0;
+}
+
+/* Pass the events given to ymx_emit to handler, along with data, instead
+ * of emitting them, until this is called again with a NULL handler. The
+ * handler mustn't keep the event, which is freed by the next ymx_emit. */
+void ymx_set_emit_handler(ymx_emit_handler_t handler, void *data) {
+    emit_handler = handler;
+    emit_handler_data = data;
+}
+
+void ymx_record_event(yaml_event_t *event) {
+    ymx_event_list_t *list = &persistent_recording;
+    if (list->num_events == list->size) {
+        list->size = list->size ? 2*list->size : EVENTS_INITIAL_SIZE;
+        list->events = list->events
+                ? mxRealloc(list->events, list->size * sizeof(yaml_event_t))
+                : mxMalloc(list->size * sizeof(yaml_event_t));
+        mexMakeMemoryPersistent(list->events);
+    }
+    list->events[list->num_events++] = *event;
+    memset(event, 0, sizeof(yaml_event_t));
+}
+
+/* A fast non-cryptographic 64-bit hash of length bytes of data, read a
+ * word at a time. Values are only meaningful within one machine (they
+ * depend on byte order), which is all the caches keyed on them need. */
+uint64_T ymx_hash_bytes(const void *data, size_t length, uint64_T seed) {
+    const unsigned char *bytes = data;
+    uint64_T hash = seed ^ ((uint64_T)length * YMX_HASH_MULTIPLIER);
+    uint64_T word;
+    while (length >= sizeof(word)) {
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ ymx_hash_mix(word)) * YMX_HASH_MULTIPLIER;
+        bytes += sizeof(word);
+        length -= sizeof(word);
+    }
+    if (length) {
+        word = 0;
+        memcpy(&word, bytes, length);
+        hash = (hash ^ ymx_hash_mix(word)) * YMX_HASH_MULTIPLIER;
+    }
+    return ymx_hash_mix(hash);
+}
+
+/* The splitmix64 finalizer: every input bit affects every output bit */
+uint64_T ymx_hash_mix(uint64_T value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
 mxArray *ymx_create_int_scalar(int32_T value) {
     mxArray *output = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
     ((int32_T *)mxGetData(output))[0] = value;
@@ -321,6 +619,31 @@ int ymx_is_valid_node_array(const mxArray *node) {
     return 1;
 }
 
+/* As ymx_is_valid_node_array, but first looking for node's layout among
+ * those already checked in this document (see ymx_dump_context_t).
+ */
+int ymx_is_known_node_array(
+        ymx_dump_context_t *context,
+        const mxArray *node ) {
+    if (!mxIsStruct(node) || mxGetNumberOfFields(node) != YMX_NODE_NUM_FIELDS)
+        return 0;
+    
+    const char *names[YMX_NODE_NUM_FIELDS];
+    int field_ind;
+    for (field_ind = 0; field_ind < YMX_NODE_NUM_FIELDS; field_ind++) {
+        names[field_ind] = mxGetFieldNameByNumber(node, field_ind);
+    }
+    size_t slot = ((size_t)names[0] / sizeof(void *))
+            % YMX_LAYOUT_CACHE_SIZE;
+    if (memcmp(context->layouts[slot], names, sizeof(names)) == 0)
+        return 1;
+    
+    if (!ymx_is_valid_node_array(node))
+        return 0;
+    memcpy(context->layouts[slot], names, sizeof(names));
+    return 1;
+}
+
 int ymx_is_valid_int_scalar(const mxArray *scalar) {
     if (!mxIsInt32(scalar))
         return 0;
@@ -351,23 +674,169 @@ int ymx_is_valid_string(const mxArray *string) {
 }
 
 
+/*
+ * Resource limits
+ *************************************************************************/
+
+/* Return the current limits as a scalar struct with fields max_depth,
+ * max_nodes and max_bytes; a limit that isn't set is Inf. */
+mxArray *ymx_get_limits() {
+    mxArray *output = mxCreateStructMatrix(1, 1,
+            YMX_LIMITS_NUM_FIELDS, YMX_LIMITS_FIELD_STRS);
+    mxSetFieldByNumber(output, 0, 0, ymx_limit_to_array(limits.max_depth));
+    mxSetFieldByNumber(output, 0, 1, ymx_limit_to_array(limits.max_nodes));
+    mxSetFieldByNumber(output, 0, 2, ymx_limit_to_array(limits.max_bytes));
+    return output;
+}
+
+/* Change the limits on what loads will accept. options is a scalar struct
+ * with any of these fields, each a positive whole number, or Inf for no
+ * limit; limits not given are left as they are.
+ *     max_depth: Most sequences and mappings open at once in a load.
+ *                Default 1000.
+ *     max_nodes: Most nodes (scalars, aliases, sequences and mappings) in
+ *                one load. Default Inf.
+ *     max_bytes: Most bytes of YAML input to one load. Default Inf.
+ */
+void ymx_set_limits(const mxArray *options) {
+    if (!mxIsStruct(options) || mxGetNumberOfElements(options) != 1)
+        ymx_error("Limits must be a scalar struct");
+
+    ymx_limits_t new_limits;
+    new_limits.max_depth = ymx_get_limit_option(options, "max_depth",
+            limits.max_depth);
+    new_limits.max_nodes = ymx_get_limit_option(options, "max_nodes",
+            limits.max_nodes);
+    new_limits.max_bytes = ymx_get_limit_option(options, "max_bytes",
+            limits.max_bytes);
+    limits = new_limits;
+}
+
+/* A hash of the settings that can change what a load of the same input
+ * gives: the limits, and the scanner, whose errors can differ from
+ * libyaml's. The load cache keeps it with each entry. */
+uint64_T ymx_load_settings_key() {
+    uint64_T settings[4];
+    settings[0] = limits.max_depth;
+    settings[1] = limits.max_nodes;
+    settings[2] = limits.max_bytes;
+    settings[3] = (uint64_T)ymx_scanner_mode();
+    return ymx_hash_bytes(settings, sizeof(settings),
+            YMX_SETTINGS_HASH_SEED);
+}
+
+/* Attach input to a parser from ymx_init_parser, if it isn't too long */
+void ymx_set_parser_input(yaml_parser_t *parser,
+        const char *input, size_t length) {
+    if (length > limits.max_bytes)
+        ymx_error("Input exceeds the maximum size");
+    if (!ymx_scanner_start(input, length))
+        yaml_parser_set_input_string(parser,
+                (const yaml_char_t *)input, length);
+}
+
+/* As ymx_set_parser_input, but never taking the fast scanner's path, for
+ * loads that need the marks only libyaml fills in */
+void ymx_set_libyaml_input(yaml_parser_t *parser,
+        const char *input, size_t length) {
+    if (length > limits.max_bytes)
+        ymx_error("Input exceeds the maximum size");
+    yaml_parser_set_input_string(parser, (const yaml_char_t *)input, length);
+}
+
+/* Have ymx_parse serve the events in a list, from its first, instead of
+ * parsing; the list's events (and its malloc'd array) are taken over, and
+ * the list left empty. length is the size of the text they were parsed
+ * from, which is held to the same limit as any other input. */
+void ymx_set_replay_input(ymx_event_list_t *events, size_t length) {
+    persistent_replay = *events;
+    memset(events, 0, sizeof(ymx_event_list_t));
+    replay_next = 0;
+    replaying = 1;
+    if (length > limits.max_bytes)
+        ymx_error("Input exceeds the maximum size");
+}
+
+/* Stream a file into a parser from ymx_init_parser, through libyaml's
+ * read handler. The file is taken over, and closed by the next
+ * ymx_persistent_cleanup. Its size isn't known up front, so the limit on
+ * input size is checked against the bytes read as they're read. */
+void ymx_set_file_input(yaml_parser_t *parser, ymx_cfile_t *file) {
+    persistent_input = file;
+    yaml_parser_set_input(parser, ymx_file_read_handler, file);
+}
+
+/* Forget the counts of a load that ended, perhaps in an error */
+void ymx_reset_limit_counts() {
+    num_nodes = 0;
+    depth = 0;
+}
+
+/* libyaml read handler for ymx_set_file_input. A read that fails, or
+ * goes over the limit, fails the parse, and ymx_parse reports why. */
+int ymx_file_read_handler(void *data, unsigned char *buffer, size_t size,
+        size_t *size_read) {
+    *size_read = ymx_cfile_read(data, buffer, size);
+    if (ymx_cfile_problem(data))
+        return 0;
+    input_bytes += *size_read;
+    if (input_bytes > limits.max_bytes) {
+        input_too_long = 1;
+        return 0;
+    }
+    return 1;
+}
+
+size_t ymx_get_limit_option(const mxArray *options, const char *name,
+        size_t current) {
+    mxArray *option = mxGetField(options, 0, name);
+    if (!option)
+        return current;
+
+    double value = mxIsNumeric(option) && mxGetNumberOfElements(option) == 1
+            ? mxGetScalar(option) : 0;
+    if (mxIsInf(value) && value > 0)
+        return YMX_NO_LIMIT;
+    if (!(value >= 1 && value < (double)YMX_NO_LIMIT)
+            || value != (double)(size_t)value)
+        ymx_error("Limits must be positive whole numbers, or Inf");
+    return (size_t)value;
+}
+
+mxArray *ymx_limit_to_array(size_t limit) {
+    return mxCreateDoubleScalar(limit == YMX_NO_LIMIT
+            ? mxGetInf() : (double)limit);
+}
+
+
 /*
  * Functions for loading
  *************************************************************************/
 
 mxArray *ymx_load_stream(const mxArray *yaml_stream) {
     ymx_debug_msg("Entering ymx_load_stream\n");
-    ymx_persistent_cleanup();
-    
-    mwSize num_docs = 0;
     char *yaml_cstr = mxArrayToString(yaml_stream);
+    mxArray *docs_array = ymx_load_string(yaml_cstr, strlen(yaml_cstr));
+    mxFree(yaml_cstr);
+    ymx_debug_msg("Exiting ymx_load_stream\n");
+    return docs_array;
+}
+
+/* As ymx_load_stream, but with the stream given as length bytes of UTF-8
+ * (which need not be NUL-terminated). Returns NULL if the stream has no
+ * documents. */
+mxArray *ymx_load_string(const char *yaml_str, size_t length) {
+    yaml_parser_t *parser = ymx_init_parser();
+    ymx_set_parser_input(parser, yaml_str, length);
+    return ymx_load_parsed(parser);
+}
+
+/* As ymx_load_string, but reading the stream from a parser whose input has
+ * already been set */
+mxArray *ymx_load_parsed(yaml_parser_t *parser) {
+    mwSize num_docs = 0;
     ymx_document_t *raw_docs = NULL;
     
-    yaml_parser_t *parser = &persistent_parser;
-    yaml_parser_initialize(parser);
-    yaml_parser_set_input_string(parser,
-            (yaml_char_t *)yaml_cstr, strlen(yaml_cstr));
-    
     const yaml_event_t *event = ymx_parse(parser);
     mxAssert(event->type == YAML_STREAM_START_EVENT,
             "Expected stream start event!");
@@ -404,9 +873,7 @@ mxArray *ymx_load_stream(const mxArray *yaml_stream) {
         }
     }
     
-    mxFree(yaml_cstr);
     mxFree(raw_docs);
-    ymx_debug_msg("Exiting ymx_load_stream\n");
     return docs_array;
 }
 
@@ -464,29 +931,71 @@ void ymx_load_document( ymx_document_t *doc,
     ymx_debug_msg("Exiting ymx_load_document\n");
 }
 
+/* Load the node that starts with first_event, and everything in it.
+ * Sequences and mappings still open are kept on a stack of frames rather
+ * than loaded by recursion; the frames' item buffers are kept for reuse by
+ * later collections at the same depth, until the whole node is loaded.
+ */
 void ymx_load_node( ymx_node_t *node,
         yaml_parser_t *parser,
         const yaml_event_t *first_event ) {
     ymx_debug_msg("Entering ymx_load_node\n");
-    switch (first_event->type) {
-        case YAML_ALIAS_EVENT:
-            ymx_load_alias(node, parser, first_event);
-            break;
-        case YAML_SCALAR_EVENT:
-            ymx_load_scalar(node, parser, first_event);
-            break;
-        case YAML_SEQUENCE_START_EVENT:
-            ymx_load_sequence(node, parser, first_event);
-            break;
-        case YAML_MAPPING_START_EVENT:
-            ymx_load_mapping(node, parser, first_event);
+    size_t frames_size = FRAMES_INITIAL_SIZE;
+    ymx_load_frame_t *frames = mxCalloc(frames_size,
+            sizeof(ymx_load_frame_t));
+    size_t num_frames = 0;
+
+    const yaml_event_t *event = first_event;
+    ymx_node_t item;
+    while (1) {
+        memset(&item, 0, sizeof(item));
+        switch (event->type) {
+            case YAML_ALIAS_EVENT:
+                ymx_load_alias(&item, event);
+                break;
+            case YAML_SCALAR_EVENT:
+                ymx_load_scalar(&item, event);
+                break;
+            case YAML_SEQUENCE_START_EVENT:
+            case YAML_MAPPING_START_EVENT:
+                if (num_frames == frames_size) {
+                    frames = mxRealloc(frames,
+                            2*frames_size * sizeof(ymx_load_frame_t));
+                    memset(frames + frames_size, 0,
+                            frames_size * sizeof(ymx_load_frame_t));
+                    frames_size *= 2;
+                }
+                ymx_load_collection_start(frames + num_frames, event);
+                num_frames++;
+                event = ymx_parse(parser);
+                continue;
+            case YAML_SEQUENCE_END_EVENT:
+            case YAML_MAPPING_END_EVENT:
+                num_frames--;
+                ymx_load_collection_end(frames + num_frames);
+                item = frames[num_frames].node;
+                break;
+            default:
+                ymx_error("Unexpected event while loading node");
+        }
+
+        if (!num_frames)
             break;
+        ymx_load_frame_append(frames + num_frames - 1, &item);
+        event = ymx_parse(parser);
+    }
+    *node = item;
+
+    size_t i;
+    for (i=0; i<frames_size; i++) {
+        if (frames[i].items)
+            mxFree(frames[i].items);
     }
+    mxFree(frames);
     ymx_debug_msg("Exiting ymx_load_node\n");
 }
 
 void ymx_load_scalar( ymx_node_t *node,
-        yaml_parser_t *parser,
         const yaml_event_t *first_event ) {
     ymx_debug_msg("Entering ymx_load_scalar\n");
     yaml_char_t *tag = first_event->data.scalar.tag;
@@ -527,7 +1036,6 @@ void ymx_load_scalar( ymx_node_t *node,
 }
 
 void ymx_load_alias( ymx_node_t *node,
-        yaml_parser_t *parser,
         const yaml_event_t *first_event ) {
     ymx_debug_msg("Entering ymx_load_alias\n");
     node->anchor = mxCreateString((char *)first_event->data.alias.anchor);
@@ -539,131 +1047,81 @@ void ymx_load_alias( ymx_node_t *node,
     ymx_debug_msg("Exiting ymx_load_alias\n");
 }
 
-void ymx_load_sequence( ymx_node_t *node,
-        yaml_parser_t *parser,
+/* Begin a frame for the sequence or mapping started by first_event,
+ * filling in everything in its node but the value. */
+void ymx_load_collection_start(
+        ymx_load_frame_t *frame,
         const yaml_event_t *first_event ) {
-    ymx_debug_msg("Entering ymx_load_sequence\n");
-    yaml_char_t *tag = first_event->data.sequence_start.tag;
-    if (tag) {
-        node->tag = mxCreateString((char *)tag);
+    ymx_node_t *node = &frame->node;
+    memset(node, 0, sizeof(ymx_node_t));
+    frame->num_items = 0;
+    
+    yaml_char_t *tag;
+    yaml_char_t *anchor;
+    int implicit;
+    int style;
+    frame->is_mapping = (first_event->type == YAML_MAPPING_START_EVENT);
+    if (frame->is_mapping) {
+        tag = first_event->data.mapping_start.tag;
+        anchor = first_event->data.mapping_start.anchor;
+        implicit = first_event->data.mapping_start.implicit;
+        style = first_event->data.mapping_start.style;
+        node->type = ymx_create_int_scalar(YMX_NODE_TYPE_MAPPING);
     } else {
-        node->tag = mxCreateString("?");
+        tag = first_event->data.sequence_start.tag;
+        anchor = first_event->data.sequence_start.anchor;
+        implicit = first_event->data.sequence_start.implicit;
+        style = first_event->data.sequence_start.style;
+        node->type = ymx_create_int_scalar(YMX_NODE_TYPE_SEQUENCE);
     }
     
-    yaml_char_t *anchor = first_event->data.sequence_start.anchor;
+    node->tag = mxCreateString(tag ? (char *)tag : "?");
     if (anchor) {
         node->anchor = mxCreateString((char *)anchor);
     }
-    
-    node->implicit = ymx_create_int_scalar(
-            first_event->data.sequence_start.implicit );
-    node->style = ymx_create_int_scalar(
-            first_event->data.sequence_start.style );
-    node->type = ymx_create_int_scalar(YMX_NODE_TYPE_SEQUENCE);
-    
-    size_t items_buffer_size = NODES_BUFFER_CHUNK_SIZE;
-    ymx_node_t *items = mxCalloc(items_buffer_size, sizeof(ymx_node_t *));
-    size_t num_items = 0;
-    
-    const yaml_event_t *event = ymx_parse(parser);
-    
-    while (event->type != YAML_SEQUENCE_END_EVENT) {
-        if (num_items == items_buffer_size) {
-            items_buffer_size += NODES_BUFFER_CHUNK_SIZE;
-            items = mxRealloc(items,
-                    items_buffer_size * sizeof(ymx_node_t *));
-            memset(items + num_items, 0,
-                    NODES_BUFFER_CHUNK_SIZE * sizeof(ymx_node_t *));
-        }
-        ymx_load_node(items + num_items, parser, event);
-        num_items++;
-        
-        event = ymx_parse(parser);
-    }
-    
-    if (num_items) {
-        node->value = mxCreateStructMatrix(1, num_items,
-                YMX_NODE_NUM_FIELDS, YMX_NODE_FIELD_STRS);
-        int i;
-        for (i=0; i<num_items; i++) {
-            ymx_set_node_fields(node->value, i, items+i);
-        }
-    }
-    
-    mxFree(items);
-    ymx_debug_msg("Exiting ymx_load_sequence\n");
+    node->implicit = ymx_create_int_scalar(implicit);
+    node->style = ymx_create_int_scalar(style);
 }
 
-void ymx_load_mapping( ymx_node_t *node,
-        yaml_parser_t *parser,
-        const yaml_event_t *first_event ) {
-    ymx_debug_msg("Entering ymx_load_mapping\n");
-    yaml_char_t *tag = first_event->data.mapping_start.tag;
-    if (tag) {
-        node->tag = mxCreateString((char *)tag);
+/* Finish the node of a frame, making its items into its value: a 1-by-N
+ * node array for a sequence, or a 2-by-N array of keys above values for a
+ * mapping. */
+void ymx_load_collection_end(ymx_load_frame_t *frame) {
+    size_t num_items = frame->num_items;
+    if (!num_items)
+        return;
+    
+    ymx_node_t *node = &frame->node;
+    if (frame->is_mapping) {
+        node->value = mxCreateStructMatrix(2, num_items/2,
+                YMX_NODE_NUM_FIELDS, YMX_NODE_FIELD_STRS);
     } else {
-        node->tag = mxCreateString("?");
-    }
-    
-    yaml_char_t *anchor = first_event->data.mapping_start.anchor;
-    if (anchor) {
-        node->anchor = mxCreateString((char *)anchor);
-    }
-    
-    node->implicit = ymx_create_int_scalar(
-            first_event->data.mapping_start.implicit );
-    node->style = ymx_create_int_scalar(
-            first_event->data.mapping_start.style );
-    node->type = ymx_create_int_scalar(YMX_NODE_TYPE_MAPPING);
-    
-    size_t buffer_size = NODES_BUFFER_CHUNK_SIZE;
-    ymx_node_t *keys   = mxCalloc(buffer_size, sizeof(ymx_node_t *));
-    ymx_node_t *values = mxCalloc(buffer_size, sizeof(ymx_node_t *));
-    size_t num_items = 0;
-    
-    const yaml_event_t *event = ymx_parse(parser);
-    
-    while (event->type != YAML_MAPPING_END_EVENT) {
-        if (num_items == buffer_size) {
-            buffer_size += NODES_BUFFER_CHUNK_SIZE;
-            keys = mxRealloc(keys,
-                    buffer_size * sizeof(ymx_node_t *));
-            memset(keys + num_items, 0,
-                    NODES_BUFFER_CHUNK_SIZE * sizeof(ymx_node_t *));
-            values = mxRealloc(values,
-                    buffer_size * sizeof(ymx_node_t *));
-            memset(values + num_items, 0,
-                    NODES_BUFFER_CHUNK_SIZE * sizeof(ymx_node_t *));
-        }
-        
-        ymx_load_node(keys + num_items, parser, event);
-        event = ymx_parse(parser);
-        ymx_load_node(values + num_items, parser, event);
-        num_items++;
-        event = ymx_parse(parser);
-    }
-    
-    if (num_items) {
-        node->value = mxCreateStructMatrix(2, num_items,
+        node->value = mxCreateStructMatrix(1, num_items,
                 YMX_NODE_NUM_FIELDS, YMX_NODE_FIELD_STRS);
-        int i;
-        for (i=0; i<num_items; i++) {
-            ymx_set_node_fields(node->value, 2*i, keys+i);
-            ymx_set_node_fields(node->value, 2*i+1, values+i);
-        }
     }
-    
-    mxFree(keys);
-    mxFree(values);
-    ymx_debug_msg("Exiting ymx_load_mapping\n");
+    size_t i;
+    for (i=0; i<num_items; i++) {
+        ymx_set_node_fields(node->value, i, frame->items + i);
+    }
 }
 
+void ymx_load_frame_append(ymx_load_frame_t *frame, ymx_node_t *item) {
+    if (frame->num_items == frame->items_size) {
+        size_t new_size = frame->items_size
+                ? 2*frame->items_size : NODES_BUFFER_CHUNK_SIZE;
+        frame->items = frame->items
+                ? mxRealloc(frame->items, new_size * sizeof(ymx_node_t))
+                : mxMalloc(new_size * sizeof(ymx_node_t));
+        frame->items_size = new_size;
+    }
+    frame->items[frame->num_items++] = *item;
+}
 
 /*
  * Functions for dumping
  *************************************************************************/
 
-mxArray *ymx_dump_stream(const mxArray *docs_array) {
+mxArray *ymx_dump_stream(const mxArray *docs_array, int trusted) {
     ymx_persistent_cleanup();
     if (!ymx_is_valid_doc_array(docs_array))
         ymx_error("Invalid document array");
@@ -671,8 +1129,7 @@ mxArray *ymx_dump_stream(const mxArray *docs_array) {
     ymx_buffer_t buffer;
     ymx_buffer_init(&buffer, YMX_BUFFER_CHUNK_SIZE);
     
-    yaml_emitter_t *emitter = &persistent_emitter;
-    yaml_emitter_initialize(emitter);
+    yaml_emitter_t *emitter = ymx_init_emitter();
     yaml_emitter_set_output(emitter, ymx_buffer_write_handler, &buffer);
     
     yaml_event_t *event = &persistent_event;
@@ -685,7 +1142,7 @@ mxArray *ymx_dump_stream(const mxArray *docs_array) {
     mwSize num_docs = mxGetNumberOfElements(docs_array);
     mwIndex ind;
     for (ind=0; ind<num_docs; ind++) {
-        ymx_dump_document(emitter, docs_array, ind);
+        ymx_dump_document(emitter, docs_array, ind, 0, trusted);
     }
     
     yaml_stream_end_event_initialize(event);
@@ -700,8 +1157,18 @@ mxArray *ymx_dump_stream(const mxArray *docs_array) {
     return stream;
 }
 
+/* Emit document ind of a document array. If force_explicit_start is
+ * nonzero, the document starts with "---" whatever its start_implicit
+ * field says, which is needed when the emitter's output is appended to
+ * existing documents. If trusted is nonzero, the fields of individual
+ * nodes are used without being checked (though the layout of every node
+ * array still is), which is faster but has undefined results if a field
+ * holds the wrong type of value.
+ */
 void ymx_dump_document(yaml_emitter_t *emitter,
-        const mxArray *docs_array, mwIndex ind) {
+        const mxArray *docs_array, mwIndex ind,
+        int force_explicit_start,
+        int trusted) {
     
     ymx_document_t doc;
     doc.root = mxGetFieldByNumber( docs_array, ind,
@@ -773,6 +1240,8 @@ void ymx_dump_document(yaml_emitter_t *emitter,
         start_implicit = 0;
         mexWarnMsgTxt("Invalid document start implicit specifier");
     }
+    if (force_explicit_start)
+        start_implicit = 0;
     
     int32_T end_implicit;
     doc.end_implicit = mxGetFieldByNumber( docs_array, ind,
@@ -794,7 +1263,11 @@ void ymx_dump_document(yaml_emitter_t *emitter,
             start_implicit);
     ymx_emit(emitter, event);
     
-    ymx_dump_node(emitter, doc.root, 0);
+    ymx_dump_context_t context;
+    memset(&context, 0, sizeof(context));
+    context.trusted = trusted;
+    ymx_dump_tree(emitter, &context, doc.root);
+    ymx_dump_context_delete(&context);
     
     yaml_document_end_event_initialize(event, end_implicit);
     ymx_emit(emitter, event);
@@ -807,20 +1280,75 @@ void ymx_dump_document(yaml_emitter_t *emitter,
     mxFree(tag_directives_start);
 }
 
-void ymx_dump_node(
+/* Emit the node tree under root. Sequences and mappings still open are
+ * kept on a stack of frames rather than dumped by recursion.
+ */
+void ymx_dump_tree(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
+        const mxArray *root ) {
+    size_t frames_size = FRAMES_INITIAL_SIZE;
+    ymx_dump_frame_t *frames = mxMalloc(frames_size
+            * sizeof(ymx_dump_frame_t));
+    size_t num_frames = 0;
+    
+    const mxArray *node = root;
+    mwIndex ind = 0;
+    while (1) {
+        const mxArray *items = NULL;
+        int type = ymx_dump_node(emitter, context, node, ind, &items);
+        if (type == YMX_NODE_TYPE_SEQUENCE || type == YMX_NODE_TYPE_MAPPING) {
+            if (num_frames == frames_size) {
+                frames_size *= 2;
+                frames = mxRealloc(frames,
+                        frames_size * sizeof(ymx_dump_frame_t));
+            }
+            ymx_dump_frame_t *frame = frames + num_frames++;
+            frame->items = items;
+            frame->next = 0;
+            frame->size = items ? mxGetNumberOfElements(items) : 0;
+            frame->is_mapping = (type == YMX_NODE_TYPE_MAPPING);
+        }
+        
+        /* Close every collection that has no nodes left */
+        while (num_frames && frames[num_frames-1].next
+                == frames[num_frames-1].size) {
+            num_frames--;
+            ymx_dump_collection_end(emitter, frames[num_frames].is_mapping);
+        }
+        if (!num_frames)
+            break;
+        
+        node = frames[num_frames-1].items;
+        ind = frames[num_frames-1].next++;
+    }
+    
+    mxFree(frames);
+}
+
+/* Emit node ind of a node array, if it's a scalar or an alias, or the
+ * start of it, if it's a sequence or a mapping; in that case, its checked
+ * node array (or NULL, if it has no nodes) is stored in *items. Returns
+ * the type of the node.
+ */
+int ymx_dump_node(
+        yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         const mxArray *node,
-        mwIndex ind ) {
-    /* Assemble tag */
+        mwIndex ind,
+        const mxArray **items ) {
+    int trusted = context->trusted;
+    
+    /* Assemble tag; the interned string belongs to the context */
     mxArray *tag_arr = mxGetFieldByNumber( node, ind,
             YMX_NODE_FIELD_TAG );
     
     yaml_char_t *tag_str = NULL;
     if (tag_arr && !mxIsEmpty(tag_arr)) {
-        if (!ymx_is_valid_string(tag_arr))
+        if (!trusted && !ymx_is_valid_string(tag_arr))
             ymx_error("Invalid tag");
         
-        tag_str = (yaml_char_t *)mxArrayToString(tag_arr);
+        tag_str = ymx_intern_tag(context, tag_arr);
     }
     
     /* Assemble anchor */
@@ -828,7 +1356,7 @@ void ymx_dump_node(
             YMX_NODE_FIELD_ANCHOR );
     yaml_char_t *anchor_str = NULL;
     if (anchor_arr && !mxIsEmpty(anchor_arr)) {
-        if (!ymx_is_valid_string(anchor_arr))
+        if (!trusted && !ymx_is_valid_string(anchor_arr))
             ymx_error("Invalid anchor");
         
         anchor_str = (yaml_char_t *)mxArrayToString(anchor_arr);
@@ -838,7 +1366,8 @@ void ymx_dump_node(
     mxArray *implicit_arr = mxGetFieldByNumber( node, ind,
             YMX_NODE_FIELD_IMPLICIT );
     int32_T implicit_int = 0;
-    if ( implicit_arr && ymx_is_valid_int_scalar(implicit_arr) ) {
+    if ( implicit_arr
+            && (trusted || ymx_is_valid_int_scalar(implicit_arr)) ) {
         implicit_int = ymx_get_int_scalar(implicit_arr);
     } else {
         mexWarnMsgTxt("Invalid node implicit specifier");
@@ -848,7 +1377,8 @@ void ymx_dump_node(
     mxArray *style_arr = mxGetFieldByNumber( node, ind,
             YMX_NODE_FIELD_STYLE );
     int32_T style_int = 0;
-    if (style_arr && ymx_is_valid_int_scalar(style_arr)) {
+    if ( style_arr
+            && (trusted || ymx_is_valid_int_scalar(style_arr)) ) {
         style_int = ymx_get_int_scalar(style_arr);
     } else {
         mexWarnMsgTxt("Invalid node style");
@@ -860,12 +1390,14 @@ void ymx_dump_node(
     
     /* Handle type */
     mxArray *type = mxGetFieldByNumber(node, ind, YMX_NODE_FIELD_TYPE);
-    if (!type || !ymx_is_valid_int_scalar(type))
+    if (!type || (!trusted && !ymx_is_valid_int_scalar(type)))
         ymx_error("Invalid node type");
     
-    switch (ymx_get_int_scalar(type)) {
+    int32_T type_int = ymx_get_int_scalar(type);
+    switch (type_int) {
         case YMX_NODE_TYPE_SCALAR:
             ymx_dump_scalar( emitter,
+                    context,
                     value_arr,
                     tag_str,
                     anchor_str,
@@ -873,7 +1405,8 @@ void ymx_dump_node(
                     style_int );
             break;
         case YMX_NODE_TYPE_SEQUENCE:
-            ymx_dump_sequence( emitter,
+            *items = ymx_dump_sequence_start( emitter,
+                    context,
                     value_arr,
                     tag_str,
                     anchor_str,
@@ -881,7 +1414,8 @@ void ymx_dump_node(
                     style_int );
             break;
         case YMX_NODE_TYPE_MAPPING:
-            ymx_dump_mapping( emitter,
+            *items = ymx_dump_mapping_start( emitter,
+                    context,
                     value_arr,
                     tag_str,
                     anchor_str,
@@ -896,21 +1430,23 @@ void ymx_dump_node(
             ymx_error("Invalid node type value");
     }
     
-    if (tag_str)
-        mxFree(tag_str);
     if (anchor_str)
         mxFree(anchor_str);
+    return type_int;
 }
 
 void ymx_dump_scalar(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         mxArray *value_arr,
         yaml_char_t *tag,
         yaml_char_t *anchor,
         int32_T implicit,
         int32_T style ) {
     
-    if (!value_arr || !ymx_is_valid_string(value_arr))
+    if ( !value_arr
+            || !(context->trusted ? mxIsChar(value_arr)
+                    : ymx_is_valid_string(value_arr)) )
         ymx_error("Invalid scalar value");
     
     yaml_char_t *value_str = (yaml_char_t *)mxArrayToString(value_arr);
@@ -937,8 +1473,11 @@ void ymx_dump_scalar(
     mxFree(value_str);
 }
 
-void ymx_dump_sequence(
+/* Emit the start of a sequence, and return its node array if it isn't
+ * empty. */
+const mxArray *ymx_dump_sequence_start(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         mxArray *value_arr,
         yaml_char_t *tag,
         yaml_char_t *anchor,
@@ -952,25 +1491,21 @@ void ymx_dump_sequence(
             style );
     ymx_emit(emitter, event);
     
-    if (value_arr && !mxIsEmpty(value_arr)) {
-        if ( !ymx_is_valid_node_array(value_arr)
-                || mxGetNumberOfDimensions(value_arr) != 2
-                || mxGetM(value_arr) != 1 )
-            ymx_error("Invalid sequence node array");
-        
-        mwSize size = mxGetNumberOfElements(value_arr);
-        mwIndex ind;
-        for (ind = 0; ind < size; ind++) {
-            ymx_dump_node(emitter, value_arr, ind);
-        }
-    }
+    if (!value_arr || mxIsEmpty(value_arr))
+        return NULL;
     
-    yaml_sequence_end_event_initialize(event);
-    ymx_emit(emitter, event);
+    if ( !ymx_is_known_node_array(context, value_arr)
+            || mxGetNumberOfDimensions(value_arr) != 2
+            || mxGetM(value_arr) != 1 )
+        ymx_error("Invalid sequence node array");
+    return value_arr;
 }
 
-void ymx_dump_mapping(
+/* Emit the start of a mapping, and return its node array if it isn't
+ * empty. */
+const mxArray *ymx_dump_mapping_start(
         yaml_emitter_t *emitter,
+        ymx_dump_context_t *context,
         mxArray *value_arr,
         yaml_char_t *tag,
         yaml_char_t *anchor,
@@ -984,20 +1519,23 @@ void ymx_dump_mapping(
             style );
     ymx_emit(emitter, event);
     
-    if (value_arr && !mxIsEmpty(value_arr)) {
-        if ( !ymx_is_valid_node_array(value_arr)
-                || mxGetNumberOfDimensions(value_arr) != 2
-                || mxGetM(value_arr) != 2 )
-            ymx_error("Invalid mapping node array");
-        
-        mwSize size = mxGetNumberOfElements(value_arr);
-        mwIndex ind;
-        for (ind = 0; ind < size; ind++) {
-            ymx_dump_node(emitter, value_arr, ind);
-        }
-    }
+    if (!value_arr || mxIsEmpty(value_arr))
+        return NULL;
     
-    yaml_mapping_end_event_initialize(event);
+    if ( !ymx_is_known_node_array(context, value_arr)
+            || mxGetNumberOfDimensions(value_arr) != 2
+            || mxGetM(value_arr) != 2 )
+        ymx_error("Invalid mapping node array");
+    return value_arr;
+}
+
+void ymx_dump_collection_end(yaml_emitter_t *emitter, int is_mapping) {
+    yaml_event_t *event = &persistent_event;
+    if (is_mapping) {
+        yaml_mapping_end_event_initialize(event);
+    } else {
+        yaml_sequence_end_event_initialize(event);
+    }
     ymx_emit(emitter, event);
 }
 
@@ -1009,6 +1547,74 @@ void ymx_dump_alias(
     ymx_emit(emitter, event);
 }
 
+/* Return the C string for a tag string array, converting it only if the
+ * same tag hasn't been seen before in this document. */
+yaml_char_t *ymx_intern_tag(
+        ymx_dump_context_t *context,
+        const mxArray *tag ) {
+    size_t length = mxGetNumberOfElements(tag);
+    const mxChar *chars = mxGetChars(tag);
+    uint64_T key = ymx_hash_bytes(chars, length * sizeof(mxChar), 0);
+    
+    size_t mask = context->tags_size - 1;
+    size_t slot;
+    if (context->tags_size) {
+        for (slot = key & mask; context->tags[slot].str;
+                slot = (slot + 1) & mask) {
+            ymx_interned_t *entry = context->tags + slot;
+            if (entry->key == key && entry->length == length
+                    && memcmp(entry->chars, chars,
+                            length * sizeof(mxChar)) == 0)
+                return (yaml_char_t *)entry->str;
+        }
+    }
+    
+    /* Not found; keep the table at most half full */
+    if (2*(context->num_tags + 1) > context->tags_size) {
+        size_t old_size = context->tags_size;
+        ymx_interned_t *old_tags = context->tags;
+        context->tags_size = old_size ? 2*old_size : TAGS_INITIAL_SIZE;
+        context->tags = mxCalloc(context->tags_size, sizeof(ymx_interned_t));
+        mask = context->tags_size - 1;
+        size_t i;
+        for (i=0; i<old_size; i++) {
+            if (!old_tags[i].str)
+                continue;
+            for (slot = old_tags[i].key & mask; context->tags[slot].str;
+                    slot = (slot + 1) & mask)
+                ;
+            context->tags[slot] = old_tags[i];
+        }
+        if (old_tags)
+            mxFree(old_tags);
+    }
+    
+    for (slot = key & mask; context->tags[slot].str;
+            slot = (slot + 1) & mask)
+        ;
+    ymx_interned_t *entry = context->tags + slot;
+    entry->key = key;
+    entry->length = length;
+    entry->chars = mxMalloc(length * sizeof(mxChar));
+    memcpy(entry->chars, chars, length * sizeof(mxChar));
+    entry->str = mxArrayToString(tag);
+    context->num_tags++;
+    return (yaml_char_t *)entry->str;
+}
+
+void ymx_dump_context_delete(ymx_dump_context_t *context) {
+    size_t i;
+    for (i=0; i<context->tags_size; i++) {
+        if (context->tags[i].str) {
+            mxFree(context->tags[i].chars);
+            mxFree(context->tags[i].str);
+        }
+    }
+    if (context->tags)
+        mxFree(context->tags);
+    memset(context, 0, sizeof(ymx_dump_context_t));
+}
+
 
 /*
  * ymx_buffer functions
@@ -1030,25 +1636,35 @@ void ymx_buffer_delete(ymx_buffer_t *buffer) {
 
 void ymx_buffer_append(ymx_buffer_t *buffer, 
         void *input, size_t size) {
+    memcpy(ymx_buffer_reserve(buffer, size), input, size);
+    buffer->used_size += size;
+}
+
+/* Make room for size more bytes, and return where they go; the caller
+ * writes them and adds them to used_size. The buffer grows by whole
+ * chunks, at least doubling, so writing a little at a time stays cheap. */
+char *ymx_buffer_reserve(ymx_buffer_t *buffer, size_t size) {
     size_t current_space = buffer->total_size - buffer->used_size;
     if (size > current_space) {
         /* We need to make some room */
-        int required_chunks = 1 + (size-current_space)/buffer->chunk_size;
+        size_t required_chunks = 1 + (size-current_space)/buffer->chunk_size;
+        size_t growth = buffer->chunk_size * required_chunks;
+        if (growth < buffer->total_size)
+            growth = buffer->total_size;
+        buffer->total_size += growth;
         buffer->head = mxRealloc(buffer->head, buffer->total_size
-                + (buffer->chunk_size * required_chunks)
                 + YMX_BUFFER_TAIL_SIZE);
     }
-    memcpy(buffer->head + buffer->used_size, input, size);
-    buffer->used_size += size;
+    return (char *)buffer->head + buffer->used_size;
 }
 
 ymx_buffer_char_t *ymx_buffer_as_string(ymx_buffer_t *buffer) {
-    memset(buffer->head + buffer->used_size,
+    memset((char *)buffer->head + buffer->used_size,
             0, sizeof(ymx_buffer_char_t));
     return (ymx_buffer_char_t *) buffer->head;
 }
 
-static int ymx_buffer_write_handler(void *data,
+int ymx_buffer_write_handler(void *data,
         unsigned char *yaml_buffer, size_t size) {
     ymx_buffer_t *ymx_buffer = data;
     ymx_buffer_append(ymx_buffer, yaml_buffer, size);
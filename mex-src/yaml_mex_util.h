@@ -11,14 +11,266 @@
 #define ymx_debug_msg(...)
 #endif
 
+/* Allocation counting, for finding leaks; see yaml_mex_alloc.c */
+#ifdef YMX_COUNT_ALLOCS
+void ymx_alloc_begin_call(const mxArray *command);
+void ymx_alloc_end_call();
+void ymx_alloc_cleanup();
+void *ymx_counted_malloc(size_t size, const char *file, int line);
+void *ymx_counted_calloc(size_t num, size_t size, const char *file,
+        int line);
+void *ymx_counted_realloc(void *ptr, size_t size, const char *file,
+        int line);
+void ymx_counted_free(void *ptr);
+char *ymx_counted_array_to_string(const mxArray *array, const char *file,
+        int line);
+void ymx_counted_make_persistent(void *ptr);
+void ymx_counted_set_data(mxArray *array, void *data);
+void ymx_counted_set_imag_data(mxArray *array, void *data);
+void ymx_counted_make_array_persistent(mxArray *array, const char *file,
+        int line);
+void ymx_counted_destroy_array(mxArray *array);
+#ifndef YMX_ALLOC_INTERNAL
+#define mxMalloc(size) ymx_counted_malloc(size, __FILE__, __LINE__)
+#define mxCalloc(num, size) \
+        ymx_counted_calloc(num, size, __FILE__, __LINE__)
+#define mxRealloc(ptr, size) \
+        ymx_counted_realloc(ptr, size, __FILE__, __LINE__)
+#define mxFree(ptr) ymx_counted_free(ptr)
+#define mxArrayToString(array) \
+        ymx_counted_array_to_string(array, __FILE__, __LINE__)
+#define mexMakeMemoryPersistent(ptr) ymx_counted_make_persistent(ptr)
+#define mxSetData(array, data) ymx_counted_set_data(array, data)
+#define mxSetImagData(array, data) ymx_counted_set_imag_data(array, data)
+#define mexMakeArrayPersistent(array) \
+        ymx_counted_make_array_persistent(array, __FILE__, __LINE__)
+#define mxDestroyArray(array) ymx_counted_destroy_array(array)
+#endif
+#else
+#define ymx_alloc_begin_call(command)
+#define ymx_alloc_end_call()
+#define ymx_alloc_cleanup()
+#endif
+
 /*
  * Main interface functions
  *************************************************************************/
 
 mxArray *ymx_load_stream(const mxArray *yaml_stream);
-mxArray *ymx_dump_stream(const mxArray *docs_array);
+mxArray *ymx_dump_stream(const mxArray *docs_array, int trusted);
+mxArray *ymx_dump_stream_parallel(const mxArray *docs_array, int trusted);
+typedef struct ymx_projection_s ymx_projection_t;
+
+mxArray *ymx_construct_stream(
+        const mxArray *yaml_stream,
+        const ymx_projection_t *projection );
+mxArray *ymx_load_columns(const mxArray *yaml_stream);
+mxArray *ymx_extract(const mxArray *source, int is_file,
+        const mxArray *key_path, mxArray **found);
+mxArray *ymx_load_events(const mxArray *yaml_stream, size_t batch_size);
+mxArray *ymx_load_file_cached(
+        const mxArray *filename,
+        const mxArray *cache_dir );
+mxArray *ymx_compose_stream(const mxArray *data, int flags);
+mxArray *ymx_writer_open(const mxArray *path, const mxArray *options);
+void ymx_writer_write(const mxArray *handle, const mxArray *data);
+void ymx_writer_close(const mxArray *handle);
+void ymx_writer_close_all();
+mxArray *ymx_cache_construct_stream(const mxArray *yaml_stream);
+mxArray *ymx_reloader_open(const mxArray *path, const mxArray *options);
+mxArray *ymx_reloader_read(const mxArray *handle, const mxArray *skip);
+void ymx_reloader_close(const mxArray *handle);
+void ymx_reloader_close_all();
+mxArray *ymx_load_async(const mxArray *path, const mxArray *options);
+mxArray *ymx_load_ready(const mxArray *handle);
+mxArray *ymx_load_fetch(const mxArray *handle);
+void ymx_load_cancel(const mxArray *handle);
+void ymx_load_cancel_all();
+mxArray *ymx_index_file(const mxArray *path);
+mxArray *ymx_load_doc(const mxArray *path, const mxArray *number,
+        const mxArray *options);
+mxArray *ymx_load_file(const mxArray *filename, const mxArray *options);
+mxArray *ymx_alloc_stats();
+mxArray *ymx_hash_stream(const mxArray *yaml_stream, const mxArray *options);
+mxArray *ymx_hash_data(const mxArray *data, int flags);
+void ymx_cache_set_limit(size_t limit);
+mxArray *ymx_cache_stats();
+void ymx_cache_flush();
+mxArray *ymx_get_limits();
+void ymx_set_limits(const mxArray *options);
+uint64_T ymx_load_settings_key();
+mxArray *ymx_get_scanner();
+void ymx_set_scanner(const mxArray *mode);
+mxArray *ymx_get_emitter();
+void ymx_set_emitter(const mxArray *mode);
 void ymx_persistent_cleanup();
 
+/*
+ * Internal interface shared between the yaml_mex source files
+ *************************************************************************/
+
+void ymx_error(const char *message);
+yaml_parser_t *ymx_init_parser();
+yaml_emitter_t *ymx_init_emitter();
+const yaml_event_t *ymx_parse(yaml_parser_t *parser);
+void ymx_skip_node(yaml_parser_t *parser, const yaml_event_t *first_event);
+void ymx_emit(yaml_emitter_t *emitter, yaml_event_t *event);
+
+/* A list of events: those kept by ymx_emit while recording (see
+ * yaml_mex_parallel.c), or those parsed ahead of time by an async load, for
+ * ymx_parse to replay (see yaml_mex_async.c) */
+typedef struct ymx_event_list_s {
+    yaml_event_t *events;
+    size_t num_events;
+    size_t size;
+} ymx_event_list_t;
+ymx_event_list_t *ymx_start_recording();
+void ymx_stop_recording();
+
+/* A function given the events passed to ymx_emit, in place of an emitter;
+ * see ymx_set_emit_handler */
+typedef void (*ymx_emit_handler_t)(void *data, const yaml_event_t *event);
+void ymx_set_emit_handler(ymx_emit_handler_t handler, void *data);
+
+/* Guards against hostile input; see the notes on resource limits in
+ * yaml_mex_util.c */
+void ymx_set_parser_input(yaml_parser_t *parser,
+        const char *input, size_t length);
+void ymx_set_libyaml_input(yaml_parser_t *parser,
+        const char *input, size_t length);
+void ymx_set_replay_input(ymx_event_list_t *events, size_t length);
+void ymx_reset_limit_counts();
+
+/* Compressed files, read and written as streams; see yaml_mex_compress.c */
+typedef enum ymx_codec_e {
+    YMX_CODEC_NONE = 0,
+    YMX_CODEC_GZIP,
+    YMX_CODEC_ZSTD
+} ymx_codec_t;
+typedef struct ymx_cfile_s ymx_cfile_t;
+ymx_codec_t ymx_get_codec(const char *path, const mxArray *option);
+ymx_cfile_t *ymx_cfile_open(const char *path, ymx_codec_t codec,
+        const char *mode);
+size_t ymx_cfile_read(ymx_cfile_t *file, void *buffer, size_t size);
+int ymx_cfile_write(ymx_cfile_t *file, const void *data, size_t size);
+int ymx_cfile_flush(ymx_cfile_t *file);
+int ymx_cfile_close(ymx_cfile_t *file);
+const char *ymx_cfile_problem(const ymx_cfile_t *file);
+int ymx_cfile_write_handler(void *data, unsigned char *buffer, size_t size);
+void ymx_set_file_input(yaml_parser_t *parser, ymx_cfile_t *file);
+
+/* The fast paths for parsing JSON and common YAML; see yaml_mex_scanner.c */
+int ymx_scanner_start(const char *input, size_t length);
+int ymx_scanner_parse(yaml_parser_t *parser, yaml_event_t *event);
+void ymx_scanner_reset();
+int ymx_scanner_mode();
+
+char *ymx_read_file(const char *path, size_t size);
+char *ymx_read_file_range(const char *path, size_t offset, size_t length);
+int ymx_seek_file(FILE *file, uint64_T offset);
+
+/* The state of a scan for where a stream's documents start, a line at a
+ * time; see yaml_mex_index.c */
+typedef struct ymx_doc_scan_s {
+    uint64_T pending; /* Start of directives not yet used, plus 1 */
+    int in_doc;
+} ymx_doc_scan_t;
+uint64_T ymx_doc_scan_line(ymx_doc_scan_t *scan, const char *line,
+        size_t length, uint64_T offset);
+uint64_T ymx_hash_bytes(const void *data, size_t length, uint64_T seed);
+uint64_T ymx_hash_mix(uint64_T value);
+extern const uint64_T YMX_HASH_MULTIPLIER;
+
+mxArray *ymx_load_string(const char *yaml_str, size_t length);
+mxArray *ymx_load_parsed(yaml_parser_t *parser);
+mxArray *ymx_construct_string(const char *yaml_str, size_t length,
+        const ymx_projection_t *projection);
+mxArray *ymx_construct_documents(const char *yaml_str, size_t length,
+        const ymx_projection_t *projection);
+mxArray *ymx_construct_parsed(yaml_parser_t *parser,
+        const ymx_projection_t *projection);
+mxArray *ymx_unwrap_documents(mxArray *docs);
+
+ymx_projection_t *ymx_projection_create(const mxArray *paths);
+void ymx_projection_delete(ymx_projection_t *projection);
+int ymx_projection_select(
+        const ymx_projection_t *projection,
+        const char *key, size_t length,
+        const ymx_projection_t **child );
+
+/* What a load cache entry's input is; entries only match inputs of the
+ * same kind. */
+typedef enum ymx_cache_kind_e {
+    YMX_CACHE_KIND_STRING = 1, /* The mxChars of a Matlab string */
+    YMX_CACHE_KIND_FILE        /* The bytes of a file */
+} ymx_cache_kind_t;
+
+mxArray *ymx_cache_lookup(ymx_cache_kind_t kind,
+        const void *input, size_t length);
+void ymx_cache_store(ymx_cache_kind_t kind,
+        const void *input, size_t length, const mxArray *data);
+
+int ymx_is_valid_doc_array(const mxArray *doc_array);
+void ymx_dump_document(
+        yaml_emitter_t *emitter,
+        const mxArray *docs_array,
+        mwIndex ind,
+        int force_explicit_start,
+        int trusted );
+/* Most dimensions a !matlab/array may have */
+#define YMX_MAX_ARRAY_DIMS 32
+
+/* Flags changing how native data is composed; see ymx_compose_document */
+typedef enum ymx_compose_flag_e {
+    /* Compose every non-scalar real numeric array as !!binary, not just
+     * uint8 arrays */
+    YMX_COMPOSE_BINARY_NUMERIC = 1,
+    /* Compose numeric and logical arrays (other than double and logical
+     * scalars) as !matlab/array mappings, keeping their class and size */
+    YMX_COMPOSE_TYPED_ARRAYS = 2
+} ymx_compose_flag_t;
+
+void ymx_compose_document(
+        yaml_emitter_t *emitter,
+        const mxArray *data,
+        int start_implicit,
+        int flags );
+
+size_t ymx_base64_encoded_length(size_t num_bytes);
+size_t ymx_base64_encode(char *text,
+        const unsigned char *bytes, size_t num_bytes);
+char *ymx_base64_encode_elements(const void *values,
+        size_t num_elements, size_t element_size, size_t *length);
+mxArray *ymx_base64_decode(const char *text, size_t length);
+size_t ymx_base64_decoded_length(const char *text, size_t length);
+void ymx_base64_decode_elements(const char *text, size_t length,
+        void *values, size_t num_elements, size_t element_size);
+
+/* A growable output buffer, used as a libyaml emitter's output through
+ * ymx_buffer_write_handler */
+typedef struct ymx_buffer_s {
+    size_t chunk_size; /* Size of a chunk, in bytes */
+    size_t total_size; /* Current total size of the buffer, in bytes */
+    size_t used_size;  /* Amount of the buffer currently used, in bytes */
+    void *head; /* Pointer to the head of the buffer */
+} ymx_buffer_t;
+typedef char ymx_buffer_char_t;
+
+extern const size_t YMX_BUFFER_CHUNK_SIZE;
+
+void ymx_buffer_init(ymx_buffer_t *buffer, size_t chunk_size);
+void ymx_buffer_delete(ymx_buffer_t *buffer);
+void ymx_buffer_append(ymx_buffer_t *buffer, 
+        void *input, size_t size);
+char *ymx_buffer_reserve(ymx_buffer_t *buffer, size_t size);
+ymx_buffer_char_t *ymx_buffer_as_string(ymx_buffer_t *buffer);
+int ymx_buffer_write_handler(void *data,
+        unsigned char *buffer, size_t size);
+
+/* The fast path for simple dumps; see yaml_mex_emitter.c */
+int ymx_fast_compose_stream(ymx_buffer_t *buffer, const mxArray *data,
+        int flags);
+
 /*
  * Types and constants for creating specialized mxArray structs
  *************************************************************************/
@@ -66,4 +318,66 @@ typedef enum ymx_scalar_implicit_flag_e {
     YMX_SCALAR_IMPLICIT_QUOTED
 } ymx_scalar_implicit_flag_t;
 
+/* Room for any number ymx_format_numeric writes, with its NUL */
+#define YMX_NUMBER_STRING_SIZE 32
+
+size_t ymx_format_numeric(char *buffer, const mxArray *data, mwIndex ind);
+size_t ymx_format_double(char *buffer, double value);
+size_t ymx_format_single(char *buffer, float value);
+size_t ymx_format_int(char *buffer, int64_T value);
+size_t ymx_format_uint(char *buffer, uint64_T value);
+
+/* Kinds of native Matlab value a scalar can resolve to under the YAML core
+ * schema; see ymx_resolve_scalar. */
+typedef enum ymx_scalar_kind_e {
+    YMX_SCALAR_KIND_NULL,
+    YMX_SCALAR_KIND_BOOL,
+    YMX_SCALAR_KIND_NUMBER,
+    YMX_SCALAR_KIND_STRING
+} ymx_scalar_kind_t;
+
+ymx_scalar_kind_t ymx_resolve_scalar(
+        const yaml_event_t *event,
+        double *number );
+int ymx_match_null(const char *value, size_t length);
+int ymx_match_bool(const char *value, double *number);
+int ymx_match_int(const char *value, size_t length, double *number);
+int ymx_match_float(const char *value, size_t length, double *number);
+extern const char *YMX_NULL_TAG;
+extern const char *YMX_BOOL_TAG;
+extern const char *YMX_INT_TAG;
+extern const char *YMX_FLOAT_TAG;
+extern const char *YMX_STR_TAG;
+extern const char *YMX_BINARY_TAG;
+int ymx_is_valid_field_name(const char *name, size_t length);
+int ymx_is_size_number(double number);
+
+/*
+ * Growable typed columns of resolved scalars
+ *************************************************************************/
+
+typedef enum ymx_column_kind_e {
+    YMX_COLUMN_KIND_EMPTY, /* Nothing but missing values so far */
+    YMX_COLUMN_KIND_NUMBER,
+    YMX_COLUMN_KIND_BOOL,
+    YMX_COLUMN_KIND_STRING
+} ymx_column_kind_t;
+
+typedef struct ymx_column_s {
+    ymx_column_kind_t kind;
+    size_t count;       /* Number of values appended */
+    size_t capacity;    /* Number of values there is room for */
+    size_t num_missing;
+    double *numbers;    /* Values of number and bool columns */
+    mxArray **strings;  /* Values of string columns */
+    mxLogical *missing; /* Missing-value mask; NULL until first needed */
+} ymx_column_t;
+
+void ymx_column_init(ymx_column_t *column);
+void ymx_column_delete(ymx_column_t *column);
+void ymx_column_append_scalar(ymx_column_t *column,
+        const yaml_event_t *event);
+void ymx_column_append_missing(ymx_column_t *column);
+mxArray *ymx_column_to_array(ymx_column_t *column);
+
 #endif /* #ifndef YAML_MEX_UTIL_H */
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include "yaml_mex_util.h"
+#include <sys/stat.h>
+
+/* NOTES
+ *
+ * Writers keep a libyaml emitter and its output file open across calls to
+ * yaml_mex, so that a stream can be built up one document at a time:
+ *     h = yaml_mex('writer_open', path, opts);
+ *     yaml_mex('writer_write', h, data);   % once per document
+ *     yaml_mex('writer_close', h);
+ * The stream start event is emitted when the writer is opened and the
+ * stream end event when it is closed; each write emits complete
+ * documents and nothing else, so writing N documents costs O(N) and the
+ * memory held between writes is just the emitter's own buffer.
+ *
+ * A writer on a path ending in .gz or .zst (or with a 'compression'
+ * option) compresses as it goes, through ymx_cfile_t (see
+ * yaml_mex_compress.c). Each flush ends a block of compressed data, so
+ * that everything flushed can be decompressed (by zcat, say) while the
+ * writer is still open; with small documents, a larger flush_every
+ * compresses better.
+ *
+ * Writers live in persistent memory and are identified to Matlab by a
+ * double handle (their slot number, from 1). Any writers still open when
+ * the MEX-file is cleared are closed by ymx_writer_close_all.
+ */
+
+/*
+ * Internal datatype declarations
+ *************************************************************************/
+
+typedef struct ymx_writer_s {
+    yaml_emitter_t emitter;
+    ymx_cfile_t *file;
+    int force_explicit_start; /* Start the next document with "---" */
+    int in_document;          /* Set while a write is in progress */
+    size_t flush_interval;    /* Documents between flushes */
+    size_t num_unflushed;     /* Documents written since the last flush */
+} ymx_writer_t;
+
+
+/*
+ * Constant definitions
+ *************************************************************************/
+
+const size_t WRITERS_INITIAL_SIZE = 8;
+
+
+/*
+ * Globals
+ *************************************************************************/
+
+static ymx_writer_t **writers = NULL;
+static size_t num_writer_slots = 0;
+
+
+/*
+ * Internal function declarations
+ *************************************************************************/
+
+ymx_writer_t *ymx_get_writer(const mxArray *handle);
+void ymx_writer_flush(ymx_writer_t *writer);
+void ymx_writer_delete(ymx_writer_t *writer);
+
+
+/*
+ * Main interface functions
+ *************************************************************************/
+
+/* Open a writer on the file at path, and return its handle. options may
+ * be NULL, or a struct with any of these fields:
+ *         append: If true, documents are appended to the file (after an
+ *                 explicit "---") rather than replacing its contents.
+ *                 Default false.
+ *    flush_every: Number of documents to write between flushes to the
+ *                 file. Default 1.
+ *    compression: 'auto' (by the path's extension), 'gzip', 'zstd' or
+ *                 'none'. Default 'auto'.
+ */
+mxArray *ymx_writer_open(const mxArray *path, const mxArray *options) {
+    int append = 0;
+    size_t flush_interval = 1;
+    const mxArray *compression = NULL;
+
+    if (options && !mxIsEmpty(options)) {
+        if (!mxIsStruct(options) || mxGetNumberOfElements(options) != 1)
+            ymx_error("Writer options must be a scalar struct");
+
+        mxArray *append_arr = mxGetField(options, 0, "append");
+        if (append_arr) {
+            if (!(mxIsLogical(append_arr) || mxIsNumeric(append_arr))
+                    || mxGetNumberOfElements(append_arr) != 1)
+                ymx_error("Writer option 'append' must be a logical scalar");
+            append = (mxGetScalar(append_arr) != 0);
+        }
+
+        mxArray *flush_arr = mxGetField(options, 0, "flush_every");
+        if (flush_arr) {
+            if (!mxIsNumeric(flush_arr)
+                    || mxGetNumberOfElements(flush_arr) != 1
+                    || !(mxGetScalar(flush_arr) >= 1))
+                ymx_error("Writer option 'flush_every' must be a positive "
+                        "scalar");
+            /* Inf, or anything too large for a size_t, never flushes */
+            double value = mxGetScalar(flush_arr);
+            flush_interval = value < (double)(size_t)-1
+                    ? (size_t)value : (size_t)-1;
+        }
+
+        compression = mxGetField(options, 0, "compression");
+    }
+
+    char *path_str = mxArrayToString(path);
+    ymx_codec_t codec = ymx_get_codec(path_str, compression);
+    struct stat info;
+    int nonempty = append && stat(path_str, &info) == 0 && info.st_size > 0;
+    ymx_cfile_t *file = ymx_cfile_open(path_str, codec, append ? "ab" : "wb");
+    mxFree(path_str);
+    if (!file)
+        ymx_error("Couldn't open file for writing");
+
+    /* Find a free slot, growing the table if there isn't one */
+    size_t slot;
+    for (slot=0; slot<num_writer_slots; slot++) {
+        if (!writers[slot])
+            break;
+    }
+    if (slot == num_writer_slots) {
+        size_t new_size = num_writer_slots
+                ? 2*num_writer_slots : WRITERS_INITIAL_SIZE;
+        ymx_writer_t **new_writers = mxCalloc(new_size,
+                sizeof(ymx_writer_t *));
+        mexMakeMemoryPersistent(new_writers);
+        if (writers) {
+            memcpy(new_writers, writers,
+                    num_writer_slots * sizeof(ymx_writer_t *));
+            mxFree(writers);
+        }
+        writers = new_writers;
+        num_writer_slots = new_size;
+    }
+
+    ymx_writer_t *writer = mxCalloc(1, sizeof(ymx_writer_t));
+    mexMakeMemoryPersistent(writer);
+    writer->file = file;
+    writer->flush_interval = flush_interval;
+    writer->force_explicit_start = nonempty;
+    writers[slot] = writer;
+
+    yaml_emitter_initialize(&writer->emitter);
+    yaml_emitter_set_output(&writer->emitter, ymx_cfile_write_handler, file);
+
+    yaml_event_t event;
+    if (!yaml_stream_start_event_initialize(&event, YAML_UTF8_ENCODING))
+        ymx_error("Couldn't initialize event");
+    ymx_emit(&writer->emitter, &event);
+
+    return mxCreateDoubleScalar((double)(slot + 1));
+}
+
+/* Write data to an open writer. If data is a document array (as used by
+ * yaml_mex('dump')), each of its documents is written; otherwise data is
+ * composed as one document, as by yaml_mex('dump_simple').
+ */
+void ymx_writer_write(const mxArray *handle, const mxArray *data) {
+    ymx_writer_t *writer = ymx_get_writer(handle);
+    if (writer->in_document)
+        ymx_error("An earlier write to this writer failed; close it");
+
+    writer->in_document = 1;
+    if (ymx_is_valid_doc_array(data)) {
+        mwSize num_docs = mxGetNumberOfElements(data);
+        mwIndex ind;
+        for (ind=0; ind<num_docs; ind++) {
+            ymx_dump_document(&writer->emitter, data, ind,
+                    writer->force_explicit_start, 0);
+            writer->force_explicit_start = 0;
+        }
+    } else {
+        ymx_compose_document(&writer->emitter, data,
+                !writer->force_explicit_start, 0);
+        writer->force_explicit_start = 0;
+    }
+    writer->in_document = 0;
+
+    writer->num_unflushed++;
+    if (writer->num_unflushed >= writer->flush_interval)
+        ymx_writer_flush(writer);
+}
+
+/* Finish the stream of an open writer and close its file */
+void ymx_writer_close(const mxArray *handle) {
+    ymx_writer_t *writer = ymx_get_writer(handle);
+    size_t slot = (size_t)mxGetScalar(handle) - 1;
+    writers[slot] = NULL;
+
+    int ok = 1;
+    if (!writer->in_document) {
+        yaml_event_t event;
+        yaml_stream_end_event_initialize(&event);
+        ok = yaml_emitter_emit(&writer->emitter, &event)
+                && yaml_emitter_flush(&writer->emitter);
+    }
+    ok = ymx_cfile_close(writer->file) && ok;
+    writer->file = NULL;
+    ymx_writer_delete(writer);
+
+    if (!ok)
+        ymx_error("Error while closing writer");
+}
+
+/* Close every open writer; called when the MEX-file is cleared. */
+void ymx_writer_close_all() {
+    size_t slot;
+    for (slot=0; slot<num_writer_slots; slot++) {
+        ymx_writer_t *writer = writers[slot];
+        if (!writer)
+            continue;
+        if (!writer->in_document) {
+            yaml_event_t event;
+            yaml_stream_end_event_initialize(&event);
+            yaml_emitter_emit(&writer->emitter, &event);
+            yaml_emitter_flush(&writer->emitter);
+        }
+        ymx_cfile_close(writer->file);
+        ymx_writer_delete(writer);
+        writers[slot] = NULL;
+    }
+    if (writers)
+        mxFree(writers);
+    writers = NULL;
+    num_writer_slots = 0;
+}
+
+
+/*
+ * Utility functions
+ *************************************************************************/
+
+ymx_writer_t *ymx_get_writer(const mxArray *handle) {
+    if (!mxIsDouble(handle) || mxGetNumberOfElements(handle) != 1)
+        ymx_error("Invalid writer handle");
+
+    double value = mxGetScalar(handle);
+    if (value < 1 || value > num_writer_slots
+            || value != (double)(size_t)value
+            || !writers[(size_t)value - 1])
+        ymx_error("Invalid writer handle");
+
+    return writers[(size_t)value - 1];
+}
+
+void ymx_writer_flush(ymx_writer_t *writer) {
+    if (!yaml_emitter_flush(&writer->emitter)
+            || !ymx_cfile_flush(writer->file))
+        ymx_error("Error while flushing writer");
+    writer->num_unflushed = 0;
+}
+
+void ymx_writer_delete(ymx_writer_t *writer) {
+    yaml_emitter_delete(&writer->emitter);
+    mxFree(writer);
+}
@@ -1,9 +1,11 @@
-function yaml_stream = yaml_dump(data)
+function yaml_stream = yaml_dump(data, varargin)
 % yaml_dump  Dump Matlab data to a YAML document
 % Usage:
 %     yaml_stream = yaml_dump(data)
-% Accepts basic Matlab objects (numeric, char, logical, cell, and struct)
-% and emits them as a YAML document, stored in the char array yaml_stream.
+%     yaml_stream = yaml_dump(data, options...)
+% Accepts basic Matlab objects (numeric, char, logical, cell, struct, and
+% table) and emits them as a YAML document, stored in the char array
+% yaml_stream.
 % More complex Matlab datatypes (eg, classes) cannot be dumped.
 % Matlab data is represented in YAML in the following way:
 %
@@ -11,6 +13,13 @@ function yaml_stream = yaml_dump(data)
 %     will be repesented as a YAML sequence of its elements. Array
 %     dimensionality and type information are not preserved explicitly, so
 %     beware if you plan to load the data back into Matlab.
+% A uint8 array with more than one element:
+%     will be represented as a YAML !!binary scalar of its bytes, base64
+%     encoded. It loads back as a 1-by-N uint8 array.
+% A sparse matrix:
+%     will be represented as a !matlab/sparse mapping holding its size and
+%     its nonzero elements in compressed column form, which yaml_load
+%     reads back as the same sparse matrix.
 % A char array:
 %     will be represented as a YAML string.
 % A numeric scalar:
@@ -22,6 +31,9 @@ function yaml_stream = yaml_dump(data)
 %     keys and the field values being the corresponding values.
 % A cell array:
 %     will be represented as a YAML sequence, even if it only one element.
+% A struct array or a table:
+%     will be represented as a YAML sequence of mappings, one per element
+%     (or table row), keyed by the field (or variable) names.
 %
 % Note that because Matlab's arrays are typed, and YAML's sequence is
 % untyped, the full structure of the Matlab data is not preserved when
@@ -32,6 +44,13 @@ function yaml_stream = yaml_dump(data)
 % (ie, each element in the array becomes a scalar element in a cell array).
 % In many cases it will be easy to recover the original data structure if
 % its types are known.
+%
+% Alternatively, the option 'typed' dumps numeric and logical arrays (other
+% than double and logical scalars) with their class and size, as
+% !matlab/array mappings that yaml_load reads back exactly:
+%     yaml_load(yaml_dump(single(magic(4)), 'typed'))
+% returns single(magic(4)). Complex data is always dumped this way. See
+% yaml_mex for the other options.
 
 % Copyright (c) 2011 Geoffrey Adams
 % 
@@ -54,5 +73,4 @@ function yaml_stream = yaml_dump(data)
 % OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
 % USE OR OTHER DEALINGS IN THE SOFTWARE.
 
-yaml_doc = yaml_simple_compose(data);
-yaml_stream = yaml_mex('dump', yaml_doc);
\ No newline at end of file
+yaml_stream = yaml_mex('dump_simple', data, varargin{:});
\ No newline at end of file
@@ -3,8 +3,8 @@ function yaml_stream = yaml_file_dump(filename, data)
 % Usage:
 %     yaml_file_dump(filename, data)
 %     yaml_stream = yaml_file_dump(...)
-% Accepts a basic Matlab object (numeric, char, logical, cell, and struct)
-% as "data" and emits it as a YAML document, stored in a new YAML file
+% Accepts a basic Matlab object (numeric, char, logical, cell, struct, and
+% table) as "data" and emits it as a YAML document, stored in a new YAML file
 % "filename". More complex Matlab datatypes (eg, classes) cannot be dumped.
 % The stream may optionally also be returned as an output string.
 % Matlab data is represented in YAML in the following way:
@@ -24,6 +24,9 @@ function yaml_stream = yaml_file_dump(filename, data)
 %     keys and the field values being the corresponding values.
 % A cell array:
 %     will be represented as a YAML sequence, even if it only one element.
+% A struct array or a table:
+%     will be represented as a YAML sequence of mappings, one per element
+%     (or table row), keyed by the field (or variable) names.
 %
 % Note that because Matlab's arrays are typed, and YAML's sequence is
 % untyped, the full structure of the Matlab data is not preserved when
@@ -36,7 +39,9 @@ function yaml_stream = yaml_file_dump(filename, data)
 % its types are known.
 %
 % This is a convenience function which calls yaml_dump to compose the YAML
-% document and fwrite to write it to a file.
+% document and fwrite to write it to a file. A file whose name ends in
+% .gz or .zst is written through a yaml_mex writer instead, which
+% compresses it (with gzip or zstd) as it goes.
 
 % Copyright (c) 2011 Geoffrey Adams
 % 
@@ -59,6 +64,21 @@ function yaml_stream = yaml_file_dump(filename, data)
 % OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
 % USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+if ~isempty(regexp(filename, '\.(gz|zst)$', 'once'))
+    h = yaml_mex('writer_open', filename);
+    try
+        yaml_mex('writer_write', h, data);
+    catch e
+        yaml_mex('writer_close', h);
+        rethrow(e);
+    end
+    yaml_mex('writer_close', h);
+    if nargout
+        yaml_stream = yaml_dump(data);
+    end
+    return;
+end
+
 my_yaml_stream = yaml_dump(data);
 fid = fopen(filename, 'w');
 try
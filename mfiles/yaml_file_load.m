@@ -1,7 +1,8 @@
-function data = yaml_file_load(filename)
+function data = yaml_file_load(filename, cache_dir)
 % yaml_load  Load data from a YAML file
 % Usage:
 %     data = yaml_file_load(filename)
+%     data = yaml_file_load(filename, cache_dir)
 % Loads a YAML stream from a file and constructs it to native Matlab data.
 %
 % YAML mappings:
@@ -14,7 +15,9 @@ function data = yaml_file_load(filename)
 %     are constructed as Matlab cell arrays, 1-by-M. Note that this is done
 %     independently of the datatypes of the sequence elements, meaning that
 %     a sequence of all numbers will still be constructed as a cell array
-%     rather than a numeric array.
+%     rather than a numeric array. The exception is a sequence of two or
+%     more mappings that all have the same keys in the same order, which
+%     is constructed as an M-by-1 struct array.
 % YAML strings:
 %     are constructed as char arrays.
 % YAML ints and floats:
@@ -30,6 +33,18 @@ function data = yaml_file_load(filename)
 %
 % This is just a convenience function which calls fileread to load the YAML
 % file and yaml_load to construct the native representation.
+%
+% If cache_dir is given, a binary snapshot of the constructed data is kept
+% in that directory, and later loads of the same, unchanged file are built
+% from the snapshot instead of parsing the file again. Snapshots are
+% checked against the file's size, modification time and contents, and
+% stale or damaged snapshots are rebuilt, so a cache directory can be
+% shared freely and deleted at any time. With a cache directory, the file
+% is read as UTF-8 rather than in the platform's default encoding.
+%
+% A file whose name ends in .gz or .zst is decompressed (with gzip or
+% zstd) as it is parsed, without a temporary file; cache_dir doesn't
+% apply to these. See yaml_mex('load_file').
 
 % Copyright (c) 2011 Geoffrey Adams
 % 
@@ -52,5 +67,15 @@ function data = yaml_file_load(filename)
 % OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
 % USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+if ~isempty(regexp(filename, '\.(gz|zst)$', 'once'))
+    data = yaml_mex('load_file', filename, struct('simple', true));
+    return;
+end
+
+if nargin >= 2 && ~isempty(cache_dir)
+    data = yaml_mex('load_file_cached', filename, cache_dir);
+    return;
+end
+
 yaml_stream = fileread(filename);
 data = yaml_load(yaml_stream);
@@ -1,9 +1,12 @@
-function yaml_data = yaml_load(yaml_stream)
+function yaml_data = yaml_load(yaml_stream, paths)
 % yaml_load  Load data from a YAML document
 % Usage:
 %     yaml_data = yaml_load(yaml_stream)
+%     yaml_data = yaml_load(yaml_stream, paths)
 % Extracts the data represented in the YAML stream stored in the char array
-% yaml_stream into native Matlab data.
+% yaml_stream into native Matlab data. If paths is given (a string or cell
+% array of strings such as {'meta', 'runs/*/score'}), only the parts of the
+% data they name are loaded; see yaml_mex('load_simple') for details.
 %
 % YAML mappings:
 %     are constructed as Matlab structs, subject to the constraint that the
@@ -15,11 +18,19 @@ function yaml_data = yaml_load(yaml_stream)
 %     are constructed as Matlab cell arrays, 1-by-M. Note that this is done
 %     independently of the datatypes of the sequence elements, meaning that
 %     a sequence of all numbers will still be constructed as a cell array
-%     rather than a numeric array.
+%     rather than a numeric array. The exception is a sequence of two or
+%     more mappings that all have the same keys in the same order, which
+%     is constructed as an M-by-1 struct array.
 % YAML strings:
 %     are constructed as char arrays.
 % YAML ints and floats:
 %     are both constructed as doubles.
+% YAML binary (!!binary) scalars:
+%     are decoded from base64 into uint8 arrays, 1-by-N.
+% !matlab/array mappings (as written by yaml_dump with the 'typed' option):
+%     are constructed as arrays of the class and size they give.
+% !matlab/sparse mappings (as written by yaml_dump for sparse matrices):
+%     are constructed as sparse matrices.
 % YAML bools:
 %     are constructed as logicals.
 % YAML nulls:
@@ -50,12 +61,8 @@ function yaml_data = yaml_load(yaml_stream)
 % OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
 % USE OR OTHER DEALINGS IN THE SOFTWARE.
 
-yaml_doc = yaml_mex('load', yaml_stream);
-if isscalar(yaml_doc)
-    yaml_data = yaml_simple_construct(yaml_doc.root);
+if nargin < 2
+    yaml_data = yaml_mex('load_simple', yaml_stream);
 else
-    yaml_data = cell(size(yaml_doc));
-    for i=1:numel(yaml_doc)
-        yaml_data{i} = yaml_simple_construct(yaml_doc(i).root);
-    end
+    yaml_data = yaml_mex('load_simple', yaml_stream, paths);
 end
@@ -1,7 +1,52 @@
 % yaml_mex    A MEX-file for processing YAML
 % Usage:
-%     doc = yaml_mex('load', str)
-%     str = yaml_mex('dump', doc)
+%     doc  = yaml_mex('load', str)
+%     data = yaml_mex('load_simple', str)
+%     data = yaml_mex('load_simple', str, paths)
+%     cols = yaml_mex('load_columns', str)
+%     cols = yaml_mex('load_columns', str, format)
+%     [vals, found] = yaml_mex('extract', str, key_path)
+%     [vals, found] = yaml_mex('extract', filename, key_path, 'file')
+%     doc  = yaml_mex('load_file', filename)
+%     doc  = yaml_mex('load_file', filename, opts)
+%     data = yaml_mex('load_file_cached', filename, cache_dir)
+%            yaml_mex('cache', 'limit', max_bytes)
+%            yaml_mex('cache', 'flush')
+%     stat = yaml_mex('cache', 'stats')
+%     lims = yaml_mex('limits')
+%     lims = yaml_mex('limits', new_limits)
+%     scan = yaml_mex('scanner')
+%     scan = yaml_mex('scanner', mode)
+%     emit = yaml_mex('emitter')
+%     emit = yaml_mex('emitter', mode)
+%     stat = yaml_mex('alloc_stats')
+%     evts = yaml_mex('events', str)
+%     evts = yaml_mex('events', str, batch_size)
+%     str  = yaml_mex('dump', doc)
+%     str  = yaml_mex('dump', doc, options...)
+%     str  = yaml_mex('dump_simple', data)
+%     str  = yaml_mex('dump_simple', data, options...)
+%     key  = yaml_mex('hash', str)
+%     key  = yaml_mex('hash', str, opts)
+%     key  = yaml_mex('hash_data', data)
+%     key  = yaml_mex('hash_data', data, options...)
+%     h    = yaml_mex('writer_open', filename)
+%     h    = yaml_mex('writer_open', filename, opts)
+%            yaml_mex('writer_write', h, data)
+%            yaml_mex('writer_close', h)
+%     h    = yaml_mex('reloader_open', filename)
+%     h    = yaml_mex('reloader_open', filename, opts)
+%     docs = yaml_mex('reloader_read', h)
+%     docs = yaml_mex('reloader_read', h, skip)
+%            yaml_mex('reloader_close', h)
+%     h    = yaml_mex('load_async', filename)
+%     h    = yaml_mex('load_async', filename, opts)
+%     done = yaml_mex('ready', h)
+%     docs = yaml_mex('fetch', h)
+%            yaml_mex('cancel', h)
+%     n    = yaml_mex('index', filename)
+%     doc  = yaml_mex('load_doc', filename, k)
+%     doc  = yaml_mex('load_doc', filename, k, opts)
 %
 % yaml_mex is a high-level interface to the libyaml YAML processor. It
 % exposes to Matlab a partially-constructed representation of a YAML
@@ -18,6 +63,248 @@
 % with aliases or mapping keys which are not valid Matlab struct field
 % names.
 %
+% yaml_mex('load_simple', str) skips the document representation below
+% and constructs native Matlab data directly, following the same rules as
+% yaml_simple_construct. If the stream has one document, its data is
+% returned; otherwise a 1-by-N cell array holds the data of each document.
+% This is what yaml_load uses.
+%
+% yaml_mex('load_simple', str, paths) constructs only the parts of each
+% document named by paths, a string or cell array of strings such as
+% {'meta', 'runs/*/score'}. Each path is a list of mapping keys separated
+% by '/', where '*' matches any key or any item of a sequence. Whatever a
+% path ends at is constructed in full (as is any scalar a path reaches);
+% keys no path names are left out of their structs, and sequences no path
+% enters with '*' are empty. The rest of the document is read past without
+% being constructed, which is much faster when most of it is left out.
+% Projected loads aren't cached.
+%
+% yaml_mex('load_columns', str) loads "records": the first document in
+% str must be a sequence of mappings whose values are all scalars. The
+% result is a scalar struct with one N-by-1 column per key, in the order
+% the keys first appear, built without creating a struct per row. A
+% column of numbers is double; a column of bools is logical; any other
+% column (strings, or a mix of kinds) is a cellstr. Nulls and keys missing
+% from a row are missing values: NaN in double columns (a bool column with
+% missing values becomes double), and '' in cellstr columns. If format is
+% 'table', the columns are returned as a table instead of a struct.
+%
+% yaml_mex('extract', str, key_path) gathers one value from every document
+% in str into an N-by-1 column, typed like a column of 'load_columns',
+% without loading anything else. key_path names mapping keys separated by
+% '/', such as 'stats/loss'; a segment that is a positive whole number
+% also picks that item (counting from 1) of a sequence. Documents where
+% the path is missing, or leads to a null or to a sequence or mapping,
+% give a missing value, and are false in the N-by-1 logical array found.
+% With 'file', the documents are read from the file filename instead,
+% streamed through the parser rather than read whole, and decompressed if
+% its name ends in .gz or .zst.
+%
+% yaml_mex('load_file_cached', filename, cache_dir) is like 'load_simple'
+% on the contents of the file filename (read as UTF-8), but keeps a binary
+% snapshot of the result in the directory cache_dir. While the file is
+% unchanged, later calls build the result from the snapshot without
+% parsing the file. Snapshots hold every class a load can give, including
+% the integer, single, complex and sparse arrays of !matlab/array and
+% !matlab/sparse nodes. This is what yaml_file_load uses when given a
+% cache directory.
+%
+% yaml_mex('cache', 'limit', max_bytes) enables an in-memory cache of the
+% results of 'load_simple' and 'load_file_cached', using at most about
+% max_bytes of memory (Inf for no limit, 0 to disable the cache, which is
+% the default). Loading exactly the same input again, under the same
+% limits and scanner, then returns a copy of the cached result without
+% parsing; when the cache is full, the least recently used results are
+% dropped. Snapshots are likewise only used under the limits and scanner
+% they were made under. yaml_mex('cache', 'flush') empties
+% the cache, and yaml_mex('cache', 'stats') returns a struct with the
+% fields hits, misses, entries, bytes and limit. The cache is released when
+% yaml_mex is cleared.
+%
+% yaml_mex('limits', new_limits) guards against hostile or runaway input
+% by limiting what any load will accept. new_limits is a scalar struct
+% with any of the fields below, each a positive whole number or Inf for no
+% limit; limits not given are unchanged. Input beyond a limit is an error.
+% yaml_mex('limits') returns all the current limits.
+%         max_depth: Most sequences and mappings nested inside each other.
+%                    Default 1000.
+%         max_nodes: Most nodes (scalars, aliases, sequences and mappings)
+%                    in one load. Default Inf.
+%         max_bytes: Most bytes of YAML text in one load. Default Inf.
+% Limits last until yaml_mex is cleared. They don't apply to dumps, which
+% take data of any depth.
+%
+% By default, every load reads JSON text (whose first character other than
+% a space or line break is '{' or '[') with a much faster JSON scanner,
+% giving exactly the same results as libyaml; anything that isn't strictly
+% JSON, or that libyaml would read differently, is left to libyaml.
+% yaml_mex('scanner', 'fast') makes later loads also use a faster scanner
+% for the common subset of YAML: block mappings and sequences, one-line
+% flow collections, and plain or quoted one-line scalars, in ASCII text.
+% It too gives exactly the same results as libyaml, to which it hands over
+% any document it can't handle (including any malformed one, so errors
+% are libyaml's). yaml_mex('scanner', 'libyaml') makes every load use
+% libyaml alone, yaml_mex('scanner', 'json') goes back to the default,
+% and yaml_mex('scanner') returns the current mode. The mode lasts until
+% yaml_mex is cleared. 'events' always uses libyaml.
+%
+% 'dump_simple' writes the YAML for most data itself, rather than through
+% libyaml's emitter, which is much faster; the text is exactly what libyaml
+% would write, and it leaves to libyaml whatever it can't match (lone
+% scalars, strings with characters other than printable ASCII, !!binary,
+% typed and sparse arrays, and tables). yaml_mex('emitter', 'libyaml')
+% sends every simple dump through libyaml, yaml_mex('emitter', 'fast')
+% goes back to the default, and yaml_mex('emitter') returns the current
+% mode. The mode lasts until yaml_mex is cleared. Writers always use
+% libyaml. yaml_mex_emitter_check dumps a random corpus both ways and
+% checks that the texts are the same.
+%
+% yaml_mex('alloc_stats') returns what the call to yaml_mex before it
+% allocated: its command, whether it completed, its counts of allocations
+% and frees, its peak bytes, and the blocks it left unreleased or made
+% persistent, each with the file and line that allocated it; and the
+% bytes held in persistent memory altogether. It is only available if
+% yaml_mex was built with -DYMX_COUNT_ALLOCS, which counts every block of
+% Matlab memory yaml_mex allocates, and every array it makes persistent
+% (with an estimate of its size); arrays that are returned, or destroyed
+% within the call, aren't counted. yaml_mex_alloc_check runs a corpus of
+% streams through it.
+%
+% yaml_mex('events', str) returns the raw libyaml event stream of str in
+% columnar form, for custom constructors that work on events with
+% vectorized code. The result is a 1-by-K struct array of batches, each
+% holding at most batch_size events (default Inf) as N-by-1 columns:
+%              type: int32 event type: 1 stream start, 2 stream end,
+%                    3 document start, 4 document end, 5 alias, 6 scalar,
+%                    7 sequence start, 8 sequence end, 9 mapping start,
+%                    10 mapping end.
+%             style: int32 style of scalars, sequences and mappings, with
+%                    the same values as the node style field below; 0
+%                    for other events.
+%          implicit: int32 implicit flag of scalars, sequences, mappings,
+%                    and document starts and ends, with the same values as
+%                    the node implicit field below; 0 for other events.
+%       start_index: First character of str in the event.
+%         end_index: Last character of str in the event.
+%       value_start: Start of a scalar's value in text; 0 if none.
+%      value_length: Length of a scalar's value in text; 0 if none.
+%         tag_start: Start of the event's tag in text; 0 if none.
+%        tag_length: Length of the event's tag in text; 0 if none.
+%      anchor_start: Start of the event's anchor (or for an alias, the
+%                    anchor it refers to) in text; 0 if none.
+%     anchor_length: Length of the event's anchor in text; 0 if none.
+%              text: A char row vector holding the batch's strings.
+% For example, the value of the ith event of batch b is
+%     b.text(b.value_start(i) + (0:b.value_length(i)-1))
+%
+% yaml_mex('dump_simple', data) is the reverse of 'load_simple': it
+% dumps native Matlab data directly, following the same rules as
+% yaml_simple_compose, and additionally accepts tables. Struct arrays and
+% tables are dumped as block sequences of mappings, one per element or
+% row. A uint8 array of more than one element is dumped as its bytes, in
+% a base64 !!binary block scalar. This is what yaml_dump uses. options are
+% any of these strings:
+%     'binary': Dump any other non-scalar real numeric array as a !!binary
+%               scalar too, holding the little-endian bytes of its
+%               elements (but not its class or size).
+%      'typed': Dump numeric and logical arrays, other than double and
+%               logical scalars, as !matlab/array mappings that keep their
+%               class and size:
+%                   !matlab/array
+%                   class: single
+%                   size: [4000, 4000]
+%                   data: !!binary ...
+%               Complex arrays are always dumped this way, with their
+%               imaginary parts in a further !!binary value, imag.
+% Sparse double and logical matrices are dumped as !matlab/sparse mappings
+% of their class, size, nnz, zero-based column pointers jc, row indices
+% ir, and nonzero values data. The last three are flow sequences, or
+% !!binary (with uint64 indices) under the 'binary' or 'typed' option.
+% 'load_simple' constructs !!binary scalars as 1-by-N uint8 arrays, and
+% !matlab/array and !matlab/sparse mappings as the arrays they describe.
+%
+% yaml_mex('hash', str) returns a 128-bit hash of the YAML stream str, as
+% a string of 32 hex digits, for use as a cache key. It hashes what the
+% stream means rather than how it's written: the order of mapping keys,
+% comments, layout and anchor names don't count, aliases count as the
+% nodes they refer to, and scalars count by what they resolve to, so that
+% 1, 1.0 and 0x1 hash the same, as do 'a' and a. Scalars with tags outside
+% the core schema count by their tag and text. opts may be a struct with
+% the field 'styles': if true, scalar and collection styles count too.
+% yaml_mex('hash_data', data) hashes Matlab data as 'hash' would hash
+% yaml_mex('dump_simple', data), with the same options, but without
+% writing the YAML. The hash is the same on every platform, but isn't
+% cryptographic.
+%
+% yaml_mex('writer_open', filename) opens a YAML stream for writing one
+% document at a time, and returns a handle to it. Each call to
+% yaml_mex('writer_write', h, data) writes data to the stream: if data is
+% a document array (as accepted by 'dump'), each of its documents is
+% written, and otherwise data is dumped as one document, as by
+% 'dump_simple'. yaml_mex('writer_close', h) ends the stream and closes
+% the file; writers left open are closed when yaml_mex is cleared. opts is
+% a struct with any of these fields:
+%          append: If true, documents are added to the end of the file
+%                  instead of replacing it. Default false.
+%     flush_every: Number of documents to write between flushes to the
+%                  file. Default 1.
+%     compression: 'gzip', 'zstd' or 'none' to compress the file (or not),
+%                  or 'auto' to go by its extension. Default 'auto'.
+% A writer whose write fails partway through a document can only be
+% closed.
+%
+% yaml_mex('reloader_open', filename) returns a handle for reading a
+% multi-document file repeatedly, as it changes. Each call to
+% yaml_mex('reloader_read', h) reads the whole file and returns its
+% documents, as by 'load', but parses only the documents that are new or
+% have changed since the last read; the rest are copied from what that
+% read loaded. Documents are told apart by their "---" lines, so a file
+% whose documents don't start with "---" is parsed in full each time.
+% yaml_mex('reloader_read', h, skip) leaves out the first skip documents,
+% and only copies those after them, so that a caller polling a growing
+% file need not pay for the documents it already has; the result is a
+% document array (or cell array) even when it holds just one. With
+% 'append', polling this way costs only as much as the new data:
+%     n = max(numel(docs) - 1, 0);   % the last may have been partial
+%     docs = [docs(1:n), yaml_mex('reloader_read', h, n)];
+% yaml_mex('reloader_close', h) releases what the reloader remembers;
+% reloaders left open are closed when yaml_mex is cleared. opts is a
+% struct with any of these fields:
+%     append: If true, the file is trusted only ever to be appended to, so
+%             that each read only reads the file from the start of the
+%             last document onward. Default false.
+%     simple: If true, documents are returned as by 'load_simple' rather
+%             than 'load'. Default false.
+%
+% yaml_mex('load_async', filename) starts reading and parsing a file on a
+% background thread, and returns a handle at once, so that Matlab can do
+% other work meanwhile. yaml_mex('ready', h) returns true once the
+% background work has finished (whether or not it succeeded), and
+% yaml_mex('fetch', h) waits for it if need be and returns the file's
+% documents, as by 'load' (or with opts.simple true, as by 'load_simple'),
+% reporting any error in reading or parsing the file. Only building the
+% Matlab arrays is left to the fetch. yaml_mex('cancel', h) stops a load
+% that is no longer wanted. Either of them closes the handle. Loads left
+% open are cancelled when yaml_mex is cleared.
+%
+% yaml_mex('load_file', filename) loads a file, as by 'load' (or with
+% opts.simple true, as by 'load_simple'). A file whose name ends in .gz
+% or .zst is decompressed with gzip or zstd as it is parsed, so that
+% neither it nor its text is ever held in memory whole; opts.compression
+% ('gzip', 'zstd', 'none' or 'auto') overrides the extension. Writers
+% compress by the same rules. zstd is only available if yaml_mex was
+% built with it (see the README); the 'max_bytes' limit counts the
+% decompressed text.
+%
+% yaml_mex('load_doc', filename, k) loads just the k'th document of a
+% multi-document file, as by 'load' (or with opts.simple true, as by
+% 'load_simple'), parsing nothing else. It finds the document through an
+% index of where each document starts, kept in the file filename.ymxi
+% beside it, which records the file's size and modification time and is
+% rebuilt by the first load_doc after either changes. yaml_mex('index',
+% filename) builds the index ahead of time (an error if it can't be
+% written) and returns the number of documents.
+%
 % A YAML stream is represented as an array of structs, each representing a
 % document in the stream. Documents have must these fields:
 %               root: The root node of the document, see below.
@@ -86,6 +373,21 @@
 % When dumping a stream, there is no guarantee that presentation style
 % requests will be honored.
 %
+% yaml_mex('dump', doc, 'trusted') skips checking the fields of individual
+% nodes (that tags and anchors are strings, that type, implicit and style
+% are int32 scalars, and so on), which makes dumping large documents
+% faster. The layout of every node array is still checked. Use it only for
+% documents built by yaml_mex('load') or the functions listed below: with
+% a malformed document, the output is undefined.
+%
+% yaml_mex('dump', doc, 'parallel') emits the documents of a multi-document
+% stream on several threads at once, one libyaml emitter per thread, and
+% joins their output in order; the result is the same as without it. Each
+% document is still read from doc on Matlab's thread (into a copy held
+% outside Matlab), so this pays off for streams of many documents, such as
+% one result per document. Options may be combined, as in
+% yaml_mex('dump', doc, 'trusted', 'parallel').
+%
 % To ensure that yaml_mex is supplied with the proper YAML document
 % representation, it is strongly recommended that you use these functions
 % to compose the input to yaml_mex('dump'):
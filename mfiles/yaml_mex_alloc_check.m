@@ -0,0 +1,114 @@
+function report = yaml_mex_alloc_check(corpus)
+% yaml_mex_alloc_check  Count yaml_mex's allocations over a corpus of YAML
+% Usage:
+%     report = yaml_mex_alloc_check()
+%     report = yaml_mex_alloc_check(corpus)
+% Runs each YAML stream in corpus (a cell array of strings, any of which
+% may instead name a file to read) through yaml_mex's load, dump,
+% load_simple, dump_simple and events commands, and reports the memory
+% each call allocated, as counted by yaml_mex('alloc_stats'). Without a
+% corpus, a small built-in one is used, of well-formed streams and of
+% malformed ones that fail partway through parsing. yaml_mex must have
+% been built with -DYMX_COUNT_ALLOCS.
+%
+% report is a struct array with an element per call, holding the fields
+% returned by yaml_mex('alloc_stats'), and input, the index in corpus of
+% the stream used. A line is printed per call, followed by any blocks it
+% left unreleased or made persistent. Blocks left by a call that failed
+% are reclaimed by Matlab, but those left by a call that completed, and
+% any growth in persistent_bytes, are worth looking into. Arrays count
+% only once they are made persistent (by the cache or a reloader), so
+% the arrays a load returns aren't in these counts.
+
+% Copyright (c) 2011 Geoffrey Adams
+%
+% Permission is hereby granted, free of charge, to any person obtaining a
+% copy of this software and associated documentation files
+% (the "Software"), to deal in the Software without restriction, including
+% without limitation the rights to use, copy, modify, merge, publish,
+% distribute, sublicense, and/or sell copies of the Software, and to
+% permit persons to whom the Software is furnished to do so, subject to the
+% following conditions:
+%
+% The above copyright notice and this permission notice shall be included
+% in all copies or substantial portions of the Software.
+%
+% THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+% OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+% MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+% NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+% DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+% OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+% USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+if nargin < 1
+    corpus = {
+        sprintf('a: 1\nb: [1, 2, 3]\nc: {d: e}\n')
+        sprintf('- 1\n- two\n- [3, 4.5]\n- {x: [], y: null}\n')
+        sprintf('{"x": [1, 2, {"y": null}], "z": "caf\\u00e9"}\n')
+        sprintf('--- 1\n--- [2]\n--- {a: b}\n')
+        sprintf('x: &a [1, 2]\ny: *a\n')
+        sprintf('a: [1, 2\nb: }\n')
+        sprintf('a: 1\n b: 2\n  - c\n')
+        sprintf('{"x": [1, 2,\n')
+        sprintf('key: "unterminated\n')
+        sprintf('- a\n- [b, {c: d\n')
+        };
+end
+
+report = [];
+for i = 1:numel(corpus)
+    yaml_str = corpus{i};
+    if exist(yaml_str, 'file') == 2
+        yaml_str = fileread(yaml_str);
+    end
+
+    [stats, doc] = counted_call(i, 'load', yaml_str);
+    report = [report, stats];
+    if stats.completed
+        report = [report, counted_call(i, 'dump', doc)];
+    end
+    [stats, data] = counted_call(i, 'load_simple', yaml_str);
+    report = [report, stats];
+    if stats.completed
+        report = [report, counted_call(i, 'dump_simple', data)];
+    end
+    report = [report, counted_call(i, 'events', yaml_str)];
+end
+
+for k = 1:numel(report)
+    r = report(k);
+    if r.completed
+        outcome = 'ok';
+    else
+        outcome = 'failed';
+    end
+    fprintf('%3d %-12s %-7s %7d allocs %7d frees %10d peak bytes\n', ...
+        r.input, r.command, outcome, r.allocations, r.frees, r.peak_bytes);
+    for b = 1:numel(r.unreleased)
+        fprintf('        unreleased %8d bytes from %s:%d\n', ...
+            r.unreleased(b).bytes, r.unreleased(b).file, ...
+            r.unreleased(b).line);
+    end
+    for b = 1:numel(r.persistent)
+        fprintf('        persistent %8d bytes from %s:%d\n', ...
+            r.persistent(b).bytes, r.persistent(b).file, ...
+            r.persistent(b).line);
+    end
+end
+if ~isempty(report)
+    fprintf('%d bytes held in persistent memory\n', ...
+        report(end).persistent_bytes);
+end
+
+
+function [stats, result] = counted_call(input, varargin)
+% Call yaml_mex, and return the counts for the call, whether or not it
+% fails
+result = [];
+try
+    result = yaml_mex(varargin{:});
+catch
+end
+stats = yaml_mex('alloc_stats');
+stats.input = input;
@@ -0,0 +1,218 @@
+function mismatches = yaml_mex_emitter_check(num_items, seed)
+% yaml_mex_emitter_check  Check dump_simple's fast emitter against libyaml
+% Usage:
+%     mismatches = yaml_mex_emitter_check()
+%     mismatches = yaml_mex_emitter_check(num_items)
+%     mismatches = yaml_mex_emitter_check(num_items, seed)
+% Generates a corpus of num_items random values (default 1000) from the
+% random seed seed (default 0): nested structs, struct arrays and cell
+% arrays of strings, numbers, logicals, integer arrays and empties, with
+% strings chosen to reach the corners of the fast emitter, such as quotes,
+% leading and trailing spaces, text that would resolve as another type,
+% and lines long enough to fold. Each value is dumped with 'dump_simple',
+% with no options and with 'binary' and 'typed', once with
+% yaml_mex('emitter', 'fast') and once with yaml_mex('emitter', 'libyaml'),
+% and the two texts (or errors) must be the same byte for byte. The
+% emitter mode is restored afterwards.
+%
+% mismatches is a struct array with an element per value and options that
+% gave different results, with the fields index (in the corpus), options,
+% value, fast and libyaml (the two texts, or the error messages). A line
+% is printed for each, showing the first line on which the texts differ;
+% if mismatches isn't asked for, an error is raised when there are any.
+
+% Copyright (c) 2011 Geoffrey Adams
+%
+% Permission is hereby granted, free of charge, to any person obtaining a
+% copy of this software and associated documentation files
+% (the "Software"), to deal in the Software without restriction, including
+% without limitation the rights to use, copy, modify, merge, publish,
+% distribute, sublicense, and/or sell copies of the Software, and to
+% permit persons to whom the Software is furnished to do so, subject to the
+% following conditions:
+%
+% The above copyright notice and this permission notice shall be included
+% in all copies or substantial portions of the Software.
+%
+% THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+% OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+% MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+% NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+% DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+% OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+% USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+if nargin < 1
+    num_items = 1000;
+end
+if nargin < 2
+    seed = 0;
+end
+stream = RandStream('mt19937ar', 'Seed', seed);
+option_sets = {{}, {'binary'}, {'typed'}};
+
+old_mode = yaml_mex('emitter');
+mismatches = struct('index', {}, 'options', {}, 'value', {}, ...
+    'fast', {}, 'libyaml', {});
+try
+    for i = 1:num_items
+        value = random_value(stream, 0);
+        for k = 1:numel(option_sets)
+            options = option_sets{k};
+            yaml_mex('emitter', 'fast');
+            fast = dump_or_error(value, options);
+            yaml_mex('emitter', 'libyaml');
+            libyaml = dump_or_error(value, options);
+            if ~strcmp(fast, libyaml)
+                mismatches(end+1) = struct('index', i, ...
+                    'options', {options}, 'value', {value}, ...
+                    'fast', fast, 'libyaml', libyaml);
+                fprintf('%5d %-8s %s\n', i, sprintf('%s', options{:}), ...
+                    first_difference(fast, libyaml));
+            end
+        end
+    end
+catch err
+    yaml_mex('emitter', old_mode);
+    rethrow(err);
+end
+yaml_mex('emitter', old_mode);
+
+fprintf('%d of %d dumps differ\n', numel(mismatches), ...
+    num_items * numel(option_sets));
+if ~isempty(mismatches) && nargout == 0
+    error('yaml_mex:EmitterMismatch', ...
+        'The fast emitter and libyaml disagree');
+end
+
+
+function text = dump_or_error(value, options)
+% The text of a simple dump of value, or its error message
+try
+    text = yaml_mex('dump_simple', value, options{:});
+catch err
+    text = ['ERROR: ', err.message];
+end
+
+
+function line = first_difference(a, b)
+% Describe the first line on which texts a and b differ
+a_lines = regexp(a, '\n', 'split');
+b_lines = regexp(b, '\n', 'split');
+n = min(numel(a_lines), numel(b_lines));
+k = find(~strcmp(a_lines(1:n), b_lines(1:n)), 1);
+if isempty(k)
+    line = sprintf('%d lines against %d', numel(a_lines), numel(b_lines));
+else
+    line = sprintf('line %d: fast ''%s'', libyaml ''%s''', k, ...
+        a_lines{k}, b_lines{k});
+end
+
+
+function value = random_value(stream, depth)
+% A random value to dump; collections are only nested a few deep
+if depth >= 4
+    kind = randi(stream, 5);
+else
+    kind = randi(stream, 9);
+end
+switch kind
+    case 1
+        value = random_string(stream);
+    case 2
+        value = random_number(stream);
+    case 3
+        value = rand(stream) < 0.5;
+    case 4
+        value = random_array(stream);
+    case 5
+        empties = {[], '', {}, struct(), zeros(0, 3), true(1, 0)};
+        value = empties{randi(stream, numel(empties))};
+    case {6, 7}
+        num = randi(stream, 6) - 1;
+        value = cell(1, num);
+        for i = 1:num
+            value{i} = random_value(stream, depth + 1);
+        end
+        if rand(stream) < 0.2
+            value = value';
+        end
+    case 8
+        value = struct();
+        names = random_field_names(stream);
+        for i = 1:numel(names)
+            value.(names{i}) = random_value(stream, depth + 1);
+        end
+    otherwise
+        names = random_field_names(stream);
+        num = randi(stream, 4);
+        value = repmat(cell2struct(cell(numel(names), 1), names, 1), ...
+            1, num);
+        for j = 1:num
+            for i = 1:numel(names)
+                value(j).(names{i}) = random_value(stream, depth + 1);
+            end
+        end
+end
+
+
+function names = random_field_names(stream)
+% Up to 6 distinct field names, some long
+pool = {'a', 'b', 'x1', 'name', 'value', 'data', 'count', 'flag', ...
+    'a_rather_long_field_name_that_takes_up_space', 'Z'};
+[ignored, order] = sort(rand(stream, 1, numel(pool)));
+names = pool(order(1:randi(stream, 6)));
+
+
+function number = random_number(stream)
+% A double scalar, often an integer, sometimes special
+specials = [0, -0, 1, -1, 0.5, 1e-300, 1e300, pi, -pi*1e7, NaN, Inf, ...
+    -Inf, 2^53, 123456789012, 1/3];
+switch randi(stream, 3)
+    case 1
+        number = specials(randi(stream, numel(specials)));
+    case 2
+        number = randi(stream, 2001) - 1001;
+    otherwise
+        number = randn(stream) * 10^(randi(stream, 21) - 11);
+end
+
+
+function array = random_array(stream)
+% A row vector or matrix of some class, long enough at times to wrap
+classes = {'double', 'single', 'int8', 'uint8', 'int16', 'int32', ...
+    'uint32', 'int64', 'logical'};
+class_name = classes{randi(stream, numel(classes))};
+rows = 1;
+if rand(stream) < 0.3
+    rows = randi(stream, 3);
+end
+cols = randi(stream, 40);
+if strcmp(class_name, 'logical')
+    array = rand(stream, rows, cols) < 0.5;
+elseif any(strcmp(class_name, {'double', 'single'}))
+    array = cast(round(randn(stream, rows, cols) * 1000) / 8, class_name);
+else
+    array = cast(randi(stream, 200, rows, cols) - 100, class_name);
+end
+
+
+function str = random_string(stream)
+% A string, from pieces that need quoting, folding or nothing at all
+pieces = {'a', 'word', ' ', '  ', '''', '"', ':', ': ', ' #', '-', ...
+    '- ', '?', ',', '[', ']', '{', '}', '&', '*', '!', '|', '>', '%', ...
+    '@', '`', '\', 'true', 'null', '~', '1e3', '0x1F', '.inf', 'yes', ...
+    '12', '-3.5', 'Lorem ipsum dolor sit amet,', 'consectetur', ...
+    'adipiscing elit, sed do eiusmod tempor incididunt'};
+switch randi(stream, 4)
+    case 1
+        num = 1;
+    case 2
+        num = randi(stream, 4);
+    otherwise
+        num = randi(stream, 30);
+end
+str = '';
+for i = 1:num
+    str = [str, pieces{randi(stream, numel(pieces))}];
+end
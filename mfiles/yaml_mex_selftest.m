@@ -0,0 +1,410 @@
+function failures = yaml_mex_selftest()
+% yaml_mex_selftest  Check yaml_mex against known results
+% Usage:
+%     failures = yaml_mex_selftest()
+% Runs yaml_mex on a set of inputs whose results are known, at least one
+% for each feature and more for cases that once went wrong, and prints a
+% line for each case that fails. failures is a cell array of the names of
+% the failed cases; if it isn't asked for, an error is raised when any
+% case fails.
+
+% Copyright (c) 2011 Geoffrey Adams
+%
+% Permission is hereby granted, free of charge, to any person obtaining a
+% copy of this software and associated documentation files
+% (the "Software"), to deal in the Software without restriction, including
+% without limitation the rights to use, copy, modify, merge, publish,
+% distribute, sublicense, and/or sell copies of the Software, and to
+% permit persons to whom the Software is furnished to do so, subject to the
+% following conditions:
+%
+% The above copyright notice and this permission notice shall be included
+% in all copies or substantial portions of the Software.
+%
+% THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+% OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+% MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+% NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+% DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+% OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+% USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+failures = {};
+
+% load_simple: a sequence of mappings with the same keys is a struct
+% array, and one whose keys differ stays a cell array
+data = yaml_mex('load_simple', sprintf('- {a: 1, b: x}\n- {a: 2, b: y}\n'));
+failures = check(failures, 'load_simple: struct array', ...
+    data, struct('a', {1; 2}, 'b', {'x'; 'y'}));
+data = yaml_mex('load_simple', sprintf('- {a: 1}\n- {b: 2}\n'));
+failures = check(failures, 'load_simple: mixed keys', ...
+    data, {struct('a', 1), struct('b', 2)});
+
+% load_simple: only the parts a path names are constructed
+data = yaml_mex('load_simple', '{a: 1, b: {c: [2, 3], d: x}}', 'b/c');
+failures = check(failures, 'load_simple: projected path', ...
+    data, struct('b', struct('c', {{2, 3}})));
+
+% scanner: the fast scanner gives what libyaml gives
+text = sprintf('a: 1\nb: [x, ''y z'']\nc:\n  - {d: 2.5}\n  - null\n');
+old_scanner = yaml_mex('scanner');
+yaml_mex('scanner', 'fast');
+fast = yaml_mex('load', text);
+yaml_mex('scanner', 'libyaml');
+slow = yaml_mex('load', text);
+yaml_mex('scanner', old_scanner);
+failures = check(failures, 'scanner: fast matches libyaml', fast, slow);
+
+% scanner: the JSON scanner gives what libyaml gives
+text = '{"a": [1, 2.5, "x\ty", true, null], "b": {}}';
+old_scanner = yaml_mex('scanner');
+yaml_mex('scanner', 'json');
+json = yaml_mex('load', text);
+yaml_mex('scanner', 'libyaml');
+slow = yaml_mex('load', text);
+yaml_mex('scanner', old_scanner);
+failures = check(failures, 'scanner: json matches libyaml', json, slow);
+
+% load_columns: one column per key, typed by its values
+cols = yaml_mex('load_columns', ...
+    sprintf('- {a: 1, b: x, c: true}\n- {a: 2, b: y, c: false}\n'));
+failures = check(failures, 'columns: typed columns', ...
+    cols, struct('a', [1; 2], 'b', {{'x'; 'y'}}, 'c', [true; false]));
+
+% load_columns: a column whose first rows are missing
+cols = yaml_mex('load_columns', sprintf('- {a: 1}\n- {a: 2, b: x}\n'));
+failures = check(failures, 'columns: missing then string', ...
+    cols.b, {''; 'x'});
+cols = yaml_mex('load_columns', sprintf('- {a: 1}\n- {a: 2, b: 3}\n'));
+failures = check(failures, 'columns: missing then number', ...
+    cols.b, [NaN; 3]);
+cols = yaml_mex('load_columns', ...
+    sprintf('- {a: 1}\n- {a: 2}\n- {a: 3, b: x}\n- {a: 4, b: 5}\n'));
+failures = check(failures, 'columns: missing, string, number', ...
+    cols.b, {''; ''; 'x'; '5'});
+
+% extract: one value from every document
+[vals, found] = yaml_mex('extract', ...
+    sprintf('a: {b: [x, y]}\n---\na: {b: [z]}\n'), 'a/b/1');
+failures = check(failures, 'extract: key path with an index', ...
+    {vals, found}, {{'x'; 'z'}, logical([1; 1])});
+
+% extract: documents without the path before ones with it
+[vals, found] = yaml_mex('extract', sprintf('b: 1\n---\na: foo\n'), 'a');
+failures = check(failures, 'extract: missing then string', ...
+    {vals, found}, {{''; 'foo'}, logical([0; 1])});
+[vals, found] = yaml_mex('extract', sprintf('b: 1\n---\na: 5\n'), 'a');
+failures = check(failures, 'extract: missing then number', ...
+    {vals, found}, {[NaN; 5], logical([0; 1])});
+
+% extract: a file is streamed rather than read whole
+path = [tempname, '.yaml'];
+write_text(path, sprintf('a: 1\n---\nb: 2\n---\na: 3\n'), 'w');
+[vals, found] = yaml_mex('extract', path, 'a', 'file');
+delete(path);
+failures = check(failures, 'extract: from a file', ...
+    {vals, found}, {[1; NaN; 3], logical([1; 0; 1])});
+
+% events: the event types of a small stream, in one batch
+evts = yaml_mex('events', 'a: 1');
+failures = check(failures, 'events: types', ...
+    evts.type, int32([1; 3; 9; 6; 6; 10; 4; 2]));
+
+% reloaders: a changed document is read again
+path = [tempname, '.yaml'];
+write_text(path, sprintf('--- 1\n--- 2\n'), 'w');
+h = yaml_mex('reloader_open', path, struct('simple', true));
+first = yaml_mex('reloader_read', h);
+write_text(path, sprintf('--- 1\n--- 5\n'), 'w');
+second = yaml_mex('reloader_read', h);
+yaml_mex('reloader_close', h);
+delete(path);
+failures = check(failures, 'reloader: changed document', ...
+    {first, second}, {{1, 2}, {1, 5}});
+
+% reloaders: identical documents appended
+path = [tempname, '.yaml'];
+write_text(path, sprintf('---\nstatus: ok\n'), 'w');
+h = yaml_mex('reloader_open', path, struct('append', true, 'simple', true));
+yaml_mex('reloader_read', h);
+write_text(path, sprintf('---\nstatus: ok\n'), 'a');
+docs = yaml_mex('reloader_read', h);
+yaml_mex('reloader_close', h);
+delete(path);
+failures = check(failures, 'reloader: repeated documents', ...
+    docs, {struct('status', 'ok'), struct('status', 'ok')});
+
+% reloaders: skipping the documents already read
+path = [tempname, '.yaml'];
+write_text(path, sprintf('--- 1\n--- 2\n'), 'w');
+h = yaml_mex('reloader_open', path, struct('append', true, 'simple', true));
+docs = yaml_mex('reloader_read', h, 0);
+write_text(path, sprintf('--- 3\n'), 'a');
+n = numel(docs) - 1;
+docs = [docs(1:n), yaml_mex('reloader_read', h, n)];
+last = yaml_mex('reloader_read', h, 2);
+yaml_mex('reloader_close', h);
+delete(path);
+failures = check(failures, 'reloader: skipped documents', ...
+    {docs, last}, {{1, 2, 3}, {3}});
+
+% reloaders: a comment between a directive and its "---"
+path = [tempname, '.yaml'];
+write_text(path, sprintf('%%YAML 1.1\n# c\n---\na: 1\n'), 'w');
+h = yaml_mex('reloader_open', path, struct('simple', true));
+data = yaml_mex('reloader_read', h);
+yaml_mex('reloader_close', h);
+delete(path);
+failures = check(failures, 'reloader: directive, comment, start', ...
+    data, struct('a', 1));
+
+% load_async: a file loaded in the background
+path = [tempname, '.yaml'];
+write_text(path, sprintf('a: [1, 2]\n'), 'w');
+h = yaml_mex('load_async', path, struct('simple', true));
+data = yaml_mex('fetch', h);
+delete(path);
+failures = check(failures, 'load_async: fetch', ...
+    data, struct('a', {{1, 2}}));
+
+% load_doc: one document of a file, found through its index
+path = [tempname, '.yaml'];
+write_text(path, sprintf('--- a\n--- {b: 1}\n--- c\n'), 'w');
+n = yaml_mex('index', path);
+doc = yaml_mex('load_doc', path, 2, struct('simple', true));
+delete(path);
+delete([path, '.ymxi']);
+failures = check(failures, 'load_doc: second document', ...
+    {n, doc}, {3, struct('b', 1)});
+
+% load_doc: a '%' line inside a document isn't a directive
+path = [tempname, '.yaml'];
+write_text(path, sprintf('--- a\n%%b\n--- c\n'), 'w');
+doc = yaml_mex('load_doc', path, 2, struct('simple', true));
+delete(path);
+if exist([path, '.ymxi'], 'file')
+    delete([path, '.ymxi']);
+end
+failures = check(failures, 'load_doc: % line in a scalar', doc, 'c');
+
+% dump_simple: a struct array is a block sequence of mappings
+failures = check(failures, 'dump_simple: struct array', ...
+    yaml_mex('dump_simple', struct('a', {1, 2}, 'b', {'x', 'y'})), ...
+    sprintf('- ''a'': 1\n  ''b'': ''x''\n- ''a'': 2\n  ''b'': ''y''\n'));
+
+% emitter: the fast emitter writes what libyaml writes
+data = struct('a', {1, 'two words'}, 'b', {{true, [1, 2]}, struct('c', [])});
+old_emitter = yaml_mex('emitter');
+yaml_mex('emitter', 'fast');
+fast = yaml_mex('dump_simple', data);
+yaml_mex('emitter', 'libyaml');
+slow = yaml_mex('dump_simple', data);
+yaml_mex('emitter', old_emitter);
+failures = check(failures, 'emitter: fast matches libyaml', fast, slow);
+
+% dump_simple: floats are written with the fewest digits that round-trip
+x = [0.1, 1/3, 1e-300, 2^53 + 2, -2.5e10];
+text = yaml_mex('dump_simple', x);
+failures = check(failures, 'dump_simple: shortest floats', ...
+    {text, yaml_mex('load_simple', text)}, {sprintf(['[0.1, ' ...
+    '0.3333333333333333, 1e-300, 9007199254740994, -25000000000]\n']), ...
+    num2cell(x)});
+
+% dump: a trusted dump is the same as a checked one
+doc = yaml_mex('load', sprintf('a: [1, 2]\nb: &x {c: d}\ne: *x\n'));
+failures = check(failures, 'dump: trusted', ...
+    yaml_mex('dump', doc, 'trusted'), yaml_mex('dump', doc));
+
+% dump: a parallel dump is the same as a serial one
+doc = yaml_mex('load', sprintf('--- 1\n--- [a, b]\n--- {c: 3}\n'));
+failures = check(failures, 'dump: parallel', ...
+    yaml_mex('dump', doc, 'parallel'), yaml_mex('dump', doc));
+
+% hash: streams that mean the same hash the same, and data hashes as its
+% dump would
+failures = check(failures, 'hash: key order and number forms', ...
+    yaml_mex('hash', '{a: 1, b: x}'), ...
+    yaml_mex('hash', sprintf('b: ''x''\na: 0x1\n')));
+failures = check(failures, 'hash_data: as its dump', ...
+    yaml_mex('hash_data', struct('a', 1, 'b', 'x')), ...
+    yaml_mex('hash', '{a: 1, b: x}'));
+
+% writers: documents written one at a time
+path = [tempname, '.yaml'];
+h = yaml_mex('writer_open', path);
+yaml_mex('writer_write', h, struct('a', 1));
+yaml_mex('writer_write', h, [1, 2]);
+yaml_mex('writer_close', h);
+data = yaml_mex('load_simple', fileread(path));
+delete(path);
+failures = check(failures, 'writer: two documents', ...
+    data, {struct('a', 1), {1, 2}});
+
+% load_file: a gzip file written by a writer
+path = [tempname, '.yaml.gz'];
+h = yaml_mex('writer_open', path);
+yaml_mex('writer_write', h, struct('a', [1, 2]));
+yaml_mex('writer_close', h);
+data = yaml_mex('load_file', path, struct('simple', true));
+delete(path);
+failures = check(failures, 'load_file: gzip', ...
+    data, struct('a', {{1, 2}}));
+
+% !!binary: a uint8 array is dumped as its bytes and loaded back
+failures = check(failures, '!!binary: uint8 round trip', ...
+    yaml_mex('load_simple', yaml_mex('dump_simple', uint8([1, 2, 255]))), ...
+    uint8([1, 2, 255]));
+failures = check(failures, '!!binary: load', ...
+    yaml_mex('load_simple', '!!binary AQID'), uint8([1, 2, 3]));
+
+% !matlab/array: a typed dump keeps an array's class and size
+x = single([1, 2; 3, 4]);
+y = yaml_mex('load_simple', yaml_mex('dump_simple', x, 'typed'));
+failures = check(failures, '!matlab/array: round trip', ...
+    {class(y), y}, {'single', x});
+
+% !matlab/array: a size larger than the data is an error, found before
+% any memory is asked for
+failures = check(failures, '!matlab/array: size larger than data', ...
+    raises(@() yaml_mex('load_simple', ['!matlab/array {class: double, ' ...
+        'size: [100000, 100000], data: !!binary ''''}'])), true);
+
+% !matlab/sparse: a sparse matrix is dumped and loaded as sparse
+x = sparse([0, 2; 3, 0; 0, 0]);
+y = yaml_mex('load_simple', yaml_mex('dump_simple', x));
+failures = check(failures, '!matlab/sparse: round trip', ...
+    {issparse(y), y}, {true, x});
+
+% !matlab/sparse: an nnz larger than the parts is an error, found before
+% any memory is asked for
+failures = check(failures, '!matlab/sparse: nnz larger than parts', ...
+    raises(@() yaml_mex('load_simple', ['!matlab/sparse {class: double, ' ...
+        'size: [10, 10], nnz: 10000000000, jc: [0], ir: [], data: []}'])), ...
+    true);
+
+% load_file_cached: a second load is built from the snapshot
+path = [tempname, '.yaml'];
+cache_dir = tempname;
+mkdir(cache_dir);
+write_text(path, sprintf('a: [1, 2]\nb: {c: x}\n'), 'w');
+first = yaml_mex('load_file_cached', path, cache_dir);
+second = yaml_mex('load_file_cached', path, cache_dir);
+delete(path);
+rmdir(cache_dir, 's');
+failures = check(failures, 'load_file_cached: snapshot', ...
+    {first, second}, {struct('a', {{1, 2}}, 'b', struct('c', 'x')), ...
+    struct('a', {{1, 2}}, 'b', struct('c', 'x'))});
+
+% load_file_cached: typed and sparse arrays are rebuilt from the snapshot
+path = [tempname, '.yaml'];
+cache_dir = tempname;
+mkdir(cache_dir);
+write_text(path, ['a: !matlab/array {class: uint8, size: [1, 3], ' ...
+    'data: !!binary AQID}', sprintf('\n'), 's: !matlab/sparse ' ...
+    '{class: double, size: [3, 2], jc: [0, 0, 1], ir: [2], data: [5]}'], ...
+    'w');
+first = yaml_mex('load_file_cached', path, cache_dir);
+second = yaml_mex('load_file_cached', path, cache_dir);
+snapshots = dir(fullfile(cache_dir, '*.ymxs'));
+delete(path);
+rmdir(cache_dir, 's');
+failures = check(failures, 'load_file_cached: typed and sparse', ...
+    {numel(snapshots), first, second}, {1, struct('a', uint8([1, 2, 3]), ...
+    's', sparse(3, 2, 5, 3, 2)), struct('a', uint8([1, 2, 3]), ...
+    's', sparse(3, 2, 5, 3, 2))});
+
+% cache: loading the same text again is a hit
+old_stats = yaml_mex('cache', 'stats');
+yaml_mex('cache', 'limit', Inf);
+yaml_mex('load_simple', '{cached: [1, 2, 3]}');
+before = yaml_mex('cache', 'stats');
+data = yaml_mex('load_simple', '{cached: [1, 2, 3]}');
+after = yaml_mex('cache', 'stats');
+yaml_mex('cache', 'limit', old_stats.limit);
+failures = check(failures, 'cache: hit', ...
+    {after.hits - before.hits, data}, {1, struct('cached', {{1, 2, 3}})});
+
+% cache: a result cached under loose limits isn't returned under tighter
+% ones
+old_limits = yaml_mex('limits');
+old_stats = yaml_mex('cache', 'stats');
+yaml_mex('cache', 'limit', Inf);
+yaml_mex('limits', struct('max_depth', Inf));
+yaml_mex('load_simple', '[[[1]]]');
+yaml_mex('limits', struct('max_depth', 2));
+failures = check(failures, 'cache: limits are part of the key', ...
+    raises(@() yaml_mex('load_simple', '[[[1]]]')), true);
+yaml_mex('limits', old_limits);
+yaml_mex('cache', 'limit', old_stats.limit);
+
+% limits: input nested or sized past a limit is an error
+old_limits = yaml_mex('limits');
+yaml_mex('limits', struct('max_depth', 2, 'max_nodes', 4));
+failures = check(failures, 'limits: max_depth and max_nodes', ...
+    {raises(@() yaml_mex('load_simple', '[[[1]]]')), ...
+    raises(@() yaml_mex('load_simple', '[1, 2, 3, 4]')), ...
+    yaml_mex('load_simple', '[[1], 2]')}, {true, true, {{1}, 2}});
+yaml_mex('limits', old_limits);
+
+% limits: with max_depth Inf, loads take data nested far deeper than a
+% recursive reader could, and dumps aren't held to max_depth at all
+deep = [repmat('[', 1, 20000), '1', repmat(']', 1, 20000)];
+old_limits = yaml_mex('limits');
+yaml_mex('limits', struct('max_depth', Inf));
+data = yaml_mex('load_simple', deep);
+yaml_mex('limits', struct('max_depth', 10));
+text = yaml_mex('dump_simple', data);
+yaml_mex('limits', struct('max_depth', Inf));
+failures = check(failures, 'limits: deep data round trip', ...
+    isequal(yaml_mex('load_simple', text), data), true);
+yaml_mex('limits', old_limits);
+
+% dump_simple: rows of a table's char variable keep characters beyond
+% ASCII (Octave has no tables)
+if exist('table', 'class')
+    t = table([1; 2], [char(233), 'a'; 'bc'], 'VariableNames', {'n', 's'});
+    failures = check(failures, 'dump_simple: table of wide chars', ...
+        yaml_mex('load_simple', yaml_mex('dump_simple', t)), ...
+        struct('n', {1; 2}, 's', {[char(233), 'a']; 'bc'}));
+end
+
+% alloc_stats: a load that completes leaves nothing unreleased (only
+% with -DYMX_COUNT_ALLOCS)
+if ~raises(@() yaml_mex('alloc_stats'))
+    yaml_mex('load_simple', sprintf('a: [1, 2]\nb: x\n'));
+    stats = yaml_mex('alloc_stats');
+    failures = check(failures, 'alloc_stats: load', ...
+        {stats.completed, isempty(stats.unreleased)}, {true, true});
+end
+
+if ~isempty(failures)
+    fprintf('%d case(s) failed\n', numel(failures));
+    if nargout == 0
+        error('yaml_mex:SelfTestFailed', 'yaml_mex_selftest failed');
+    end
+end
+
+
+function failures = check(failures, name, actual, expected)
+% Note a failure unless actual matches expected, counting NaNs as equal
+if ~isequaln(actual, expected)
+    fprintf('FAILED: %s\n', name);
+    failures{end+1} = name;
+end
+
+
+function write_text(path, text, mode)
+% Write text to the file at path, opened with mode
+fid = fopen(path, mode);
+fwrite(fid, text);
+fclose(fid);
+
+
+function raised = raises(f)
+% Whether calling f raises an error
+raised = false;
+try
+    f();
+catch
+    raised = true;
+end
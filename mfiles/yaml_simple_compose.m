@@ -119,6 +119,20 @@ elseif num == -Inf
     str = '-.Inf';
 elseif isnan(num)
     str = '.NaN';
+elseif isinteger(num)
+    str = sprintf('%d', num);
 else
-    str = num2str(num);
+    % The fewest digits (from those %g writes in full) that read back as
+    % exactly the same value, as the native dump does
+    if isa(num, 'single')
+        precisions = 6:9;
+    else
+        precisions = 15:17;
+    end
+    for p = precisions
+        str = sprintf('%.*g', p, num);
+        if cast(str2double(str), class(num)) == num
+            break;
+        end
+    end
 end
\ No newline at end of file
@@ -23,6 +23,8 @@ function data = yaml_simple_construct(yaml_node)
 %   -> All sequences will be constructed as cell arrays. If the sequence is
 %      intended to represent, e.g., a numeric vector, this should be easy
 %      enough for downstream code to convert (eg, [data{:}]).
+%   -> Except: a sequence of two or more mappings that all have the same
+%      keys in the same order is constructed as an N-by-1 struct array.
 % ...
 % Scalars are resolved according to the YAML core tags.
 
@@ -60,6 +62,9 @@ switch yaml_node.type
         for i=1:numel(yaml_node.value)
             data{i} = yaml_simple_construct(yaml_node.value(i));
         end
+        if is_uniform_struct_list(data)
+            data = vertcat(data{:});
+        end
     case 3 % mapping
         keys = {yaml_node.value(1,:).value};
         values = cell(size(keys));
@@ -83,6 +88,18 @@ switch yaml_node.type
             'Unrecognized node type.');
 end
 
+function tf = is_uniform_struct_list(items)
+tf = numel(items) >= 2 && all(cellfun(@(x)isstruct(x) && isscalar(x), items));
+if tf
+    fnames = fieldnames(items{1});
+    for i=2:numel(items)
+        if ~isequal(fieldnames(items{i}), fnames)
+            tf = false;
+            return;
+        end
+    end
+end
+
 function data = construct_scalar(value, tag)
 if ismember(tag, {'!', 'tag:yaml.org,2002:str'})
     data = value;